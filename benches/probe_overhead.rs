@@ -0,0 +1,293 @@
+//! Measures the overhead of each BPF program loaded by a running Rezolus agent.
+//!
+//! The agent must have the `rezolus_bpf` sampler enabled so that the kernel
+//! collects runtime stats for its programs:
+//!
+//! ```toml
+//! [samplers.rezolus_bpf]
+//! enabled = true
+//! ```
+//!
+//! The benchmark reads the per-program stats from the agent's `/metrics`
+//! endpoint, drives a synthetic workload of syscalls, context switches, TCP
+//! connections and file writes, and then reports the mean time per run along
+//! with the instruction counts of each program. Programs which were loaded but
+//! never ran during the workload are listed at the end, so a program which no
+//! longer attaches is noticed.
+//!
+//! Run with `cargo bench --bench probe_overhead`. The agent address defaults to
+//! `http://localhost:4242` and can be changed with `REZOLUS_URL`. The number of
+//! iterations of each phase of the workload can be set with `ITERATIONS`.
+
+use std::collections::BTreeMap;
+use std::io::{Read, Write};
+use std::net::{TcpListener, TcpStream};
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+use std::time::Instant;
+
+const DEFAULT_URL: &str = "http://localhost:4242";
+const DEFAULT_ITERATIONS: usize = 100_000;
+
+/// The stats for one BPF program, keyed by `sampler/program`.
+#[derive(Default, Clone, Copy)]
+struct ProgramStats {
+    run_time: u64,
+    run_count: u64,
+    instructions: u64,
+    verified_instructions: u64,
+}
+
+fn main() {
+    let url = std::env::var("REZOLUS_URL").unwrap_or_else(|_| DEFAULT_URL.to_string());
+    let iterations = std::env::var("ITERATIONS")
+        .ok()
+        .and_then(|v| v.parse().ok())
+        .unwrap_or(DEFAULT_ITERATIONS);
+
+    let runtime = tokio::runtime::Builder::new_current_thread()
+        .enable_all()
+        .build()
+        .expect("failed to launch async runtime");
+
+    let before = match runtime.block_on(snapshot(&url)) {
+        Ok(stats) => stats,
+        Err(e) => {
+            eprintln!("failed to read BPF stats from {url}: {e}");
+            std::process::exit(1);
+        }
+    };
+
+    if before.is_empty() {
+        eprintln!("no BPF programs found at {url}, is `rezolus_bpf` enabled?");
+        std::process::exit(1);
+    }
+
+    let start = Instant::now();
+
+    syscalls(iterations);
+    context_switches(iterations);
+    tcp_connections(iterations / 100);
+    file_writes(iterations / 100);
+
+    let elapsed = start.elapsed();
+
+    let after = match runtime.block_on(snapshot(&url)) {
+        Ok(stats) => stats,
+        Err(e) => {
+            eprintln!("failed to read BPF stats from {url}: {e}");
+            std::process::exit(1);
+        }
+    };
+
+    println!("workload took {elapsed:?}\n");
+    println!(
+        "{:<56} {:>12} {:>10} {:>8} {:>10}",
+        "program", "runs", "ns/run", "insns", "verified"
+    );
+
+    let mut idle = Vec::new();
+
+    for (name, stats) in &after {
+        let previous = before.get(name).copied().unwrap_or_default();
+
+        let runs = stats.run_count.saturating_sub(previous.run_count);
+        let time = stats.run_time.saturating_sub(previous.run_time);
+
+        if runs == 0 {
+            idle.push(name);
+            continue;
+        }
+
+        println!(
+            "{:<56} {:>12} {:>10.1} {:>8} {:>10}",
+            name,
+            runs,
+            time as f64 / runs as f64,
+            stats.instructions,
+            stats.verified_instructions
+        );
+    }
+
+    if !idle.is_empty() {
+        println!("\nnot run by the workload:");
+
+        for name in idle {
+            println!("  {name}");
+        }
+    }
+}
+
+/// Reads the stats for each BPF program from the agent's prometheus endpoint.
+/// Runtime counters are only exported once they are non-zero, while the
+/// instruction counts are exported for every loaded program.
+async fn snapshot(url: &str) -> Result<BTreeMap<String, ProgramStats>, reqwest::Error> {
+    let body = reqwest::get(format!("{url}/metrics"))
+        .await?
+        .error_for_status()?
+        .text()
+        .await?;
+
+    Ok(parse(&body))
+}
+
+/// Parses the BPF program stats out of the prometheus exposition. Every `/` in
+/// the exposition, including those in label values, is replaced with `_`, so
+/// the metrics are `rezolus_bpf_*` and each program is identified by its
+/// `sampler` and `program` labels.
+fn parse(body: &str) -> BTreeMap<String, ProgramStats> {
+    let mut stats: BTreeMap<String, ProgramStats> = BTreeMap::new();
+
+    for line in body.lines() {
+        if line.starts_with('#') {
+            continue;
+        }
+
+        // lines are in the form: `metric{key="value", ...} value timestamp`
+        let Some((metric, rest)) = line.split_once('{') else {
+            continue;
+        };
+
+        let Some((labels, rest)) = rest.split_once('}') else {
+            continue;
+        };
+
+        let Some(value) = rest
+            .split_whitespace()
+            .next()
+            .and_then(|v| v.parse::<i64>().ok())
+        else {
+            continue;
+        };
+
+        let label = |key: &str| {
+            labels
+                .split(", ")
+                .filter_map(|label| label.split_once('='))
+                .find(|(k, _)| *k == key)
+                .map(|(_, v)| v.trim_matches('"'))
+        };
+
+        let (Some(sampler), Some(program)) = (label("sampler"), label("program")) else {
+            continue;
+        };
+
+        let name = format!("{sampler}/{program}");
+        let value = value.max(0) as u64;
+
+        match metric {
+            "rezolus_bpf_run_time" => stats.entry(name).or_default().run_time = value,
+            "rezolus_bpf_run_count" => stats.entry(name).or_default().run_count = value,
+            "rezolus_bpf_instructions" => stats.entry(name).or_default().instructions = value,
+            "rezolus_bpf_verified_instructions" => {
+                stats.entry(name).or_default().verified_instructions = value
+            }
+            _ => {}
+        }
+    }
+
+    stats
+}
+
+/// Makes cheap syscalls which do no work in the kernel, so the cost is
+/// dominated by the syscall probes.
+fn syscalls(iterations: usize) {
+    for _ in 0..iterations {
+        unsafe {
+            libc::syscall(libc::SYS_getppid);
+        }
+    }
+}
+
+/// Passes a byte back and forth between two threads over a pair of pipes. Each
+/// round trip blocks both threads once, which drives the scheduler probes.
+fn context_switches(iterations: usize) {
+    let (ping_rx, ping_tx) = pipe();
+    let (pong_rx, pong_tx) = pipe();
+
+    let peer = std::thread::spawn(move || {
+        let mut buf = [0u8; 1];
+
+        for _ in 0..iterations {
+            if read_fd(&ping_rx, &mut buf) != 1 || write_fd(&pong_tx, &buf) != 1 {
+                break;
+            }
+        }
+    });
+
+    let mut buf = [0u8; 1];
+
+    for _ in 0..iterations {
+        if write_fd(&ping_tx, &buf) != 1 || read_fd(&pong_rx, &mut buf) != 1 {
+            break;
+        }
+    }
+
+    let _ = peer.join();
+}
+
+/// Opens loopback TCP connections and exchanges a small request and response
+/// on each, which drives the connect, traffic and socket lifecycle probes.
+fn tcp_connections(iterations: usize) {
+    let listener = TcpListener::bind("127.0.0.1:0").expect("failed to bind listener");
+    let addr = listener
+        .local_addr()
+        .expect("failed to get listener address");
+
+    let server = std::thread::spawn(move || {
+        let mut buf = [0u8; 64];
+
+        for stream in listener.incoming().take(iterations) {
+            let Ok(mut stream) = stream else {
+                continue;
+            };
+
+            if let Ok(len) = stream.read(&mut buf) {
+                let _ = stream.write_all(&buf[0..len]);
+            }
+        }
+    });
+
+    let mut buf = [0u8; 64];
+
+    for _ in 0..iterations {
+        // the server accepts a fixed number of connections, so every one of
+        // them must be made
+        let mut stream = TcpStream::connect(addr).expect("failed to connect to listener");
+
+        let _ = stream.write_all(b"ping");
+        let _ = stream.read(&mut buf);
+    }
+
+    let _ = server.join();
+}
+
+/// Writes and syncs a small file, which drives the block IO and filesystem
+/// probes. The writes go to the temporary directory, which may not be backed
+/// by a block device.
+fn file_writes(iterations: usize) {
+    let mut file = tempfile::tempfile().expect("failed to create temporary file");
+    let buf = [0u8; 4096];
+
+    for _ in 0..iterations {
+        let _ = file.write_all(&buf);
+        let _ = file.sync_data();
+    }
+}
+
+fn pipe() -> (OwnedFd, OwnedFd) {
+    let mut fds = [0; 2];
+
+    if unsafe { libc::pipe(fds.as_mut_ptr()) } != 0 {
+        panic!("failed to create pipe: {}", std::io::Error::last_os_error());
+    }
+
+    unsafe { (OwnedFd::from_raw_fd(fds[0]), OwnedFd::from_raw_fd(fds[1])) }
+}
+
+fn read_fd(fd: &OwnedFd, buf: &mut [u8]) -> isize {
+    unsafe { libc::read(fd.as_raw_fd(), buf.as_mut_ptr() as *mut _, buf.len()) }
+}
+
+fn write_fd(fd: &OwnedFd, buf: &[u8]) -> isize {
+    unsafe { libc::write(fd.as_raw_fd(), buf.as_ptr() as *const _, buf.len()) }
+}
@@ -13,13 +13,14 @@ mod bpf {
     const SOURCES: &[(&str, &str)] = &[
         ("blockio", "latency"),
         ("blockio", "requests"),
-        ("cpu", "frequency"),
-        ("cpu", "perf"),
+        ("cpu", "profile"),
         ("cpu", "usage"),
+        ("irq", "latency"),
+        ("lock", "contention"),
+        ("memory", "stall"),
         ("network", "traffic"),
-        ("scheduler", "runqueue"),
-        ("syscall", "counts"),
-        ("syscall", "latency"),
+        ("scheduler", "sched_switch"),
+        ("syscall", "syscall"),
         ("tcp", "connect_latency"),
         ("tcp", "packet_latency"),
         ("tcp", "receive"),
@@ -27,14 +28,30 @@ mod bpf {
         ("tcp", "traffic"),
     ];
 
+    // `COMMON` lists BPF programs which are shared by all samplers. Each entry
+    // maps to a unique path in the `common/bpf` directory.
+    const COMMON: &[&str] = &["cgroup_registry"];
+
     pub fn generate() {
         let out_dir = std::env::var("OUT_DIR").unwrap();
         let target_arch = std::env::var("CARGO_CFG_TARGET_ARCH").unwrap();
 
-        for (sampler, prog) in SOURCES {
-            let src = format!("src/samplers/{sampler}/linux/{prog}/mod.bpf.c");
-            let tgt = format!("{out_dir}/{sampler}_{prog}.bpf.rs");
+        let sources = SOURCES
+            .iter()
+            .map(|(sampler, prog)| {
+                (
+                    format!("src/samplers/{sampler}/linux/{prog}/mod.bpf.c"),
+                    format!("{out_dir}/{sampler}_{prog}.bpf.rs"),
+                )
+            })
+            .chain(COMMON.iter().map(|prog| {
+                (
+                    format!("src/common/bpf/{prog}/mod.bpf.c"),
+                    format!("{out_dir}/common_{prog}.bpf.rs"),
+                )
+            }));
 
+        for (src, tgt) in sources {
             if target_arch == "x86_64" {
                 SkeletonBuilder::new()
                     .source(&src)
@@ -62,7 +79,13 @@ mod bpf {
             println!("cargo:rerun-if-changed={src}");
         }
 
+        println!("cargo:rerun-if-changed=src/common/bpf/cgroup.h");
+        println!("cargo:rerun-if-changed=src/common/bpf/cgroup_info.h");
+        println!("cargo:rerun-if-changed=src/common/bpf/epoch.h");
+        println!("cargo:rerun-if-changed=src/common/bpf/exemplar.h");
+        println!("cargo:rerun-if-changed=src/common/bpf/health.h");
         println!("cargo:rerun-if-changed=src/common/bpf/histogram.h");
+        println!("cargo:rerun-if-changed=src/common/bpf/stacks.h");
         println!("cargo:rerun-if-changed=src/common/bpf/vmlinux.h");
     }
 }
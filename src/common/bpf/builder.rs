@@ -12,7 +12,7 @@ use std::os::fd::{AsFd, AsRawFd, FromRawFd};
 use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
 use std::sync::mpsc::sync_channel;
 use std::sync::Arc;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
 pub struct PerfEvent {
     inner: Event,
@@ -48,13 +48,28 @@ impl CpuPerfCounters {
 
     pub fn refresh(&mut self) {
         for c in self.counters.iter_mut() {
-            if let Ok(value) = c.counter.read() {
-                let _ = c.group.set(self.cpu, value);
+            if let Ok(data) = c.counter.read_full() {
+                let _ = c.group.set(self.cpu, scaled_count(&data));
             }
         }
     }
 }
 
+/// Returns the count for a perf counter, scaled up by the fraction of the time
+/// the counter was enabled that it was actually running. When there are more
+/// events than hardware counters, the kernel multiplexes the events, and the
+/// raw count would undercount the event.
+fn scaled_count(data: &perf_event::CounterData) -> u64 {
+    let count = data.count();
+
+    match (data.time_enabled(), data.time_running()) {
+        (Some(enabled), Some(running)) if !running.is_zero() && running < enabled => {
+            (count as u128 * enabled.as_nanos() / running.as_nanos()) as u64
+        }
+        _ => count,
+    }
+}
+
 pub struct PerfCounters {
     inner: HashMap<usize, CpuPerfCounters>,
 }
@@ -74,6 +89,8 @@ impl PerfCounters {
 
 enum Event {
     Hardware(perf_event::events::Hardware),
+    Software(perf_event::events::Software),
+    Cache(perf_event::events::Cache),
     Msr(perf_event::events::x86::Msr),
 }
 
@@ -81,6 +98,8 @@ impl Event {
     fn builder(&self) -> perf_event::Builder {
         match self {
             Self::Hardware(e) => perf_event::Builder::new(*e),
+            Self::Software(e) => perf_event::Builder::new(*e),
+            Self::Cache(c) => perf_event::Builder::new(c.clone()),
             Self::Msr(m) => perf_event::Builder::new(*m),
         }
     }
@@ -93,12 +112,52 @@ impl PerfEvent {
         }
     }
 
+    pub fn cpu_clock() -> Self {
+        Self {
+            inner: Event::Software(perf_event::events::Software::CPU_CLOCK),
+        }
+    }
+
     pub fn instructions() -> Self {
         Self {
             inner: Event::Hardware(perf_event::events::Hardware::INSTRUCTIONS),
         }
     }
 
+    pub fn llc_misses() -> Self {
+        Self {
+            inner: Event::Hardware(perf_event::events::Hardware::CACHE_MISSES),
+        }
+    }
+
+    pub fn branch_misses() -> Self {
+        Self {
+            inner: Event::Hardware(perf_event::events::Hardware::BRANCH_MISSES),
+        }
+    }
+
+    pub fn stalled_cycles_frontend() -> Self {
+        Self {
+            inner: Event::Hardware(perf_event::events::Hardware::STALLED_CYCLES_FRONTEND),
+        }
+    }
+
+    pub fn stalled_cycles_backend() -> Self {
+        Self {
+            inner: Event::Hardware(perf_event::events::Hardware::STALLED_CYCLES_BACKEND),
+        }
+    }
+
+    pub fn dtlb_misses() -> Self {
+        Self {
+            inner: Event::Cache(perf_event::events::Cache {
+                which: perf_event::events::CacheId::DTLB,
+                operation: perf_event::events::CacheOp::READ,
+                result: perf_event::events::CacheResult::MISS,
+            }),
+        }
+    }
+
     pub fn msr(msr_id: perf_event::events::x86::MsrId) -> Result<Self, std::io::Error> {
         let msr = perf_event::events::x86::Msr::new(msr_id)?;
 
@@ -108,15 +167,43 @@ impl PerfEvent {
     }
 }
 
+/// A function which is run against the open skeleton before it is loaded.
+type OpenHook<T> = Box<
+    dyn FnOnce(&mut <T as SkelBuilder<'static>>::Output) -> Result<(), libbpf_rs::Error> + Send,
+>;
+
 pub struct Builder<T: 'static + SkelBuilder<'static>> {
+    name: &'static str,
     skel: fn() -> T,
+    open_hooks: Vec<OpenHook<T>>,
+    fentry_fallbacks: Vec<(&'static str, &'static str, &'static str)>,
+    sample_rate: u64,
+    histogram_grouping_power: u8,
     counters: Vec<(&'static str, Vec<&'static LazyCounter>)>,
     histograms: Vec<(&'static str, &'static RwLockHistogram)>,
+    percpu_histograms: Vec<(
+        &'static str,
+        &'static RwLockHistogram,
+        Option<&'static HistogramGroup>,
+    )>,
+    percpu_histogram_arrays: Vec<(&'static str, Vec<&'static RwLockHistogram>)>,
+    histogram_groups: Vec<(&'static str, &'static HistogramGroup)>,
+    percpu_histogram_groups: Vec<(&'static str, &'static HistogramGroup)>,
+    heatmaps: Vec<(&'static str, Vec<&'static HistogramGroup>, &'static str, u8)>,
     maps: Vec<(&'static str, Vec<u64>)>,
+    dirty_bitmaps: Vec<(&'static str, &'static str)>,
+    epoch: Option<&'static str>,
     cpu_counters: Vec<(&'static str, Vec<&'static CounterGroup>)>,
-    perf_events: Vec<(&'static str, PerfEvent, &'static CounterGroup)>,
-    packed_counters: Vec<(&'static str, &'static CounterGroup)>,
+    perf_events: Vec<(&'static str, usize, PerfEvent, &'static CounterGroup, bool)>,
+    packed_counters: Vec<(&'static str, Vec<&'static CounterGroup>)>,
+    percpu_packed_counters: Vec<(&'static str, Vec<&'static CounterGroup>)>,
     ringbuf_handler: Vec<(&'static str, fn(&[u8]) -> i32)>,
+    exemplars: Vec<(&'static str, &'static str, fn(u32) -> String)>,
+    stack_totals: Vec<(&'static str, &'static str, &'static str, bool)>,
+    perf_event_programs: Vec<(&'static str, PerfEvent, u64)>,
+    cgroups: bool,
+    cgroup_metrics: Vec<&'static dyn CgroupMetric>,
+    health_counters: Option<&'static str>,
 }
 
 impl<T: 'static> Builder<T>
@@ -125,16 +212,37 @@ where
     <<T as SkelBuilder<'static>>::Output as OpenSkel<'static>>::Output: OpenSkelExt,
     <<T as SkelBuilder<'static>>::Output as OpenSkel<'static>>::Output: SkelExt,
 {
-    pub fn new(skel: fn() -> T) -> Self {
+    /// Create a new builder for a BPF sampler. The `name` is the name of the
+    /// sampler and is used to identify its BPF programs.
+    pub fn new(name: &'static str, skel: fn() -> T) -> Self {
         Self {
+            name,
             skel,
+            open_hooks: Vec::new(),
+            fentry_fallbacks: Vec::new(),
+            sample_rate: 1,
+            histogram_grouping_power: HISTOGRAM_GROUPING_POWER,
             counters: Vec::new(),
             histograms: Vec::new(),
+            percpu_histograms: Vec::new(),
+            percpu_histogram_arrays: Vec::new(),
+            histogram_groups: Vec::new(),
+            percpu_histogram_groups: Vec::new(),
+            heatmaps: Vec::new(),
             maps: Vec::new(),
+            dirty_bitmaps: Vec::new(),
+            epoch: None,
             cpu_counters: Vec::new(),
             perf_events: Vec::new(),
             packed_counters: Vec::new(),
+            percpu_packed_counters: Vec::new(),
             ringbuf_handler: Vec::new(),
+            exemplars: Vec::new(),
+            stack_totals: Vec::new(),
+            perf_event_programs: Vec::new(),
+            cgroups: false,
+            cgroup_metrics: Vec::new(),
+            health_counters: None,
         }
     }
 
@@ -155,34 +263,249 @@ where
         let (perf_threads_tx, perf_threads_rx) = sync_channel(cpus);
         let (perf_sync_tx, perf_sync_rx) = sync_channel(cpus);
 
+        // the groups are filled directly from the BPF banks, so they must use
+        // the same grouping power as the BPF program
+        let groups = self
+            .percpu_histograms
+            .iter()
+            .filter_map(|(_, _, percpu)| *percpu)
+            .chain(self.histogram_groups.iter().map(|(_, group)| *group))
+            .chain(self.percpu_histogram_groups.iter().map(|(_, group)| *group))
+            .chain(
+                self.heatmaps
+                    .iter()
+                    .flat_map(|(_, heatmaps, _, _)| heatmaps.iter().copied()),
+            );
+
+        for group in groups {
+            group.set_grouping_power(self.histogram_grouping_power);
+        }
+
         let thread = std::thread::spawn(move || {
+            let load_start = Instant::now();
+
             // storage for the BPF object file
             let open_object: &'static mut MaybeUninit<OpenObject> =
                 Box::leak(Box::new(MaybeUninit::uninit()));
 
-            // open and load the BPF program
-            let mut skel = (self.skel)().open(open_object)?.load()?;
+            // open the BPF program
+            let mut open_skel = (self.skel)().open(open_object)?;
+
+            // size the histogram maps, and their dirty bitmaps, for the
+            // grouping power and the per-CPU maps for the CPUs on this host.
+            // this happens before the open hooks so that they can still shrink
+            // the maps of any features which are disabled
+            let entries = self.map_entries();
+            let buffers = self.buffers();
+
+            for mut map in open_skel.open_object_mut().maps_mut() {
+                let name = map.name();
+
+                let len = entries
+                    .iter()
+                    .find(|(map, _)| name == *map)
+                    .map(|(_, len)| *len)
+                    .or_else(|| {
+                        // the bitmap is sized for the map it tracks
+                        let (tracked, _) = self
+                            .dirty_bitmaps
+                            .iter()
+                            .find(|(_, bitmap)| name == *bitmap)?;
+
+                        entries
+                            .iter()
+                            .find(|(map, _)| map == tracked)
+                            .map(|(_, len)| dirty_bitmap_entries(*len))
+                    });
+
+                if let Some(len) = len {
+                    map.set_max_entries(len as u32)?;
+                }
+            }
+
+            // load either the fentry or kprobe program for each function
+            for (func, fentry, kprobe) in self.fentry_fallbacks.iter() {
+                let use_fentry = fentry_supported(func);
+
+                if !use_fentry {
+                    debug!("{} using kprobe for {func}()", self.name);
+                }
+
+                for mut prog in open_skel.open_object_mut().progs_mut() {
+                    if prog.name() == *fentry {
+                        prog.set_autoload(use_fentry)?;
+                    } else if prog.name() == *kprobe {
+                        prog.set_autoload(!use_fentry)?;
+                    }
+                }
+            }
+
+            // share the cgroup registry maps so cgroup slots match across samplers
+            if self.cgroups {
+                match CgroupRegistry::get() {
+                    Some(registry) => registry.reuse_maps(open_skel.open_object_mut())?,
+                    None => debug!(
+                        "{} has no cgroup registry, cgroups will not be tracked",
+                        self.name
+                    ),
+                }
+
+                register_cgroup_metrics(self.cgroup_metrics);
+            }
+
+            // apply any configuration which must happen before load
+            for hook in self.open_hooks.into_iter() {
+                hook(&mut open_skel)?;
+            }
+
+            // load the BPF program
+            let mut skel = open_skel.load()?;
 
             // log the number of instructions for each probe in the program
             skel.log_prog_instructions();
 
+            // register each program so the kernel's stats for it are exported
+            for prog in skel.object().progs() {
+                register_program(self.name, &prog, self.sample_rate);
+            }
+
             // attach the BPF program
             skel.attach()?;
 
+            // attach the programs which run on perf event samples. the events
+            // and links are kept for as long as the sampler runs
+            let mut perf_event_links = Vec::new();
+
+            for (name, event, frequency) in self.perf_event_programs.iter() {
+                for prog in skel.object_mut().progs_mut() {
+                    if prog.name() != *name {
+                        continue;
+                    }
+
+                    for cpu in 0..cpus {
+                        let Ok(mut counter) = event
+                            .inner
+                            .builder()
+                            .one_cpu(cpu)
+                            .any_pid()
+                            .exclude_kernel(false)
+                            .sample_frequency(*frequency)
+                            .build()
+                        else {
+                            // offline cpus can not be sampled
+                            continue;
+                        };
+
+                        let link = prog.attach_perf_event(counter.as_raw_fd())?;
+
+                        let _ = counter.enable();
+
+                        perf_event_links.push((counter, link));
+                    }
+                }
+            }
+
             // convert our metrics into wrapped types that we can refresh
 
+            let dirty_bitmaps = self.dirty_bitmaps;
+
+            // the dirty bitmap for a map, if it has one
+            let dirty = |name: &str| {
+                dirty_bitmaps
+                    .iter()
+                    .find(|(map, _)| *map == name)
+                    .map(|(_, bitmap)| skel.map(bitmap))
+            };
+
+            // the counters and histograms are double-buffered when there is an
+            // epoch, in which case they can't also use dirty tracking
+            let mut epoch = self.epoch.map(|name| Epoch::new(skel.map(name)));
+
             let mut counters: Vec<Counters> = self
                 .counters
                 .into_iter()
-                .map(|(name, counters)| Counters::new(skel.map(name), counters))
+                .map(|(name, counters)| Counters::with_buffers(skel.map(name), counters, buffers))
                 .collect();
 
             let mut histograms: Vec<Histogram> = self
                 .histograms
                 .into_iter()
-                .map(|(name, histogram)| Histogram::new(skel.map(name), histogram))
+                .map(|(name, histogram)| {
+                    Histogram::new(
+                        skel.map(name),
+                        histogram,
+                        self.histogram_grouping_power,
+                        self.sample_rate,
+                        if epoch.is_some() { None } else { dirty(name) },
+                        buffers,
+                    )
+                })
+                .collect();
+
+            let mut percpu_histograms: Vec<PercpuHistogram> = self
+                .percpu_histograms
+                .into_iter()
+                .map(|(name, histogram, percpu)| {
+                    PercpuHistogram::new(
+                        skel.map(name),
+                        histogram,
+                        percpu,
+                        self.histogram_grouping_power,
+                        self.sample_rate,
+                        dirty(name),
+                    )
+                })
+                .collect();
+
+            let mut percpu_histogram_arrays: Vec<PercpuHistogramArray> = self
+                .percpu_histogram_arrays
+                .into_iter()
+                .map(|(name, histograms)| {
+                    PercpuHistogramArray::new(
+                        skel.map(name),
+                        histograms,
+                        self.histogram_grouping_power,
+                        self.sample_rate,
+                    )
+                })
+                .collect();
+
+            let mut histogram_groups: Vec<HistogramGroupMap> = self
+                .histogram_groups
+                .into_iter()
+                .map(|(name, group)| {
+                    HistogramGroupMap::new(skel.map(name), group, self.sample_rate, dirty(name))
+                })
+                .collect();
+
+            let mut percpu_histogram_groups: Vec<PercpuHistogramGroupMap> = self
+                .percpu_histogram_groups
+                .into_iter()
+                .map(|(name, group)| {
+                    PercpuHistogramGroupMap::new(skel.map(name), group, self.sample_rate)
+                })
                 .collect();
 
+            let mut heatmaps: Vec<Heatmap> = self
+                .heatmaps
+                .into_iter()
+                .map(|(name, heatmaps, key, min_power)| {
+                    Heatmap::new(skel.map(name), heatmaps, key, min_power, self.sample_rate)
+                })
+                .collect();
+
+            let mut stack_totals: Vec<StackTotals> = self
+                .stack_totals
+                .into_iter()
+                .map(|(name, totals, stacks, clear_stacks)| {
+                    StackTotals::new(name, skel.map(totals), skel.map(stacks), clear_stacks)
+                })
+                .collect();
+
+            let mut health_counters: Option<HealthCounters> = self
+                .health_counters
+                .and_then(|name| HealthCounters::new(skel.map(name), self.name));
+
             let mut cpu_counters: Vec<CpuCounters> = self
                 .cpu_counters
                 .into_iter()
@@ -196,7 +519,7 @@ where
 
             let mut perf_counters = PerfCounters::new();
 
-            for (name, event, group) in self.perf_events.into_iter() {
+            for (name, offset, event, group, pinned) in self.perf_events.into_iter() {
                 let map = skel.map(name);
 
                 for cpu in 0..cpus {
@@ -207,7 +530,7 @@ where
                         .any_pid()
                         .exclude_hv(false)
                         .exclude_kernel(false)
-                        .pinned(true)
+                        .pinned(pinned)
                         .read_format(
                             ReadFormat::TOTAL_TIME_ENABLED
                                 | ReadFormat::TOTAL_TIME_RUNNING
@@ -220,7 +543,7 @@ where
                         let fd = counter.as_raw_fd();
 
                         let _ = map.update(
-                            &((cpu as u32).to_ne_bytes()),
+                            &(((offset + cpu) as u32).to_ne_bytes()),
                             &(fd.to_ne_bytes()),
                             MapFlags::ANY,
                         );
@@ -319,7 +642,9 @@ where
 
             debug!("all perf threads launched");
 
-            let ringbuffer: Option<RingBuffer> = if self.ringbuf_handler.is_empty() {
+            let ringbuffer: Option<RingBuffer> = if self.ringbuf_handler.is_empty()
+                && self.exemplars.is_empty()
+            {
                 None
             } else {
                 let mut builder = RingBufferBuilder::new();
@@ -328,13 +653,27 @@ where
                     let _ = builder.add(skel.map(name), handler);
                 }
 
+                for (name, id_label, format) in self.exemplars.into_iter() {
+                    let handler = ExemplarHandler::new(self.name, id_label, format);
+
+                    let _ = builder.add(skel.map(name), move |data: &[u8]| handler.handle(data));
+                }
+
                 Some(builder.build().expect("failed to initialize ringbuffer"))
             };
 
             let mut packed_counters: Vec<PackedCounters> = self
                 .packed_counters
                 .into_iter()
-                .map(|(name, counters)| PackedCounters::new(skel.map(name), counters))
+                .map(|(name, counters)| PackedCounters::new(skel.map(name), counters, dirty(name)))
+                .collect();
+
+            let mut percpu_packed_counters: Vec<PercpuPackedCounters> = self
+                .percpu_packed_counters
+                .into_iter()
+                .map(|(name, counters)| {
+                    PercpuPackedCounters::new(skel.map(name), counters, dirty(name))
+                })
                 .collect();
 
             // load any data from userspace into BPF maps
@@ -361,6 +700,22 @@ where
                 let _ = mmap.flush();
             }
 
+            // the cgroup registry maps are shared by every sampler which uses
+            // them, so they are not counted as part of this sampler
+            let map_memory = skel
+                .object()
+                .maps()
+                .filter(|map| {
+                    !(self.cgroups
+                        && ["cgroup_slots", "cgroup_free_slots", "cgroup_info"]
+                            .iter()
+                            .any(|name| map.name() == *name))
+                })
+                .filter_map(|map| map_memory(map.as_fd()))
+                .sum();
+
+            let refresh_time = register_sampler(self.name, load_start.elapsed(), map_memory);
+
             // indicate that we have finished initialization
             initialized.store(true, Ordering::Relaxed);
 
@@ -376,11 +731,47 @@ where
 
                 // refresh all the metrics
 
-                for v in &mut counters {
+                let refresh_start = Instant::now();
+
+                if let Some(ref mut epoch) = epoch {
+                    // if the writers have not left the previous buffer yet,
+                    // its values are picked up on the next refresh instead
+                    if let Some(buffer) = epoch.flip() {
+                        for v in &mut counters {
+                            v.refresh_buffer(buffer);
+                        }
+
+                        for v in &mut histograms {
+                            v.refresh_buffer(buffer);
+                        }
+                    }
+                } else {
+                    for v in &mut counters {
+                        v.refresh();
+                    }
+
+                    for v in &mut histograms {
+                        v.refresh();
+                    }
+                }
+
+                for v in &mut percpu_histograms {
+                    v.refresh();
+                }
+
+                for v in &mut percpu_histogram_arrays {
                     v.refresh();
                 }
 
-                for v in &mut histograms {
+                for v in &mut histogram_groups {
+                    v.refresh();
+                }
+
+                for v in &mut percpu_histogram_groups {
+                    v.refresh();
+                }
+
+                for v in &mut heatmaps {
                     v.refresh();
                 }
 
@@ -392,6 +783,21 @@ where
                     v.refresh();
                 }
 
+                for v in &mut percpu_packed_counters {
+                    v.refresh();
+                }
+
+                for v in &mut stack_totals {
+                    v.refresh();
+                }
+
+                if let Some(ref mut v) = health_counters {
+                    v.refresh();
+                }
+
+                refresh_time
+                    .fetch_add(refresh_start.elapsed().as_nanos() as u64, Ordering::Relaxed);
+
                 // notify that we have finished running
                 sync.notify();
             }
@@ -431,6 +837,133 @@ where
         })
     }
 
+    /// Register a function which is run against the open skeleton before the
+    /// BPF program is loaded. This can be used to set read-only data, resize
+    /// maps, or disable programs and maps which are not supported by the
+    /// running kernel.
+    pub fn open_hook<F>(mut self, hook: F) -> Self
+    where
+        F: FnOnce(&mut <T as SkelBuilder<'static>>::Output) -> Result<(), libbpf_rs::Error>
+            + Send
+            + 'static,
+    {
+        self.open_hooks.push(Box::new(hook));
+        self
+    }
+
+    /// Register a pair of programs which trace the kernel function `func`. The
+    /// `fentry` program is loaded when the running kernel can attach fentry
+    /// programs to the function, otherwise the `kprobe` program is loaded
+    /// instead. Both are the function names of the programs in the BPF source.
+    pub fn fentry_with_fallback(
+        mut self,
+        func: &'static str,
+        fentry: &'static str,
+        kprobe: &'static str,
+    ) -> Self {
+        self.fentry_fallbacks.push((func, fentry, kprobe));
+        self
+    }
+
+    /// Set the rate at which the BPF program samples events for its
+    /// histograms. A rate of `N` means 1-in-N events are recorded, and the
+    /// bucket counts of every histogram registered with this builder are
+    /// scaled up by `N`. Counters are not scaled. The BPF program itself must
+    /// be configured to sample at the same rate, typically from an
+    /// `open_hook()`.
+    pub fn sample_rate(mut self, rate: u32) -> Self {
+        self.sample_rate = rate.max(1) as u64;
+        self
+    }
+
+    /// Set the grouping power of the BPF histograms. Every histogram map
+    /// registered with this builder, along with its dirty bitmap, is resized
+    /// for the grouping power before the program is loaded. The BPF buckets are
+    /// mapped onto the userspace histograms, which may use a different power,
+    /// and any `HistogramGroup`s are switched to the same power. The BPF
+    /// program itself must be configured to use the same power, typically from
+    /// an `open_hook()`.
+    pub fn histogram_grouping_power(mut self, power: u8) -> Self {
+        self.histogram_grouping_power = power;
+        self
+    }
+
+    /// The number of buffers in each of the counter and histogram maps.
+    fn buffers(&self) -> usize {
+        if self.epoch.is_some() {
+            EPOCH_BUFFERS
+        } else {
+            1
+        }
+    }
+
+    /// The number of entries for each of the maps which are sized at load
+    /// time, by map name.
+    fn map_entries(&self) -> Vec<(&'static str, usize)> {
+        let cpus = nr_cpus();
+        let buckets = histogram_buckets(self.histogram_grouping_power);
+        let bank_width = histogram_bank_width(buckets);
+
+        let mut entries = Vec::new();
+
+        let buffers = self.buffers();
+
+        // the per-CPU banks of counters are a whole number of cachelines wide
+        let counter_bank =
+            |counters: usize| whole_cachelines::<u64>(counters) * COUNTERS_PER_CACHELINE;
+
+        for (name, counters) in self.counters.iter() {
+            entries.push((*name, cpus * buffers * counter_bank(counters.len())));
+        }
+
+        for (name, counters) in self.cpu_counters.iter() {
+            entries.push((*name, cpus * counter_bank(counters.len())));
+        }
+
+        for (name, counters) in self.percpu_packed_counters.iter() {
+            let len = counters.iter().map(|c| c.len()).sum();
+
+            entries.push((*name, cpus * counter_bank(len)));
+        }
+
+        if let Some(name) = self.health_counters {
+            entries.push((name, cpus * counter_bank(HEALTH_REASONS.len())));
+        }
+
+        // the epoch has a cacheline for the active buffer before the CPUs
+        if let Some(name) = self.epoch {
+            entries.push((name, (cpus + 1) * COUNTERS_PER_CACHELINE));
+        }
+
+        for (name, _) in self.histograms.iter() {
+            entries.push((*name, buckets * buffers));
+        }
+
+        for (name, _, _) in self.percpu_histograms.iter() {
+            entries.push((*name, cpus * bank_width));
+        }
+
+        for (name, histograms) in self.percpu_histogram_arrays.iter() {
+            entries.push((*name, cpus * histograms.len() * bank_width));
+        }
+
+        for (name, group) in self.histogram_groups.iter() {
+            entries.push((*name, group.len() * bank_width));
+        }
+
+        for (name, group) in self.percpu_histogram_groups.iter() {
+            entries.push((*name, cpus * group.len() * bank_width));
+        }
+
+        for (name, heatmaps, _, _) in self.heatmaps.iter() {
+            let rows = heatmaps.first().map(|h| h.len()).unwrap_or(0);
+
+            entries.push((*name, heatmaps.len() * rows * bank_width));
+        }
+
+        entries
+    }
+
     /// Register a set of counters for this BPF sampler. The `name` is the BPF
     /// map name and the `counters` are a set of userspace lazy counters which
     /// must match the ordering used in the BPF map. See `Counters` for more
@@ -441,15 +974,92 @@ where
     }
 
     /// Register a histogram for this BPF sampler. The `name` is the BPF map
-    /// name and the `histogram` is the userspace histogram. The histogram
-    /// parameters used in both the BPF and userpsace histograms must match
-    /// exactly. See `Histogram` for more details on the assumptions and
-    /// requirements.
+    /// name and the `histogram` is the userspace histogram. The BPF histogram
+    /// uses the grouping power set with `histogram_grouping_power()`. See
+    /// `Histogram` for more details on the assumptions and requirements.
     pub fn histogram(mut self, name: &'static str, histogram: &'static RwLockHistogram) -> Self {
         self.histograms.push((name, histogram));
         self
     }
 
+    /// Register a per-CPU histogram for this BPF sampler. The `name` is the BPF
+    /// map name and the `histogram` is the userspace histogram which holds the
+    /// combined distribution across all CPUs. If `percpu` is provided, the
+    /// distribution for each individual CPU is also tracked. See
+    /// `PercpuHistogram` for more details on the assumptions and requirements.
+    pub fn percpu_histogram(
+        mut self,
+        name: &'static str,
+        histogram: &'static RwLockHistogram,
+        percpu: Option<&'static HistogramGroup>,
+    ) -> Self {
+        self.percpu_histograms.push((name, histogram, percpu));
+        self
+    }
+
+    /// Register a set of per-CPU histograms which share a single BPF map. The
+    /// `name` is the BPF map name and the `histograms` are the userspace
+    /// histograms, in the same order as the rows in the BPF map. See
+    /// `PercpuHistogramArray` for more details on the assumptions and
+    /// requirements.
+    pub fn percpu_histogram_array(
+        mut self,
+        name: &'static str,
+        histograms: Vec<&'static RwLockHistogram>,
+    ) -> Self {
+        self.percpu_histogram_arrays.push((name, histograms));
+        self
+    }
+
+    /// Register a set of histograms which share a single BPF map, with one
+    /// histogram for each entry in the `group`. The `name` is the BPF map name.
+    /// See `HistogramGroupMap` for more details on the assumptions and
+    /// requirements.
+    pub fn histogram_group(mut self, name: &'static str, group: &'static HistogramGroup) -> Self {
+        self.histogram_groups.push((name, group));
+        self
+    }
+
+    /// Register a set of histograms which share a single BPF map, with one
+    /// histogram for each entry in the `group` and a bank of them for each
+    /// CPU. The `name` is the BPF map name. See `PercpuHistogramGroupMap` for
+    /// more details on the assumptions and requirements.
+    pub fn percpu_histogram_group(
+        mut self,
+        name: &'static str,
+        group: &'static HistogramGroup,
+    ) -> Self {
+        self.percpu_histogram_groups.push((name, group));
+        self
+    }
+
+    /// Register a set of 2-D histograms (heatmaps) which share a single BPF
+    /// map. The `name` is the BPF map name and each of the `heatmaps` has one
+    /// entry for each row, in the same order as in the BPF map. Rows are
+    /// labeled with their upper bound under the metadata `key`, starting from
+    /// `2^min_power`. See `Heatmap` for more details on the assumptions and
+    /// requirements.
+    pub fn heatmap(
+        mut self,
+        name: &'static str,
+        heatmaps: Vec<&'static HistogramGroup>,
+        key: &'static str,
+        min_power: u8,
+    ) -> Self {
+        self.heatmaps.push((name, heatmaps, key, min_power));
+        self
+    }
+
+    /// Register a dirty bitmap for a map which is read by one of the histogram
+    /// or packed counter types. The `name` is the BPF map name of the tracked
+    /// map and `bitmap` is the BPF map name of its bitmap. Only the parts of
+    /// the map which have changed are read on each refresh. See `DirtyBitmap`
+    /// for more details on the assumptions and requirements.
+    pub fn dirty_bitmap(mut self, name: &'static str, bitmap: &'static str) -> Self {
+        self.dirty_bitmaps.push((name, bitmap));
+        self
+    }
+
     /// Register a map which is loaded from userspace values into the BPF
     /// program. This is useful for dynamic configuration or providing lookup
     /// tables.
@@ -477,7 +1087,25 @@ where
         event: PerfEvent,
         group: &'static CounterGroup,
     ) -> Self {
-        self.perf_events.push((name, event, group));
+        self.perf_events.push((name, 0, event, group, true));
+        self
+    }
+
+    /// Specify a perf event array which holds several perf events. The array
+    /// has one row of `MAX_CPUS` entries for each of the `events`, in order, so
+    /// the fd for event `i` on a CPU is at index `i * MAX_CPUS + cpu`. Unlike
+    /// `perf_event()` the events are not pinned, which allows the kernel to
+    /// multiplex them when there are more events than hardware counters. The
+    /// per-CPU counts are scaled to account for the multiplexing.
+    pub fn perf_event_array(
+        mut self,
+        name: &'static str,
+        events: Vec<(PerfEvent, &'static CounterGroup)>,
+    ) -> Self {
+        for (idx, (event, group)) in events.into_iter().enumerate() {
+            self.perf_events
+                .push((name, idx * MAX_CPUS, event, group, false));
+        }
         self
     }
 
@@ -486,12 +1114,114 @@ where
     /// expected to be densely packed, meaning there is no padding. The order of
     /// the `counters` must exactly match the order in the BPF map.
     pub fn packed_counters(mut self, name: &'static str, counters: &'static CounterGroup) -> Self {
+        self.packed_counters.push((name, vec![counters]));
+        self
+    }
+
+    /// Register a set of packed counters where the BPF map holds one row for
+    /// each of the `counters`, in order. Each row is densely packed and has one
+    /// entry for each counter in its group. See `packed_counters()`.
+    pub fn packed_counters_array(
+        mut self,
+        name: &'static str,
+        counters: Vec<&'static CounterGroup>,
+    ) -> Self {
         self.packed_counters.push((name, counters));
         self
     }
 
+    /// Register a set of packed counters where each CPU has its own bank of
+    /// counters in the BPF map, so that CPUs do not contend on the same
+    /// cachelines. Each bank is laid out as for `packed_counters()` and padded
+    /// to a whole number of cachelines, and the map is sized for the CPUs on
+    /// this host. See `PercpuPackedCounters`.
+    pub fn percpu_packed_counters(
+        mut self,
+        name: &'static str,
+        counters: &'static CounterGroup,
+    ) -> Self {
+        self.percpu_packed_counters.push((name, vec![counters]));
+        self
+    }
+
+    /// Double-buffer the counters and histograms of this BPF sampler, so that
+    /// each refresh reads a consistent snapshot. The `name` is the BPF map
+    /// name, which is `epoch` when using `epoch.h`. The maps registered with
+    /// `counters()` and `histogram()` must hold two buffers and be written
+    /// between `epoch_enter()` and `epoch_exit()`. See `Epoch` for more
+    /// details.
+    pub fn epoch(mut self, name: &'static str) -> Self {
+        self.epoch = Some(name);
+        self
+    }
+
+    /// Register the drop counters for this BPF sampler. The `name` is the BPF
+    /// map name, which is `health` when using `health.h`. See `HealthCounters`
+    /// for more details.
+    pub fn health_counters(mut self, name: &'static str) -> Self {
+        self.health_counters = Some(name);
+        self
+    }
+
+    /// Register the per-cgroup metrics for a BPF program which uses `cgroup.h`.
+    /// The program shares its cgroup maps with the `CgroupRegistry`, which
+    /// labels the `metrics` with the name of the cgroup in each slot. Programs
+    /// which only need the cgroup slots, such as to label stacks, can pass an
+    /// empty list.
+    pub fn cgroup_metrics(mut self, metrics: Vec<&'static dyn CgroupMetric>) -> Self {
+        self.cgroups = true;
+        self.cgroup_metrics.extend(metrics);
+        self
+    }
+
     pub fn ringbuf_handler(mut self, name: &'static str, handler: fn(&[u8]) -> i32) -> Self {
         self.ringbuf_handler.push((name, handler));
         self
     }
+
+    /// Register aggregated stack totals for a BPF program which uses
+    /// `stacks.h`. The `totals` map is a hash map from `struct stack_key`,
+    /// with ids from the `stacks` map, to a total such as the time spent
+    /// blocked. The totals are periodically drained and published as the stack
+    /// profile `name`. Set `clear_stacks` if the program uses each stack id as
+    /// soon as it is captured, so the stacks can be removed as they are
+    /// drained. See `StackTotals` for more details.
+    pub fn stack_totals(
+        mut self,
+        name: &'static str,
+        totals: &'static str,
+        stacks: &'static str,
+        clear_stacks: bool,
+    ) -> Self {
+        self.stack_totals.push((name, totals, stacks, clear_stacks));
+        self
+    }
+
+    /// Attach the `perf_event` program `prog` to a sampling perf event on each
+    /// CPU, which runs the program `frequency` times per second per CPU. The
+    /// events are opened once the program is loaded.
+    pub fn perf_event_program(
+        mut self,
+        prog: &'static str,
+        event: PerfEvent,
+        frequency: u64,
+    ) -> Self {
+        self.perf_event_programs.push((prog, event, frequency));
+        self
+    }
+
+    /// Register the exemplars ringbuf for a BPF program which uses
+    /// `exemplar.h`. The `name` is the BPF map name, which is `exemplars`. Each
+    /// exemplar carries an id which is labeled with `id_label` and turned into
+    /// a readable value with `format`, for example a syscall name. The program
+    /// only submits exemplars once its `exemplar_threshold` has been set.
+    pub fn exemplars(
+        mut self,
+        name: &'static str,
+        id_label: &'static str,
+        format: fn(u32) -> String,
+    ) -> Self {
+        self.exemplars.push((name, id_label, format));
+        self
+    }
 }
@@ -0,0 +1,215 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+// Shared definitions for attributing events to cgroups. A BPF program which
+// includes this header gets:
+// * a `cgroup_slots` map which assigns each live cgroup a slot
+// * a `cgroup_free_slots` queue which holds the slots not currently assigned
+// * a `cgroup_info` ringbuf which passes the names of cgroups to userspace
+// * a `cgroup_slot_owner` map used to detect when a slot is reassigned
+// * `task_cgroup_id()` to find the slot for the cgroup of a task
+//
+// The first three maps are owned by the cgroup registry (see
+// `cgroup_registry/mod.bpf.c`) and are shared with every BPF program which uses
+// this header. Userspace replaces them with the registry's maps before the
+// program is loaded, when the sampler is built with
+// `BpfBuilder::cgroup_metrics()`. This means each cgroup is only assigned one
+// slot and its name is only read once, no matter how many samplers see it.
+//
+// Cgroups are keyed by their `struct cgroup` pointer, which is unique across
+// all hierarchies while the cgroup is alive. The registry releases the slot
+// when the cgroup is removed, so slots are only limited by the number of live
+// cgroups and not by how many have ever been created.
+//
+// Per-cgroup metrics are then kept in arrays indexed by the slot, with
+// `MAX_CGROUPS` entries. In userspace the maps are read with `BpfBuilder`
+// methods as usual and the registry attaches the cgroup names to the
+// `CounterGroup` or `HistogramGroup` metrics.
+//
+// This must be included after `vmlinux.h`, the libbpf headers and `health.h`.
+
+#include "cgroup_info.h"
+
+#define MAX_CGROUPS 4096
+#define CGROUP_RINGBUF_CAPACITY 32768
+
+// the most CPUs a per-CPU cgroup array has banks for, which matches the
+// `MAX_CPUS` of the BPF programs
+#define CGROUP_MAX_CPUS 1024
+
+// the cgroup itself is online until it starts being destroyed
+#define CSS_ONLINE (1 << 1)
+
+struct cgroup_slot {
+	u32 slot;
+	u32 pad;
+	// the time the slot was assigned, which distinguishes reuse of a slot
+	u64 generation;
+};
+
+// dummy instance for skeleton to generate definition
+struct cgroup_info _cgroup_info = {};
+
+// assigned slot for each live cgroup, keyed by the `struct cgroup` pointer
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, u64);
+	__type(value, struct cgroup_slot);
+	__uint(max_entries, MAX_CGROUPS);
+} cgroup_slots SEC(".maps");
+
+// slots which are not assigned to a cgroup, filled by userspace. Slot zero is
+// never handed out so it can be used to mean no cgroup.
+struct {
+	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(key_size, 0);
+	__type(value, u32);
+	__uint(max_entries, MAX_CGROUPS);
+} cgroup_free_slots SEC(".maps");
+
+// ringbuf to pass cgroup info
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(key_size, 0);
+	__uint(value_size, 0);
+	__uint(max_entries, CGROUP_RINGBUF_CAPACITY);
+} cgroup_info SEC(".maps");
+
+// the generation of each slot last seen by this program, which is private to
+// each program so it can reset its own per-cgroup state
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CGROUPS);
+} cgroup_slot_owner SEC(".maps");
+
+// Returns the slot assigned to the cgroup, assigning one and sending the name
+// of the cgroup to userspace if it has not been seen before. Returns zero if
+// the cgroup is being removed or there are no free slots.
+static __always_inline struct cgroup_slot *cgroup_slot(struct cgroup *cgrp)
+{
+	u64 key = (u64)cgrp;
+
+	struct cgroup_slot *elem = bpf_map_lookup_elem(&cgroup_slots, &key);
+
+	if (elem) {
+		return elem;
+	}
+
+	// a cgroup which is being removed would never have its slot released
+	if (!(BPF_CORE_READ(cgrp, self.flags) & CSS_ONLINE)) {
+		return 0;
+	}
+
+	struct cgroup_slot value = {
+		.generation = bpf_ktime_get_ns(),
+	};
+
+	if (bpf_map_pop_elem(&cgroup_free_slots, &value.slot)) {
+		health_incr(HEALTH_MAP_FULL);
+		return 0;
+	}
+
+	if (bpf_map_update_elem(&cgroup_slots, &key, &value, BPF_NOEXIST)) {
+		// another cpu assigned a slot to the cgroup first
+		bpf_map_push_elem(&cgroup_free_slots, &value.slot, 0);
+
+		return bpf_map_lookup_elem(&cgroup_slots, &key);
+	}
+
+	// initialize the cgroup info
+	struct cgroup_info cginfo = {
+		.id = value.slot,
+	};
+
+	struct kernfs_node *kn = BPF_CORE_READ(cgrp, kn);
+
+	// read the cgroup name
+	bpf_probe_read_kernel_str(&cginfo.name, CGROUP_NAME_LEN, BPF_CORE_READ(kn, name));
+
+	// read the cgroup parent name
+	bpf_probe_read_kernel_str(&cginfo.pname, CGROUP_NAME_LEN, BPF_CORE_READ(kn, parent, name));
+
+	// read the cgroup grandparent name
+	bpf_probe_read_kernel_str(&cginfo.gpname, CGROUP_NAME_LEN, BPF_CORE_READ(kn, parent, parent, name));
+
+	// push the cgroup info into the ringbuf
+	if (bpf_ringbuf_output(&cgroup_info, &cginfo, sizeof(cginfo), 0)) {
+		health_incr(HEALTH_RINGBUF_FULL);
+	}
+
+	return bpf_map_lookup_elem(&cgroup_slots, &key);
+}
+
+// Returns the slot for the cpu cgroup of the task, or zero if the cgroup does
+// not have one. The slot will always be less than `MAX_CGROUPS`. If this is
+// the first time this program has seen the cgroup in its slot, `*is_new` is set
+// so the caller can reset any per-cgroup state.
+static __always_inline int task_cgroup_id(struct task_struct *task, bool *is_new)
+{
+	*is_new = false;
+
+	if (!task || !bpf_core_field_exists(task->sched_task_group)) {
+		return 0;
+	}
+
+	struct cgroup *cgrp = BPF_CORE_READ(task, sched_task_group, css.cgroup);
+
+	if (!cgrp) {
+		return 0;
+	}
+
+	struct cgroup_slot *elem = cgroup_slot(cgrp);
+
+	if (!elem) {
+		return 0;
+	}
+
+	u32 slot = elem->slot;
+	u64 generation = elem->generation;
+
+	if (!slot || slot >= MAX_CGROUPS) {
+		health_incr(HEALTH_OUT_OF_RANGE);
+		return 0;
+	}
+
+	// check if the slot was reassigned since this program last saw it
+	u64 *owner = bpf_map_lookup_elem(&cgroup_slot_owner, &slot);
+
+	if (owner && *owner != generation) {
+		*is_new = true;
+		*owner = generation;
+	}
+
+	return slot;
+}
+
+// Per-cgroup counters which are updated on every CPU are kept in per-CPU
+// arrays, so that CPUs do not contend on the cachelines of busy cgroups. The
+// array holds one bank of `MAX_CGROUPS` entries for each CPU, and userspace
+// sums the banks, see `BpfBuilder::percpu_packed_counters()`.
+
+// Returns the index of the slot in the bank for the current CPU.
+static __always_inline u32 cgroup_percpu_idx(u32 slot)
+{
+	return MAX_CGROUPS * bpf_get_smp_processor_id() + slot;
+}
+
+// Zeroes the slot in the bank for every CPU. Userspace sizes the array for the
+// CPUs on the host, so the first update which fails is past the last bank.
+static __always_inline void cgroup_percpu_zero(void *array, u32 slot)
+{
+	u64 zero = 0;
+
+	for (u32 cpu = 0; cpu < CGROUP_MAX_CPUS; cpu++) {
+		u32 idx = MAX_CGROUPS * cpu + slot;
+
+		if (bpf_map_update_elem(array, &idx, &zero, BPF_ANY)) {
+			break;
+		}
+	}
+}
+
+#endif //CGROUP_H
@@ -0,0 +1,328 @@
+mod registry {
+    include!(concat!(env!("OUT_DIR"), "/common_cgroup_registry.bpf.rs"));
+}
+
+use crate::common::bpf::*;
+use crate::common::{CounterGroup, GaugeGroup, HistogramGroup};
+use crate::*;
+
+use libbpf_rs::skel::{OpenSkel, Skel, SkelBuilder};
+use libbpf_rs::{OpenObject, RingBufferBuilder};
+use parking_lot::Mutex;
+
+use std::mem::MaybeUninit;
+use std::os::fd::{AsFd, AsRawFd, OwnedFd};
+use std::sync::mpsc::sync_channel;
+use std::sync::OnceLock;
+use std::time::Duration;
+
+const NAME: &str = "cgroup_registry";
+
+const CGROUP_NAME_LEN: usize = 64;
+
+/// The shared maps of the cgroup registry. Initialized the first time a sampler
+/// with per-cgroup metrics is built.
+static REGISTRY: OnceLock<Option<CgroupRegistry>> = OnceLock::new();
+
+/// All the per-cgroup metrics which are labeled with cgroup names.
+static METRICS: Mutex<Vec<&'static dyn CgroupMetric>> = Mutex::new(Vec::new());
+
+/// The name of the cgroup assigned to each slot, if it is known.
+static NAMES: Mutex<Vec<Option<String>>> = Mutex::new(Vec::new());
+
+/// Matches `struct cgroup_info` in `cgroup_info.h`.
+#[repr(C)]
+#[derive(Clone, Copy)]
+struct CgroupInfo {
+    id: i32,
+    removed: i32,
+    name: [u8; CGROUP_NAME_LEN],
+    pname: [u8; CGROUP_NAME_LEN],
+    gpname: [u8; CGROUP_NAME_LEN],
+}
+
+unsafe impl plain::Plain for CgroupInfo {}
+
+/// A metric with one entry per cgroup slot which can be labeled with the name
+/// of the cgroup. Other metric groups which are labeled per entry, such as the
+/// per-program BPF metrics, use it to label their entries together.
+pub trait CgroupMetric: Send + Sync {
+    fn insert_metadata(&self, idx: usize, key: String, value: String);
+
+    fn clear_metadata(&self, idx: usize);
+}
+
+impl CgroupMetric for CounterGroup {
+    fn insert_metadata(&self, idx: usize, key: String, value: String) {
+        CounterGroup::insert_metadata(self, idx, key, value)
+    }
+
+    fn clear_metadata(&self, idx: usize) {
+        CounterGroup::clear_metadata(self, idx)
+    }
+}
+
+impl CgroupMetric for GaugeGroup {
+    fn insert_metadata(&self, idx: usize, key: String, value: String) {
+        GaugeGroup::insert_metadata(self, idx, key, value)
+    }
+
+    fn clear_metadata(&self, idx: usize) {
+        GaugeGroup::clear_metadata(self, idx)
+    }
+}
+
+impl CgroupMetric for HistogramGroup {
+    fn insert_metadata(&self, idx: usize, key: String, value: String) {
+        HistogramGroup::insert_metadata(self, idx, key, value)
+    }
+
+    fn clear_metadata(&self, idx: usize) {
+        HistogramGroup::clear_metadata(self, idx)
+    }
+}
+
+/// The cgroup registry loads the BPF program from `cgroup_registry/mod.bpf.c`
+/// which owns the `cgroup_slots`, `cgroup_free_slots`, and `cgroup_info` maps
+/// from `cgroup.h`. Samplers share these maps so that each cgroup is assigned a
+/// single slot, which is the index into every per-cgroup metric. The registry
+/// thread is the only consumer of the `cgroup_info` ringbuf and labels all the
+/// registered metrics as cgroups come and go.
+pub struct CgroupRegistry {
+    slots: OwnedFd,
+    free_slots: OwnedFd,
+    info: OwnedFd,
+}
+
+impl CgroupRegistry {
+    /// Returns the cgroup registry, starting it if this is the first call.
+    /// Returns `None` if the registry could not be started.
+    pub fn get() -> Option<&'static Self> {
+        REGISTRY
+            .get_or_init(|| match Self::start() {
+                Ok(registry) => Some(registry),
+                Err(e) => {
+                    error!("failed to start {NAME}: {e}");
+                    None
+                }
+            })
+            .as_ref()
+    }
+
+    fn start() -> Result<Self, libbpf_rs::Error> {
+        let (tx, rx) = sync_channel(1);
+
+        std::thread::spawn(move || {
+            // storage for the BPF object file
+            let open_object: &'static mut MaybeUninit<OpenObject> =
+                Box::leak(Box::new(MaybeUninit::uninit()));
+
+            let mut skel = match registry::ModSkelBuilder::default()
+                .open(open_object)
+                .and_then(|open_skel| open_skel.load())
+            {
+                Ok(skel) => skel,
+                Err(e) => {
+                    let _ = tx.send(Err(e));
+                    return;
+                }
+            };
+
+            debug!(
+                "{NAME} cgroup_mkdir() BPF instruction count: {}",
+                skel.progs.cgroup_mkdir.insn_cnt()
+            );
+            debug!(
+                "{NAME} cgroup_rmdir() BPF instruction count: {}",
+                skel.progs.cgroup_rmdir.insn_cnt()
+            );
+
+            for prog in skel.object().progs() {
+                register_program(NAME, &prog, 1);
+            }
+
+            // every slot except zero starts out free
+            let fd = skel.maps.cgroup_free_slots.as_fd().as_raw_fd();
+
+            for slot in 1..MAX_CGROUPS as u32 {
+                // queue maps have no key, which libbpf-rs does not allow for
+                let ret = unsafe {
+                    libbpf_sys::bpf_map_update_elem(
+                        fd,
+                        std::ptr::null(),
+                        &slot as *const u32 as *const _,
+                        libbpf_sys::BPF_ANY as _,
+                    )
+                };
+
+                if ret != 0 {
+                    let _ = tx.send(Err(libbpf_rs::Error::from_raw_os_error(-ret)));
+                    return;
+                }
+            }
+
+            if let Err(e) = skel.attach() {
+                let _ = tx.send(Err(e));
+                return;
+            }
+
+            let mut builder = RingBufferBuilder::new();
+
+            let ringbuffer = match builder
+                .add(&skel.maps.cgroup_info, handle_cgroup_info)
+                .and_then(|builder| builder.build())
+            {
+                Ok(ringbuffer) => ringbuffer,
+                Err(e) => {
+                    let _ = tx.send(Err(e));
+                    return;
+                }
+            };
+
+            let fds = [
+                skel.maps.cgroup_slots.as_fd().try_clone_to_owned(),
+                skel.maps.cgroup_free_slots.as_fd().try_clone_to_owned(),
+                skel.maps.cgroup_info.as_fd().try_clone_to_owned(),
+            ];
+
+            let registry = match fds {
+                [Ok(slots), Ok(free_slots), Ok(info)] => CgroupRegistry {
+                    slots,
+                    free_slots,
+                    info,
+                },
+                _ => {
+                    let _ = tx.send(Err(libbpf_rs::Error::from(std::io::Error::last_os_error())));
+                    return;
+                }
+            };
+
+            let _ = tx.send(Ok(registry));
+
+            let mut health = HealthCounters::new(&skel.maps.health, NAME);
+
+            loop {
+                let _ = ringbuffer.poll(Duration::from_secs(1));
+
+                if let Some(ref mut health) = health {
+                    health.refresh();
+                }
+            }
+        });
+
+        rx.recv().unwrap_or_else(|_| {
+            Err(libbpf_rs::Error::from(std::io::Error::other(
+                "cgroup registry thread exited",
+            )))
+        })
+    }
+
+    /// Replace the maps from `cgroup.h` in an open BPF object with the maps
+    /// owned by the registry. This must happen before the object is loaded.
+    pub fn reuse_maps(&self, object: &mut OpenObject) -> Result<(), libbpf_rs::Error> {
+        for map in object.maps_mut() {
+            let fd = if map.name() == "cgroup_slots" {
+                &self.slots
+            } else if map.name() == "cgroup_free_slots" {
+                &self.free_slots
+            } else if map.name() == "cgroup_info" {
+                &self.info
+            } else {
+                continue;
+            };
+
+            map.reuse_fd(fd.as_fd())?;
+        }
+
+        Ok(())
+    }
+}
+
+/// Adds `metrics` to the set of per-cgroup metrics which are labeled with the
+/// name of the cgroup in each slot. Slots which already have a cgroup are
+/// labeled immediately.
+pub fn register_cgroup_metrics(metrics: Vec<&'static dyn CgroupMetric>) {
+    let names = NAMES.lock();
+    let mut registered = METRICS.lock();
+
+    for metric in metrics {
+        for (id, name) in names.iter().enumerate() {
+            if let Some(name) = name {
+                metric.insert_metadata(id, "name".to_string(), name.clone());
+            }
+        }
+
+        registered.push(metric);
+    }
+}
+
+/// Returns the name of the cgroup assigned to the slot, if it is known.
+pub(super) fn cgroup_slot_name(slot: usize) -> Option<String> {
+    NAMES.lock().get(slot).cloned().flatten()
+}
+
+/// Handles a record from the `cgroup_info` ringbuf as defined in `cgroup.h` by
+/// labeling the slot in each of the registered metrics with the name of the
+/// cgroup, or removing the label if the cgroup was removed.
+fn handle_cgroup_info(data: &[u8]) -> i32 {
+    let mut cgroup_info = unsafe { MaybeUninit::<CgroupInfo>::zeroed().assume_init() };
+
+    if plain::copy_from_bytes(&mut cgroup_info, data).is_err() {
+        return 0;
+    }
+
+    let id = cgroup_info.id;
+
+    if id <= 0 || id as usize >= MAX_CGROUPS {
+        return 0;
+    }
+
+    let id = id as usize;
+
+    let name = if cgroup_info.removed != 0 {
+        String::new()
+    } else {
+        let name = cgroup_name(&cgroup_info.name);
+        let pname = cgroup_name(&cgroup_info.pname);
+        let gpname = cgroup_name(&cgroup_info.gpname);
+
+        if !gpname.is_empty() {
+            format!("{gpname}_{pname}_{name}")
+        } else if !pname.is_empty() {
+            format!("{pname}_{name}")
+        } else {
+            name
+        }
+    };
+
+    let mut names = NAMES.lock();
+
+    if names.is_empty() {
+        names.resize(MAX_CGROUPS, None);
+    }
+
+    let metrics = METRICS.lock();
+
+    // the slot may have belonged to a different cgroup before
+    for metric in metrics.iter() {
+        metric.clear_metadata(id);
+    }
+
+    if name.is_empty() {
+        names[id] = None;
+    } else {
+        for metric in metrics.iter() {
+            metric.insert_metadata(id, "name".to_string(), name.clone());
+        }
+
+        names[id] = Some(name);
+    }
+
+    0
+}
+
+fn cgroup_name(name: &[u8]) -> String {
+    String::from_utf8_lossy(name)
+        .trim_end_matches(char::from(0))
+        .replace("\\x2d", "-")
+}
@@ -5,6 +5,8 @@
 
 struct cgroup_info {
 	int id;
+	// set when the cgroup was removed and its slot released
+	int removed;
 	u8 name[CGROUP_NAME_LEN];
 	u8 pname[CGROUP_NAME_LEN];
 	u8 gpname[CGROUP_NAME_LEN];
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2024 The Rezolus Authors
+
+// This BPF program owns the maps from `cgroup.h` which are shared by all of the
+// samplers that attribute events to cgroups. It assigns slots to new cgroups as
+// they are created and releases the slots of cgroups as they are removed.
+// Cgroups which existed before Rezolus started are assigned a slot the first
+// time any sampler sees them.
+
+#include <vmlinux.h>
+#include "../health.h"
+#include "../helpers.h"
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include "../cgroup.h"
+
+SEC("tp_btf/cgroup_mkdir")
+int BPF_PROG(cgroup_mkdir, struct cgroup *cgrp, const char *path)
+{
+	cgroup_slot(cgrp);
+
+	return 0;
+}
+
+SEC("tp_btf/cgroup_rmdir")
+int BPF_PROG(cgroup_rmdir, struct cgroup *cgrp, const char *path)
+{
+	u64 key = (u64)cgrp;
+
+	struct cgroup_slot *elem = bpf_map_lookup_elem(&cgroup_slots, &key);
+
+	if (!elem) {
+		return 0;
+	}
+
+	u32 slot = elem->slot;
+
+	if (bpf_map_delete_elem(&cgroup_slots, &key)) {
+		return 0;
+	}
+
+	// let userspace know the slot no longer belongs to this cgroup
+	struct cgroup_info cginfo = {
+		.id = slot,
+		.removed = 1,
+	};
+
+	if (bpf_ringbuf_output(&cgroup_info, &cginfo, sizeof(cginfo), 0)) {
+		health_incr(HEALTH_RINGBUF_FULL);
+	}
+
+	if (bpf_map_push_elem(&cgroup_free_slots, &slot, 0)) {
+		health_incr(HEALTH_MAP_FULL);
+	}
+
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
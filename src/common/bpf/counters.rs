@@ -1,3 +1,4 @@
+use crate::common::bpf::dirty::{DirtyBitmap, ENTRIES_PER_BIT};
 use crate::common::bpf::*;
 use crate::common::*;
 use crate::*;
@@ -10,16 +11,26 @@ use std::os::fd::{AsFd, AsRawFd, FromRawFd};
 
 /// This wraps the BPF map along with an opened memory-mapped region for the map
 /// values.
-struct CounterMap<'a> {
+pub(super) struct CounterMap<'a> {
     _map: &'a Map<'a>,
     mmap: MmapMut,
     bank_width: usize,
+    cpus: usize,
 }
 
 impl<'a> CounterMap<'a> {
     /// Create a new `CounterMap` from the provided BPF map that holds the
     /// provided number of counters.
     pub fn new(map: &'a Map, counters: usize) -> Result<Self, ()> {
+        Self::with_buffers(map, counters, 1)
+    }
+
+    /// Create a new `CounterMap` from the provided BPF map where each CPU has a
+    /// bank of counters for each of the `buffers`. See `Epoch`.
+    pub fn with_buffers(map: &'a Map, counters: usize, buffers: usize) -> Result<Self, ()> {
+        // the map is sized for the CPUs on this host before it is loaded
+        let cpus = nr_cpus();
+
         // each CPU has its own bank of counters, this bank is the next nearest
         // whole number of cachelines wide
         let bank_cachelines = whole_cachelines::<u64>(counters);
@@ -28,7 +39,7 @@ impl<'a> CounterMap<'a> {
         let bank_width = bank_cachelines * COUNTERS_PER_CACHELINE;
 
         // our total mapped region size in bytes
-        let total_bytes = bank_cachelines * CACHELINE_SIZE * MAX_CPUS;
+        let total_bytes = bank_cachelines * CACHELINE_SIZE * cpus * buffers;
 
         let fd = map.as_fd().as_raw_fd();
         let file = unsafe { std::fs::File::from_raw_fd(fd as _) };
@@ -41,7 +52,7 @@ impl<'a> CounterMap<'a> {
 
         let (_prefix, values, _suffix) = unsafe { mmap.align_to::<u64>() };
 
-        if values.len() != MAX_CPUS * bank_width {
+        if values.len() != cpus * bank_width * buffers {
             error!("mmap region not aligned or width doesn't match");
             return Err(());
         }
@@ -50,6 +61,7 @@ impl<'a> CounterMap<'a> {
             _map: map,
             mmap,
             bank_width,
+            cpus,
         })
     }
 
@@ -59,36 +71,65 @@ impl<'a> CounterMap<'a> {
         values
     }
 
+    /// Borrow a mutable reference to the raw values. This must only be used
+    /// for a buffer which the BPF programs are not writing to.
+    pub fn values_mut(&mut self) -> &mut [u64] {
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to_mut::<u64>() };
+        values
+    }
+
     /// Get the bank width which is the stride for reading through the values
     /// slice.
     pub fn bank_width(&self) -> usize {
         self.bank_width
     }
+
+    /// Get the number of CPUs which have a bank of counters.
+    pub fn cpus(&self) -> usize {
+        self.cpus
+    }
 }
 
 /// Tracks total counts for a set of-per CPU counters. The BPF map must have one
 /// bank of counters per CPU, padded to a whole number of cachelines. This
 /// avoids contention and false sharing. Does not track per-CPU counts.
+///
+/// When the map is double-buffered, each CPU has a bank for each buffer, one
+/// after the other, and the BPF program writes to the buffer returned by
+/// `epoch_enter()` from `epoch.h`. The values in the map are then the counts
+/// since the buffer was last read, and the totals are kept in userspace. See
+/// `Epoch`.
 pub struct Counters<'a> {
     counter_map: CounterMap<'a>,
     counters: Vec<&'static LazyCounter>,
     values: Vec<u64>,
+    totals: Vec<u64>,
+    buffers: usize,
 }
 
 impl<'a> Counters<'a> {
     /// Create a new set of counters from the provided BPF map and collection of
     /// counter metrics.
     pub fn new(map: &'a Map, counters: Vec<&'static LazyCounter>) -> Self {
+        Self::with_buffers(map, counters, 1)
+    }
+
+    /// Create a new set of counters from a double-buffered BPF map which holds
+    /// `buffers` copies of the per-CPU banks.
+    pub fn with_buffers(map: &'a Map, counters: Vec<&'static LazyCounter>, buffers: usize) -> Self {
         // we need temporary buffer so we can total up the per-CPU values
         let values = vec![0; counters.len()];
 
         // load the BPF counter map
-        let counter_map = CounterMap::new(map, counters.len()).expect("failed to initialize");
+        let counter_map =
+            CounterMap::with_buffers(map, counters.len(), buffers).expect("failed to initialize");
 
         Self {
             counter_map,
+            totals: vec![0; counters.len()],
             counters,
             values,
+            buffers,
         }
     }
 
@@ -104,7 +145,7 @@ impl<'a> Counters<'a> {
         let counters = self.counter_map.values();
 
         // iterate through and increment our local value for each cpu counter
-        for cpu in 0..MAX_CPUS {
+        for cpu in 0..self.counter_map.cpus() {
             for idx in 0..self.counters.len() {
                 let value = counters[idx + cpu * bank_width];
 
@@ -118,6 +159,34 @@ impl<'a> Counters<'a> {
             counter.set(*value);
         }
     }
+
+    /// Refreshes the counters of a double-buffered map by adding the values in
+    /// the quiescent `buffer` to the totals and zeroing them.
+    pub fn refresh_buffer(&mut self, buffer: usize) {
+        let bank_width = self.counter_map.bank_width();
+        let cpus = self.counter_map.cpus();
+
+        let counters = self.counter_map.values_mut();
+
+        for cpu in 0..cpus {
+            let offset = (cpu * self.buffers + buffer) * bank_width;
+
+            for idx in 0..self.counters.len() {
+                let value = &mut counters[offset + idx];
+
+                // most CPUs are idle for most counters, so avoid writing to
+                // the cachelines which are unchanged
+                if *value != 0 {
+                    self.totals[idx] = self.totals[idx].wrapping_add(*value);
+                    *value = 0;
+                }
+            }
+        }
+
+        for (total, counter) in self.totals.iter().zip(self.counters.iter_mut()) {
+            counter.set(*total);
+        }
+    }
 }
 
 /// Tracks per-CPU counters. The BPF map layout is the same as for `Counters`,
@@ -150,7 +219,7 @@ impl<'a> CpuCounters<'a> {
         let counters = self.counter_map.values();
 
         // iterate through and increment our local value for each cpu counter
-        for cpu in 0..MAX_CPUS {
+        for cpu in 0..self.counter_map.cpus() {
             for idx in 0..self.counters.len() {
                 let value = counters[idx + cpu * bank_width];
 
@@ -163,11 +232,18 @@ impl<'a> CpuCounters<'a> {
 
 /// Represents a set of counters where the BPF map is a dense set of counters,
 /// meaning there is no padding. No aggregation is performed, and the values are
-/// updated into a single `RwLockCounterGroup`.
+/// updated into one or more `CounterGroup`s. When there are multiple groups, the
+/// BPF map holds one row for each group, in the same order, and each row has
+/// one entry for each counter in the group.
+///
+/// If a `dirty` bitmap is provided, only the counters in cachelines which have
+/// changed are read and updated. See `DirtyBitmap`.
 pub struct PackedCounters<'a> {
     _map: &'a Map<'a>,
     mmap: MmapMut,
-    counters: &'static CounterGroup,
+    counters: Vec<&'static CounterGroup>,
+    dirty: Option<DirtyBitmap<'a>>,
+    lines: Vec<usize>,
 }
 
 impl<'a> PackedCounters<'a> {
@@ -176,8 +252,9 @@ impl<'a> PackedCounters<'a> {
     ///
     /// The map layout is not cacheline padded. The ordering of the dynamic
     /// counters must exactly match the layout in the BPF map.
-    pub fn new(map: &'a Map, counters: &'static CounterGroup) -> Self {
-        let total_bytes = counters.len() * std::mem::size_of::<u64>();
+    pub fn new(map: &'a Map, counters: Vec<&'static CounterGroup>, dirty: Option<&'a Map>) -> Self {
+        let entries: usize = counters.iter().map(|c| c.len()).sum();
+        let total_bytes = entries * std::mem::size_of::<u64>();
 
         let fd = map.as_fd().as_raw_fd();
         let file = unsafe { std::fs::File::from_raw_fd(fd as _) };
@@ -190,7 +267,7 @@ impl<'a> PackedCounters<'a> {
 
         let (_prefix, values, _suffix) = unsafe { mmap.align_to::<u64>() };
 
-        if values.len() != counters.len() {
+        if values.len() != entries {
             panic!("mmap region not aligned or width doesn't match");
         }
 
@@ -198,18 +275,171 @@ impl<'a> PackedCounters<'a> {
             _map: map,
             mmap,
             counters,
+            dirty: dirty.map(|dirty| DirtyBitmap::new(dirty, entries)),
+            lines: Vec::new(),
         }
     }
 
     /// Refreshes the counters by reading from the BPF map and setting each
     /// counter metric to the current value.
     pub fn refresh(&mut self) {
+        if self.dirty.is_some() {
+            self.refresh_dirty();
+            return;
+        }
+
+        let (_prefix, mut values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        for counters in self.counters.iter() {
+            let (row, rest) = values.split_at(counters.len());
+
+            // update all individual counters
+            for (idx, value) in row.iter().enumerate() {
+                if *value != 0 {
+                    let _ = counters.set(idx, *value);
+                }
+            }
+
+            values = rest;
+        }
+    }
+
+    fn refresh_dirty(&mut self) {
+        if let Some(ref mut dirty) = self.dirty {
+            dirty.drain(&mut self.lines);
+        }
+
         let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
 
-        // update all individual counters
-        for (idx, value) in values.iter().enumerate() {
-            if *value != 0 {
-                let _ = self.counters.set(idx, *value);
+        // lines are in ascending order, so we can walk the groups alongside
+        let mut groups = self.counters.iter();
+        let mut group = groups.next();
+        let mut group_start = 0;
+
+        for line in self.lines.iter() {
+            let start = line * ENTRIES_PER_BIT;
+            let end = (start + ENTRIES_PER_BIT).min(values.len());
+
+            for (idx, value) in values.iter().enumerate().take(end).skip(start) {
+                // skip forward to the group which holds this entry
+                while let Some(counters) = group {
+                    if idx < group_start + counters.len() {
+                        break;
+                    }
+
+                    group_start += counters.len();
+                    group = groups.next();
+                }
+
+                let Some(counters) = group else {
+                    return;
+                };
+
+                if *value != 0 {
+                    let _ = counters.set(idx - group_start, *value);
+                }
+            }
+        }
+    }
+}
+
+/// Represents a set of packed counters where each CPU has its own bank, so
+/// that BPF programs on different CPUs never write to the same cachelines. Each
+/// bank has the same layout as the map for `PackedCounters`, padded to a whole
+/// number of cachelines, and the counters are set to the totals across all the
+/// CPUs. The BPF program writes to the entry in the bank for the current CPU,
+/// which starts at `bpf_get_smp_processor_id()` times the bank width.
+///
+/// If a `dirty` bitmap is provided, only the counters in cachelines which have
+/// changed on at least one CPU are totalled and updated. See `DirtyBitmap`.
+pub struct PercpuPackedCounters<'a> {
+    counter_map: CounterMap<'a>,
+    counters: Vec<&'static CounterGroup>,
+    entries: usize,
+    dirty: Option<DirtyBitmap<'a>>,
+    lines: Vec<usize>,
+}
+
+impl<'a> PercpuPackedCounters<'a> {
+    /// Create a new set of counters from the provided BPF map and collection of
+    /// counter metrics. The ordering of the counters must exactly match the
+    /// layout of each bank in the BPF map.
+    pub fn new(map: &'a Map, counters: Vec<&'static CounterGroup>, dirty: Option<&'a Map>) -> Self {
+        let entries: usize = counters.iter().map(|c| c.len()).sum();
+
+        let counter_map = CounterMap::new(map, entries).expect("failed to initialize");
+
+        let dirty = dirty
+            .map(|dirty| DirtyBitmap::new(dirty, counter_map.cpus() * counter_map.bank_width()));
+
+        Self {
+            counter_map,
+            counters,
+            entries,
+            dirty,
+            lines: Vec::new(),
+        }
+    }
+
+    /// Refreshes the counters by totalling the banks in the BPF map and setting
+    /// each counter metric to the combined value.
+    pub fn refresh(&mut self) {
+        let bank_width = self.counter_map.bank_width();
+        let lines_per_bank = bank_width / ENTRIES_PER_BIT;
+
+        if let Some(ref mut dirty) = self.dirty {
+            dirty.drain(&mut self.lines);
+
+            // each line of a bank holds the same counters as that line of
+            // every other bank
+            for line in self.lines.iter_mut() {
+                *line %= lines_per_bank;
+            }
+
+            self.lines.sort_unstable();
+            self.lines.dedup();
+        } else {
+            self.lines.clear();
+            self.lines.extend(0..lines_per_bank);
+        }
+
+        let values = self.counter_map.values();
+
+        for line in self.lines.iter() {
+            let start = line * ENTRIES_PER_BIT;
+            let end = (start + ENTRIES_PER_BIT).min(self.entries);
+
+            if start >= end {
+                continue;
+            }
+
+            // read the line from each bank in turn
+            let mut totals = [0_u64; ENTRIES_PER_BIT];
+
+            for cpu in 0..self.counter_map.cpus() {
+                let offset = cpu * bank_width;
+
+                for (total, value) in totals.iter_mut().zip(&values[offset + start..offset + end]) {
+                    *total = total.wrapping_add(*value);
+                }
+            }
+
+            for (idx, total) in (start..end).zip(totals) {
+                if total == 0 {
+                    continue;
+                }
+
+                // find the group which holds this entry
+                let mut offset = idx;
+
+                for counters in self.counters.iter() {
+                    if offset < counters.len() {
+                        let _ = counters.set(offset, total);
+                        break;
+                    }
+
+                    offset -= counters.len();
+                }
             }
         }
     }
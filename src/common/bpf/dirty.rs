@@ -0,0 +1,196 @@
+use crate::common::bpf::*;
+use crate::*;
+
+use libbpf_rs::Map;
+use memmap2::MmapMut;
+
+use std::marker::PhantomData;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// The number of entries covered by each bit of a dirty bitmap.
+pub(super) const ENTRIES_PER_BIT: usize = COUNTERS_PER_CACHELINE;
+
+/// Returns the number of entries in a dirty bitmap for a map with the provided
+/// number of entries. This must match `DIRTY_BITMAP_ENTRIES()` from
+/// `helpers.h`.
+pub(super) fn dirty_bitmap_entries(entries: usize) -> usize {
+    // each word of the bitmap covers 64 cachelines
+    (entries + ENTRIES_PER_BIT * 64 - 1) / (ENTRIES_PER_BIT * 64)
+}
+
+/// Tracks which cachelines of a BPF map have been written to since they were
+/// last read. The bitmap must be created with:
+///
+/// ```c
+/// struct {
+///     __uint(type, BPF_MAP_TYPE_ARRAY);
+///     __uint(map_flags, BPF_F_MMAPABLE);
+///     __type(key, u32);
+///     __type(value, u64);
+///     __uint(max_entries, DIRTY_BITMAP_ENTRIES(ENTRIES));
+/// } some_map_name_dirty SEC(".maps");
+/// ```
+///
+/// Where `ENTRIES` is the number of entries in the map being tracked. Every
+/// write to the tracked map must be followed by `mark_dirty()` from
+/// `helpers.h`, the `*_dirty` helpers do both. This lets large maps, such as
+/// per-CPU or per-cgroup histograms, be refreshed in time proportional to the
+/// number of cachelines which changed instead of the size of the map.
+///
+/// The BPF side stores to the map and then loads the bit, only setting it if it
+/// was clear. BPF has no full barrier, so that store and load may be reordered
+/// and a write which races with `drain()` can see the bit as still set after it
+/// was cleared here, and the tracked map read, but before the write was
+/// visible. Instead of a fully ordered update of the bitmap on every write,
+/// each line is returned by `drain()` again on the next call so that the write
+/// is picked up one refresh later.
+pub(super) struct DirtyBitmap<'a> {
+    _map: PhantomData<&'a Map<'a>>,
+    mmap: MmapMut,
+    words: usize,
+    drained: Vec<usize>,
+    current: Vec<usize>,
+}
+
+impl<'a> DirtyBitmap<'a> {
+    /// Create a new `DirtyBitmap` from the provided BPF map which tracks a map
+    /// with the provided number of entries.
+    pub fn new(map: &'a Map, entries: usize) -> Self {
+        let words = dirty_bitmap_entries(entries);
+
+        let mmap = mmap_map(map, words);
+
+        Self {
+            _map: PhantomData,
+            mmap,
+            words,
+            drained: Vec::new(),
+            current: Vec::new(),
+        }
+    }
+
+    /// Create a `DirtyBitmap` backed by anonymous memory instead of a BPF map.
+    #[cfg(test)]
+    fn anonymous(entries: usize) -> Self {
+        let words = dirty_bitmap_entries(entries);
+
+        Self {
+            _map: PhantomData,
+            mmap: MmapMut::map_anon(words * std::mem::size_of::<u64>()).unwrap(),
+            words,
+            drained: Vec::new(),
+            current: Vec::new(),
+        }
+    }
+
+    /// Clears the bitmap and fills `lines` with the index of each cacheline
+    /// which was dirty, along with each of the cachelines returned by the
+    /// previous call, in ascending order. An entry `idx` of the tracked map is
+    /// in cacheline `idx / ENTRIES_PER_BIT`. The caller must read the tracked
+    /// map after calling this, so that writes which race with the read are
+    /// picked up on the next refresh. Reading a line which has not changed
+    /// must have no effect.
+    pub fn drain(&mut self, lines: &mut Vec<usize>) {
+        lines.clear();
+        self.current.clear();
+
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        for (idx, value) in values[0..self.words].iter().enumerate() {
+            // the BPF program sets bits with atomic operations on the shared
+            // mapping, so we must also use atomics to clear them
+            let word = unsafe { &*(value as *const u64 as *const AtomicU64) };
+
+            // most words are clear, so avoid writing to them
+            if word.load(Ordering::Relaxed) == 0 {
+                continue;
+            }
+
+            let mut bits = word.swap(0, Ordering::AcqRel);
+
+            while bits != 0 {
+                let bit = bits.trailing_zeros() as usize;
+
+                self.current.push(idx * 64 + bit);
+
+                bits &= bits - 1;
+            }
+        }
+
+        // both sets of lines are in ascending order, but may overlap
+        lines.extend_from_slice(&self.current);
+        lines.extend_from_slice(&self.drained);
+        lines.sort_unstable();
+        lines.dedup();
+
+        std::mem::swap(&mut self.drained, &mut self.current);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A direct port of `mark_dirty()` from `helpers.h`
+    fn mark_dirty(bitmap: &mut DirtyBitmap, idx: usize) {
+        let word = idx / 512;
+        let bit = 1_u64 << ((idx / 8) % 64);
+
+        let (_prefix, values, _suffix) = unsafe { bitmap.mmap.align_to_mut::<u64>() };
+
+        values[word] |= bit;
+    }
+
+    #[test]
+    fn entries() {
+        // `mark_dirty()` assumes eight entries for each bit
+        assert_eq!(ENTRIES_PER_BIT, 8);
+
+        assert_eq!(dirty_bitmap_entries(1), 1);
+        assert_eq!(dirty_bitmap_entries(ENTRIES_PER_BIT * 64), 1);
+        assert_eq!(dirty_bitmap_entries(ENTRIES_PER_BIT * 64 + 1), 2);
+    }
+
+    #[test]
+    fn drain() {
+        let entries = ENTRIES_PER_BIT * 64 * 4;
+        let mut bitmap = DirtyBitmap::anonymous(entries);
+        let mut lines = vec![usize::MAX];
+
+        // nothing is dirty, and the previous contents are cleared
+        bitmap.drain(&mut lines);
+        assert!(lines.is_empty());
+
+        // entries in the same cacheline share a bit, and lines in every word
+        // are returned in ascending order
+        for idx in [
+            entries - 1,
+            0,
+            ENTRIES_PER_BIT - 1,
+            ENTRIES_PER_BIT,
+            ENTRIES_PER_BIT * 64,
+            ENTRIES_PER_BIT * 130 + 3,
+        ] {
+            mark_dirty(&mut bitmap, idx);
+        }
+
+        bitmap.drain(&mut lines);
+        assert_eq!(lines, vec![0, 1, 64, 130, entries / ENTRIES_PER_BIT - 1]);
+
+        // the lines are returned once more, in case a write raced with the
+        // last drain, and are merged in order with the lines dirty now
+        mark_dirty(&mut bitmap, ENTRIES_PER_BIT * 3);
+        mark_dirty(&mut bitmap, ENTRIES_PER_BIT * 64);
+
+        bitmap.drain(&mut lines);
+        assert_eq!(lines, vec![0, 1, 3, 64, 130, entries / ENTRIES_PER_BIT - 1]);
+
+        // only the lines which were dirty on the last drain are returned
+        bitmap.drain(&mut lines);
+        assert_eq!(lines, vec![3, 64]);
+
+        // draining clears the bitmap
+        bitmap.drain(&mut lines);
+        assert!(lines.is_empty());
+    }
+}
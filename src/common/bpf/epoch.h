@@ -0,0 +1,90 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Shared definitions for double-buffered maps. Without this, userspace reads
+// the maps while BPF programs are still writing to them, so a refresh can see
+// one counter updated and a related counter not yet updated. A BPF program
+// which includes this header gets:
+// * an `epoch` map which holds the active buffer and the per-CPU writer counts
+// * `epoch_enter()` and `epoch_exit()` to bracket writes to the maps
+//
+// Each double-buffered map holds two buffers, one after the other, and writers
+// only ever write to the active buffer. To refresh, userspace flips the active
+// buffer and waits for the writers which may still be using the previous one
+// to leave it. The previous buffer is then quiescent, so userspace reads it,
+// zeroes it and keeps the running totals itself. In userspace the map is
+// registered with `BpfBuilder::epoch()`.
+//
+// The first cacheline of the map holds the active buffer. It is followed by one
+// cacheline for each CPU with the number of writers in each buffer, so the
+// counts never share a cacheline between CPUs.
+//
+// This must be included after `vmlinux.h`, the libbpf headers and `health.h`.
+
+#define EPOCH_MAX_CPUS 1024
+#define EPOCH_GROUP_WIDTH 8
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, (EPOCH_MAX_CPUS + 1) * EPOCH_GROUP_WIDTH);
+} epoch SEC(".maps");
+
+// Adds `delta` to the writer count for `buffer` on the current CPU. The result
+// is used so that the fetching form of the atomic is emitted, as only that form
+// is fully ordered on every architecture.
+static __always_inline int epoch_writers_add(u32 buffer, u64 delta) {
+	u32 idx = EPOCH_GROUP_WIDTH * (bpf_get_smp_processor_id() + 1) + buffer;
+	u64 *writers = bpf_map_lookup_elem(&epoch, &idx);
+
+	if (!writers) {
+		return -1;
+	}
+
+	u64 prev = __sync_fetch_and_add(writers, delta);
+	barrier_var(prev);
+
+	return 0;
+}
+
+// Returns the buffer the caller must write to, or a negative value if the event
+// must be dropped. Every call which returns a buffer must be followed by a call
+// to `epoch_exit()` with that buffer once the writes are done.
+static __always_inline int epoch_enter(void) {
+	u32 idx = 0;
+	u64 *active = bpf_map_lookup_elem(&epoch, &idx);
+
+	if (!active) {
+		return -1;
+	}
+
+	// the writer count is raised before the active buffer is read again, and
+	// userspace flips the buffer before it reads the counts, so either
+	// userspace waits for us or we see the flip. a second flip can only
+	// happen after a whole refresh, so one retry is enough in practice
+	for (int i = 0; i < 2; i++) {
+		u32 buffer = *(volatile u64 *)active & 1;
+
+		if (epoch_writers_add(buffer, 1)) {
+			return -1;
+		}
+
+		if ((*(volatile u64 *)active & 1) == buffer) {
+			return buffer;
+		}
+
+		epoch_writers_add(buffer, -1);
+	}
+
+	health_incr(HEALTH_EPOCH_BUSY);
+
+	return -1;
+}
+
+static __always_inline void epoch_exit(u32 buffer) {
+	epoch_writers_add(buffer, -1);
+}
+
+#endif //EPOCH_H
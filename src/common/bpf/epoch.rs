@@ -0,0 +1,168 @@
+use crate::common::bpf::*;
+use crate::*;
+
+use libbpf_rs::Map;
+use memmap2::MmapMut;
+
+use std::marker::PhantomData;
+use std::sync::atomic::{fence, AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+
+/// The number of buffers in each double-buffered map.
+pub(super) const EPOCH_BUFFERS: usize = 2;
+
+/// How long to wait for the writers to leave a buffer before giving up until
+/// the next refresh. Writers only hold a buffer while their BPF program runs,
+/// so this is only reached if one was preempted, such as on `PREEMPT_RT`.
+const EPOCH_GRACE_TIMEOUT: Duration = Duration::from_millis(10);
+
+/// Selects which buffer of the double-buffered maps the BPF programs write to.
+/// The map must be the `epoch` map from `epoch.h`, which holds the active
+/// buffer followed by one cacheline for each CPU with the number of writers in
+/// each buffer.
+///
+/// Each refresh flips the active buffer and waits for a grace period, until no
+/// CPU has a writer in the previous buffer. The previous buffer can then be
+/// read and zeroed without racing the BPF programs, so every counter and
+/// histogram read in that refresh covers exactly the same set of events.
+pub(super) struct Epoch<'a> {
+    _map: PhantomData<&'a Map<'a>>,
+    mmap: MmapMut,
+    cpus: usize,
+    /// The buffer which was flipped away from but has not yet been quiescent.
+    pending: Option<usize>,
+}
+
+impl<'a> Epoch<'a> {
+    pub fn new(map: &'a Map) -> Self {
+        let cpus = nr_cpus();
+        let entries = (cpus + 1) * COUNTERS_PER_CACHELINE;
+
+        let mmap = mmap_map(map, entries);
+
+        Self {
+            _map: PhantomData,
+            mmap,
+            cpus,
+            pending: None,
+        }
+    }
+
+    /// Create an `Epoch` backed by anonymous memory instead of a BPF map.
+    #[cfg(test)]
+    fn anonymous(cpus: usize) -> Self {
+        let entries = (cpus + 1) * COUNTERS_PER_CACHELINE;
+
+        Self {
+            _map: PhantomData,
+            mmap: MmapMut::map_anon(entries * std::mem::size_of::<u64>()).unwrap(),
+            cpus,
+            pending: None,
+        }
+    }
+
+    /// Flips the active buffer and returns the previous buffer once no writers
+    /// are left in it. Returns `None` if the writers did not leave within the
+    /// timeout, in which case the next call waits on the same buffer instead of
+    /// flipping again. Nothing is lost, as the buffer keeps its values until it
+    /// is read.
+    pub fn flip(&mut self) -> Option<usize> {
+        let buffer = match self.pending {
+            Some(buffer) => buffer,
+            None => {
+                let active = self.word(0);
+                let buffer = active.load(Ordering::Relaxed) as usize % EPOCH_BUFFERS;
+
+                // this must be ordered before reading the writer counts, see
+                // `epoch_enter()` in `epoch.h`
+                active.store(((buffer + 1) % EPOCH_BUFFERS) as u64, Ordering::SeqCst);
+                fence(Ordering::SeqCst);
+
+                self.pending = Some(buffer);
+
+                buffer
+            }
+        };
+
+        let deadline = Instant::now() + EPOCH_GRACE_TIMEOUT;
+
+        for cpu in 0..self.cpus {
+            let writers = self.word((cpu + 1) * COUNTERS_PER_CACHELINE + buffer);
+
+            while writers.load(Ordering::Acquire) != 0 {
+                if Instant::now() >= deadline {
+                    debug!("timed out waiting for bpf writers to leave buffer {buffer}");
+                    return None;
+                }
+
+                std::thread::yield_now();
+            }
+        }
+
+        self.pending = None;
+
+        Some(buffer)
+    }
+
+    fn word(&self, idx: usize) -> &AtomicU64 {
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        // the BPF programs update the words with atomics on the shared mapping
+        unsafe { &*(&values[idx] as *const u64 as *const AtomicU64) }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Returns the active buffer, as read by `epoch_enter()` in `epoch.h`
+    fn active(epoch: &Epoch) -> u64 {
+        epoch.word(0).load(Ordering::SeqCst)
+    }
+
+    /// Sets the number of writers a CPU has in a buffer
+    fn writers(epoch: &Epoch, cpu: usize, buffer: usize, writers: u64) {
+        epoch
+            .word((cpu + 1) * COUNTERS_PER_CACHELINE + buffer)
+            .store(writers, Ordering::SeqCst);
+    }
+
+    #[test]
+    fn flip() {
+        let mut epoch = Epoch::anonymous(4);
+
+        assert_eq!(active(&epoch), 0);
+
+        assert_eq!(epoch.flip(), Some(0));
+        assert_eq!(active(&epoch), 1);
+
+        assert_eq!(epoch.flip(), Some(1));
+        assert_eq!(active(&epoch), 0);
+    }
+
+    #[test]
+    fn flip_waits_for_writers() {
+        let mut epoch = Epoch::anonymous(4);
+
+        // writers in the newly active buffer do not hold up the flip
+        writers(&epoch, 2, 1, 1);
+        assert_eq!(epoch.flip(), Some(0));
+        writers(&epoch, 2, 1, 0);
+
+        // a writer left in the previous buffer holds it until it leaves, and
+        // the active buffer is not flipped again in the meantime
+        writers(&epoch, 3, 1, 1);
+        assert_eq!(epoch.flip(), None);
+        assert_eq!(active(&epoch), 0);
+        assert_eq!(epoch.flip(), None);
+        assert_eq!(active(&epoch), 0);
+
+        writers(&epoch, 3, 1, 0);
+        assert_eq!(epoch.flip(), Some(1));
+        assert_eq!(active(&epoch), 0);
+
+        assert_eq!(epoch.flip(), Some(0));
+        assert_eq!(active(&epoch), 1);
+    }
+}
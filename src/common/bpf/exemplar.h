@@ -0,0 +1,149 @@
+#ifndef EXEMPLAR_H
+#define EXEMPLAR_H
+
+// Shared definitions for capturing exemplars of outlier events. A BPF program
+// which includes this header gets:
+// * an `exemplars` ringbuf which passes the exemplars to userspace
+// * an `exemplar_buckets` map which holds the per-CPU rate limit state
+// * `exemplar_threshold`, set from userspace
+// * `exemplar_submit()` to record an event if it is an outlier
+//
+// An event is an outlier when its latency is at least `exemplar_threshold`
+// nanoseconds, and a threshold of zero disables capture. Each CPU may submit
+// up to `EXEMPLAR_RATE` exemplars per second, with bursts of up to
+// `EXEMPLAR_BURST`, so a storm of slow events can not flood the ringbuf. In
+// userspace the ringbuf is registered with `BpfBuilder::exemplars()`.
+//
+// This must be included after `vmlinux.h`, the libbpf headers and `health.h`.
+
+#define EXEMPLAR_COMM_LEN 16
+#define EXEMPLAR_RATE 2
+#define EXEMPLAR_BURST 8
+#define EXEMPLAR_RINGBUF_CAPACITY 65536
+
+// the token bucket credit in nanoseconds needed to submit an exemplar
+#define EXEMPLAR_COST (1000000000ULL / EXEMPLAR_RATE)
+
+// the task is not known when `pid` and `tgid` are zero
+struct exemplar {
+	u64 timestamp;
+	u64 latency;
+	u64 cgroup;
+	u32 pid;
+	u32 tgid;
+	u32 id;
+	u32 pad;
+	u8 comm[EXEMPLAR_COMM_LEN];
+};
+
+// state of the token bucket for each CPU. the credit is in nanoseconds, with
+// each exemplar costing `EXEMPLAR_COST`
+struct exemplar_bucket {
+	u64 credit;
+	u64 updated_at;
+};
+
+// the latency in nanoseconds at or above which events are captured, set from
+// userspace. zero disables capture
+const volatile u64 exemplar_threshold = 0;
+
+// dummy instance for skeleton to generate definition
+struct exemplar _exemplar = {};
+
+// ringbuf to pass exemplars to userspace
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(key_size, 0);
+	__uint(value_size, 0);
+	__uint(max_entries, EXEMPLAR_RINGBUF_CAPACITY);
+} exemplars SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct exemplar_bucket);
+} exemplar_buckets SEC(".maps");
+
+// Returns true if the current CPU may submit another exemplar, taking a token
+// from its bucket if so.
+static __always_inline bool exemplar_allowed(u64 now)
+{
+	u32 idx = 0;
+	struct exemplar_bucket *bucket = bpf_map_lookup_elem(&exemplar_buckets, &idx);
+
+	if (!bucket) {
+		return false;
+	}
+
+	u64 credit = bucket->credit + (now - bucket->updated_at);
+
+	if (credit > EXEMPLAR_COST * EXEMPLAR_BURST) {
+		credit = EXEMPLAR_COST * EXEMPLAR_BURST;
+	}
+
+	bucket->updated_at = now;
+
+	if (credit < EXEMPLAR_COST) {
+		bucket->credit = credit;
+		return false;
+	}
+
+	bucket->credit = credit - EXEMPLAR_COST;
+
+	return true;
+}
+
+// Returns true if an event with this latency should be captured, which lets
+// callers skip gathering details for events which are not outliers.
+static __always_inline bool exemplar_is_outlier(u64 latency)
+{
+	return exemplar_threshold && latency >= exemplar_threshold;
+}
+
+// Submits an exemplar for the event if its latency is above the threshold and
+// the rate limit allows. The `task` may be null when the event can not be
+// attributed to a task, and `id` identifies what the event was for, such as the
+// syscall number or the device. Returns true if the exemplar was submitted.
+static __always_inline bool exemplar_submit(struct task_struct *task, u32 id, u64 latency)
+{
+	if (!exemplar_is_outlier(latency)) {
+		return false;
+	}
+
+	u64 now = bpf_ktime_get_ns();
+
+	if (!exemplar_allowed(now)) {
+		return false;
+	}
+
+	struct exemplar *e = bpf_ringbuf_reserve(&exemplars, sizeof(*e), 0);
+
+	if (!e) {
+		health_incr(HEALTH_RINGBUF_FULL);
+		return false;
+	}
+
+	e->timestamp = now;
+	e->latency = latency;
+	e->id = id;
+	e->pad = 0;
+
+	if (task) {
+		e->pid = BPF_CORE_READ(task, pid);
+		e->tgid = BPF_CORE_READ(task, tgid);
+		e->cgroup = BPF_CORE_READ(task, cgroups, dfl_cgrp, kn, id);
+		bpf_core_read_str(&e->comm, EXEMPLAR_COMM_LEN, &task->comm);
+	} else {
+		e->pid = 0;
+		e->tgid = 0;
+		e->cgroup = 0;
+		__builtin_memset(e->comm, 0, EXEMPLAR_COMM_LEN);
+	}
+
+	bpf_ringbuf_submit(e, 0);
+
+	return true;
+}
+
+#endif //EXEMPLAR_H
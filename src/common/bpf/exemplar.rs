@@ -0,0 +1,88 @@
+use crate::common::{record_exemplar, Exemplar};
+
+use std::mem::MaybeUninit;
+use std::time::{Duration, UNIX_EPOCH};
+
+const EXEMPLAR_COMM_LEN: usize = 16;
+
+/// Matches `struct exemplar` in `exemplar.h`.
+#[repr(C)]
+#[derive(Clone, Copy)]
+struct ExemplarRecord {
+    timestamp: u64,
+    latency: u64,
+    cgroup: u64,
+    pid: u32,
+    tgid: u32,
+    id: u32,
+    pad: u32,
+    comm: [u8; EXEMPLAR_COMM_LEN],
+}
+
+unsafe impl plain::Plain for ExemplarRecord {}
+
+/// Handles the records from the `exemplars` ringbuf of a BPF program which uses
+/// `exemplar.h`, adding them to the recent exemplars.
+pub(super) struct ExemplarHandler {
+    sampler: &'static str,
+    id_label: &'static str,
+    format: fn(u32) -> String,
+    /// The offset from `CLOCK_MONOTONIC`, which the BPF timestamps use, to
+    /// `CLOCK_REALTIME`.
+    offset: Duration,
+}
+
+impl ExemplarHandler {
+    /// Create a new handler for the sampler. The `id_label` names the kind of
+    /// id in each record and `format` turns the id into a readable value.
+    pub fn new(sampler: &'static str, id_label: &'static str, format: fn(u32) -> String) -> Self {
+        let monotonic = clock_gettime(libc::CLOCK_MONOTONIC);
+        let realtime = clock_gettime(libc::CLOCK_REALTIME);
+
+        Self {
+            sampler,
+            id_label,
+            format,
+            offset: realtime.saturating_sub(monotonic),
+        }
+    }
+
+    pub fn handle(&self, data: &[u8]) -> i32 {
+        let mut record = unsafe { MaybeUninit::<ExemplarRecord>::zeroed().assume_init() };
+
+        if plain::copy_from_bytes(&mut record, data).is_err() {
+            return 0;
+        }
+
+        let comm = String::from_utf8_lossy(&record.comm)
+            .trim_end_matches(char::from(0))
+            .to_string();
+
+        record_exemplar(Exemplar {
+            sampler: self.sampler,
+            timestamp: UNIX_EPOCH + self.offset + Duration::from_nanos(record.timestamp),
+            latency: Duration::from_nanos(record.latency),
+            pid: record.pid,
+            tgid: record.tgid,
+            comm,
+            cgroup: record.cgroup,
+            id_label: self.id_label,
+            id: (self.format)(record.id),
+        });
+
+        0
+    }
+}
+
+fn clock_gettime(clock: libc::clockid_t) -> Duration {
+    let mut ts = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+
+    unsafe {
+        libc::clock_gettime(clock, &mut ts);
+    }
+
+    Duration::new(ts.tv_sec as u64, ts.tv_nsec as u32)
+}
@@ -0,0 +1,48 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <bpf/bpf_helpers.h>
+
+// Counters for events which a BPF program had to throw away. These are
+// exported by userspace as `rezolus/bpf/dropped` so that a change in a
+// distribution can be told apart from Rezolus losing events under load.
+//
+// The map is banked per-CPU in the same way as other counters, so a program
+// can increment it without atomics.
+
+// drop reasons, must match `HEALTH_REASONS` in `health.rs`
+
+// the end of an event was seen without a matching start
+#define HEALTH_MISSING_START 0
+// an entry could not be added to a map or local storage
+#define HEALTH_MAP_FULL 1
+// an index was beyond the range the maps are sized for
+#define HEALTH_OUT_OF_RANGE 2
+// a record could not be written to a ringbuf
+#define HEALTH_RINGBUF_FULL 3
+// the active bank of double-buffered maps kept changing, see `epoch.h`
+#define HEALTH_EPOCH_BUSY 4
+
+#define HEALTH_GROUP_WIDTH 8
+#define HEALTH_MAX_CPUS 1024
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HEALTH_MAX_CPUS * HEALTH_GROUP_WIDTH);
+} health SEC(".maps");
+
+static __always_inline void health_incr(u32 reason) {
+    u32 idx = HEALTH_GROUP_WIDTH * bpf_get_smp_processor_id() + reason;
+    u64 *elem;
+
+    elem = bpf_map_lookup_elem(&health, &idx);
+
+    if (elem) {
+        *elem += 1;
+    }
+}
+
+#endif //HEALTH_H
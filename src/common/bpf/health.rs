@@ -0,0 +1,90 @@
+use crate::common::bpf::counters::CounterMap;
+use crate::common::bpf::*;
+use crate::common::CounterGroup;
+use crate::*;
+
+use libbpf_rs::Map;
+use metriken::metric;
+
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+/// The reasons a BPF program may drop an event, in the same order as the
+/// `HEALTH_*` defines in `health.h`.
+pub(super) const HEALTH_REASONS: &[&str] = &[
+    "missing_start",
+    "map_full",
+    "out_of_range",
+    "ringbuf_full",
+    "epoch_busy",
+];
+
+/// The maximum number of BPF samplers which can export health counters.
+const MAX_HEALTH_SAMPLERS: usize = 32;
+
+/// The next unused slot in the `rezolus/bpf/dropped` counters.
+static NEXT_SLOT: AtomicUsize = AtomicUsize::new(0);
+
+#[metric(
+    name = "rezolus/bpf/dropped",
+    description = "The number of events which BPF programs were unable to record, by sampler and reason"
+)]
+pub static BPF_DROPPED: CounterGroup =
+    CounterGroup::new(MAX_HEALTH_SAMPLERS * HEALTH_REASONS.len());
+
+/// Tracks the drop counters for a BPF sampler. The BPF program must include
+/// `health.h` and increment the `health` map with `health_incr()`. Each sampler
+/// is given its own set of entries in `rezolus/bpf/dropped`, one for each drop
+/// reason.
+pub struct HealthCounters<'a> {
+    counter_map: CounterMap<'a>,
+    offset: usize,
+    values: Vec<u64>,
+}
+
+impl<'a> HealthCounters<'a> {
+    pub fn new(map: &'a Map, sampler: &'static str) -> Option<Self> {
+        let slot = NEXT_SLOT.fetch_add(1, Ordering::Relaxed);
+
+        if slot >= MAX_HEALTH_SAMPLERS {
+            debug!("{sampler} has no room to export BPF health counters");
+            return None;
+        }
+
+        let counter_map = CounterMap::new(map, HEALTH_REASONS.len()).ok()?;
+
+        let offset = slot * HEALTH_REASONS.len();
+
+        for (idx, reason) in HEALTH_REASONS.iter().enumerate() {
+            BPF_DROPPED.insert_metadata(
+                offset + idx,
+                "name".to_string(),
+                format!("{sampler}/{reason}"),
+            );
+            BPF_DROPPED.insert_metadata(offset + idx, "sampler".to_string(), sampler.to_string());
+            BPF_DROPPED.insert_metadata(offset + idx, "reason".to_string(), reason.to_string());
+        }
+
+        Some(Self {
+            counter_map,
+            offset,
+            values: vec![0; HEALTH_REASONS.len()],
+        })
+    }
+
+    pub fn refresh(&mut self) {
+        self.values.fill(0);
+
+        let bank_width = self.counter_map.bank_width();
+        let counters = self.counter_map.values();
+
+        for cpu in 0..self.counter_map.cpus() {
+            for (idx, value) in self.values.iter_mut().enumerate() {
+                *value = value.wrapping_add(counters[idx + cpu * bank_width]);
+            }
+        }
+
+        for (idx, value) in self.values.iter().enumerate() {
+            let _ = BPF_DROPPED.set(self.offset + idx, *value);
+        }
+    }
+}
@@ -19,3 +19,108 @@ static __always_inline void histogram_incr(void *array, u8 grouping_power, u64 v
     u32 idx = value_to_index(value, grouping_power);
     array_add(array, idx, 1);
 }
+
+// Increments a 2-D histogram (heatmap). The map holds one bank of buckets for
+// each row, with each bank padded to `bank_width` entries. The `row` is usually
+// found with `value_to_row()`.
+static __always_inline void heatmap_incr(void *array, u32 row, u32 bank_width, u8 grouping_power, u64 value) {
+    u32 idx = bank_width * row + value_to_index(value, grouping_power);
+    array_incr(array, idx);
+}
+
+// Adds to an element of a CPU-banked array. The caller must ensure that the
+// index falls within the bank for the current CPU. Since a bank is only ever
+// written from its own CPU, a plain add is used instead of an atomic.
+static __always_inline void percpu_add(void *array, u32 idx, u64 value) {
+    u64 *elem;
+
+    elem = bpf_map_lookup_elem(array, &idx);
+
+    if (elem) {
+        *elem += value;
+    }
+}
+
+static __always_inline void percpu_incr(void *array, u32 idx) {
+    percpu_add(array, idx, 1);
+}
+
+// Increments a per-CPU histogram. The map must hold one bank of buckets per
+// CPU, with each bank padded to `HISTOGRAM_BANK_WIDTH(buckets)` entries so that
+// no cachelines are shared between CPUs.
+static __always_inline void histogram_incr_percpu(void *array, u32 bank_width, u8 grouping_power, u64 value) {
+    u32 idx = bank_width * bpf_get_smp_processor_id() + value_to_index(value, grouping_power);
+    percpu_incr(array, idx);
+}
+
+// Dirty tracking lets userspace skip the parts of a large map which have not
+// changed since it was last read. The bitmap is a separate mmapable array of
+// u64 with one bit for each cacheline (8 entries) of the map, so it needs
+// `DIRTY_BITMAP_ENTRIES(entries)` entries. Every write to the map must also
+// mark the cacheline dirty, and userspace clears the bits as it reads the map.
+// The bitmap is registered with `BpfBuilder::dirty_bitmap()`.
+#define DIRTY_BITMAP_ENTRIES(entries) (((entries) + 511) / 512)
+
+// Marks the cacheline holding `idx` as dirty. The bit is checked first so that
+// the bitmap is only written to once per cacheline between reads, which keeps
+// CPUs from contending on it. This must happen after the map is written. There
+// is no barrier between the write and the check, so they may be reordered and
+// a write which races with userspace clearing the bit can find it still set.
+// Userspace reads each cacheline again on the refresh after it was dirty to
+// pick up such writes, see `DirtyBitmap::drain()`.
+static __always_inline void mark_dirty(void *bitmap, u32 idx) {
+    u32 word = idx / 512;
+    u64 bit = 1ULL << ((idx / 8) % 64);
+    u64 *elem;
+
+    elem = bpf_map_lookup_elem(bitmap, &word);
+
+    if (elem && !(*elem & bit)) {
+        __atomic_fetch_or(elem, bit, __ATOMIC_RELAXED);
+    }
+}
+
+static __always_inline void array_add_dirty(void *array, void *bitmap, u32 idx, u64 value) {
+    array_add(array, idx, value);
+    mark_dirty(bitmap, idx);
+}
+
+static __always_inline void array_incr_dirty(void *array, void *bitmap, u32 idx) {
+    array_add_dirty(array, bitmap, idx, 1);
+}
+
+// Increments a per-CPU histogram and marks the bucket dirty. See
+// `histogram_incr_percpu()`.
+static __always_inline void histogram_incr_percpu_dirty(void *array, void *bitmap, u32 bank_width, u8 grouping_power, u64 value) {
+    u32 idx = bank_width * bpf_get_smp_processor_id() + value_to_index(value, grouping_power);
+    percpu_incr(array, idx);
+    mark_dirty(bitmap, idx);
+}
+
+// Returns true if the current event should be recorded when sampling 1-in-N
+// events on each CPU. The `state` must be a `BPF_MAP_TYPE_PERCPU_ARRAY` with a
+// single u64 entry which is used as a per-CPU countdown. When `rate` is a
+// read-only constant of 1, the verifier removes the lookup entirely.
+static __always_inline bool sample_event(void *state, u32 rate) {
+    u32 idx = 0;
+    u64 *remaining;
+
+    if (rate <= 1) {
+        return true;
+    }
+
+    remaining = bpf_map_lookup_elem(state, &idx);
+
+    if (!remaining) {
+        return false;
+    }
+
+    if (*remaining) {
+        *remaining -= 1;
+        return false;
+    }
+
+    *remaining = rate - 1;
+
+    return true;
+}
@@ -7,206 +7,49 @@
 #define HISTOGRAM_BUCKETS_POW_6 3776
 #define HISTOGRAM_BUCKETS_POW_7 7424
 
+// Per-CPU histograms pad each CPU's bank of buckets out to a whole number of
+// cachelines so that no two CPUs write to the same cacheline.
+#define HISTOGRAM_BANK_WIDTH(buckets) ((((buckets) + 7) / 8) * 8)
+
+// Returns the number of buckets for the grouping power, which matches the
+// `HISTOGRAM_BUCKETS_POW_*` definitions above. Programs which take their
+// grouping power from read-only data use this, and `histogram_bank_width()`,
+// in place of the definitions. Since read-only data is frozen before the
+// program is verified, the verifier treats the result as a constant.
+static __always_inline u32 histogram_buckets(u8 grouping_power) {
+    return (65 - grouping_power) << grouping_power;
+}
+
+static __always_inline u32 histogram_bank_width(u8 grouping_power) {
+    return HISTOGRAM_BANK_WIDTH(histogram_buckets(grouping_power));
+}
+
 // Function to count leading zeros, since we cannot use the builtin CLZ from
-// within BPF. But since we also can't loop, this is implemented as a binary
-// search with a maximum of 6 branches. 
-static u32 clz(u64 value) {
-    u32 count = 0;
+// within BPF. This is implemented without any branches so that it is cheap for
+// the verifier and does not suffer from branch mispredictions. All bits below
+// the most significant set bit are first set by smearing the value to the
+// right. The leading zeros are then whatever remains after a SWAR popcount of
+// the smeared value.
+//
+// NOTE: the BPF instruction set (as of v4) has no count leading zeros
+// instruction for clang to lower `__builtin_clzll()` to, so there is no faster
+// variant to select at load time.
+static __always_inline u32 clz(u64 value) {
+    // smear the most significant set bit into all lower bits
+    value |= value >> 1;
+    value |= value >> 2;
+    value |= value >> 4;
+    value |= value >> 8;
+    value |= value >> 16;
+    value |= value >> 32;
 
-    // binary search to find number of leading zeros
-    if (value & 0xFFFFFFFF00000000) {
-        if (value & 0xFFFF000000000000) {
-            if (value & 0xFF00000000000000) {
-                if (value & 0xF000000000000000) {
-                    if (value & 0xC000000000000000) {
-                        if (value & 0x8000000000000000) {
-                            return 0;
-                        } else {
-                            return 1;
-                        }
-                    } else if (value & 0x2000000000000000) {
-                        return 2;
-                    } else {
-                        return 3;
-                    }
-                } else if (value & 0x0C00000000000000) {
-                    if (value & 0x0800000000000000) {
-                        return 4;
-                    } else {
-                        return 5;
-                    }
-                } else if (value & 0x0200000000000000) {
-                    return 6;
-                } else {
-                    return 7;
-                }
-            } else if (value & 0x00F0000000000000) {
-                if (value & 0x00C0000000000000) {
-                    if (value & 0x0080000000000000) {
-                        return 8;
-                    } else {
-                        return 9;
-                    }
-                } else if (value & 0x0020000000000000) {
-                    return 10;
-                } else {
-                    return 11;
-                }
-            } else if (value & 0x000C000000000000) {
-                if (value & 0x0008000000000000) {
-                    return 12;
-                } else {
-                    return 13;
-                }
-            } else if (value & 0x0002000000000000) {
-                return 14;
-            } else {
-                return 15;
-            }
-        } else if (value & 0x0000FF0000000000) {
-            if (value & 0x0000F00000000000) {
-                if (value & 0x0000C00000000000) {
-                    if (value & 0x0000800000000000) {
-                        return 16;
-                    } else {
-                        return 17;
-                    }
-                } else if (value & 0x0000200000000000) {
-                    return 18;
-                } else {
-                    return 19;
-                }
-            } else if (value & 0x00000C0000000000) {
-                if (value & 0x0000080000000000) {
-                    return 20;
-                } else {
-                    return 21;
-                }
-            } else if (value & 0x0000020000000000) {
-                return 22;
-            } else {
-                return 23;
-            }
-        } else if (value & 0x000000F000000000) {
-            if (value & 0x000000C000000000) {
-                if (value & 0x0000008000000000) {
-                    return 24;
-                } else {
-                    return 25;
-                }
-            } else if (value & 0x0000002000000000) {
-                return 26;
-            } else {
-                return 27;
-            }
-        } else if (value & 0x0000000C00000000) {
-            if (value & 0x0000000800000000) {
-                return 28;
-            } else {
-                return 29;
-            }
-        } else if (value & 0x0000000200000000) {
-            return 30;
-        } else {
-            return 31;
-        }
-    } else if (value & 0x00000000FFFF0000) {
-        if (value & 0x00000000FF000000) {
-            if (value & 0x00000000F0000000) {
-                if (value & 0x00000000C0000000) {
-                    if (value & 0x0000000080000000) {
-                        return 32;
-                    } else {
-                        return 33;
-                    }
-                } else if (value & 0x0000000020000000) {
-                    return 34;
-                } else {
-                    return 35;
-                }
-            } else if (value & 0x000000000C000000) {
-                if (value & 0x0000000008000000) {
-                    return 36;
-                } else {
-                    return 37;
-                }
-            } else if (value & 0x0000000002000000) {
-                return 38;
-            } else {
-                return 39;
-            }
-        } else if (value & 0x0000000000F00000) {
-            if (value & 0x0000000000C00000) {
-                if (value & 0x0000000000800000) {
-                    return 40;
-                } else {
-                    return 41;
-                }
-            } else if (value & 0x0000000000200000) {
-                return 42;
-            } else {
-                return 43;
-            } 
-        } else if (value & 0x00000000000C0000) {
-            if (value & 0x0000000000080000) {
-                return 44;
-            } else {
-                return 45;
-            }
-        } else if (value & 0x0000000000020000) {
-            return 46;
-        } else {
-            return 47;
-        }
-    } else if (value & 0x000000000000FF00) {
-        if (value & 0x000000000000F000) {
-            if (value & 0x000000000000C000) {
-                if (value & 0x0000000000008000) {
-                    return 48;
-                } else {
-                    return 49;
-                }
-            } else if (value & 0x000000000002000) {
-                return 50;
-            } else {
-                return 51;
-            }
-        } else if (value & 0x0000000000000C00) {
-            if (value & 0x0000000000000800) {
-                return 52;
-            } else {
-                return 53;
-            }
-        } else if (value & 0x0000000000000200) {
-            return 54;
-        } else {
-            return 55;
-        }
-    } else if (value & 0x00000000000000F0) {
-        if (value & 0x00000000000000C0) {
-            if (value & 0x0000000000000080) {
-                return 56;
-            } else {
-                return 57;
-            }
-        } else if (value & 0x0000000000000020) {
-            return 58;
-        } else {
-            return 59;
-        }
-    } else if (value & 0x000000000000000C) {
-        if (value & 0x0000000000000008) {
-            return 60;
-        } else {
-            return 61;
-        }
-    } else if (value & 0x0000000000000002) {
-        return 62;
-    } else {
-        return 63;
-    }
+    // popcount
+    value = value - ((value >> 1) & 0x5555555555555555);
+    value = (value & 0x3333333333333333) + ((value >> 2) & 0x3333333333333333);
+    value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    value = (value * 0x0101010101010101) >> 56;
 
-    return 64;
+    return 64 - value;
 }
 
 // base-2 histogram indexing function that is compatible with Rust `histogram`
@@ -214,14 +57,35 @@ static u32 clz(u64 value) {
 //
 // See the indexing logic here:
 // https://github.com/pelikan-io/rustcommon/blob/main/histogram/src/config.rs
-static u32 value_to_index(u64 value, u8 grouping_power) {
+static __always_inline u32 value_to_index(u64 value, u8 grouping_power) {
     if (value < (2 << grouping_power)) {
         return value;
     } else {
         u64 power = 63 - clz(value);
         u64 bin = power - grouping_power + 1;
-        u64 offset = (value - (1 << power)) >> (power - grouping_power);
+
+        // the offset within the bin is taken from the bits immediately below
+        // the most significant bit, shifting down first avoids overflowing the
+        // shift for large values
+        u64 offset = (value >> (power - grouping_power)) - (1 << grouping_power);
 
         return (bin * (1 << grouping_power) + offset);
     }
 }
+
+// Returns the row of a 2-D histogram (heatmap) for `value`. Rows are powers of
+// two: row 0 holds values up to `2^min_power`, row N holds values in
+// `(2^(min_power + N - 1), 2^(min_power + N)]`, and the last of the `rows` also
+// holds every larger value. Each row is a full histogram, indexed with
+// `value_to_index()`, so a heatmap is a coarse split of one distribution by a
+// second value. See `heatmap_incr()` in `helpers.h`.
+static __always_inline u32 value_to_row(u64 value, u8 min_power, u32 rows) {
+    if (value <= (1ULL << min_power)) {
+        return 0;
+    }
+
+    // the smallest power of two which is at least the value
+    u32 row = 64 - clz(value - 1) - min_power;
+
+    return row < rows ? row : rows - 1;
+}
@@ -1,10 +1,10 @@
+use crate::common::bpf::dirty::{DirtyBitmap, ENTRIES_PER_BIT};
 use crate::common::bpf::*;
+use crate::common::HistogramGroup;
 use crate::*;
 
 use metriken::RwLockHistogram;
 
-use std::os::fd::{AsFd, AsRawFd, FromRawFd};
-
 /// Represents a histogram in a BPF map. The distribution must be created
 /// with:
 ///
@@ -24,47 +24,1055 @@ use std::os::fd::{AsFd, AsRawFd, FromRawFd};
 /// 60KB in kernel space and an additional 60KB in user space.
 ///
 /// The distribution should be given some meaningful name in the BPF program.
+///
+/// The BPF histogram uses the `grouping_power` it was loaded with, see
+/// `Rebucket` for how it is mapped onto the userspace histogram.
+///
+/// If the BPF program only records 1-in-N events, the `scale` should be set to
+/// `N` so that the bucket counts are scaled back up.
+///
+/// If a `dirty` bitmap is provided, the histogram is only updated when some
+/// bucket has changed. See `DirtyBitmap`.
+///
+/// When there is more than one buffer, the map holds the buckets for each
+/// buffer one after the other, with the BPF program writing to the buffer
+/// returned by `epoch_enter()` from `epoch.h`. The buckets in the map are then
+/// the counts since the buffer was last read, and the totals are kept in
+/// userspace. See `Epoch`.
 pub struct Histogram<'a> {
     _map: &'a libbpf_rs::Map<'a>,
     mmap: memmap2::MmapMut,
     buckets: usize,
     histogram: &'static RwLockHistogram,
+    rebucket: Option<Rebucket>,
+    scale: u64,
+    scaled: Vec<u64>,
+    dirty: Option<DirtyBitmap<'a>>,
+    lines: Vec<usize>,
+    totals: Vec<u64>,
 }
 
 impl<'a> Histogram<'a> {
-    pub fn new(map: &'a libbpf_rs::Map, histogram: &'static RwLockHistogram) -> Self {
-        let buckets = histogram.config().total_buckets();
-
-        let mmap_len = whole_pages::<u64>(buckets) * PAGE_SIZE;
-
-        let fd = map.as_fd().as_raw_fd();
-        let file = unsafe { std::fs::File::from_raw_fd(fd as _) };
-        let mmap = unsafe {
-            memmap2::MmapOptions::new()
-                .len(mmap_len)
-                .map_mut(&file)
-                .expect("failed to mmap() bpf distribution")
+    pub fn new(
+        map: &'a libbpf_rs::Map,
+        histogram: &'static RwLockHistogram,
+        grouping_power: u8,
+        scale: u64,
+        dirty: Option<&'a libbpf_rs::Map>,
+        buffers: usize,
+    ) -> Self {
+        let buckets = histogram_buckets(grouping_power);
+
+        let mmap = mmap_map(map, buckets * buffers);
+
+        Self {
+            _map: map,
+            mmap,
+            buckets,
+            histogram,
+            rebucket: Rebucket::new(grouping_power, histogram.config().grouping_power()),
+            scale,
+            scaled: Vec::with_capacity(buckets),
+            dirty: dirty.map(|dirty| DirtyBitmap::new(dirty, buckets)),
+            lines: Vec::new(),
+            totals: if buffers > 1 {
+                vec![0; buckets]
+            } else {
+                Vec::new()
+            },
+        }
+    }
+
+    pub fn refresh(&mut self) {
+        if let Some(ref mut dirty) = self.dirty {
+            dirty.drain(&mut self.lines);
+
+            if self.lines.is_empty() {
+                return;
+            }
+        }
+
+        let (_prefix, buckets, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        Self::update(
+            self.histogram,
+            &mut self.rebucket,
+            self.scale,
+            &mut self.scaled,
+            &buckets[0..self.buckets],
+        );
+    }
+
+    /// Refreshes a double-buffered histogram by adding the buckets in the
+    /// quiescent `buffer` to the totals and zeroing them.
+    pub fn refresh_buffer(&mut self, buffer: usize) {
+        let (_prefix, buckets, _suffix) = unsafe { self.mmap.align_to_mut::<u64>() };
+        let start = buffer * self.buckets;
+
+        for (total, bucket) in self
+            .totals
+            .iter_mut()
+            .zip(buckets[start..(start + self.buckets)].iter_mut())
+        {
+            if *bucket != 0 {
+                *total = total.wrapping_add(*bucket);
+                *bucket = 0;
+            }
+        }
+
+        Self::update(
+            self.histogram,
+            &mut self.rebucket,
+            self.scale,
+            &mut self.scaled,
+            &self.totals,
+        );
+    }
+
+    /// Updates the userspace histogram from the BPF buckets. This takes the
+    /// fields it needs so that the buckets can be borrowed from `self`.
+    fn update(
+        histogram: &RwLockHistogram,
+        rebucket: &mut Option<Rebucket>,
+        scale: u64,
+        scaled: &mut Vec<u64>,
+        buckets: &[u64],
+    ) {
+        if let Some(ref mut rebucket) = rebucket {
+            let _ = histogram.update_from(rebucket.apply(buckets, scale));
+        } else if scale > 1 {
+            scaled.clear();
+            scaled.extend(buckets.iter().map(|v| v.wrapping_mul(scale)));
+
+            let _ = histogram.update_from(scaled);
+        } else {
+            let _ = histogram.update_from(buckets);
+        }
+    }
+}
+
+/// Represents a histogram in a BPF map where each CPU has its own bank of
+/// buckets. The distribution must be created with:
+///
+/// ```c
+/// struct {
+///     __uint(type, BPF_MAP_TYPE_ARRAY);
+///     __uint(map_flags, BPF_F_MMAPABLE);
+///     __type(key, u32);
+///     __type(value, u64);
+///     __uint(max_entries, MAX_CPUS * HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS));
+/// } some_distribution_name SEC(".maps");
+/// ```
+///
+/// And must be incremented using the `histogram_incr_percpu` helper from
+/// `helpers.h`. Each bank is padded to a whole number of cachelines so that
+/// CPUs never contend on the same cacheline. The banks are summed together on
+/// each refresh to produce the combined distribution. Optionally, the per-CPU
+/// distributions can also be exported as a `HistogramGroup`, which must have
+/// the same `grouping_power` as the BPF histogram. The combined distribution is
+/// mapped onto the userspace histogram with `Rebucket`.
+///
+/// If the BPF program only records 1-in-N events, the `scale` should be set to
+/// `N` so that the bucket counts are scaled back up.
+///
+/// If a `dirty` bitmap is provided, only the cachelines which changed are read
+/// and the combined distribution is kept up to date from the change in each of
+/// those buckets. A copy of the bank is kept for each CPU which has recorded
+/// any events. See `DirtyBitmap`.
+pub struct PercpuHistogram<'a> {
+    _map: &'a libbpf_rs::Map<'a>,
+    mmap: memmap2::MmapMut,
+    buckets: usize,
+    bank_width: usize,
+    histogram: &'static RwLockHistogram,
+    percpu: Option<&'static HistogramGroup>,
+    rebucket: Option<Rebucket>,
+    scale: u64,
+    totals: Vec<u64>,
+    scaled: Vec<u64>,
+    dirty: Option<DirtyBitmap<'a>>,
+    lines: Vec<usize>,
+    previous: Vec<Vec<u64>>,
+    cpus: usize,
+}
+
+impl<'a> PercpuHistogram<'a> {
+    pub fn new(
+        map: &'a libbpf_rs::Map,
+        histogram: &'static RwLockHistogram,
+        percpu: Option<&'static HistogramGroup>,
+        grouping_power: u8,
+        scale: u64,
+        dirty: Option<&'a libbpf_rs::Map>,
+    ) -> Self {
+        let buckets = histogram_buckets(grouping_power);
+
+        // each CPU has its own bank of buckets, this bank is the next nearest
+        // whole number of cachelines wide
+        let bank_width = histogram_bank_width(buckets);
+
+        // the map is sized for the CPUs on this host before it is loaded
+        let cpus = nr_cpus();
+
+        let mmap = mmap_map(map, bank_width * cpus);
+
+        Self {
+            _map: map,
+            mmap,
+            buckets,
+            bank_width,
+            histogram,
+            percpu,
+            rebucket: Rebucket::new(grouping_power, histogram.config().grouping_power()),
+            scale,
+            totals: vec![0; buckets],
+            scaled: Vec::with_capacity(buckets),
+            dirty: dirty.map(|dirty| DirtyBitmap::new(dirty, bank_width * cpus)),
+            lines: Vec::new(),
+            previous: vec![Vec::new(); cpus],
+            cpus,
+        }
+    }
+
+    pub fn refresh(&mut self) {
+        if self.dirty.is_some() {
+            self.refresh_dirty();
+            return;
+        }
+
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        self.totals.fill(0);
+
+        for cpu in 0..self.cpus {
+            let start = cpu * self.bank_width;
+            let bank = &values[start..(start + self.buckets)];
+
+            let mut nonzero = false;
+
+            for (total, value) in self.totals.iter_mut().zip(bank.iter()) {
+                if *value != 0 {
+                    *total = total.wrapping_add(value.wrapping_mul(self.scale));
+                    nonzero = true;
+                }
+            }
+
+            if nonzero {
+                if let Some(percpu) = self.percpu {
+                    if self.scale > 1 {
+                        self.scaled.clear();
+                        self.scaled
+                            .extend(bank.iter().map(|v| v.wrapping_mul(self.scale)));
+
+                        let _ = percpu.update_from(cpu, &self.scaled);
+                    } else {
+                        let _ = percpu.update_from(cpu, bank);
+                    }
+                }
+            }
+        }
+
+        self.update_totals();
+    }
+
+    fn refresh_dirty(&mut self) {
+        if let Some(ref mut dirty) = self.dirty {
+            dirty.drain(&mut self.lines);
+        }
+
+        if self.lines.is_empty() {
+            return;
+        }
+
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        let mut changed = None;
+
+        for line in self.lines.iter() {
+            let start = line * ENTRIES_PER_BIT;
+            let cpu = start / self.bank_width;
+
+            if cpu >= self.cpus {
+                continue;
+            }
+
+            let previous = &mut self.previous[cpu];
+
+            if previous.is_empty() {
+                previous.resize(self.buckets, 0);
+            }
+
+            // cachelines never span banks, but the last one may hold padding
+            let offset = start - cpu * self.bank_width;
+            let end = (offset + ENTRIES_PER_BIT).min(self.buckets);
+
+            for bucket in offset..end {
+                let value = values[start + bucket - offset];
+                let delta = value.wrapping_sub(previous[bucket]);
+
+                self.totals[bucket] =
+                    self.totals[bucket].wrapping_add(delta.wrapping_mul(self.scale));
+                previous[bucket] = value;
+            }
+
+            // lines are in ascending order, so each CPU is only updated once
+            // after all of its lines have been read
+            if let (Some(percpu), Some(last)) = (self.percpu, changed) {
+                if last != cpu {
+                    Self::update_percpu(percpu, last, &self.previous, self.scale, &mut self.scaled);
+                }
+            }
+
+            changed = Some(cpu);
+        }
+
+        if let (Some(percpu), Some(cpu)) = (self.percpu, changed) {
+            Self::update_percpu(percpu, cpu, &self.previous, self.scale, &mut self.scaled);
+        }
+
+        self.update_totals();
+    }
+
+    fn update_totals(&mut self) {
+        // the totals are already scaled
+        if let Some(ref mut rebucket) = self.rebucket {
+            let _ = self.histogram.update_from(rebucket.apply(&self.totals, 1));
+        } else {
+            let _ = self.histogram.update_from(&self.totals);
+        }
+    }
+
+    fn update_percpu(
+        percpu: &HistogramGroup,
+        cpu: usize,
+        previous: &[Vec<u64>],
+        scale: u64,
+        scaled: &mut Vec<u64>,
+    ) {
+        let bank = &previous[cpu];
+
+        if scale > 1 {
+            scaled.clear();
+            scaled.extend(bank.iter().map(|v| v.wrapping_mul(scale)));
+
+            let _ = percpu.update_from(cpu, scaled);
+        } else {
+            let _ = percpu.update_from(cpu, bank);
+        }
+    }
+}
+
+/// Represents a set of histograms in a single BPF map where each CPU has its
+/// own bank of buckets for each of the histograms. The map is laid out as
+/// `[cpu][row][bucket]` and must be created with:
+///
+/// ```c
+/// struct {
+///     __uint(type, BPF_MAP_TYPE_ARRAY);
+///     __uint(map_flags, BPF_F_MMAPABLE);
+///     __type(key, u32);
+///     __type(value, u64);
+///     __uint(max_entries, MAX_CPUS * ROWS * HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS));
+/// } some_distribution_name SEC(".maps");
+/// ```
+///
+/// The index of a bucket is `(cpu * ROWS + row) * HISTOGRAM_BANK_WIDTH() +
+/// value_to_index()`. The number of rows is the number of userspace histograms
+/// and all of them must share the same configuration. Since the number of
+/// rows is only known to userspace, the map is resized to match before the
+/// program is loaded. The BPF histograms use the `grouping_power` they were
+/// loaded with and are mapped onto the userspace histograms with `Rebucket`.
+///
+/// If the BPF program only records 1-in-N events, the `scale` should be set to
+/// `N` so that the bucket counts are scaled back up.
+pub struct PercpuHistogramArray<'a> {
+    _map: &'a libbpf_rs::Map<'a>,
+    mmap: memmap2::MmapMut,
+    buckets: usize,
+    bank_width: usize,
+    histograms: Vec<&'static RwLockHistogram>,
+    rebucket: Option<Rebucket>,
+    scale: u64,
+    totals: Vec<Vec<u64>>,
+    cpus: usize,
+}
+
+impl<'a> PercpuHistogramArray<'a> {
+    pub fn new(
+        map: &'a libbpf_rs::Map,
+        histograms: Vec<&'static RwLockHistogram>,
+        grouping_power: u8,
+        scale: u64,
+    ) -> Self {
+        let config = histograms.first().map(|h| h.config());
+
+        if histograms
+            .iter()
+            .any(|h| Some(h.config().total_buckets()) != config.map(|c| c.total_buckets()))
+        {
+            error!("histograms in a histogram array must share the same config");
+            panic!();
+        }
+
+        let buckets = if histograms.is_empty() {
+            0
+        } else {
+            histogram_buckets(grouping_power)
         };
 
-        // check the alignment
-        let (_prefix, data, _suffix) = unsafe { mmap.align_to::<u64>() };
-        let expected_len = mmap_len / std::mem::size_of::<u64>();
+        let bank_width = histogram_bank_width(buckets);
+
+        // the map is sized for the CPUs on this host before it is loaded
+        let cpus = nr_cpus();
+
+        let mmap = mmap_map(map, bank_width * histograms.len() * cpus);
+
+        let totals = vec![vec![0; buckets]; histograms.len()];
+
+        Self {
+            _map: map,
+            mmap,
+            buckets,
+            bank_width,
+            histograms,
+            rebucket: config
+                .and_then(|config| Rebucket::new(grouping_power, config.grouping_power())),
+            scale,
+            totals,
+            cpus,
+        }
+    }
+
+    pub fn refresh(&mut self) {
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        let rows = self.histograms.len();
+
+        for totals in self.totals.iter_mut() {
+            totals.fill(0);
+        }
+
+        for cpu in 0..self.cpus {
+            for (row, totals) in self.totals.iter_mut().enumerate() {
+                let start = (cpu * rows + row) * self.bank_width;
+                let bank = &values[start..(start + self.buckets)];
+
+                for (total, value) in totals.iter_mut().zip(bank.iter()) {
+                    if *value != 0 {
+                        *total = total.wrapping_add(value.wrapping_mul(self.scale));
+                    }
+                }
+            }
+        }
+
+        for (histogram, totals) in self.histograms.iter().zip(self.totals.iter()) {
+            // the totals are already scaled
+            if let Some(ref mut rebucket) = self.rebucket {
+                let _ = histogram.update_from(rebucket.apply(totals, 1));
+            } else {
+                let _ = histogram.update_from(totals);
+            }
+        }
+    }
+}
+
+/// Represents a set of histograms in a single BPF map where each entry of a
+/// `HistogramGroup` has its own bank of buckets. The map is laid out as
+/// `[entry][bucket]` and must be created with:
+///
+/// ```c
+/// struct {
+///     __uint(type, BPF_MAP_TYPE_ARRAY);
+///     __uint(map_flags, BPF_F_MMAPABLE);
+///     __type(key, u32);
+///     __type(value, u64);
+///     __uint(max_entries, ENTRIES * HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS));
+/// } some_distribution_name SEC(".maps");
+/// ```
+///
+/// The index of a bucket is `entry * HISTOGRAM_BANK_WIDTH() +
+/// value_to_index()`. Entries which have never been incremented, or whose bank
+/// has been zeroed by the BPF program, are not exported.
+///
+/// If the BPF program only records 1-in-N events, the `scale` should be set to
+/// `N` so that the bucket counts are scaled back up.
+///
+/// If a `dirty` bitmap is provided, only the entries which have changed are
+/// read and updated. See `DirtyBitmap`.
+pub struct HistogramGroupMap<'a> {
+    _map: &'a libbpf_rs::Map<'a>,
+    mmap: memmap2::MmapMut,
+    buckets: usize,
+    bank_width: usize,
+    group: &'static HistogramGroup,
+    scale: u64,
+    scaled: Vec<u64>,
+    dirty: Option<DirtyBitmap<'a>>,
+    lines: Vec<usize>,
+}
+
+impl<'a> HistogramGroupMap<'a> {
+    pub fn new(
+        map: &'a libbpf_rs::Map,
+        group: &'static HistogramGroup,
+        scale: u64,
+        dirty: Option<&'a libbpf_rs::Map>,
+    ) -> Self {
+        let buckets = group.total_buckets();
+
+        let bank_width = histogram_bank_width(buckets);
+
+        let mmap = mmap_map(map, bank_width * group.len());
+
+        Self {
+            _map: map,
+            mmap,
+            buckets,
+            bank_width,
+            group,
+            scale,
+            scaled: Vec::with_capacity(buckets),
+            dirty: dirty.map(|dirty| DirtyBitmap::new(dirty, bank_width * group.len())),
+            lines: Vec::new(),
+        }
+    }
+
+    pub fn refresh(&mut self) {
+        if let Some(ref mut dirty) = self.dirty {
+            dirty.drain(&mut self.lines);
+
+            // lines are in ascending order, so each entry only appears once
+            let mut last = None;
 
-        if data.len() != expected_len {
-            error!("mmap region not aligned or width doesn't match");
+            for idx in 0..self.lines.len() {
+                let entry = self.lines[idx] * ENTRIES_PER_BIT / self.bank_width;
+
+                if last != Some(entry) && entry < self.group.len() {
+                    self.update(entry);
+                }
+
+                last = Some(entry);
+            }
+
+            return;
+        }
+
+        for entry in 0..self.group.len() {
+            self.update(entry);
+        }
+    }
+
+    fn update(&mut self, entry: usize) {
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        let start = entry * self.bank_width;
+        let bank = &values[start..(start + self.buckets)];
+
+        // the BPF program zeroes the bank when the entry is reused
+        if bank.iter().all(|v| *v == 0) {
+            self.group.clear(entry);
+            return;
+        }
+
+        if self.scale > 1 {
+            self.scaled.clear();
+            self.scaled
+                .extend(bank.iter().map(|v| v.wrapping_mul(self.scale)));
+
+            let _ = self.group.update_from(entry, &self.scaled);
+        } else {
+            let _ = self.group.update_from(entry, bank);
+        }
+    }
+}
+
+/// Represents a set of histograms in a single BPF map where each CPU has its
+/// own bank of buckets for each entry of a `HistogramGroup`. The map is laid
+/// out as `[cpu][entry][bucket]` and must be created with:
+///
+/// ```c
+/// struct {
+///     __uint(type, BPF_MAP_TYPE_ARRAY);
+///     __uint(map_flags, BPF_F_MMAPABLE);
+///     __type(key, u32);
+///     __type(value, u64);
+///     __uint(max_entries, MAX_CPUS * ENTRIES * HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS));
+/// } some_distribution_name SEC(".maps");
+/// ```
+///
+/// The index of a bucket is `(cpu * ENTRIES + entry) * HISTOGRAM_BANK_WIDTH() +
+/// value_to_index()` and it must be incremented with `percpu_incr()`. The map
+/// is resized for the CPUs on this host before the program is loaded, and the
+/// banks for each entry are summed together on each refresh. Entries which
+/// have never been incremented are not exported.
+///
+/// An entry is reset by clearing it from the `HistogramGroup`, such as when the
+/// slot it belongs to is released. Zeroing every CPU's bank would take far more
+/// iterations than the verifier allows a BPF program, so the banks of a cleared
+/// entry are zeroed here on the next refresh instead, and it starts over from
+/// zero. Any events recorded for the entry before that refresh are discarded.
+///
+/// If the BPF program only records 1-in-N events, the `scale` should be set to
+/// `N` so that the bucket counts are scaled back up.
+pub struct PercpuHistogramGroupMap<'a> {
+    _map: &'a libbpf_rs::Map<'a>,
+    mmap: memmap2::MmapMut,
+    buckets: usize,
+    bank_width: usize,
+    group: &'static HistogramGroup,
+    scale: u64,
+    totals: Vec<u64>,
+    exported: Vec<bool>,
+    cpus: usize,
+}
+
+impl<'a> PercpuHistogramGroupMap<'a> {
+    pub fn new(map: &'a libbpf_rs::Map, group: &'static HistogramGroup, scale: u64) -> Self {
+        let buckets = group.total_buckets();
+
+        let bank_width = histogram_bank_width(buckets);
+
+        // the map is sized for the CPUs on this host before it is loaded
+        let cpus = nr_cpus();
+
+        let mmap = mmap_map(map, bank_width * group.len() * cpus);
+
+        Self {
+            _map: map,
+            mmap,
+            buckets,
+            bank_width,
+            group,
+            scale,
+            totals: vec![0; buckets],
+            exported: vec![false; group.len()],
+            cpus,
+        }
+    }
+
+    pub fn refresh(&mut self) {
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to_mut::<u64>() };
+
+        let entries = self.group.len();
+
+        for entry in 0..entries {
+            // the entry was cleared from the group since it was last exported
+            if self.exported[entry] && !self.group.is_populated(entry) {
+                for cpu in 0..self.cpus {
+                    let start = (cpu * entries + entry) * self.bank_width;
+
+                    values[start..(start + self.buckets)].fill(0);
+                }
+
+                self.exported[entry] = false;
+
+                continue;
+            }
+
+            self.totals.fill(0);
+
+            let mut recorded = false;
+
+            for cpu in 0..self.cpus {
+                let start = (cpu * entries + entry) * self.bank_width;
+                let bank = &values[start..(start + self.buckets)];
+
+                for (total, value) in self.totals.iter_mut().zip(bank.iter()) {
+                    if *value != 0 {
+                        *total = total.wrapping_add(value.wrapping_mul(self.scale));
+                        recorded = true;
+                    }
+                }
+            }
+
+            if recorded {
+                let _ = self.group.update_from(entry, &self.totals);
+
+                self.exported[entry] = true;
+            }
+        }
+    }
+}
+
+/// Represents a set of 2-D histograms (heatmaps) in a single BPF map. Each
+/// heatmap is a `HistogramGroup` with one entry per row, and every row has its
+/// own bank of buckets. The map is laid out as `[heatmap][row][bucket]` and
+/// must be created with:
+///
+/// ```c
+/// struct {
+///     __uint(type, BPF_MAP_TYPE_ARRAY);
+///     __uint(map_flags, BPF_F_MMAPABLE);
+///     __type(key, u32);
+///     __type(value, u64);
+///     __uint(max_entries, HEATMAPS * ROWS * HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS));
+/// } some_distribution_name SEC(".maps");
+/// ```
+///
+/// And must be incremented using the `heatmap_incr` helper from `helpers.h`
+/// with a row of `heatmap * ROWS + value_to_row()`. The rows are power of two
+/// ranges starting at `2^min_power`, see `value_to_row()` in `histogram.h`.
+/// Each row is labeled with its upper bound under the metadata `key`, with the
+/// last row labeled `inf`. Rows which have never been incremented are not
+/// exported.
+///
+/// If the BPF program only records 1-in-N events, the `scale` should be set to
+/// `N` so that the bucket counts are scaled back up.
+pub struct Heatmap<'a> {
+    _map: &'a libbpf_rs::Map<'a>,
+    mmap: memmap2::MmapMut,
+    buckets: usize,
+    bank_width: usize,
+    heatmaps: Vec<&'static HistogramGroup>,
+    scale: u64,
+    scaled: Vec<u64>,
+}
+
+impl<'a> Heatmap<'a> {
+    pub fn new(
+        map: &'a libbpf_rs::Map,
+        heatmaps: Vec<&'static HistogramGroup>,
+        key: &'static str,
+        min_power: u8,
+        scale: u64,
+    ) -> Self {
+        let buckets = heatmaps.first().map(|h| h.total_buckets()).unwrap_or(0);
+        let rows = heatmaps.first().map(|h| h.len()).unwrap_or(0);
+
+        if heatmaps
+            .iter()
+            .any(|h| h.total_buckets() != buckets || h.len() != rows)
+        {
+            error!("heatmaps in a heatmap map must share the same config");
             panic!();
         }
 
+        let bank_width = histogram_bank_width(buckets);
+
+        let mmap = mmap_map(map, bank_width * rows * heatmaps.len());
+
+        for heatmap in heatmaps.iter() {
+            for row in 0..rows {
+                let bound = if row + 1 < rows {
+                    (1_u64 << (min_power as usize + row)).to_string()
+                } else {
+                    "inf".to_string()
+                };
+
+                heatmap.insert_metadata(row, key.to_string(), bound);
+            }
+        }
+
         Self {
             _map: map,
             mmap,
             buckets,
-            histogram,
+            bank_width,
+            heatmaps,
+            scale,
+            scaled: Vec::with_capacity(buckets),
         }
     }
 
     pub fn refresh(&mut self) {
-        let (_prefix, buckets, _suffix) = unsafe { self.mmap.align_to::<u64>() };
-        let _ = self.histogram.update_from(&buckets[0..self.buckets]);
+        let (_prefix, values, _suffix) = unsafe { self.mmap.align_to::<u64>() };
+
+        let mut start = 0;
+
+        for heatmap in self.heatmaps.iter() {
+            for row in 0..heatmap.len() {
+                let bank = &values[start..(start + self.buckets)];
+
+                start += self.bank_width;
+
+                if bank.iter().all(|v| *v == 0) {
+                    continue;
+                }
+
+                if self.scale > 1 {
+                    self.scaled.clear();
+                    self.scaled
+                        .extend(bank.iter().map(|v| v.wrapping_mul(self.scale)));
+
+                    let _ = heatmap.update_from(row, &self.scaled);
+                } else {
+                    let _ = heatmap.update_from(row, bank);
+                }
+            }
+        }
+    }
+}
+
+/// Maps the buckets of a BPF histogram onto a userspace histogram which has a
+/// different grouping power. Each BPF bucket is added to the userspace bucket
+/// which holds its upper bound. A BPF histogram with a higher grouping power is
+/// downsampled exactly, since its buckets never span two userspace buckets. One
+/// with a lower grouping power reports the same percentiles as it would on its
+/// own, since each bucket keeps its upper bound.
+struct Rebucket {
+    index: Vec<usize>,
+    buckets: Vec<u64>,
+}
+
+impl Rebucket {
+    /// Returns `None` if the BPF histogram already has the userspace grouping
+    /// power and its buckets can be used as they are.
+    fn new(grouping_power: u8, userspace_power: u8) -> Option<Self> {
+        if grouping_power == userspace_power {
+            return None;
+        }
+
+        let index = (0..histogram_buckets(grouping_power))
+            .map(|idx| bucket_index(bucket_upper_bound(idx, grouping_power), userspace_power))
+            .collect();
+
+        Some(Self {
+            index,
+            buckets: vec![0; histogram_buckets(userspace_power)],
+        })
+    }
+
+    /// Returns the userspace buckets for the BPF `buckets`, multiplying each
+    /// count by the `scale`.
+    fn apply(&mut self, buckets: &[u64], scale: u64) -> &[u64] {
+        self.buckets.fill(0);
+
+        for (idx, value) in self.index.iter().zip(buckets.iter()) {
+            if *value != 0 {
+                self.buckets[*idx] = self.buckets[*idx].wrapping_add(value.wrapping_mul(scale));
+            }
+        }
+
+        &self.buckets
+    }
+}
+
+/// Returns the index of the bucket holding `value`, matching `value_to_index()`
+/// from `histogram.h`.
+fn bucket_index(value: u64, grouping_power: u8) -> usize {
+    if value < (2 << grouping_power) {
+        value as usize
+    } else {
+        let power = 63 - value.leading_zeros() as u64;
+        let bin = power - grouping_power as u64 + 1;
+        let offset = (value >> (power - grouping_power as u64)) - (1 << grouping_power);
+
+        (bin * (1 << grouping_power) + offset) as usize
+    }
+}
+
+/// Returns the largest value held by the bucket at `idx`. This is the inverse
+/// of `bucket_index()`.
+fn bucket_upper_bound(idx: usize, grouping_power: u8) -> u64 {
+    let idx = idx as u64;
+
+    if idx < (2 << grouping_power) {
+        idx
+    } else {
+        let bin = idx >> grouping_power;
+        let offset = idx & ((1 << grouping_power) - 1);
+        let power = bin + grouping_power as u64 - 1;
+        let width = 1 << (power - grouping_power as u64);
+
+        (1 << power) + offset * width + (width - 1)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    /// A direct port of `clz()` from `histogram.h`
+    fn clz(value: u64) -> u32 {
+        let mut value = value;
+
+        value |= value >> 1;
+        value |= value >> 2;
+        value |= value >> 4;
+        value |= value >> 8;
+        value |= value >> 16;
+        value |= value >> 32;
+
+        value = value - ((value >> 1) & 0x5555555555555555);
+        value = (value & 0x3333333333333333) + ((value >> 2) & 0x3333333333333333);
+        value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0F;
+        value = value.wrapping_mul(0x0101010101010101) >> 56;
+
+        64 - value as u32
+    }
+
+    /// A direct port of `value_to_index()` from `histogram.h`
+    fn value_to_index(value: u64, grouping_power: u8) -> usize {
+        if value < (2 << grouping_power) {
+            value as usize
+        } else {
+            let power = 63 - clz(value) as u64;
+            let bin = power - grouping_power as u64 + 1;
+            let offset = (value >> (power - grouping_power as u64)) - (1 << grouping_power);
+
+            (bin * (1 << grouping_power) + offset) as usize
+        }
+    }
+
+    /// A direct port of `value_to_row()` from `histogram.h`
+    fn value_to_row(value: u64, min_power: u8, rows: u32) -> u32 {
+        if value <= (1 << min_power) {
+            return 0;
+        }
+
+        let row = 64 - clz(value - 1) - min_power as u32;
+
+        if row < rows {
+            row
+        } else {
+            rows - 1
+        }
+    }
+
+    /// Returns the grouping power and bucket count for each of the
+    /// `HISTOGRAM_BUCKETS_POW_*` definitions in `histogram.h`
+    fn configs() -> Vec<(u8, usize)> {
+        include_str!("histogram.h")
+            .lines()
+            .filter_map(|line| line.strip_prefix("#define HISTOGRAM_BUCKETS_POW_"))
+            .map(|line| {
+                let mut parts = line.split_whitespace();
+                let power = parts.next().unwrap().parse().unwrap();
+                let buckets = parts.next().unwrap().parse().unwrap();
+                (power, buckets)
+            })
+            .collect()
+    }
+
+    fn values() -> Vec<u64> {
+        let mut values: Vec<u64> = (0..=4096).collect();
+
+        for power in 0..64 {
+            let value = 1_u64 << power;
+            values.extend([value - 1, value, value + 1, value | (value >> 1)]);
+        }
+
+        values.push(u64::MAX);
+
+        // xorshift to cover values which are not near a power of two
+        let mut x: u64 = 0x2545F4914F6CDD1D;
+        for _ in 0..1000 {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            values.push(x >> (x % 64));
+        }
+
+        values
+    }
+
+    #[test]
+    fn clz_matches_builtin() {
+        for value in values() {
+            if value != 0 {
+                assert_eq!(clz(value), value.leading_zeros(), "value: {value}");
+            }
+        }
+    }
+
+    #[test]
+    fn bucket_counts() {
+        let configs = configs();
+
+        assert_eq!(configs.len(), 6);
+
+        for (power, buckets) in configs {
+            let config = histogram::Config::new(power, 64).unwrap();
+            assert_eq!(config.total_buckets(), buckets, "grouping power: {power}");
+        }
+    }
+
+    #[test]
+    fn indexing() {
+        for (power, buckets) in configs() {
+            for value in values() {
+                let index = value_to_index(value, power);
+
+                assert!(index < buckets);
+
+                let mut histogram = histogram::Histogram::new(power, 64).unwrap();
+                histogram.increment(value).unwrap();
+
+                let expected = (&histogram)
+                    .into_iter()
+                    .position(|bucket| bucket.count() == 1)
+                    .unwrap();
+
+                assert_eq!(index, expected, "grouping power: {power} value: {value}");
+            }
+        }
+    }
+
+    #[test]
+    fn rows() {
+        for min_power in [0, 9, 12] {
+            let rows = 12;
+
+            for value in values() {
+                let row = value_to_row(value, min_power, rows);
+
+                assert!(row < rows);
+
+                // each row but the last covers the values up to its upper bound
+                let lower = if row == 0 {
+                    0
+                } else {
+                    1_u64 << (min_power as u32 + row - 1)
+                };
+
+                assert!(row == 0 || value > lower, "value: {value} row: {row}");
+
+                if row + 1 < rows {
+                    let upper = 1_u64 << (min_power as u32 + row);
+                    assert!(value <= upper, "value: {value} row: {row}");
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn rebucketing() {
+        for (from, buckets) in configs() {
+            assert_eq!(super::histogram_buckets(from), buckets);
+
+            for value in values() {
+                let index = super::bucket_index(value, from);
+
+                assert_eq!(index, value_to_index(value, from), "value: {value}");
+
+                // the upper bound holds the value and is in the same bucket
+                let upper = super::bucket_upper_bound(index, from);
+
+                assert!(value <= upper, "grouping power: {from} value: {value}");
+                assert_eq!(super::bucket_index(upper, from), index);
+            }
+
+            for (to, _) in configs() {
+                let config = histogram::Config::new(to, 64).unwrap();
+
+                let Some(mut rebucket) = super::Rebucket::new(from, to) else {
+                    assert_eq!(from, to);
+                    continue;
+                };
+
+                // each bucket lands where its upper bound would be recorded
+                for idx in 0..buckets {
+                    let mut bpf = vec![0; buckets];
+                    bpf[idx] = 1;
+
+                    let upper = super::bucket_upper_bound(idx, from);
+                    let expected = super::bucket_index(upper, to);
+
+                    let userspace = rebucket.apply(&bpf, 2);
+
+                    assert_eq!(userspace.len(), config.total_buckets());
+                    assert_eq!(userspace[expected], 2, "from: {from} to: {to} idx: {idx}");
+                    assert_eq!(userspace.iter().sum::<u64>(), 2);
+                }
+            }
+        }
     }
 }
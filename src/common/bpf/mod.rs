@@ -1,14 +1,28 @@
 mod builder;
+mod cgroup;
 mod counters;
+mod dirty;
+mod epoch;
+mod exemplar;
+mod health;
 mod histogram;
+mod programs;
+mod stacks;
 mod sync_primitive;
 
 pub use builder::Builder as BpfBuilder;
 pub use builder::PerfEvent;
+pub use cgroup::{CgroupMetric, CgroupRegistry};
+pub use programs::{
+    bpf_enable_stats, bpf_programs, bpf_samplers, BpfProgram, BpfProgramStats, BpfSampler,
+};
 
 use crate::samplers::Sampler;
 use crate::*;
 
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+use std::sync::OnceLock;
+
 pub trait OpenSkelExt {
     /// When called, the SkelBuilder should log instruction counts for each of
     /// the programs within the skeleton. Log level should be debug.
@@ -25,23 +39,208 @@ const PAGE_SIZE: usize = 4096;
 // This is the maximum number of CPUs we track with BPF counters.
 pub const MAX_CPUS: usize = 1024;
 
-// This is the maximum number of cgroups we track with BPF counters.
+// This is the kernel's upper limit on `pid_max`, which the BPF arrays indexed
+// by pid are sized for at compile time.
+const MAX_PID: usize = 4194304;
+
+// This is the maximum number of live cgroups we track with BPF counters.
 pub const MAX_CGROUPS: usize = 4096;
 
 const COUNTER_SIZE: usize = std::mem::size_of::<u64>();
 
 const COUNTERS_PER_CACHELINE: usize = CACHELINE_SIZE / COUNTER_SIZE;
 
+/// Returns the number of CPUs which the per-CPU banks of the BPF maps are sized
+/// for. This is the kernel's `nr_cpu_ids`, so that CPUs which are hotplugged
+/// later still have a bank, and is at most `MAX_CPUS`. The maps are resized to
+/// match before they are loaded, see `BpfBuilder`.
+pub fn nr_cpus() -> usize {
+    static NR_CPUS: OnceLock<usize> = OnceLock::new();
+
+    *NR_CPUS.get_or_init(|| {
+        match crate::common::linux::possible_cpus() {
+            Ok(cpus) => cpus.last().map(|cpu| cpu + 1).unwrap_or(MAX_CPUS),
+            Err(e) => {
+                debug!("failed to read the possible cpus, assuming {MAX_CPUS}: {e}");
+                MAX_CPUS
+            }
+        }
+        .min(MAX_CPUS)
+    })
+}
+
+/// Returns the number of entries needed for a BPF array indexed by pid on this
+/// host, from `/proc/sys/kernel/pid_max`. Samplers which fall back to these
+/// arrays when task local storage is not supported should size them with this,
+/// as the default `pid_max` is far smaller than the compile time limit.
+pub fn pid_max() -> u32 {
+    static PID_MAX: OnceLock<usize> = OnceLock::new();
+
+    *PID_MAX.get_or_init(|| match crate::common::linux::pid_max() {
+        Ok(pid_max) => pid_max.clamp(1, MAX_PID),
+        Err(e) => {
+            debug!("failed to read pid_max, assuming {MAX_PID}: {e}");
+            MAX_PID
+        }
+    }) as u32
+}
+
+/// Returns true if the running kernel supports task local storage maps. These
+/// should be preferred over arrays indexed by pid for per-task state as the
+/// storage lives with the `task_struct` and scales with the number of live
+/// tasks instead of with `pid_max`.
+pub fn task_storage_supported() -> bool {
+    unsafe {
+        libbpf_sys::libbpf_probe_bpf_map_type(
+            libbpf_sys::BPF_MAP_TYPE_TASK_STORAGE,
+            std::ptr::null(),
+        ) == 1
+    }
+}
+
+/// Returns true if a fentry program can be attached to the kernel function
+/// `func`. This requires BTF for the function and BPF trampoline support, which
+/// we check by loading a trivial fentry program targeting it and attaching it.
+/// The program can load on kernels where the trampoline can not be created,
+/// such as arm64 before Linux 6.0, so only a successful attach is enough.
+pub fn fentry_supported(func: &str) -> bool {
+    let Ok(func) = std::ffi::CString::new(func) else {
+        return false;
+    };
+
+    unsafe {
+        let btf = libbpf_sys::btf__load_vmlinux_btf();
+
+        if btf.is_null() {
+            return false;
+        }
+
+        let id = libbpf_sys::btf__find_by_name_kind(btf, func.as_ptr(), libbpf_sys::BTF_KIND_FUNC);
+
+        libbpf_sys::btf__free(btf);
+
+        if id <= 0 {
+            return false;
+        }
+
+        // `r0 = 0; exit`
+        let insns: [u64; 2] = [0xb7, 0x95];
+
+        let mut opts: libbpf_sys::bpf_prog_load_opts = std::mem::zeroed();
+        opts.sz = std::mem::size_of::<libbpf_sys::bpf_prog_load_opts>() as _;
+        opts.expected_attach_type = libbpf_sys::BPF_TRACE_FENTRY;
+        opts.attach_btf_id = id as _;
+
+        let fd = libbpf_sys::bpf_prog_load(
+            libbpf_sys::BPF_PROG_TYPE_TRACING,
+            std::ptr::null(),
+            b"GPL\0".as_ptr() as *const _,
+            insns.as_ptr() as *const libbpf_sys::bpf_insn,
+            insns.len() as _,
+            &opts,
+        );
+
+        if fd < 0 {
+            return false;
+        }
+
+        let prog = OwnedFd::from_raw_fd(fd);
+
+        // the trampoline is created on attach. the program does nothing, so it
+        // is harmless for the moment it is attached
+        let link = libbpf_sys::bpf_raw_tracepoint_open(std::ptr::null(), prog.as_raw_fd());
+
+        if link < 0 {
+            return false;
+        }
+
+        // detach and close the probe program
+        drop(OwnedFd::from_raw_fd(link));
+        drop(prog);
+
+        true
+    }
+}
+
+/// Returns true if the running kernel's BTF has a struct named `name` with a
+/// member named `field`. This can be used to decide which programs to load
+/// before the skeleton is loaded, where `bpf_core_field_exists()` is only
+/// available from within the BPF program itself.
+pub fn kernel_struct_has_field(name: &str, field: &str) -> bool {
+    let (Ok(name), Ok(field)) = (std::ffi::CString::new(name), std::ffi::CString::new(field))
+    else {
+        return false;
+    };
+
+    unsafe {
+        let btf = libbpf_sys::btf__load_vmlinux_btf();
+
+        if btf.is_null() {
+            return false;
+        }
+
+        let mut found = false;
+
+        let id =
+            libbpf_sys::btf__find_by_name_kind(btf, name.as_ptr(), libbpf_sys::BTF_KIND_STRUCT);
+
+        if id > 0 {
+            let t = libbpf_sys::btf__type_by_id(btf, id as _);
+
+            if !t.is_null() {
+                // the members of a struct directly follow its type in the BTF
+                let vlen = ((*t).info & 0xffff) as usize;
+                let members = t.add(1) as *const libbpf_sys::btf_member;
+
+                for i in 0..vlen {
+                    let member = libbpf_sys::btf__name_by_offset(btf, (*members.add(i)).name_off);
+
+                    if !member.is_null() && std::ffi::CStr::from_ptr(member) == field.as_c_str() {
+                        found = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        libbpf_sys::btf__free(btf);
+
+        found
+    }
+}
+
 fn whole_cachelines<T>(count: usize) -> usize {
     ((count * std::mem::size_of::<T>()) + CACHELINE_SIZE - 1) / CACHELINE_SIZE
 }
 
+/// Returns the number of buckets in a BPF histogram with the grouping power.
+/// This must match `histogram_buckets()` from `histogram.h`.
+pub fn histogram_buckets(grouping_power: u8) -> usize {
+    (65 - grouping_power as usize) << grouping_power
+}
+
+/// Returns the number of buckets reserved for each CPU's bank in a per-CPU
+/// histogram. This must match `HISTOGRAM_BANK_WIDTH()` from `histogram.h`.
+pub fn histogram_bank_width(buckets: usize) -> usize {
+    whole_cachelines::<u64>(buckets) * COUNTERS_PER_CACHELINE
+}
+
 fn whole_pages<T>(count: usize) -> usize {
     ((count * std::mem::size_of::<T>()) + PAGE_SIZE - 1) / PAGE_SIZE
 }
 
-use counters::{Counters, CpuCounters, PackedCounters};
-use histogram::Histogram;
+use cgroup::register_cgroup_metrics;
+use counters::{Counters, CpuCounters, PackedCounters, PercpuPackedCounters};
+use dirty::dirty_bitmap_entries;
+use epoch::{Epoch, EPOCH_BUFFERS};
+use exemplar::ExemplarHandler;
+use health::{HealthCounters, HEALTH_REASONS};
+use histogram::{
+    Heatmap, Histogram, HistogramGroupMap, PercpuHistogram, PercpuHistogramArray,
+    PercpuHistogramGroupMap,
+};
+use programs::{map_memory, mmap_map, register_program, register_sampler};
+use stacks::StackTotals;
 use sync_primitive::SyncPrimitive;
 
 pub struct AsyncBpf {
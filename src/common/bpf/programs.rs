@@ -0,0 +1,229 @@
+use crate::*;
+
+use super::{whole_pages, PAGE_SIZE};
+
+use libbpf_rs::{AsRawLibbpf, Program};
+use memmap2::{MmapMut, MmapOptions};
+use parking_lot::{Mutex, MutexGuard};
+
+use std::os::fd::{AsFd, AsRawFd, BorrowedFd, FromRawFd, OwnedFd};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+
+/// All BPF programs which have been loaded by Rezolus samplers, in the order
+/// they were loaded.
+static PROGRAMS: Mutex<Vec<BpfProgram>> = Mutex::new(Vec::new());
+
+/// All the BPF samplers which have been started, in the order they started.
+static SAMPLERS: Mutex<Vec<BpfSampler>> = Mutex::new(Vec::new());
+
+/// A BPF sampler along with the cumulative time its thread has spent reading
+/// metrics from its BPF maps, and what it cost to start.
+pub struct BpfSampler {
+    name: &'static str,
+    refresh_time: Arc<AtomicU64>,
+    load_time: Duration,
+    map_memory: u64,
+}
+
+impl BpfSampler {
+    pub fn name(&self) -> &str {
+        self.name
+    }
+
+    /// The time taken to open, load and attach the BPF programs and to set up
+    /// the maps for this sampler, in nanoseconds.
+    pub fn load_time(&self) -> u64 {
+        self.load_time.as_nanos() as u64
+    }
+
+    /// The memory used by the BPF maps of this sampler, in bytes. Maps which
+    /// are shared with the cgroup registry are not included.
+    pub fn map_memory(&self) -> u64 {
+        self.map_memory
+    }
+
+    /// The total time spent refreshing the metrics for this sampler, in
+    /// nanoseconds.
+    pub fn refresh_time(&self) -> u64 {
+        self.refresh_time.load(Ordering::Relaxed)
+    }
+}
+
+/// A loaded BPF program. We hold our own copy of the program fd so that the
+/// kernel's runtime stats for the program can be read from outside of the
+/// sampler thread which owns the skeleton.
+pub struct BpfProgram {
+    sampler: &'static str,
+    name: String,
+    fd: OwnedFd,
+    sample_rate: u64,
+}
+
+/// A snapshot of the kernel's statistics for a BPF program.
+pub struct BpfProgramStats {
+    /// Cumulative time spent executing the program. Only collected while BPF
+    /// stats are enabled. See `bpf_enable_stats()`.
+    pub run_time: u64,
+    /// Number of times the program has run. Only collected while BPF stats are
+    /// enabled. See `bpf_enable_stats()`.
+    pub run_count: u64,
+    /// Number of instructions in the program after it was translated by the
+    /// kernel.
+    pub instructions: u64,
+    /// Number of instructions the verifier processed when loading the program.
+    pub verified_instructions: u64,
+}
+
+impl BpfProgram {
+    pub fn sampler(&self) -> &str {
+        self.sampler
+    }
+
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    /// The rate at which the sampler which loaded this program samples events
+    /// for its histograms. A rate of `N` means 1-in-N events are recorded.
+    pub fn sample_rate(&self) -> u64 {
+        self.sample_rate
+    }
+
+    /// Read the current stats for this program from the kernel.
+    pub fn stats(&self) -> Option<BpfProgramStats> {
+        let mut info: libbpf_sys::bpf_prog_info = unsafe { std::mem::zeroed() };
+        let mut len = std::mem::size_of::<libbpf_sys::bpf_prog_info>() as u32;
+
+        let ret = unsafe {
+            libbpf_sys::bpf_obj_get_info_by_fd(
+                self.fd.as_raw_fd(),
+                &mut info as *mut _ as *mut _,
+                &mut len,
+            )
+        };
+
+        if ret != 0 {
+            return None;
+        }
+
+        Some(BpfProgramStats {
+            run_time: info.run_time_ns,
+            run_count: info.run_cnt,
+            instructions: (info.xlated_prog_len as usize
+                / std::mem::size_of::<libbpf_sys::bpf_insn>()) as u64,
+            verified_instructions: info.verified_insns as u64,
+        })
+    }
+}
+
+/// Register a loaded program so that its stats can be exported. Programs which
+/// were not loaded are ignored.
+pub fn register_program(sampler: &'static str, prog: &Program, sample_rate: u64) {
+    let fd = unsafe { libbpf_sys::bpf_program__fd(prog.as_libbpf_object().as_ptr()) };
+
+    if fd < 0 {
+        return;
+    }
+
+    let fd = match unsafe { BorrowedFd::borrow_raw(fd) }.try_clone_to_owned() {
+        Ok(fd) => fd,
+        Err(e) => {
+            debug!("{sampler} failed to duplicate BPF program fd: {e}");
+            return;
+        }
+    };
+
+    PROGRAMS.lock().push(BpfProgram {
+        sampler,
+        name: prog.name().to_string_lossy().into_owned(),
+        fd,
+        sample_rate,
+    });
+}
+
+/// Register a BPF sampler so that the time spent refreshing it can be exported,
+/// along with the time it took to load and the memory used by its maps. The
+/// sampler adds the time for each refresh to the returned counter.
+pub fn register_sampler(
+    name: &'static str,
+    load_time: Duration,
+    map_memory: u64,
+) -> Arc<AtomicU64> {
+    let refresh_time = Arc::new(AtomicU64::new(0));
+
+    SAMPLERS.lock().push(BpfSampler {
+        name,
+        refresh_time: refresh_time.clone(),
+        load_time,
+        map_memory,
+    });
+
+    refresh_time
+}
+
+/// Returns the memory used by a BPF map, in bytes. This is the `memlock` the
+/// kernel reports for the map fd, which is what is charged against
+/// `RLIMIT_MEMLOCK` on kernels which account BPF memory that way.
+pub fn map_memory(map: BorrowedFd) -> Option<u64> {
+    let fdinfo = std::fs::read_to_string(format!("/proc/self/fdinfo/{}", map.as_raw_fd())).ok()?;
+
+    fdinfo
+        .lines()
+        .find_map(|line| line.strip_prefix("memlock:"))
+        .and_then(|value| value.trim().parse().ok())
+}
+
+/// Maps the values of a `BPF_F_MMAPABLE` array of `u64`s into memory, rounding
+/// the length of the region for `entries` values up to whole pages. Panics if
+/// the map cannot be mapped or the region does not hold exactly that many
+/// aligned values.
+pub fn mmap_map(map: &libbpf_rs::Map, entries: usize) -> MmapMut {
+    let mmap_len = whole_pages::<u64>(entries) * PAGE_SIZE;
+
+    let fd = map.as_fd().as_raw_fd();
+    let file = unsafe { std::fs::File::from_raw_fd(fd as _) };
+    let mmap = unsafe {
+        MmapOptions::new()
+            .len(mmap_len)
+            .map_mut(&file)
+            .expect("failed to mmap() bpf map")
+    };
+
+    // check the alignment
+    let (_prefix, data, _suffix) = unsafe { mmap.align_to::<u64>() };
+    let expected_len = mmap_len / std::mem::size_of::<u64>();
+
+    if data.len() != expected_len {
+        error!("mmap region not aligned or width doesn't match");
+        panic!();
+    }
+
+    mmap
+}
+
+/// Returns all the BPF samplers which have been started.
+pub fn bpf_samplers() -> MutexGuard<'static, Vec<BpfSampler>> {
+    SAMPLERS.lock()
+}
+
+/// Returns all the BPF programs which have been loaded.
+pub fn bpf_programs() -> MutexGuard<'static, Vec<BpfProgram>> {
+    PROGRAMS.lock()
+}
+
+/// Enables collection of runtime stats for all BPF programs. The kernel keeps
+/// collecting stats until the returned fd is closed.
+///
+/// NOTE: this adds a small overhead to every BPF program on the system, not
+/// just the programs loaded by Rezolus.
+pub fn bpf_enable_stats() -> Result<OwnedFd, std::io::Error> {
+    let fd = unsafe { libbpf_sys::bpf_enable_stats(libbpf_sys::BPF_STATS_RUN_TIME) };
+
+    if fd < 0 {
+        Err(std::io::Error::from_raw_os_error(-fd))
+    } else {
+        Ok(unsafe { OwnedFd::from_raw_fd(fd) })
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef STACKS_H
+#define STACKS_H
+
+// Shared definitions for aggregating totals by stack in the kernel. Programs
+// capture stacks into their own `BPF_MAP_TYPE_STACK_TRACE` map and add to a
+// hash map of totals keyed by `struct stack_key`, which userspace drains and
+// publishes as a folded stack profile, see `BpfBuilder::stack_totals()`.
+//
+// This must be included after `vmlinux.h`, the libbpf headers and `health.h`.
+
+// the layout must match the key read by `StackTotals` in `stacks.rs`
+struct stack_key {
+	// the slot of the cgroup from `cgroup.h`, zero if not known
+	u32 cgroup;
+	u32 tgid;
+	// stack ids are negative when the stack was not captured
+	s32 user_stack_id;
+	s32 kernel_stack_id;
+};
+
+// Adds `value` to the total for the key, inserting the key if it is new.
+static __always_inline void stack_total_add(void *totals, struct stack_key *key, u64 value)
+{
+	u64 *total = bpf_map_lookup_elem(totals, key);
+
+	if (!total) {
+		// another CPU may add the key first, in which case we use theirs
+		u64 zero = 0;
+		bpf_map_update_elem(totals, key, &zero, BPF_NOEXIST);
+
+		total = bpf_map_lookup_elem(totals, key);
+
+		if (!total) {
+			health_incr(HEALTH_MAP_FULL);
+			return;
+		}
+	}
+
+	__atomic_fetch_add(total, value, __ATOMIC_RELAXED);
+}
+
+#endif //STACKS_H
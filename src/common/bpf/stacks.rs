@@ -0,0 +1,323 @@
+use crate::common::bpf::cgroup::cgroup_slot_name;
+use crate::common::record_stack_profile;
+use crate::*;
+
+use libbpf_rs::{Map, MapCore, MapFlags};
+
+use std::collections::{HashMap, HashSet};
+use std::sync::OnceLock;
+use std::time::{Duration, Instant};
+
+/// How often the totals are drained from the BPF map. Each profile covers the
+/// time since the previous drain.
+const STACK_PROFILE_INTERVAL: Duration = Duration::from_secs(10);
+
+/// The kernel symbols from `/proc/kallsyms`, sorted by address. Empty if the
+/// addresses are hidden from us.
+static KERNEL_SYMBOLS: OnceLock<Vec<(u64, String)>> = OnceLock::new();
+
+/// Matches `struct stack_key` in `stacks.h`.
+#[repr(C)]
+#[derive(Clone, Copy)]
+struct StackKey {
+    cgroup: u32,
+    tgid: u32,
+    user_stack_id: i32,
+    kernel_stack_id: i32,
+}
+
+unsafe impl plain::Plain for StackKey {}
+
+/// Aggregated stack totals from a BPF program which uses `stacks.h`. The totals
+/// map is a hash map from `struct stack_key` to a `u64` total, and the stack
+/// ids are from a `BPF_MAP_TYPE_STACK_TRACE` map. The totals are drained every
+/// `STACK_PROFILE_INTERVAL` and published as a folded stack profile. The
+/// outermost frames are the name of the cgroup, if it is known, and the command
+/// name of the process.
+///
+/// Kernel frames are symbolized with `/proc/kallsyms`. User frames are shown as
+/// the file they are mapped from and the offset into it, which can be
+/// symbolized offline.
+///
+/// When `clear_stacks` is set the stack traces are removed as the totals are
+/// drained, for programs which use each stack id as soon as it is captured.
+/// Otherwise a task may hold a stack id for some time, such as while it is
+/// blocked, and a removed id could be reused for a different stack, so the
+/// stack map must be sized to hold all the distinct stacks.
+pub(super) struct StackTotals<'a> {
+    name: &'static str,
+    totals: &'a Map<'a>,
+    stacks: &'a Map<'a>,
+    clear_stacks: bool,
+    drained_at: Instant,
+}
+
+impl<'a> StackTotals<'a> {
+    pub fn new(name: &'static str, totals: &'a Map, stacks: &'a Map, clear_stacks: bool) -> Self {
+        Self {
+            name,
+            totals,
+            stacks,
+            clear_stacks,
+            drained_at: Instant::now(),
+        }
+    }
+
+    pub fn refresh(&mut self) {
+        if self.drained_at.elapsed() < STACK_PROFILE_INTERVAL {
+            return;
+        }
+
+        // collect the keys first, as deleting while iterating would restart
+        // the iteration
+        let keys: Vec<Vec<u8>> = self.totals.keys().collect();
+
+        let mut folded: HashMap<String, u64> = HashMap::new();
+        let mut processes: HashMap<u32, Process> = HashMap::new();
+        let mut stack_ids: HashSet<i32> = HashSet::new();
+
+        for bytes in keys {
+            let Ok(Some(value)) = self.totals.lookup_and_delete(&bytes) else {
+                continue;
+            };
+
+            let Some((key, value)) = parse_total(&bytes, &value) else {
+                continue;
+            };
+
+            let process = processes
+                .entry(key.tgid)
+                .or_insert_with(|| Process::new(key.tgid));
+
+            let mut frames = Vec::new();
+
+            if let Some(name) = cgroup_slot_name(key.cgroup as usize) {
+                frames.push(name);
+            }
+
+            frames.push(process.comm.clone());
+
+            // the stack traces start from the innermost frame
+            match self.stack(key.user_stack_id) {
+                Some(stack) => frames.extend(stack.iter().rev().map(|a| process.user_symbol(*a))),
+                None => frames.push("[unknown]".to_string()),
+            }
+
+            match self.stack(key.kernel_stack_id) {
+                Some(stack) => frames.extend(stack.iter().rev().map(|a| kernel_symbol(*a))),
+                None => frames.push("[unknown]".to_string()),
+            }
+
+            stack_ids.insert(key.user_stack_id);
+            stack_ids.insert(key.kernel_stack_id);
+
+            *folded.entry(frames.join(";")).or_insert(0) += value;
+        }
+
+        if self.clear_stacks {
+            for id in stack_ids.into_iter().filter(|id| *id >= 0) {
+                let _ = self.stacks.delete(&id.to_ne_bytes());
+            }
+        }
+
+        let mut stacks: Vec<(String, u64)> = folded.into_iter().collect();
+        stacks.sort();
+
+        record_stack_profile(self.name, &stacks);
+
+        self.drained_at = Instant::now();
+    }
+
+    /// Returns the addresses in a stack trace, starting from the innermost
+    /// frame. Empty if the stack was not captured, and `None` if the stack is
+    /// no longer in the stack map.
+    fn stack(&self, stack_id: i32) -> Option<Vec<u64>> {
+        if stack_id < 0 {
+            return Some(Vec::new());
+        }
+
+        let trace = self
+            .stacks
+            .lookup(&stack_id.to_ne_bytes(), MapFlags::ANY)
+            .ok()??;
+
+        Some(
+            trace
+                .chunks_exact(8)
+                .map(|bytes| u64::from_ne_bytes(bytes.try_into().unwrap()))
+                .take_while(|addr| *addr != 0)
+                .collect(),
+        )
+    }
+}
+
+/// Parses an entry of the totals map into its key and total. Returns `None` if
+/// either is too short.
+fn parse_total(key: &[u8], value: &[u8]) -> Option<(StackKey, u64)> {
+    let mut stack_key = StackKey {
+        cgroup: 0,
+        tgid: 0,
+        user_stack_id: -1,
+        kernel_stack_id: -1,
+    };
+
+    plain::copy_from_bytes(&mut stack_key, key).ok()?;
+
+    let total = u64::from_ne_bytes(value.get(0..8)?.try_into().unwrap());
+
+    Some((stack_key, total))
+}
+
+/// The details of a process which are needed to format its frames, read once
+/// each time the totals are drained.
+struct Process {
+    comm: String,
+    /// The executable mappings from `/proc/[pid]/maps` as the start and end
+    /// address, the file offset, and the name of the file.
+    mappings: Vec<(u64, u64, u64, String)>,
+}
+
+impl Process {
+    fn new(tgid: u32) -> Self {
+        // any characters which are part of the folded format are replaced
+        let comm = std::fs::read_to_string(format!("/proc/{tgid}/comm"))
+            .map(|comm| comm.trim_end().replace([';', ' '], "_"))
+            .unwrap_or_else(|_| format!("[{tgid}]"));
+
+        let mappings = std::fs::read_to_string(format!("/proc/{tgid}/maps"))
+            .map(|maps| maps.lines().filter_map(parse_mapping).collect())
+            .unwrap_or_default();
+
+        Self { comm, mappings }
+    }
+
+    /// Returns the file and offset for a user address, or the address in hex if
+    /// it is not in a file mapping.
+    fn user_symbol(&self, addr: u64) -> String {
+        self.mappings
+            .iter()
+            .find(|(start, end, _, _)| *start <= addr && addr < *end)
+            .map(|(start, _, offset, file)| format!("{file}+{:#x}", addr - start + offset))
+            .unwrap_or_else(|| format!("{addr:#x}"))
+    }
+}
+
+/// Parses an executable file mapping from a line of `/proc/[pid]/maps`.
+fn parse_mapping(line: &str) -> Option<(u64, u64, u64, String)> {
+    let mut parts = line.split_whitespace();
+
+    let (start, end) = parts.next()?.split_once('-')?;
+    let perms = parts.next()?;
+    let offset = parts.next()?;
+    let path = parts.nth(2)?;
+
+    if !perms.contains('x') || !path.starts_with('/') {
+        return None;
+    }
+
+    let file = path.rsplit('/').next()?.replace([';', ' '], "_");
+
+    Some((
+        u64::from_str_radix(start, 16).ok()?,
+        u64::from_str_radix(end, 16).ok()?,
+        u64::from_str_radix(offset, 16).ok()?,
+        file,
+    ))
+}
+
+/// Returns the name of the kernel function containing `addr`, or the address
+/// in hex if it is not known.
+fn kernel_symbol(addr: u64) -> String {
+    let symbols = KERNEL_SYMBOLS.get_or_init(load_kernel_symbols);
+
+    let idx = symbols.partition_point(|(start, _)| *start <= addr);
+
+    if idx == 0 {
+        format!("{addr:#x}")
+    } else {
+        symbols[idx - 1].1.clone()
+    }
+}
+
+fn load_kernel_symbols() -> Vec<(u64, String)> {
+    let Ok(content) = std::fs::read_to_string("/proc/kallsyms") else {
+        debug!("failed to read /proc/kallsyms, kernel stacks will not be symbolized");
+        return Vec::new();
+    };
+
+    let mut symbols: Vec<(u64, String)> = content
+        .lines()
+        .filter_map(|line| {
+            let mut parts = line.split_whitespace();
+
+            let addr = u64::from_str_radix(parts.next()?, 16).ok()?;
+            let kind = parts.next()?;
+            let name = parts.next()?;
+
+            // only functions are useful for stacks, and the addresses are all
+            // zero when they are hidden from us
+            if addr == 0 || !matches!(kind, "t" | "T" | "w" | "W") {
+                return None;
+            }
+
+            Some((addr, name.to_string()))
+        })
+        .collect();
+
+    symbols.sort();
+
+    symbols
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn mappings() {
+        let mapping = parse_mapping(
+            "7f2c4a600000-7f2c4a795000 r-xp 00028000 fd:01 1835 /usr/lib/x86_64-linux-gnu/libc.so.6",
+        )
+        .unwrap();
+
+        assert_eq!(
+            mapping,
+            (
+                0x7f2c4a600000,
+                0x7f2c4a795000,
+                0x28000,
+                "libc.so.6".to_string()
+            )
+        );
+
+        // only executable file mappings are used for symbols
+        assert!(parse_mapping("7ffd1c9e4000-7ffd1ca05000 rw-p 00000000 00:00 0 [stack]").is_none());
+        assert!(parse_mapping(
+            "7f2c4a5d8000-7f2c4a600000 r--p 00000000 fd:01 1835 /usr/lib/libc.so.6"
+        )
+        .is_none());
+        assert!(parse_mapping("7f2c4a9a0000-7f2c4a9a2000 rw-p 00000000 00:00 0").is_none());
+    }
+
+    #[test]
+    fn totals() {
+        // `struct stack_key` from `stacks.h`
+        let mut key = Vec::new();
+        key.extend(7_u32.to_ne_bytes());
+        key.extend(1234_u32.to_ne_bytes());
+        key.extend(42_i32.to_ne_bytes());
+        key.extend((-14_i32).to_ne_bytes());
+
+        let (stack_key, total) = parse_total(&key, &99_u64.to_ne_bytes()).unwrap();
+
+        assert_eq!(stack_key.cgroup, 7);
+        assert_eq!(stack_key.tgid, 1234);
+        assert_eq!(stack_key.user_stack_id, 42);
+        assert_eq!(stack_key.kernel_stack_id, -14);
+        assert_eq!(total, 99);
+
+        // truncated keys and values are skipped
+        assert!(parse_total(&key[0..12], &99_u64.to_ne_bytes()).is_none());
+        assert!(parse_total(&key, &99_u32.to_ne_bytes()).is_none());
+    }
+}
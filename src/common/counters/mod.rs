@@ -78,7 +78,9 @@ impl CounterGroup {
 
     pub fn clear_metadata(&self, idx: usize) {
         if let Some(metadata) = self.metadata.get() {
-            let _ = metadata.write().get(idx).cloned();
+            if let Some(metadata) = metadata.write().get_mut(idx) {
+                metadata.clear();
+            }
         }
     }
 
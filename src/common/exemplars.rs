@@ -0,0 +1,49 @@
+use parking_lot::Mutex;
+
+use std::collections::VecDeque;
+use std::time::{Duration, SystemTime};
+
+/// The number of recent exemplars which are retained. Once full, the oldest
+/// exemplar is dropped for each new one.
+pub const MAX_EXEMPLARS: usize = 1024;
+
+static EXEMPLARS: Mutex<VecDeque<Exemplar>> = Mutex::new(VecDeque::new());
+
+/// A record of an individual outlier event, such as a syscall which took longer
+/// than the configured threshold. Exemplars complement the latency histograms
+/// by identifying which task was responsible for the tail.
+#[derive(Clone)]
+pub struct Exemplar {
+    /// The name of the sampler which captured the exemplar.
+    pub sampler: &'static str,
+    /// The time at which the event completed.
+    pub timestamp: SystemTime,
+    pub latency: Duration,
+    /// The task the event is attributed to. These are zero and `comm` is empty
+    /// when the event could not be attributed to a task.
+    pub pid: u32,
+    pub tgid: u32,
+    pub comm: String,
+    /// The kernel id of the task's cgroup in the unified hierarchy.
+    pub cgroup: u64,
+    /// What the event was for, such as the syscall or the device. The label
+    /// names the kind of id, for example `syscall`.
+    pub id_label: &'static str,
+    pub id: String,
+}
+
+/// Adds an exemplar to the set of recent exemplars.
+pub fn record_exemplar(exemplar: Exemplar) {
+    let mut exemplars = EXEMPLARS.lock();
+
+    if exemplars.len() >= MAX_EXEMPLARS {
+        exemplars.pop_front();
+    }
+
+    exemplars.push_back(exemplar);
+}
+
+/// Returns the recent exemplars from all samplers, oldest first.
+pub fn exemplars() -> Vec<Exemplar> {
+    EXEMPLARS.lock().iter().cloned().collect()
+}
@@ -0,0 +1,168 @@
+use metriken::Metric;
+use metriken::Value;
+use parking_lot::RwLock;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU8, Ordering};
+use std::sync::OnceLock;
+use thiserror::Error;
+
+type OnceLockVec<T> = OnceLock<RwLock<Vec<T>>>;
+
+#[derive(Error, Debug, PartialEq)]
+#[allow(dead_code)]
+pub enum HistogramGroupError {
+    #[error("the index is higher than the histogram group size")]
+    InvalidIndex,
+    #[error("the number of buckets does not match the histogram config")]
+    InvalidBuckets,
+}
+
+/// A group of histograms that's protected by a reader-writer lock. All of the
+/// histograms in the group share the same configuration. Storage for each
+/// histogram is only allocated once it has been updated. The grouping power may
+/// be changed before the group is first updated, so that groups which are
+/// filled from BPF match the power the BPF program was loaded with.
+#[allow(dead_code)]
+pub struct HistogramGroup {
+    buckets: OnceLockVec<Vec<u64>>,
+    metadata: OnceLockVec<HashMap<String, String>>,
+    entries: usize,
+    grouping_power: AtomicU8,
+    max_value_power: u8,
+}
+
+impl Metric for HistogramGroup {
+    fn as_any(&self) -> std::option::Option<&(dyn std::any::Any + 'static)> {
+        Some(self)
+    }
+
+    fn value(&self) -> std::option::Option<metriken::Value<'_>> {
+        Some(Value::Other(self))
+    }
+}
+
+#[allow(dead_code)]
+impl HistogramGroup {
+    /// Create a new histogram group
+    pub const fn new(entries: usize, grouping_power: u8, max_value_power: u8) -> Self {
+        Self {
+            buckets: OnceLock::new(),
+            metadata: OnceLock::new(),
+            entries,
+            grouping_power: AtomicU8::new(grouping_power),
+            max_value_power,
+        }
+    }
+
+    /// Replaces the buckets of the histogram at the given index with the
+    /// provided bucket counts.
+    pub fn update_from(&self, idx: usize, buckets: &[u64]) -> Result<(), HistogramGroupError> {
+        if idx >= self.entries {
+            return Err(HistogramGroupError::InvalidIndex);
+        }
+
+        if buckets.len() != self.total_buckets() {
+            return Err(HistogramGroupError::InvalidBuckets);
+        }
+
+        let mut inner = self.get_or_init().write();
+
+        inner[idx].clear();
+        inner[idx].extend_from_slice(buckets);
+
+        Ok(())
+    }
+
+    /// Discards the buckets of the histogram at the given index, so that it is
+    /// not exported until it is next updated.
+    pub fn clear(&self, idx: usize) {
+        if let Some(inner) = self.buckets.get() {
+            if let Some(buckets) = inner.write().get_mut(idx) {
+                buckets.clear();
+            }
+        }
+    }
+
+    /// Returns true if the histogram at the given index has been updated since
+    /// it was created or last cleared.
+    pub fn is_populated(&self, idx: usize) -> bool {
+        self.buckets
+            .get()
+            .and_then(|inner| inner.read().get(idx).map(|buckets| !buckets.is_empty()))
+            .unwrap_or(false)
+    }
+
+    /// Load the histogram at the given index. Returns `None` if the histogram
+    /// has never been updated.
+    pub fn load(&self, idx: usize) -> Option<histogram::Histogram> {
+        let inner = self.buckets.get()?.read();
+        let buckets = inner.get(idx)?;
+
+        if buckets.is_empty() {
+            return None;
+        }
+
+        histogram::Histogram::from_buckets(
+            self.grouping_power(),
+            self.max_value_power,
+            buckets.clone(),
+        )
+        .ok()
+    }
+
+    pub fn len(&self) -> usize {
+        self.entries
+    }
+
+    pub fn grouping_power(&self) -> u8 {
+        self.grouping_power.load(Ordering::Relaxed)
+    }
+
+    /// Sets the grouping power of the histograms in the group. Any histograms
+    /// which were already stored are discarded, since their buckets no longer
+    /// match the config.
+    pub fn set_grouping_power(&self, grouping_power: u8) {
+        self.grouping_power.store(grouping_power, Ordering::Relaxed);
+
+        if let Some(inner) = self.buckets.get() {
+            for buckets in inner.write().iter_mut() {
+                buckets.clear();
+            }
+        }
+    }
+
+    pub fn total_buckets(&self) -> usize {
+        histogram::Config::new(self.grouping_power(), self.max_value_power)
+            .map(|c| c.total_buckets())
+            .unwrap_or(0)
+    }
+
+    fn get_or_init(&self) -> &RwLock<Vec<Vec<u64>>> {
+        self.buckets
+            .get_or_init(|| vec![Vec::new(); self.entries].into())
+    }
+
+    pub fn load_metadata(&self, idx: usize) -> Option<HashMap<String, String>> {
+        match self.metadata.get() {
+            Some(metadata) => metadata.read().get(idx).cloned(),
+            None => None,
+        }
+    }
+
+    pub fn clear_metadata(&self, idx: usize) {
+        if let Some(metadata) = self.metadata.get() {
+            if let Some(metadata) = metadata.write().get_mut(idx) {
+                metadata.clear();
+            }
+        }
+    }
+
+    pub fn insert_metadata(&self, idx: usize, key: String, value: String) {
+        let metadata = self
+            .metadata
+            .get_or_init(|| vec![HashMap::new(); self.entries].into());
+        if let Some(metadata) = metadata.write().get_mut(idx) {
+            metadata.insert(key, value);
+        }
+    }
+}
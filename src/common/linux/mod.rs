@@ -6,6 +6,30 @@ pub fn cpus() -> Result<Vec<usize>, Error> {
     let raw =
         std::fs::read_to_string("/sys/devices/system/cpu/present").map(|v| v.trim().to_string())?;
 
+    parse_cpu_list(&raw)
+}
+
+/// Returns the CPUs which could ever be online, including any which are
+/// hotplugged later. CPU ids are always less than the highest possible CPU plus
+/// one, which is the kernel's `nr_cpu_ids`.
+pub fn possible_cpus() -> Result<Vec<usize>, Error> {
+    let raw = std::fs::read_to_string("/sys/devices/system/cpu/possible")
+        .map(|v| v.trim().to_string())?;
+
+    parse_cpu_list(&raw)
+}
+
+/// Returns the kernel's limit on pids, which is one more than the largest pid
+/// which can be assigned.
+pub fn pid_max() -> Result<usize, Error> {
+    std::fs::read_to_string("/proc/sys/kernel/pid_max")?
+        .trim()
+        .parse()
+        .map_err(|_| Error::other("could not parse"))
+}
+
+/// Parses a list of CPUs in the kernel's list format, e.g. `0-3,8,10-11`.
+fn parse_cpu_list(raw: &str) -> Result<Vec<usize>, Error> {
     let mut ids = Vec::new();
 
     for range in raw.split(',') {
@@ -37,6 +61,65 @@ pub fn cpus() -> Result<Vec<usize>, Error> {
     Ok(ids)
 }
 
+/// Returns the last level cache for a CPU, identified by the lowest numbered
+/// CPU which shares the cache. Returns `None` if the cache topology is not
+/// available.
+pub fn cpu_llc(cpu: usize) -> Option<usize> {
+    let mut llc: Option<(u32, usize)> = None;
+
+    let walker = WalkDir::new(format!("/sys/devices/system/cpu/cpu{cpu}/cache"))
+        .min_depth(1)
+        .max_depth(1)
+        .into_iter();
+
+    for entry in walker.filter_entry(|e| !is_hidden(e)).flatten() {
+        let path = entry.path();
+
+        let Some(level) = std::fs::read_to_string(path.join("level"))
+            .ok()
+            .and_then(|v| v.trim().parse::<u32>().ok())
+        else {
+            continue;
+        };
+
+        let Some(first) = std::fs::read_to_string(path.join("shared_cpu_list"))
+            .ok()
+            .and_then(|v| parse_cpu_list(v.trim()).ok())
+            .and_then(|cpus| cpus.into_iter().min())
+        else {
+            continue;
+        };
+
+        if llc.map(|(l, _)| level > l).unwrap_or(true) {
+            llc = Some((level, first));
+        }
+    }
+
+    llc.map(|(_, first)| first)
+}
+
+/// Returns the NUMA node for a CPU. Returns `None` if the NUMA topology is not
+/// available.
+pub fn cpu_node(cpu: usize) -> Option<usize> {
+    let walker = WalkDir::new(format!("/sys/devices/system/cpu/cpu{cpu}"))
+        .min_depth(1)
+        .max_depth(1)
+        .into_iter();
+
+    for entry in walker.filter_entry(|e| !is_hidden(e)).flatten() {
+        if let Some(node) = entry
+            .file_name()
+            .to_str()
+            .and_then(|name| name.strip_prefix("node"))
+            .and_then(|id| id.parse().ok())
+        {
+            return Some(node);
+        }
+    }
+
+    None
+}
+
 pub(crate) fn is_hidden(entry: &DirEntry) -> bool {
     entry
         .file_name()
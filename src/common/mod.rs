@@ -1,8 +1,14 @@
 mod counters;
+mod exemplars;
 mod gauges;
+mod histograms;
+mod stacks;
 
 pub use counters::*;
+pub use exemplars::*;
 pub use gauges::*;
+pub use histograms::*;
+pub use stacks::*;
 
 #[cfg(target_os = "linux")]
 pub mod bpf;
@@ -13,8 +19,16 @@ pub use bpf::*;
 #[cfg(target_os = "linux")]
 pub mod linux;
 
+/// The default grouping power for histograms. BPF samplers record their
+/// histograms with this power unless `histogram_grouping_power` is configured.
 pub static HISTOGRAM_GROUPING_POWER: u8 = 3;
 
+/// The range of grouping powers which may be configured for the BPF samplers.
+/// Userspace histograms which are filled from BPF are kept at the highest
+/// power so that no precision is lost whichever power is configured.
+pub static MIN_HISTOGRAM_GROUPING_POWER: u8 = 2;
+pub static MAX_HISTOGRAM_GROUPING_POWER: u8 = 6;
+
 // Time units with base unit as nanoseconds
 pub const SECONDS: u64 = 1_000 * MILLISECONDS;
 pub const MILLISECONDS: u64 = 1_000 * MICROSECONDS;
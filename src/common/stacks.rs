@@ -0,0 +1,34 @@
+use parking_lot::Mutex;
+
+/// The most recent stack profiles, each in the folded format.
+static PROFILES: Mutex<Vec<(&'static str, String)>> = Mutex::new(Vec::new());
+
+/// Replaces the profile with the provided name. The `stacks` have their frames
+/// from the outermost to the innermost separated by `;`, and are stored in the
+/// folded format used by flamegraph tools with one stack per line followed by
+/// its total.
+pub fn record_stack_profile(name: &'static str, stacks: &[(String, u64)]) {
+    let mut folded = String::new();
+
+    for (stack, value) in stacks {
+        folded += &format!("{stack} {value}\n");
+    }
+
+    let mut profiles = PROFILES.lock();
+
+    if let Some((_, profile)) = profiles.iter_mut().find(|(n, _)| *n == name) {
+        *profile = folded;
+    } else {
+        profiles.push((name, folded));
+    }
+}
+
+/// Returns the most recent profile with the provided name in the folded format,
+/// if there is one.
+pub fn stack_profile(name: &str) -> Option<String> {
+    PROFILES
+        .lock()
+        .iter()
+        .find(|(n, _)| *n == name)
+        .map(|(_, profile)| profile.clone())
+}
@@ -1,4 +1,6 @@
-use crate::common::HISTOGRAM_GROUPING_POWER;
+use crate::common::{
+    HISTOGRAM_GROUPING_POWER, MAX_HISTOGRAM_GROUPING_POWER, MIN_HISTOGRAM_GROUPING_POWER,
+};
 use crate::debug;
 
 use ringlog::Level;
@@ -7,6 +9,7 @@ use serde::Deserialize;
 use std::collections::HashMap;
 use std::net::{SocketAddr, ToSocketAddrs};
 use std::path::Path;
+use std::time::Duration;
 
 mod general;
 mod log;
@@ -22,6 +25,18 @@ fn enabled() -> bool {
     true
 }
 
+fn sample_rate() -> u32 {
+    1
+}
+
+fn sample_frequency() -> u32 {
+    49
+}
+
+/// The highest sampling frequency, in Hz, which may be configured. Sampling
+/// much faster would make the profiler itself a significant source of load.
+const MAX_SAMPLE_FREQUENCY: u32 = 1000;
+
 fn histogram_grouping_power() -> u8 {
     HISTOGRAM_GROUPING_POWER
 }
@@ -108,4 +123,111 @@ impl Config {
 
         enabled
     }
+
+    /// Returns whether an opt-in sampler is enabled. These samplers have costs
+    /// beyond their own probes, so they are only enabled by `enabled = true` in
+    /// their own section and are not affected by `[defaults]`.
+    pub fn opt_in_enabled(&self, name: &str) -> bool {
+        let enabled = self
+            .samplers
+            .get(name)
+            .and_then(|v| v.enabled())
+            .unwrap_or(false);
+
+        if enabled {
+            debug!("'{name}' sampler is enabled");
+        } else {
+            debug!("'{name}' sampler is not enabled, it must be enabled explicitly");
+        }
+
+        enabled
+    }
+
+    /// Returns the sample rate for the sampler. A sample rate of `N` means
+    /// that samplers which support sampling only record 1-in-N events in their
+    /// distributions.
+    pub fn sample_rate(&self, name: &str) -> u32 {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.sample_rate())
+            .unwrap_or(self.defaults.sample_rate().unwrap_or(sample_rate()))
+    }
+
+    /// Returns the frequency, in Hz, at which the sampler takes samples on each
+    /// CPU. Used by samplers which sample on a timer, such as `cpu_profile`.
+    pub fn sample_frequency(&self, name: &str) -> u32 {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.sample_frequency())
+            .unwrap_or(
+                self.defaults
+                    .sample_frequency()
+                    .unwrap_or(sample_frequency()),
+            )
+    }
+
+    /// Returns the grouping power for the histograms recorded by the sampler.
+    /// Higher powers reduce the relative error of each bucket at the cost of
+    /// more memory for the BPF maps.
+    pub fn histogram_grouping_power(&self, name: &str) -> u8 {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.histogram_grouping_power())
+            .unwrap_or(
+                self.defaults
+                    .histogram_grouping_power()
+                    .unwrap_or(HISTOGRAM_GROUPING_POWER),
+            )
+    }
+
+    /// Returns the latency at or above which the sampler captures exemplars of
+    /// individual events. Exemplar capture is disabled when this is `None`.
+    pub fn exemplar_threshold(&self, name: &str) -> Option<Duration> {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.exemplar_threshold())
+            .or(self.defaults.exemplar_threshold())
+    }
+
+    /// Returns the off-cpu time at or above which the sampler aggregates the
+    /// kernel stacks that tasks blocked in. Stack capture is disabled when this
+    /// is `None`.
+    pub fn offcpu_stack_threshold(&self, name: &str) -> Option<Duration> {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.offcpu_stack_threshold())
+            .or(self.defaults.offcpu_stack_threshold())
+    }
+
+    /// Returns the events selected for the sampler, if it supports a choice of
+    /// events and the events were configured. Samplers use their own default
+    /// set of events otherwise.
+    pub fn events(&self, name: &str) -> Option<&[String]> {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.events())
+            .or(self.defaults.events())
+    }
+
+    /// Returns true if the sampler should read the timestamps the kernel keeps
+    /// in each block request instead of tracing when requests are inserted and
+    /// issued. This is off unless configured, as it changes what the latency
+    /// measures.
+    pub fn request_timestamps(&self, name: &str) -> bool {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.request_timestamps())
+            .or(self.defaults.request_timestamps())
+            .unwrap_or(false)
+    }
+
+    /// Returns the changes to the family each syscall is grouped in, as a map
+    /// from the syscall name to the family name. Syscalls which are not listed
+    /// keep their default family.
+    pub fn syscall_families(&self, name: &str) -> Option<&HashMap<String, String>> {
+        self.samplers
+            .get(name)
+            .and_then(|v| v.syscall_families())
+            .or(self.defaults.syscall_families())
+    }
 }
@@ -19,8 +19,8 @@ impl Default for Prometheus {
 
 impl Prometheus {
     pub fn check(&self) {
-        if !(0..=HISTOGRAM_GROUPING_POWER).contains(&self.histogram_grouping_power) {
-            eprintln!("prometheus histogram downsample factor must be in the range 0..={HISTOGRAM_GROUPING_POWER}",);
+        if !(0..=MAX_HISTOGRAM_GROUPING_POWER).contains(&self.histogram_grouping_power) {
+            eprintln!("prometheus histogram downsample factor must be in the range 0..={MAX_HISTOGRAM_GROUPING_POWER}",);
             std::process::exit(1);
         }
     }
@@ -4,6 +4,22 @@ use crate::config::*;
 pub struct Sampler {
     #[serde(default)]
     enabled: Option<bool>,
+    #[serde(default)]
+    sample_rate: Option<u32>,
+    #[serde(default)]
+    sample_frequency: Option<u32>,
+    #[serde(default)]
+    events: Option<Vec<String>>,
+    #[serde(default)]
+    histogram_grouping_power: Option<u8>,
+    #[serde(default)]
+    exemplar_threshold: Option<String>,
+    #[serde(default)]
+    offcpu_stack_threshold: Option<String>,
+    #[serde(default)]
+    request_timestamps: Option<bool>,
+    #[serde(default)]
+    syscall_families: Option<HashMap<String, String>>,
 }
 
 impl Sampler {
@@ -11,5 +27,89 @@ impl Sampler {
         self.enabled
     }
 
-    pub fn check(&self, _name: &str) {}
+    pub fn sample_rate(&self) -> Option<u32> {
+        self.sample_rate
+    }
+
+    pub fn sample_frequency(&self) -> Option<u32> {
+        self.sample_frequency
+    }
+
+    pub fn events(&self) -> Option<&[String]> {
+        self.events.as_deref()
+    }
+
+    pub fn histogram_grouping_power(&self) -> Option<u8> {
+        self.histogram_grouping_power
+    }
+
+    pub fn exemplar_threshold(&self) -> Option<Duration> {
+        parse_threshold(self.exemplar_threshold.as_deref())
+    }
+
+    pub fn offcpu_stack_threshold(&self) -> Option<Duration> {
+        parse_threshold(self.offcpu_stack_threshold.as_deref())
+    }
+
+    pub fn request_timestamps(&self) -> Option<bool> {
+        self.request_timestamps
+    }
+
+    pub fn syscall_families(&self) -> Option<&HashMap<String, String>> {
+        self.syscall_families.as_ref()
+    }
+
+    pub fn check(&self, name: &str) {
+        if self.sample_rate == Some(0) {
+            eprintln!("{name} sample rate must be greater than zero");
+            std::process::exit(1);
+        }
+
+        if let Some(frequency) = self.sample_frequency {
+            if !(1..=MAX_SAMPLE_FREQUENCY).contains(&frequency) {
+                eprintln!(
+                    "{name} sample frequency must be in the range 1..={MAX_SAMPLE_FREQUENCY}"
+                );
+                std::process::exit(1);
+            }
+        }
+
+        if let Some(power) = self.histogram_grouping_power {
+            if !(MIN_HISTOGRAM_GROUPING_POWER..=MAX_HISTOGRAM_GROUPING_POWER).contains(&power) {
+                eprintln!("{name} histogram grouping power must be in the range {MIN_HISTOGRAM_GROUPING_POWER}..={MAX_HISTOGRAM_GROUPING_POWER}");
+                std::process::exit(1);
+            }
+        }
+
+        for (option, threshold) in [
+            ("exemplar threshold", &self.exemplar_threshold),
+            ("off-cpu stack threshold", &self.offcpu_stack_threshold),
+        ] {
+            if let Some(threshold) = threshold {
+                match threshold.parse::<humantime::Duration>() {
+                    Ok(threshold) => {
+                        if Duration::from(threshold).is_zero() {
+                            eprintln!("{name} {option} must be greater than zero");
+                            std::process::exit(1);
+                        }
+                    }
+                    Err(e) => {
+                        eprintln!("{name} {option} is not valid: {e}");
+                        std::process::exit(1);
+                    }
+                }
+            }
+        }
+
+        if self.events.as_ref().is_some_and(|events| events.is_empty()) {
+            eprintln!("{name} events must not be empty");
+            std::process::exit(1);
+        }
+    }
+}
+
+fn parse_threshold(threshold: Option<&str>) -> Option<Duration> {
+    threshold
+        .and_then(|v| v.parse::<humantime::Duration>().ok())
+        .map(|v| v.into())
 }
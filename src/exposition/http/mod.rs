@@ -1,6 +1,7 @@
 use crate::common::*;
 use crate::{Arc, Config, Sampler};
-use axum::extract::State;
+use axum::extract::{Path, State};
+use axum::http::StatusCode;
 use axum::routing::get;
 use axum::Router;
 use metriken::{AtomicHistogram, RwLockHistogram, Value};
@@ -38,6 +39,9 @@ fn app(state: Arc<AppState>) -> Router {
         .route("/metrics/binary", get(msgpack))
         .route("/vars", get(human_readable))
         .route("/vars.json", get(json))
+        .route("/exemplars", get(exemplars_human_readable))
+        .route("/exemplars.json", get(exemplars_json))
+        .route("/stacks/:name", get(stacks))
         .with_state(state)
         .layer(
             ServiceBuilder::new()
@@ -69,6 +73,75 @@ async fn json(State(state): State<Arc<AppState>>) -> String {
     content
 }
 
+/// Lists the recent exemplars of outlier events, most recent first.
+async fn exemplars_human_readable(State(state): State<Arc<AppState>>) -> String {
+    refresh(&state.samplers).await;
+
+    let mut content = String::new();
+
+    for e in exemplars().iter().rev() {
+        content += &format!(
+            "{} {} {}={} latency={:?} pid={} tgid={} comm={} cgroup={}\n",
+            humantime::format_rfc3339_micros(e.timestamp),
+            e.sampler,
+            e.id_label,
+            e.id,
+            e.latency,
+            e.pid,
+            e.tgid,
+            e.comm,
+            e.cgroup,
+        );
+    }
+
+    content
+}
+
+async fn exemplars_json(State(state): State<Arc<AppState>>) -> String {
+    refresh(&state.samplers).await;
+
+    let data: Vec<String> = exemplars()
+        .iter()
+        .rev()
+        .map(|e| {
+            let timestamp = e
+                .timestamp
+                .duration_since(std::time::UNIX_EPOCH)
+                .unwrap_or_default()
+                .as_nanos();
+
+            format!(
+                "{{\"timestamp\": {timestamp}, \"sampler\": \"{}\", \"{}\": \"{}\", \"latency\": {}, \"pid\": {}, \"tgid\": {}, \"comm\": \"{}\", \"cgroup\": {}}}",
+                e.sampler,
+                e.id_label,
+                json_escape(&e.id),
+                e.latency.as_nanos(),
+                e.pid,
+                e.tgid,
+                json_escape(&e.comm),
+                e.cgroup,
+            )
+        })
+        .collect();
+
+    let mut content = "[".to_string();
+    content += &data.join(", ");
+    content += "]";
+
+    content
+}
+
+/// Returns the most recent stack profile with the provided name in the folded
+/// format, such as `offcpu` from the `scheduler_runqueue` sampler.
+async fn stacks(
+    State(state): State<Arc<AppState>>,
+    Path(name): Path<String>,
+) -> Result<String, StatusCode> {
+    refresh(&state.samplers).await;
+
+    stack_profile(&name).ok_or(StatusCode::NOT_FOUND)
+}
+
 async fn msgpack(State(state): State<Arc<AppState>>) -> Vec<u8> {
     refresh(&state.samplers).await;
 
@@ -146,50 +219,49 @@ async fn prometheus(State(state): State<Arc<AppState>>) -> String {
                 if let Some(histogram) = any.downcast_ref::<RwLockHistogram>() {
                     if state.config.prometheus().histograms() {
                         if let Some(histogram) = histogram.load() {
-                            let current = HISTOGRAM_GROUPING_POWER;
-                            let target = state.config.prometheus().histogram_grouping_power();
-
-                            // downsample the histogram if necessary
-                            let downsampled: Option<histogram::Histogram> = if current == target {
-                                // the powers matched, we don't need to downsample
-                                None
-                            } else {
-                                Some(histogram.downsample(target).unwrap())
-                            };
-
-                            // reassign to either use the downsampled histogram or the original
-                            let histogram = if let Some(histogram) = downsampled.as_ref() {
-                                histogram
-                            } else {
-                                &histogram
-                            };
-
-                            // we need to export a total count (free-running)
-                            let mut count = 0;
-                            // we also need to export a total sum of all observations
-                            // which is also free-running
-                            let mut sum = 0;
-
-                            let mut entry = format!("# TYPE {name}_distribution histogram\n");
-                            for bucket in histogram {
-                                // add this bucket's sum of observations
-                                sum += bucket.count() * bucket.end();
-
-                                // add the count to the aggregate
-                                count += bucket.count();
+                            let entry = prometheus_histogram(
+                                &state.config,
+                                name,
+                                "",
+                                &histogram,
+                                timestamp,
+                            );
 
-                                entry += &format!(
-                                    "{name}_distribution_bucket{{le=\"{}\"}} {count} {timestamp}\n",
-                                    bucket.end()
+                            data.push(format!("# TYPE {name}_distribution histogram\n{entry}"));
+                        }
+                    }
+                } else if let Some(histograms) = any.downcast_ref::<HistogramGroup>() {
+                    if state.config.prometheus().histograms() {
+                        let mut entry = format!("# TYPE {name}_distribution histogram");
+                        let mut populated = false;
+
+                        for id in 0..histograms.len() {
+                            if let Some(histogram) = histograms.load(id) {
+                                let mut labels: Vec<String> =
+                                    if let Some(md) = histograms.load_metadata(id) {
+                                        md.iter().map(|(k, v)| format!("{k}=\"{v}\"")).collect()
+                                    } else {
+                                        Vec::new()
+                                    };
+
+                                labels.push(format!("id=\"{id}\""));
+
+                                let labels = labels.join(", ");
+
+                                populated = true;
+
+                                entry += "\n";
+                                entry += &prometheus_histogram(
+                                    &state.config,
+                                    name,
+                                    &labels,
+                                    &histogram,
+                                    timestamp,
                                 );
                             }
+                        }
 
-                            entry += &format!(
-                                "{name}_distribution_bucket{{le=\"+Inf\"}} {count} {timestamp}\n"
-                            );
-                            entry += &format!("{name}_distribution_count {count} {timestamp}\n");
-                            entry += &format!("{name}_distribution_sum {sum} {timestamp}");
-
+                        if populated {
                             data.push(entry);
                         }
                     }
@@ -297,6 +369,86 @@ async fn prometheus(State(state): State<Arc<AppState>>) -> String {
     parts.join("_")
 }
 
+/// Formats a histogram as a Prometheus histogram. Any `labels` provided are
+/// included with each of the timeseries, the `le` label is always added to the
+/// bucket timeseries.
+fn prometheus_histogram(
+    config: &Config,
+    name: &str,
+    labels: &str,
+    histogram: &histogram::Histogram,
+    timestamp: u128,
+) -> String {
+    let current = histogram.config().grouping_power();
+    let target = config.prometheus().histogram_grouping_power();
+
+    // downsample the histogram if necessary
+    let downsampled: Option<histogram::Histogram> = if current <= target {
+        // the histogram is already at or below the target power, it can't be
+        // upsampled
+        None
+    } else {
+        Some(histogram.downsample(target).unwrap())
+    };
+
+    // reassign to either use the downsampled histogram or the original
+    let histogram = if let Some(histogram) = downsampled.as_ref() {
+        histogram
+    } else {
+        histogram
+    };
+
+    let (bucket_labels, labels) = if labels.is_empty() {
+        (String::new(), String::new())
+    } else {
+        (format!("{labels}, "), format!("{{{labels}}}"))
+    };
+
+    // we need to export a total count (free-running)
+    let mut count = 0;
+    // we also need to export a total sum of all observations
+    // which is also free-running
+    let mut sum = 0;
+
+    let mut entry = String::new();
+    for bucket in histogram {
+        // add this bucket's sum of observations
+        sum += bucket.count() * bucket.end();
+
+        // add the count to the aggregate
+        count += bucket.count();
+
+        entry += &format!(
+            "{name}_distribution_bucket{{{bucket_labels}le=\"{}\"}} {count} {timestamp}\n",
+            bucket.end()
+        );
+    }
+
+    entry +=
+        &format!("{name}_distribution_bucket{{{bucket_labels}le=\"+Inf\"}} {count} {timestamp}\n");
+    entry += &format!("{name}_distribution_count{labels} {count} {timestamp}\n");
+    entry += &format!("{name}_distribution_sum{labels} {sum} {timestamp}");
+
+    entry
+}
+
+/// Escapes a string for use in a JSON string literal. Task names are set by
+/// the task itself, so they may contain any characters.
+fn json_escape(value: &str) -> String {
+    let mut escaped = String::with_capacity(value.len());
+
+    for c in value.chars() {
+        match c {
+            '"' => escaped += "\\\"",
+            '\\' => escaped += "\\\\",
+            c if c.is_control() => escaped += &format!("\\u{:04x}", c as u32),
+            c => escaped.push(c),
+        }
+    }
+
+    escaped
+}
+
 async fn root() -> String {
     let version = env!("CARGO_PKG_VERSION");
     format!("Rezolus {version}\nFor information, see: https://rezolus.com\n")
@@ -360,3 +512,16 @@ fn simple_stats(quoted: bool) -> Vec<String> {
     data.sort();
     data
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn escape() {
+        assert_eq!(json_escape("nginx"), "nginx");
+        assert_eq!(json_escape(r#"a"b\c"#), r#"a\"b\\c"#);
+        assert_eq!(json_escape("a\nb\tc\u{7f}"), "a\\u000ab\\u0009c\\u007f");
+        assert_eq!(json_escape("café"), "café");
+    }
+}
@@ -3,17 +3,26 @@
 // Copyright (c) 2023 The Rezolus Authors
 
 #include <vmlinux.h>
+#include "../../../common/bpf/health.h"
 #include "../../../common/bpf/helpers.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
+#include "../../../common/bpf/core_fixes.h"
+#include "../../../common/bpf/exemplar.h"
 
 extern int LINUX_KERNEL_VERSION __kconfig;
 
 #define COUNTER_GROUP_WIDTH 8
 #define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
-#define HISTOGRAM_POWER 3
+#define HISTOGRAM_BANK HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS)
 #define MAX_CPUS 1024
+#define MAX_DISKS 64
+#define MAX_OPS 4
+#define SIZE_ROWS 12
+#define SIZE_MIN_POWER 12
+#define DISK_NAME_LEN 32
+#define RINGBUF_CAPACITY 32768
 
 #define REQ_OP_BITS 8
 #define REQ_OP_MASK ((1 << REQ_OP_BITS) - 1)
@@ -24,13 +33,61 @@ extern int LINUX_KERNEL_VERSION __kconfig;
 #define REQ_OP_FLUSH 2
 #define REQ_OP_DISCARD 3
 
+// when set, the start timestamps are read from the request at completion and
+// the insert and issue programs are not loaded
+const volatile bool use_request_timestamps = false;
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// the timestamps for an in-flight request. a request which bypasses the IO
+// scheduler is never inserted and only has an issue timestamp
+struct request_start {
+	u64 inserted_at;
+	u64 issued_at;
+};
+
+// passed to userspace when a disk is first seen so that the per-disk
+// histograms can be labeled
+struct disk_info {
+	u32 slot;
+	u32 major;
+	u32 minor;
+	u8 name[DISK_NAME_LEN];
+};
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, 65536);
 	__type(key, struct request *);
-	__type(value, u64);
+	__type(value, struct request_start);
 } start SEC(".maps");
 
+// dummy instance for skeleton to generate definition
+struct disk_info _disk_info = {};
+
+// ringbuf to pass disk info to userspace when a disk is assigned a slot
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(key_size, 0);
+	__uint(value_size, 0);
+	__uint(max_entries, RINGBUF_CAPACITY);
+} disk_info SEC(".maps");
+
+// maps the device number of a disk to its slot in the per-disk histograms
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_DISKS);
+	__type(key, u32);
+	__type(value, u32);
+} disk_slots SEC(".maps");
+
+// the next unassigned slot in the per-disk histograms
+u32 next_disk_slot = 0;
+
+// histograms for the total latency from insert (or issue) to completion
+
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
 	__uint(map_flags, BPF_F_MMAPABLE);
@@ -55,47 +112,187 @@ struct {
 	__uint(max_entries, HISTOGRAM_BUCKETS);
 } write_latency SEC(".maps");
 
-static int __always_inline trace_rq_start(struct request *rq, int issue)
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} flush_latency SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} discard_latency SEC(".maps");
+
+// heatmaps of the total latency by request size, with one heatmap for each
+// op. rows start at requests of up to 4KiB and each row doubles the size, so
+// the last row holds requests larger than 4MiB
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_OPS * SIZE_ROWS * HISTOGRAM_BANK);
+} size_latency SEC(".maps");
+
+// histograms for the time spent in the IO scheduler, from insert to issue
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} queue_latency SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_DISKS * HISTOGRAM_BANK);
+} disk_queue_latency SEC(".maps");
+
+// histograms for the time spent in the device, from issue to completion
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} device_latency SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_DISKS * HISTOGRAM_BANK);
+} disk_device_latency SEC(".maps");
+
+// returns the device number of the disk in the same form as the kernel's
+// `dev_t`, which is also how the disks are identified in exemplars
+static __always_inline u32 disk_dev(struct gendisk *disk)
 {
-	u64 ts = bpf_ktime_get_ns();
+	return (BPF_CORE_READ(disk, major) << 20) | BPF_CORE_READ(disk, first_minor);
+}
 
-	bpf_map_update_elem(&start, &rq, &ts, 0);
-	return 0;
+// returns the slot for the disk the request is for, assigning a new slot if
+// this is the first time the disk has been seen. returns MAX_DISKS if there is
+// no slot for the disk
+static __always_inline u32 disk_slot(struct request *rq)
+{
+	struct gendisk *disk = get_disk(rq);
+	u32 *slot, new_slot, dev;
+
+	if (!disk) {
+		return MAX_DISKS;
+	}
+
+	dev = disk_dev(disk);
+
+	slot = bpf_map_lookup_elem(&disk_slots, &dev);
+
+	if (slot) {
+		return *slot;
+	}
+
+	new_slot = __sync_fetch_and_add(&next_disk_slot, 1);
+
+	if (new_slot >= MAX_DISKS) {
+		health_incr(HEALTH_OUT_OF_RANGE);
+		return MAX_DISKS;
+	}
+
+	// another CPU may have assigned a slot for this disk first, in which case
+	// the new slot goes unused
+	if (bpf_map_update_elem(&disk_slots, &dev, &new_slot, BPF_NOEXIST)) {
+		slot = bpf_map_lookup_elem(&disk_slots, &dev);
+
+		return slot ? *slot : MAX_DISKS;
+	}
+
+	// let userspace know about the new disk
+	struct disk_info info = {
+		.slot = new_slot,
+		.major = BPF_CORE_READ(disk, major),
+		.minor = BPF_CORE_READ(disk, first_minor),
+	};
+
+	bpf_core_read_str(&info.name, DISK_NAME_LEN, &disk->disk_name);
+
+	if (bpf_ringbuf_output(&disk_info, &info, sizeof(info), 0)) {
+		health_incr(HEALTH_RINGBUF_FULL);
+	}
+
+	return new_slot;
 }
 
 static int handle_block_rq_insert(__u64 *ctx)
 {
-	return trace_rq_start((void *)ctx[0], false);
+	struct request *rq = (void *)ctx[0];
+	struct request_start start_ts = {
+		.inserted_at = bpf_ktime_get_ns(),
+	};
+
+	if (bpf_map_update_elem(&start, &rq, &start_ts, 0)) {
+		health_incr(HEALTH_MAP_FULL);
+	}
+
+	return 0;
 }
 
 static int handle_block_rq_issue(__u64 *ctx)
 {
-	return trace_rq_start((void *)ctx[0], true);
+	struct request *rq = (void *)ctx[0];
+	struct request_start *tsp, start_ts = {};
+	u64 ts = bpf_ktime_get_ns();
+
+	tsp = bpf_map_lookup_elem(&start, &rq);
+
+	if (tsp) {
+		tsp->issued_at = ts;
+	} else {
+		start_ts.issued_at = ts;
+
+		if (bpf_map_update_elem(&start, &rq, &start_ts, 0)) {
+			health_incr(HEALTH_MAP_FULL);
+		}
+	}
+
+	return 0;
 }
 
-static int handle_block_rq_complete(struct request *rq, int error, unsigned int nr_bytes)
+// record the latency distributions for a completed request. either of the
+// start timestamps may be zero if they were not recorded
+static __always_inline void record_latency(struct request *rq, unsigned int nr_bytes, u64 inserted_at, u64 issued_at, u64 ts)
 {
-	u64 delta, *tsp, ts = bpf_ktime_get_ns();
-	u32 idx, op;
+	u64 delta;
+	u32 idx, op, slot;
 	unsigned int cmd_flags;
 
-	tsp = bpf_map_lookup_elem(&start, &rq);
-	if (!tsp) {
-		return 0;
-	}
-
 	cmd_flags = BPF_CORE_READ(rq, cmd_flags);
 	op = cmd_flags & REQ_OP_MASK;
 
-	if (*tsp <= ts) {
-		delta = ts - *tsp;
+	slot = disk_slot(rq);
+
+	// total latency, starting from the earliest timestamp we have
+	u64 started_at = inserted_at ? inserted_at : issued_at;
 
-		idx = value_to_index(delta, HISTOGRAM_POWER);
+	if (started_at && started_at <= ts) {
+		delta = ts - started_at;
+
+		idx = value_to_index(delta, histogram_power);
 
 		// increment total latency histogram
 		array_incr(&latency, idx);
 
-		// incremenet per-operation latency histogram
+		// increment per-operation latency histogram
 		switch (op) {
 			case REQ_OP_READ:
 				array_incr(&read_latency, idx);
@@ -103,8 +300,78 @@ static int handle_block_rq_complete(struct request *rq, int error, unsigned int
 			case REQ_OP_WRITE:
 				array_incr(&write_latency, idx);
 				break;
+			case REQ_OP_FLUSH:
+				array_incr(&flush_latency, idx);
+				break;
+			case REQ_OP_DISCARD:
+				array_incr(&discard_latency, idx);
+				break;
+		}
+
+		// increment the size-by-latency heatmap for the operation
+		if (op < MAX_OPS) {
+			u32 row = op * SIZE_ROWS + value_to_row(nr_bytes, SIZE_MIN_POWER, SIZE_ROWS);
+			heatmap_incr(&size_latency, row, histogram_bank_width(histogram_power), histogram_power, delta);
+		}
+
+		// requests usually complete in interrupt context, so exemplars are
+		// not attributed to a task
+		if (exemplar_is_outlier(delta)) {
+			struct gendisk *disk = get_disk(rq);
+
+			exemplar_submit(NULL, disk ? disk_dev(disk) : 0, delta);
+		}
+	}
+
+	// time spent in the IO scheduler
+	if (inserted_at && issued_at && inserted_at <= issued_at) {
+		delta = issued_at - inserted_at;
+
+		idx = value_to_index(delta, histogram_power);
+
+		array_incr(&queue_latency, idx);
+
+		if (slot < MAX_DISKS) {
+			array_incr(&disk_queue_latency, histogram_bank_width(histogram_power) * slot + idx);
+		}
+	}
+
+	// time spent in the device
+	if (issued_at && issued_at <= ts) {
+		delta = ts - issued_at;
+
+		idx = value_to_index(delta, histogram_power);
+
+		array_incr(&device_latency, idx);
+
+		if (slot < MAX_DISKS) {
+			array_incr(&disk_device_latency, histogram_bank_width(histogram_power) * slot + idx);
 		}
 	}
+}
+
+static int handle_block_rq_complete(struct request *rq, int error, unsigned int nr_bytes)
+{
+	u64 ts = bpf_ktime_get_ns();
+	struct request_start *tsp;
+
+	// the kernel keeps its own timestamps in the request, so there is no need
+	// to track them ourselves. `start_time_ns` is set when the request is
+	// allocated. `io_start_time_ns` is only set on issue when the queue
+	// collects IO stats, so it is zero otherwise and only the total latency is
+	// recorded
+	if (use_request_timestamps) {
+		record_latency(rq, nr_bytes, BPF_CORE_READ(rq, start_time_ns), BPF_CORE_READ(rq, io_start_time_ns), ts);
+		return 0;
+	}
+
+	tsp = bpf_map_lookup_elem(&start, &rq);
+	if (!tsp) {
+		health_incr(HEALTH_MISSING_START);
+		return 0;
+	}
+
+	record_latency(rq, nr_bytes, tsp->inserted_at, tsp->issued_at, ts);
 
 	bpf_map_delete_elem(&start, &rq);
 	return 0;
@@ -5,6 +5,31 @@
 ///
 /// And produces these stats:
 /// * `blockio/latency`
+/// * `blockio/read/latency`
+/// * `blockio/write/latency`
+/// * `blockio/flush/latency`
+/// * `blockio/discard/latency`
+/// * `blockio/*/latency/size`
+/// * `blockio/queue/latency`
+/// * `blockio/queue/latency/disk`
+/// * `blockio/device/latency`
+/// * `blockio/device/latency/disk`
+///
+/// The queue latency is the time from insert to issue, which is the time spent
+/// in the IO scheduler. The device latency is the time from issue to
+/// completion. Requests which bypass the IO scheduler only have a device
+/// latency.
+///
+/// The `blockio/*/latency/size` heatmaps split the total latency for each op by
+/// the size of the request. Each range of sizes is labeled with its upper
+/// bound in bytes as `size`, from 4KiB up to 4MiB with the last range holding
+/// all larger requests.
+///
+/// When `request_timestamps` is set and the kernel exposes `start_time_ns` and
+/// `io_start_time_ns` in the request, they are read at completion instead and
+/// the insert and issue traces are not attached. In this mode the latency
+/// starts when the request is allocated, and the queue and device latency are
+/// only available for queues where the kernel collects IO stats.
 
 static NAME: &str = "blockio_latency";
 
@@ -20,19 +45,96 @@ use crate::*;
 
 use std::sync::Arc;
 
+unsafe impl plain::Plain for bpf::types::disk_info {}
+
+fn handle_disk_info(data: &[u8]) -> i32 {
+    let mut disk_info = bpf::types::disk_info::default();
+
+    if plain::copy_from_bytes(&mut disk_info, data).is_ok() {
+        let name = String::from_utf8_lossy(&disk_info.name)
+            .trim_end_matches(char::from(0))
+            .to_string();
+
+        let slot = disk_info.slot as usize;
+
+        for group in [&BLOCKIO_QUEUE_LATENCY_DISK, &BLOCKIO_DEVICE_LATENCY_DISK] {
+            group.insert_metadata(slot, "name".to_string(), name.clone());
+            group.insert_metadata(slot, "major".to_string(), disk_info.major.to_string());
+            group.insert_metadata(slot, "minor".to_string(), disk_info.minor.to_string());
+        }
+    }
+
+    0
+}
+
+/// Formats the device number of a disk from the exemplars as `major:minor`.
+fn disk_dev(dev: u32) -> String {
+    format!("{}:{}", dev >> 20, dev & 0xfffff)
+}
+
 #[distributed_slice(SAMPLERS)]
 fn init(config: Arc<Config>) -> SamplerResult {
     if !config.enabled(NAME) {
         return Ok(None);
     }
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    // when configured and the kernel keeps its own timestamps in the request we
+    // can read them at completion and skip tracking every request in a hash map
+    let use_request_timestamps = config.request_timestamps(NAME)
+        && kernel_struct_has_field("request", "start_time_ns")
+        && kernel_struct_has_field("request", "io_start_time_ns");
+
+    let histogram_power = config.histogram_grouping_power(NAME);
+    let exemplar_threshold = config.exemplar_threshold(NAME);
+
+    let mut bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+
+            if let Some(threshold) = exemplar_threshold {
+                skel.maps.rodata_data.exemplar_threshold = threshold.as_nanos() as u64;
+            }
+
+            if use_request_timestamps {
+                debug!("{NAME} using request timestamps");
+
+                skel.maps.rodata_data.use_request_timestamps = true;
+                skel.maps.start.set_max_entries(1)?;
+                skel.progs.block_rq_insert.set_autoload(false)?;
+                skel.progs.block_rq_issue.set_autoload(false)?;
+            }
+
+            Ok(())
+        })
+        .histogram_grouping_power(histogram_power)
         .histogram("latency", &BLOCKIO_LATENCY)
         .histogram("read_latency", &BLOCKIO_READ_LATENCY)
         .histogram("write_latency", &BLOCKIO_WRITE_LATENCY)
-        .build()?;
+        .histogram("flush_latency", &BLOCKIO_FLUSH_LATENCY)
+        .histogram("discard_latency", &BLOCKIO_DISCARD_LATENCY)
+        .histogram("queue_latency", &BLOCKIO_QUEUE_LATENCY)
+        .histogram("device_latency", &BLOCKIO_DEVICE_LATENCY)
+        .histogram_group("disk_queue_latency", &BLOCKIO_QUEUE_LATENCY_DISK)
+        .histogram_group("disk_device_latency", &BLOCKIO_DEVICE_LATENCY_DISK)
+        .heatmap(
+            "size_latency",
+            vec![
+                &BLOCKIO_READ_LATENCY_SIZE,
+                &BLOCKIO_WRITE_LATENCY_SIZE,
+                &BLOCKIO_FLUSH_LATENCY_SIZE,
+                &BLOCKIO_DISCARD_LATENCY_SIZE,
+            ],
+            "size",
+            SIZE_MIN_POWER,
+        )
+        .ringbuf_handler("disk_info", handle_disk_info)
+        .health_counters("health");
+
+    if exemplar_threshold.is_some() {
+        bpf = bpf.exemplars("exemplars", "device", disk_dev);
+    }
 
-    Ok(Some(Box::new(bpf)))
+    Ok(Some(Box::new(bpf.build()?)))
 }
 
 impl SkelExt for ModSkel<'_> {
@@ -41,6 +143,16 @@ impl SkelExt for ModSkel<'_> {
             "latency" => &self.maps.latency,
             "read_latency" => &self.maps.read_latency,
             "write_latency" => &self.maps.write_latency,
+            "flush_latency" => &self.maps.flush_latency,
+            "discard_latency" => &self.maps.discard_latency,
+            "size_latency" => &self.maps.size_latency,
+            "queue_latency" => &self.maps.queue_latency,
+            "device_latency" => &self.maps.device_latency,
+            "disk_queue_latency" => &self.maps.disk_queue_latency,
+            "disk_device_latency" => &self.maps.disk_device_latency,
+            "disk_info" => &self.maps.disk_info,
+            "exemplars" => &self.maps.exemplars,
+            "health" => &self.maps.health,
             _ => unimplemented!(),
         }
     }
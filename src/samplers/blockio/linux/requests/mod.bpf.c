@@ -12,7 +12,6 @@ extern int LINUX_KERNEL_VERSION __kconfig;
 
 #define COUNTER_GROUP_WIDTH 8
 #define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
-#define HISTOGRAM_POWER 3
 #define MAX_CPUS 1024
 
 #define REQ_OP_BITS 8
@@ -24,6 +23,10 @@ extern int LINUX_KERNEL_VERSION __kconfig;
 #define REQ_OP_FLUSH 2
 #define REQ_OP_DISCARD 3
 
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
 // counters
 // 0 - read ops
 // 1 - write ops
@@ -65,6 +68,22 @@ struct {
 	__uint(max_entries, HISTOGRAM_BUCKETS);
 } write_size SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} flush_size SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} discard_size SEC(".maps");
+
 static int handle_block_rq_complete(struct request *rq, int error, unsigned int nr_bytes)
 {
 	u64 delta, *tsp;
@@ -82,12 +101,12 @@ static int handle_block_rq_complete(struct request *rq, int error, unsigned int
 		idx = idx + COUNTER_GROUP_WIDTH / 2;
 		array_add(&counters, idx, nr_bytes);
 
-		idx = value_to_index(nr_bytes, HISTOGRAM_POWER);
+		idx = value_to_index(nr_bytes, histogram_power);
 
 		// increment size histogram for all ops
 		array_incr(&size, idx);
 
-		// incremenet per-operation size histogram
+		// increment per-operation size histogram
 		switch (op) {
 			case REQ_OP_READ:
 				array_incr(&read_size, idx);
@@ -95,6 +114,12 @@ static int handle_block_rq_complete(struct request *rq, int error, unsigned int
 			case REQ_OP_WRITE:
 				array_incr(&write_size, idx);
 				break;
+			case REQ_OP_FLUSH:
+				array_incr(&flush_size, idx);
+				break;
+			case REQ_OP_DISCARD:
+				array_incr(&discard_size, idx);
+				break;
 		}
 	}
 
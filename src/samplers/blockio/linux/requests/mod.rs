@@ -5,6 +5,7 @@
 /// * `blockio/*/operations`
 /// * `blockio/*/bytes`
 /// * `blockio/size`
+/// * `blockio/*/size`
 
 static NAME: &str = "blockio_requests";
 
@@ -37,11 +38,20 @@ fn init(config: Arc<Config>) -> SamplerResult {
         &BLOCKIO_DISCARD_BYTES,
     ];
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+            Ok(())
+        })
+        .histogram_grouping_power(histogram_power)
         .counters("counters", counters)
         .histogram("size", &BLOCKIO_SIZE)
         .histogram("read_size", &BLOCKIO_READ_SIZE)
         .histogram("write_size", &BLOCKIO_WRITE_SIZE)
+        .histogram("flush_size", &BLOCKIO_FLUSH_SIZE)
+        .histogram("discard_size", &BLOCKIO_DISCARD_SIZE)
         .build()?;
 
     Ok(Some(Box::new(bpf)))
@@ -54,6 +64,8 @@ impl SkelExt for ModSkel<'_> {
             "size" => &self.maps.size,
             "read_size" => &self.maps.read_size,
             "write_size" => &self.maps.write_size,
+            "flush_size" => &self.maps.flush_size,
+            "discard_size" => &self.maps.discard_size,
             _ => unimplemented!(),
         }
     }
@@ -1,4 +1,16 @@
-use crate::common::HISTOGRAM_GROUPING_POWER;
+use crate::common::{HistogramGroup, HISTOGRAM_GROUPING_POWER, MAX_HISTOGRAM_GROUPING_POWER};
+
+/// The maximum number of disks which are tracked individually. This must match
+/// `MAX_DISKS` in the BPF program.
+pub const MAX_DISKS: usize = 64;
+
+/// The number of request size rows in each size-by-latency heatmap. Must match
+/// `SIZE_ROWS` in the BPF program.
+pub const SIZE_ROWS: usize = 12;
+
+/// The upper bound of the first request size row is `2^SIZE_MIN_POWER` bytes.
+/// Must match `SIZE_MIN_POWER` in the BPF program.
+pub const SIZE_MIN_POWER: u8 = 12;
 use metriken::*;
 
 #[metric(
@@ -6,7 +18,8 @@ use metriken::*;
     description = "Distribution of blockio operation latency in nanoseconds",
     metadata = { unit = "nanoseconds" }
 )]
-pub static BLOCKIO_LATENCY: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static BLOCKIO_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "blockio/read/latency",
@@ -14,7 +27,7 @@ pub static BLOCKIO_LATENCY: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GRO
     metadata = { unit = "nanoseconds" }
 )]
 pub static BLOCKIO_READ_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "blockio/write/latency",
@@ -22,28 +35,126 @@ pub static BLOCKIO_READ_LATENCY: RwLockHistogram =
     metadata = { unit = "nanoseconds" }
 )]
 pub static BLOCKIO_WRITE_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/flush/latency",
+    description = "Distribution of blockio flush operation latency in nanoseconds",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_FLUSH_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/discard/latency",
+    description = "Distribution of blockio discard operation latency in nanoseconds",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_DISCARD_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/read/latency/size",
+    description = "Distribution of blockio read operation latency in nanoseconds, for each range of request sizes",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_READ_LATENCY_SIZE: HistogramGroup =
+    HistogramGroup::new(SIZE_ROWS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/write/latency/size",
+    description = "Distribution of blockio write operation latency in nanoseconds, for each range of request sizes",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_WRITE_LATENCY_SIZE: HistogramGroup =
+    HistogramGroup::new(SIZE_ROWS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/flush/latency/size",
+    description = "Distribution of blockio flush operation latency in nanoseconds, for each range of request sizes",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_FLUSH_LATENCY_SIZE: HistogramGroup =
+    HistogramGroup::new(SIZE_ROWS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/discard/latency/size",
+    description = "Distribution of blockio discard operation latency in nanoseconds, for each range of request sizes",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_DISCARD_LATENCY_SIZE: HistogramGroup =
+    HistogramGroup::new(SIZE_ROWS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/queue/latency",
+    description = "Distribution of the time blockio operations spend in the IO scheduler in nanoseconds",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_QUEUE_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/queue/latency/disk",
+    description = "Distribution of the time blockio operations spend in the IO scheduler in nanoseconds, for each disk",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_QUEUE_LATENCY_DISK: HistogramGroup =
+    HistogramGroup::new(MAX_DISKS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/device/latency",
+    description = "Distribution of the time blockio operations spend in the device in nanoseconds",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_DEVICE_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/device/latency/disk",
+    description = "Distribution of the time blockio operations spend in the device in nanoseconds, for each disk",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BLOCKIO_DEVICE_LATENCY_DISK: HistogramGroup =
+    HistogramGroup::new(MAX_DISKS, HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "blockio/size",
     description = "Distribution of blockio operation sizes in bytes",
     metadata = { unit = "bytes" }
 )]
-pub static BLOCKIO_SIZE: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static BLOCKIO_SIZE: RwLockHistogram = RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "blockio/read/size",
     description = "Distribution of blockio read operation sizes in bytes",
     metadata = { unit = "bytes" }
 )]
-pub static BLOCKIO_READ_SIZE: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static BLOCKIO_READ_SIZE: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "blockio/write/size",
     description = "Distribution of blockio write operation sizes in bytes",
     metadata = { unit = "bytes" }
 )]
-pub static BLOCKIO_WRITE_SIZE: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static BLOCKIO_WRITE_SIZE: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/flush/size",
+    description = "Distribution of blockio flush operation sizes in bytes",
+    metadata = { unit = "bytes" }
+)]
+pub static BLOCKIO_FLUSH_SIZE: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "blockio/discard/size",
+    description = "Distribution of blockio discard operation sizes in bytes",
+    metadata = { unit = "bytes" }
+)]
+pub static BLOCKIO_DISCARD_SIZE: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "blockio/operations/total",
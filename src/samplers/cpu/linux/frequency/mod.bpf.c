@@ -1,237 +0,0 @@
-// SPDX-License-Identifier: GPL-2.0
-// Copyright (c) 2023 The Rezolus Authors
-
-#include <vmlinux.h>
-#include "../../../common/bpf/cgroup_info.h"
-#include "../../../common/bpf/helpers.h"
-#include <bpf/bpf_core_read.h>
-#include <bpf/bpf_helpers.h>
-#include <bpf/bpf_tracing.h>
-
-#define COUNTER_GROUP_WIDTH 8
-#define MAX_CPUS 1024
-#define MAX_CGROUPS 4096
-#define RINGBUF_CAPACITY 32768
-
-#define TASK_RUNNING 0
-
-// counter positions
-#define APERF 0
-#define MPERF 1
-#define TSC 2
-
-// dummy instance for skeleton to generate definition
-struct cgroup_info _cgroup_info = {};
-
-// ringbuf to pass cgroup info
-struct {
-	__uint(type, BPF_MAP_TYPE_RINGBUF);
-	__uint(key_size, 0);
-	__uint(value_size, 0);
-	__uint(max_entries, RINGBUF_CAPACITY);
-} cgroup_info SEC(".maps");
-
-// holds known cgroup serial numbers to help determine new or changed groups
-struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
-	__uint(map_flags, BPF_F_MMAPABLE);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, MAX_CGROUPS);
-} cgroup_serial_numbers SEC(".maps");
-
-// counters for various events
-
-struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
-	__uint(map_flags, BPF_F_MMAPABLE);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, MAX_CGROUPS);
-} cgroup_aperf SEC(".maps");
-
-struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
-	__uint(map_flags, BPF_F_MMAPABLE);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, MAX_CGROUPS);
-} cgroup_mperf SEC(".maps");
-
-struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
-	__uint(map_flags, BPF_F_MMAPABLE);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, MAX_CGROUPS);
-} cgroup_tsc SEC(".maps");
-
-// previous readings for various events
-
-struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
-	__uint(map_flags, BPF_F_MMAPABLE);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, MAX_CGROUPS);
-} aperf_prev SEC(".maps");
-
-struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
-	__uint(map_flags, BPF_F_MMAPABLE);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, MAX_CGROUPS);
-} mperf_prev SEC(".maps");
-
-struct {
-	__uint(type, BPF_MAP_TYPE_ARRAY);
-	__uint(map_flags, BPF_F_MMAPABLE);
-	__type(key, u32);
-	__type(value, u64);
-	__uint(max_entries, MAX_CGROUPS);
-} tsc_prev SEC(".maps");
-
-/**
- * perf event arrays
- */
-
-struct {
-	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
-	__type(key, u32);
-	__type(value, u32);
-} aperf SEC(".maps");
-
-struct {
-	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
-	__type(key, u32);
-	__type(value, u32);
-} mperf SEC(".maps");
-
-struct {
-	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
-	__type(key, u32);
-	__type(value, u32);
-} tsc SEC(".maps");
-
-/**
- * commit 2f064a59a1 ("sched: Change task_struct::state") changes
- * the name of task_struct::state to task_struct::__state
- * see:
- *     https://github.com/torvalds/linux/commit/2f064a59a1
- */
-struct task_struct___o {
-	volatile long int state;
-} __attribute__((preserve_access_index));
-
-struct task_struct___x {
-	unsigned int __state;
-} __attribute__((preserve_access_index));
-
-static __always_inline __s64 get_task_state(void *task)
-{
-	struct task_struct___x *t = task;
-
-	if (bpf_core_field_exists(t->__state))
-		return BPF_CORE_READ(t, __state);
-	return BPF_CORE_READ((struct task_struct___o *)task, state);
-}
-
-// attach a tracepoint on sched_switch for per-cgroup accounting
-
-SEC("tp_btf/sched_switch")
-int handle__sched_switch(u64 *ctx)
-{
-	/* TP_PROTO(bool preempt, struct task_struct *prev,
-	 *      struct task_struct *next)
-	 */
-	struct task_struct *prev = (struct task_struct *)ctx[1];
-	struct task_struct *next = (struct task_struct *)ctx[2];
-
-	u32 idx;
-	u64 *elem, delta_a, delta_m, delta_t;
-
-	u32 processor_id = bpf_get_smp_processor_id();
-
-	u64 a = bpf_perf_event_read(&aperf, BPF_F_CURRENT_CPU);
-	u64 m = bpf_perf_event_read(&mperf, BPF_F_CURRENT_CPU);
-	u64 t = bpf_perf_event_read(&tsc, BPF_F_CURRENT_CPU);
-
-	if (bpf_core_field_exists(prev->sched_task_group)) {
-		int cgroup_id = prev->sched_task_group->css.id;
-		u64	serial_nr = prev->sched_task_group->css.serial_nr;
-
-		if (cgroup_id && cgroup_id < MAX_CGROUPS) {
-
-			// we check to see if this is a new cgroup by checking the serial number
-
-			elem = bpf_map_lookup_elem(&cgroup_serial_numbers, &cgroup_id);
-
-			if (elem && *elem != serial_nr) {
-				// zero the counters, they will not be exported until they are non-zero
-				u64 zero = 0;
-				bpf_map_update_elem(&cgroup_aperf, &cgroup_id, &zero, BPF_ANY);
-				bpf_map_update_elem(&cgroup_mperf, &cgroup_id, &zero, BPF_ANY);
-				bpf_map_update_elem(&cgroup_tsc, &cgroup_id, &zero, BPF_ANY);
-
-				// initialize the cgroup info
-				struct cgroup_info cginfo = {
-					.id = cgroup_id,
-				};
-
-				// read the cgroup name
-				bpf_probe_read_kernel_str(&cginfo.name, CGROUP_NAME_LEN, prev->sched_task_group->css.cgroup->kn->name);
-
-				// read the cgroup parent name
-				bpf_probe_read_kernel_str(&cginfo.pname, CGROUP_NAME_LEN, prev->sched_task_group->css.cgroup->kn->parent->name);
-
-				// read the cgroup grandparent name
-				bpf_probe_read_kernel_str(&cginfo.gpname, CGROUP_NAME_LEN, prev->sched_task_group->css.cgroup->kn->parent->parent->name);
-				
-				// push the cgroup info into the ringbuf
-				bpf_ringbuf_output(&cgroup_info, &cginfo, sizeof(cginfo), 0);
-
-				// update the serial number in the local map
-				bpf_map_update_elem(&cgroup_serial_numbers, &cgroup_id, &serial_nr, BPF_ANY);
-			}
-
-			// update cgroup aperf
-
-			elem = bpf_map_lookup_elem(&aperf_prev, &processor_id);
-
-			if (elem) {
-				delta_a = a - *elem;
-
-				array_add(&cgroup_aperf, cgroup_id, delta_a);
-			}
-
-			// update cgroup mperf
-
-			elem = bpf_map_lookup_elem(&mperf_prev, &processor_id);
-
-			if (elem) {
-				delta_m = m - *elem;
-
-				array_add(&cgroup_mperf, cgroup_id, delta_m);
-			}
-
-			// update cgroup tsc
-
-			elem = bpf_map_lookup_elem(&tsc_prev, &processor_id);
-
-			if (elem) {
-				delta_t = t - *elem;
-
-				array_add(&cgroup_tsc, cgroup_id, delta_t);
-			}
-		}
-	}
-
-	bpf_map_update_elem(&aperf_prev, &processor_id, &a, BPF_ANY);
-	bpf_map_update_elem(&mperf_prev, &processor_id, &m, BPF_ANY);
-	bpf_map_update_elem(&tsc_prev, &processor_id, &t, BPF_ANY);
-
-	return 0;
-}
-
-char LICENSE[] SEC("license") = "GPL";
@@ -1,4 +1,5 @@
 mod cores;
-mod frequency;
-mod perf;
+pub mod frequency;
+pub mod perf;
+mod profile;
 mod usage;
@@ -1,107 +1,121 @@
 //! Collects CPU perf counters using BPF and traces:
 //! * `sched_switch`
 //!
-//! Initializes perf events to collect cycles and instructions.
+//! The BPF program is shared with the other samplers which trace context
+//! switches, see `scheduler/linux/sched_switch`.
 //!
-//! And produces these stats:
+//! Initializes perf events to collect cycles and instructions by default. The
+//! `events` option selects up to `MAX_EVENTS` events from:
+//! * `cycles`
+//! * `instructions`
+//! * `llc_misses`
+//! * `branch_misses`
+//! * `stalled_cycles_frontend`
+//! * `stalled_cycles_backend`
+//! * `dtlb_misses`
+//!
+//! And produces these stats for each selected event, both per-CPU and
+//! per-cgroup:
 //! * `cpu/cycles`
 //! * `cpu/instructions`
+//! * `cpu/llc/misses`
+//! * `cpu/branch/misses`
+//! * `cpu/stalled_cycles/frontend`
+//! * `cpu/stalled_cycles/backend`
+//! * `cpu/dtlb/misses`
+//!
+//! The events are not pinned, so when more events are selected than there are
+//! hardware counters the kernel multiplexes them. The counts are scaled by the
+//! fraction of time each event was running.
 //!
 //! These stats can be used to calculate the IPC and IPNS in post-processing or
 //! in an observability stack.
 
-const NAME: &str = "cpu_perf";
-
-mod bpf {
-    include!(concat!(env!("OUT_DIR"), "/cpu_perf.bpf.rs"));
-}
-
-use bpf::*;
+pub const NAME: &str = "cpu_perf";
 
 use crate::common::*;
 use crate::*;
 
-use std::sync::Arc;
-
 mod stats;
 
 use stats::*;
 
-unsafe impl plain::Plain for bpf::types::cgroup_info {}
-
-fn handle_event(data: &[u8]) -> i32 {
-    let mut cgroup_info = bpf::types::cgroup_info::default();
-
-    if plain::copy_from_bytes(&mut cgroup_info, data).is_ok() {
-        let name = std::str::from_utf8(&cgroup_info.name)
-            .unwrap()
-            .trim_end_matches(char::from(0))
-            .replace("\\x2d", "-");
+/// The maximum number of events. This must match `MAX_EVENTS` in
+/// `scheduler/linux/sched_switch/mod.bpf.c`.
+const MAX_EVENTS: usize = 8;
+
+const DEFAULT_EVENTS: &[&str] = &["cycles", "instructions"];
+
+/// A perf event along with its per-CPU and per-cgroup counters.
+pub type Event = (PerfEvent, &'static CounterGroup, &'static CounterGroup);
+
+/// Returns the perf event along with the per-CPU and per-cgroup metrics for an
+/// event name from the `events` option.
+fn event(name: &str) -> Option<Event> {
+    match name {
+        "cycles" => Some((PerfEvent::cpu_cycles(), &CPU_CYCLES, &CGROUP_CPU_CYCLES)),
+        "instructions" => Some((
+            PerfEvent::instructions(),
+            &CPU_INSTRUCTIONS,
+            &CGROUP_CPU_INSTRUCTIONS,
+        )),
+        "llc_misses" => Some((
+            PerfEvent::llc_misses(),
+            &CPU_LLC_MISSES,
+            &CGROUP_CPU_LLC_MISSES,
+        )),
+        "branch_misses" => Some((
+            PerfEvent::branch_misses(),
+            &CPU_BRANCH_MISSES,
+            &CGROUP_CPU_BRANCH_MISSES,
+        )),
+        "stalled_cycles_frontend" => Some((
+            PerfEvent::stalled_cycles_frontend(),
+            &CPU_STALLED_CYCLES_FRONTEND,
+            &CGROUP_CPU_STALLED_CYCLES_FRONTEND,
+        )),
+        "stalled_cycles_backend" => Some((
+            PerfEvent::stalled_cycles_backend(),
+            &CPU_STALLED_CYCLES_BACKEND,
+            &CGROUP_CPU_STALLED_CYCLES_BACKEND,
+        )),
+        "dtlb_misses" => Some((
+            PerfEvent::dtlb_misses(),
+            &CPU_DTLB_MISSES,
+            &CGROUP_CPU_DTLB_MISSES,
+        )),
+        _ => None,
+    }
+}
 
-        let pname = std::str::from_utf8(&cgroup_info.pname)
-            .unwrap()
-            .trim_end_matches(char::from(0))
-            .replace("\\x2d", "-");
+/// Returns the configured events along with the per-CPU and per-cgroup
+/// metrics for each. The events are counted by the `sched_switch` sampler.
+pub fn events(config: &Config) -> Vec<Event> {
+    let names: Vec<&str> = match config.events(NAME) {
+        Some(events) => events.iter().map(|e| e.as_str()).collect(),
+        None => DEFAULT_EVENTS.to_vec(),
+    };
 
-        let gpname = std::str::from_utf8(&cgroup_info.gpname)
-            .unwrap()
-            .trim_end_matches(char::from(0))
-            .replace("\\x2d", "-");
+    let mut events: Vec<Event> = Vec::new();
 
-        let name = if !gpname.is_empty() {
-            format!("{gpname}_{pname}_{name}")
-        } else if !pname.is_empty() {
-            format!("{pname}_{name}")
-        } else {
-            name.to_string()
+    for name in names {
+        let Some((event, percpu, cgroup)) = event(name) else {
+            error!("{NAME} does not support the event: {name}");
+            continue;
         };
 
-        let id = cgroup_info.id;
-
-        if !name.is_empty() {
-            CGROUP_CPU_CYCLES.insert_metadata(id as usize, "name".to_string(), name.clone());
-            CGROUP_CPU_INSTRUCTIONS.insert_metadata(id as usize, "name".to_string(), name);
+        // skip duplicate events
+        if events.iter().any(|(_, _, c)| std::ptr::eq(*c, cgroup)) {
+            continue;
         }
-    }
-
-    0
-}
-
-#[distributed_slice(SAMPLERS)]
-fn init(config: Arc<Config>) -> SamplerResult {
-    if !config.enabled(NAME) {
-        return Ok(None);
-    }
-
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
-        .perf_event("cycles", PerfEvent::cpu_cycles(), &CPU_CYCLES)
-        .perf_event("instructions", PerfEvent::instructions(), &CPU_INSTRUCTIONS)
-        .packed_counters("cgroup_cycles", &CGROUP_CPU_CYCLES)
-        .packed_counters("cgroup_instructions", &CGROUP_CPU_INSTRUCTIONS)
-        .ringbuf_handler("cgroup_info", handle_event)
-        .build()?;
 
-    Ok(Some(Box::new(bpf)))
-}
-
-impl SkelExt for ModSkel<'_> {
-    fn map(&self, name: &str) -> &libbpf_rs::Map {
-        match name {
-            "cgroup_cycles" => &self.maps.cgroup_cycles,
-            "cgroup_info" => &self.maps.cgroup_info,
-            "cgroup_instructions" => &self.maps.cgroup_instructions,
-            "cycles" => &self.maps.cycles,
-            "instructions" => &self.maps.instructions,
-            _ => unimplemented!(),
+        if events.len() >= MAX_EVENTS {
+            error!("{NAME} supports at most {MAX_EVENTS} events, ignoring: {name}");
+            continue;
         }
-    }
-}
 
-impl OpenSkelExt for ModSkel<'_> {
-    fn log_prog_instructions(&self) {
-        debug!(
-            "{NAME} handle__sched_switch() BPF instruction count: {}",
-            self.progs.handle__sched_switch.insn_cnt()
-        );
+        events.push((event, percpu, cgroup));
     }
+
+    events
 }
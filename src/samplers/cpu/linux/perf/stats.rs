@@ -20,6 +20,46 @@ pub static CPU_CYCLES: CounterGroup = CounterGroup::new(MAX_CPUS);
 )]
 pub static CPU_INSTRUCTIONS: CounterGroup = CounterGroup::new(MAX_CPUS);
 
+#[metric(
+    name = "cpu/llc/misses",
+    description = "The number of last level cache misses",
+    formatter = formatter,
+    metadata = { unit = "misses" }
+)]
+pub static CPU_LLC_MISSES: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "cpu/branch/misses",
+    description = "The number of mispredicted branches",
+    formatter = formatter,
+    metadata = { unit = "misses" }
+)]
+pub static CPU_BRANCH_MISSES: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "cpu/stalled_cycles/frontend",
+    description = "The number of CPU cycles stalled in the frontend",
+    formatter = formatter,
+    metadata = { unit = "cycles" }
+)]
+pub static CPU_STALLED_CYCLES_FRONTEND: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "cpu/stalled_cycles/backend",
+    description = "The number of CPU cycles stalled in the backend",
+    formatter = formatter,
+    metadata = { unit = "cycles" }
+)]
+pub static CPU_STALLED_CYCLES_BACKEND: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "cpu/dtlb/misses",
+    description = "The number of data TLB read misses",
+    formatter = formatter,
+    metadata = { unit = "misses" }
+)]
+pub static CPU_DTLB_MISSES: CounterGroup = CounterGroup::new(MAX_CPUS);
+
 // per-cgroup metrics
 
 #[metric(
@@ -38,6 +78,46 @@ pub static CGROUP_CPU_CYCLES: CounterGroup = CounterGroup::new(MAX_CGROUPS);
 )]
 pub static CGROUP_CPU_INSTRUCTIONS: CounterGroup = CounterGroup::new(MAX_CGROUPS);
 
+#[metric(
+    name = "cgroup/cpu/llc/misses",
+    description = "The number of last level cache misses on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "misses" }
+)]
+pub static CGROUP_CPU_LLC_MISSES: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "cgroup/cpu/branch/misses",
+    description = "The number of mispredicted branches on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "misses" }
+)]
+pub static CGROUP_CPU_BRANCH_MISSES: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "cgroup/cpu/stalled_cycles/frontend",
+    description = "The number of CPU cycles stalled in the frontend on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "cycles" }
+)]
+pub static CGROUP_CPU_STALLED_CYCLES_FRONTEND: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "cgroup/cpu/stalled_cycles/backend",
+    description = "The number of CPU cycles stalled in the backend on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "cycles" }
+)]
+pub static CGROUP_CPU_STALLED_CYCLES_BACKEND: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "cgroup/cpu/dtlb/misses",
+    description = "The number of data TLB read misses on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "misses" }
+)]
+pub static CGROUP_CPU_DTLB_MISSES: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
 // formatters
 
 pub fn formatter(metric: &MetricEntry, format: Format) -> String {
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2024 The Rezolus Authors
+
+// This BPF program is attached to a timer based perf event on each CPU and
+// samples the stacks of whatever is running. The samples are counted in the
+// kernel by cgroup, process, and the user and kernel stacks, so the overhead
+// only depends on the sampling frequency and not on how busy the system is.
+// The cgroup is the cpu cgroup used by the per-cgroup perf counters, so that
+// the profiles line up with the per-cgroup cycles and instructions.
+
+#include <vmlinux.h>
+#include "../../../common/bpf/health.h"
+#include "../../../common/bpf/helpers.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "../../../common/bpf/cgroup.h"
+#include "../../../common/bpf/stacks.h"
+
+#define MAX_STACKS 16384
+#define STACK_DEPTH 64
+
+// the user and kernel stacks of the samples. userspace removes the stacks as
+// it drains the counts, so these only need to hold the stacks seen in one
+// profile
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, STACK_DEPTH * sizeof(u64));
+	__uint(max_entries, MAX_STACKS);
+} stacks SEC(".maps");
+
+// the number of samples for each cgroup, process and stack, drained from
+// userspace
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_STACKS);
+	__type(key, struct stack_key);
+	__type(value, u64);
+} samples SEC(".maps");
+
+SEC("perf_event")
+int profile(struct bpf_perf_event_data *ctx)
+{
+	u64 pid_tgid = bpf_get_current_pid_tgid();
+
+	// the idle task is not interesting, and is only running when the CPU
+	// has nothing else to do
+	if ((u32)pid_tgid == 0) {
+		return 0;
+	}
+
+	// there is no per-cgroup state to reset, so `is_new` is not needed
+	bool is_new;
+
+	struct stack_key key = {
+		.cgroup = task_cgroup_id((struct task_struct *)bpf_get_current_task(), &is_new),
+		.tgid = pid_tgid >> 32,
+		.kernel_stack_id = bpf_get_stackid(ctx, &stacks, 0),
+		.user_stack_id = bpf_get_stackid(ctx, &stacks, BPF_F_USER_STACK),
+	};
+
+	// kernel threads have no user stack, and either stack may be missing if
+	// the map is full. the sample is still counted with the stack we have,
+	// unless there are none
+	if (key.kernel_stack_id < 0 && key.user_stack_id < 0) {
+		health_incr(HEALTH_MAP_FULL);
+		return 0;
+	}
+
+	stack_total_add(&samples, &key, 1);
+
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,63 @@
+//! Continuously profiles what is running on each CPU using BPF. A timer based
+//! perf event samples the user and kernel stacks of the current task at
+//! `sample_frequency` times per second on each CPU, and the samples are counted
+//! in the kernel by cgroup, process and stack.
+//!
+//! The counts are drained periodically and published as a folded stack profile
+//! at `/stacks/cpu`, which can be rendered directly as a flamegraph. The first
+//! frame of each stack is the name of the cpu cgroup, so the profile can be
+//! split the same way as the per-cgroup cycles and instructions.
+//!
+//! Sampling costs CPU time on every CPU regardless of the workload, so this
+//! sampler is only enabled when its own config section enables it.
+
+const NAME: &str = "cpu_profile";
+
+mod bpf {
+    include!(concat!(env!("OUT_DIR"), "/cpu_profile.bpf.rs"));
+}
+
+use bpf::*;
+
+use crate::common::*;
+use crate::*;
+
+use std::sync::Arc;
+
+#[distributed_slice(SAMPLERS)]
+fn init(config: Arc<Config>) -> SamplerResult {
+    if !config.opt_in_enabled(NAME) {
+        return Ok(None);
+    }
+
+    let frequency = config.sample_frequency(NAME);
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .perf_event_program("profile", PerfEvent::cpu_clock(), frequency as u64)
+        .stack_totals("cpu", "samples", "stacks", true)
+        .cgroup_metrics(vec![])
+        .health_counters("health")
+        .build()?;
+
+    Ok(Some(Box::new(bpf)))
+}
+
+impl SkelExt for ModSkel<'_> {
+    fn map(&self, name: &str) -> &libbpf_rs::Map {
+        match name {
+            "samples" => &self.maps.samples,
+            "stacks" => &self.maps.stacks,
+            "health" => &self.maps.health,
+            _ => unimplemented!(),
+        }
+    }
+}
+
+impl OpenSkelExt for ModSkel<'_> {
+    fn log_prog_instructions(&self) {
+        debug!(
+            "{NAME} profile() BPF instruction count: {}",
+            self.progs.profile.insn_cnt()
+        );
+    }
+}
@@ -50,8 +50,7 @@ int account_delta(u64 delta, u32 usage_idx)
 	return 0;
 }
 
-SEC("kprobe/cpuacct_account_field")
-int BPF_KPROBE(cpuacct_account_field_kprobe, void *task, u32 index, u64 delta)
+static __always_inline int account_field(u32 index, u64 delta)
 {
   // ignore both the idle and the iowait counting since both count the idle time
   // https://elixir.bootlin.com/linux/v6.9-rc4/source/kernel/sched/cputime.c#L227
@@ -69,4 +68,19 @@ int BPF_KPROBE(cpuacct_account_field_kprobe, void *task, u32 index, u64 delta)
 	}
 }
 
+// the fentry and kprobe programs trace the same function, only one of them is
+// loaded. fentry is preferred as it avoids the kprobe dispatch cost
+
+SEC("fentry/cpuacct_account_field")
+int BPF_PROG(cpuacct_account_field_fentry, struct task_struct *task, int index, u64 delta)
+{
+	return account_field(index, delta);
+}
+
+SEC("kprobe/cpuacct_account_field")
+int BPF_KPROBE(cpuacct_account_field_kprobe, void *task, u32 index, u64 delta)
+{
+	return account_field(index, delta);
+}
+
 char LICENSE[] SEC("license") = "GPL";
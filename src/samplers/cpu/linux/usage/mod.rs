@@ -47,7 +47,12 @@ fn init(config: Arc<Config>) -> SamplerResult {
         &CPU_USAGE_GUEST_NICE,
     ];
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .fentry_with_fallback(
+            "cpuacct_account_field",
+            "cpuacct_account_field_fentry",
+            "cpuacct_account_field_kprobe",
+        )
         .cpu_counters("counters", counters)
         .build()?;
 
@@ -66,7 +71,11 @@ impl SkelExt for ModSkel<'_> {
 impl OpenSkelExt for ModSkel<'_> {
     fn log_prog_instructions(&self) {
         debug!(
-            "{NAME} cpuacct_account_field() BPF instruction count: {}",
+            "{NAME} cpuacct_account_field() fentry BPF instruction count: {}",
+            self.progs.cpuacct_account_field_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} cpuacct_account_field() kprobe BPF instruction count: {}",
             self.progs.cpuacct_account_field_kprobe.insn_cnt()
         );
     }
@@ -1,5 +1,5 @@
 #[cfg(target_os = "linux")]
-mod linux;
+pub mod linux;
 
 #[cfg(target_os = "macos")]
 mod macos;
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2024 The Rezolus Authors
+
+// This BPF program tracks hardirq handlers and softirqs to provide metrics
+// about the time each CPU spends servicing them, how long each handler runs
+// and how long a raised softirq waits before it runs.
+
+#include <vmlinux.h>
+#include "../../../common/bpf/health.h"
+#include "../../../common/bpf/helpers.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+
+#define COUNTER_GROUP_WIDTH 16
+#define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
+#define HISTOGRAM_BANK HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS)
+#define MAX_CPUS 1024
+#define NR_SOFTIRQS 10
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// the start of the in-progress handlers on a CPU. hardirq handlers do not nest
+// and softirqs only run one at a time on each CPU, so one timestamp of each is
+// enough. a softirq records when it was first raised, and a raise while it is
+// already pending keeps the earlier timestamp
+struct irq_start {
+	u64 hardirq;
+	u64 softirq;
+	u64 raised[NR_SOFTIRQS];
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct irq_start);
+} start SEC(".maps");
+
+// counters for the time spent in each context
+// 0 - hardirq
+// 1..=NR_SOFTIRQS - softirq, by vector + 1
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
+} counters SEC(".maps");
+
+// the distribution of hardirq handler run time
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} hardirq_duration SEC(".maps");
+
+// the distribution of softirq run time, with one bank for each vector
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, NR_SOFTIRQS * HISTOGRAM_BANK);
+} softirq_duration SEC(".maps");
+
+// the distribution of the time from a softirq being raised until it runs, with
+// one bank for each vector
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, NR_SOFTIRQS * HISTOGRAM_BANK);
+} softirq_latency SEC(".maps");
+
+static __always_inline struct irq_start *lookup_start(void)
+{
+	u32 zero = 0;
+
+	return bpf_map_lookup_elem(&start, &zero);
+}
+
+// the time counters are only written from their own CPU, and the contexts which
+// share a bank never write the same entry, so no atomics are needed
+static __always_inline void account_time(u32 row, u64 delta)
+{
+	u32 idx = COUNTER_GROUP_WIDTH * bpf_get_smp_processor_id() + row;
+
+	percpu_add(&counters, idx, delta);
+}
+
+SEC("tp_btf/irq_handler_entry")
+int BPF_PROG(irq_handler_entry, int irq, struct irqaction *action)
+{
+	struct irq_start *start_ts = lookup_start();
+
+	if (start_ts) {
+		start_ts->hardirq = bpf_ktime_get_ns();
+	}
+
+	return 0;
+}
+
+SEC("tp_btf/irq_handler_exit")
+int BPF_PROG(irq_handler_exit, int irq, struct irqaction *action, int ret)
+{
+	struct irq_start *start_ts = lookup_start();
+	u64 delta;
+
+	if (!start_ts || start_ts->hardirq == 0) {
+		health_incr(HEALTH_MISSING_START);
+		return 0;
+	}
+
+	delta = bpf_ktime_get_ns() - start_ts->hardirq;
+	start_ts->hardirq = 0;
+
+	account_time(0, delta);
+	histogram_incr(&hardirq_duration, histogram_power, delta);
+
+	return 0;
+}
+
+SEC("tp_btf/softirq_raise")
+int BPF_PROG(softirq_raise, unsigned int vec_nr)
+{
+	struct irq_start *start_ts;
+
+	if (vec_nr >= NR_SOFTIRQS) {
+		health_incr(HEALTH_OUT_OF_RANGE);
+		return 0;
+	}
+
+	start_ts = lookup_start();
+
+	if (start_ts && start_ts->raised[vec_nr] == 0) {
+		start_ts->raised[vec_nr] = bpf_ktime_get_ns();
+	}
+
+	return 0;
+}
+
+SEC("tp_btf/softirq_entry")
+int BPF_PROG(softirq_entry, unsigned int vec_nr)
+{
+	struct irq_start *start_ts;
+	u64 ts = bpf_ktime_get_ns();
+	u32 idx;
+
+	if (vec_nr >= NR_SOFTIRQS) {
+		health_incr(HEALTH_OUT_OF_RANGE);
+		return 0;
+	}
+
+	start_ts = lookup_start();
+
+	if (!start_ts) {
+		return 0;
+	}
+
+	start_ts->softirq = ts;
+
+	// softirqs raised before we attached have no timestamp, those are not
+	// counted as dropped as they are only missed once
+	if (start_ts->raised[vec_nr] && start_ts->raised[vec_nr] <= ts) {
+		idx = value_to_index(ts - start_ts->raised[vec_nr], histogram_power);
+		array_incr(&softirq_latency, histogram_bank_width(histogram_power) * vec_nr + idx);
+	}
+
+	// the pending bit is cleared before the handler runs, so a raise from
+	// within the handler is the start of the next run
+	start_ts->raised[vec_nr] = 0;
+
+	return 0;
+}
+
+SEC("tp_btf/softirq_exit")
+int BPF_PROG(softirq_exit, unsigned int vec_nr)
+{
+	struct irq_start *start_ts;
+	u64 delta;
+	u32 idx;
+
+	if (vec_nr >= NR_SOFTIRQS) {
+		health_incr(HEALTH_OUT_OF_RANGE);
+		return 0;
+	}
+
+	start_ts = lookup_start();
+
+	if (!start_ts || start_ts->softirq == 0) {
+		health_incr(HEALTH_MISSING_START);
+		return 0;
+	}
+
+	delta = bpf_ktime_get_ns() - start_ts->softirq;
+	start_ts->softirq = 0;
+
+	account_time(vec_nr + 1, delta);
+
+	idx = value_to_index(delta, histogram_power);
+	array_incr(&softirq_duration, histogram_bank_width(histogram_power) * vec_nr + idx);
+
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
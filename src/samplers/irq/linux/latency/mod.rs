@@ -0,0 +1,120 @@
+/// Collects hardirq and softirq stats using BPF and traces:
+/// * `irq_handler_entry`
+/// * `irq_handler_exit`
+/// * `softirq_raise`
+/// * `softirq_entry`
+/// * `softirq_exit`
+///
+/// And produces these stats:
+/// * `hardirq/time`
+/// * `hardirq/duration`
+/// * `softirq/time`
+/// * `softirq/duration`
+/// * `softirq/latency`
+///
+/// The time counters are per-CPU, with the softirq time split by the kind of
+/// softirq as `kind`. The softirq histograms have one histogram for each kind.
+/// The latency is the time from a softirq first being raised on a CPU until it
+/// starts to run, which includes any time spent waiting for `ksoftirqd`.
+///
+/// Hardirq handlers are traced as they are dispatched by the generic IRQ code,
+/// so interrupts which are handled directly by the architecture, such as the
+/// local timer interrupt on x86, are not included.
+
+const NAME: &str = "irq_latency";
+
+mod bpf {
+    include!(concat!(env!("OUT_DIR"), "/irq_latency.bpf.rs"));
+}
+
+use bpf::*;
+
+use crate::common::*;
+use crate::samplers::irq::linux::stats::*;
+use crate::samplers::irq::linux::SOFTIRQ_NAMES;
+use crate::*;
+
+use std::sync::Arc;
+
+#[distributed_slice(SAMPLERS)]
+fn init(config: Arc<Config>) -> SamplerResult {
+    if !config.enabled(NAME) {
+        return Ok(None);
+    }
+
+    for (vec, kind) in SOFTIRQ_NAMES.iter().enumerate() {
+        for group in [&SOFTIRQ_DURATION, &SOFTIRQ_LATENCY] {
+            group.insert_metadata(vec, "kind".to_string(), kind.to_string());
+        }
+    }
+
+    // the order must match the counter indices in the BPF program
+    let counters = vec![
+        &HARDIRQ_TIME,
+        &SOFTIRQ_TIME_HI,
+        &SOFTIRQ_TIME_TIMER,
+        &SOFTIRQ_TIME_NET_TX,
+        &SOFTIRQ_TIME_NET_RX,
+        &SOFTIRQ_TIME_BLOCK,
+        &SOFTIRQ_TIME_IRQ_POLL,
+        &SOFTIRQ_TIME_TASKLET,
+        &SOFTIRQ_TIME_SCHED,
+        &SOFTIRQ_TIME_HRTIMER,
+        &SOFTIRQ_TIME_RCU,
+    ];
+
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+            Ok(())
+        })
+        .histogram_grouping_power(histogram_power)
+        .cpu_counters("counters", counters)
+        .histogram("hardirq_duration", &HARDIRQ_DURATION)
+        .histogram_group("softirq_duration", &SOFTIRQ_DURATION)
+        .histogram_group("softirq_latency", &SOFTIRQ_LATENCY)
+        .health_counters("health")
+        .build()?;
+
+    Ok(Some(Box::new(bpf)))
+}
+
+impl SkelExt for ModSkel<'_> {
+    fn map(&self, name: &str) -> &libbpf_rs::Map {
+        match name {
+            "counters" => &self.maps.counters,
+            "hardirq_duration" => &self.maps.hardirq_duration,
+            "softirq_duration" => &self.maps.softirq_duration,
+            "softirq_latency" => &self.maps.softirq_latency,
+            "health" => &self.maps.health,
+            _ => unimplemented!(),
+        }
+    }
+}
+
+impl OpenSkelExt for ModSkel<'_> {
+    fn log_prog_instructions(&self) {
+        debug!(
+            "{NAME} irq_handler_entry() BPF instruction count: {}",
+            self.progs.irq_handler_entry.insn_cnt()
+        );
+        debug!(
+            "{NAME} irq_handler_exit() BPF instruction count: {}",
+            self.progs.irq_handler_exit.insn_cnt()
+        );
+        debug!(
+            "{NAME} softirq_raise() BPF instruction count: {}",
+            self.progs.softirq_raise.insn_cnt()
+        );
+        debug!(
+            "{NAME} softirq_entry() BPF instruction count: {}",
+            self.progs.softirq_entry.insn_cnt()
+        );
+        debug!(
+            "{NAME} softirq_exit() BPF instruction count: {}",
+            self.progs.softirq_exit.insn_cnt()
+        );
+    }
+}
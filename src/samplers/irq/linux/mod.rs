@@ -0,0 +1,13 @@
+mod stats;
+
+mod latency;
+
+/// The number of softirq vectors in the kernel. Must match `NR_SOFTIRQS` in the
+/// BPF program.
+pub const NR_SOFTIRQS: usize = 10;
+
+/// The names of the softirq vectors, in vector order. These match the names in
+/// `/proc/softirqs` in lowercase.
+pub const SOFTIRQ_NAMES: [&str; NR_SOFTIRQS] = [
+    "hi", "timer", "net_tx", "net_rx", "block", "irq_poll", "tasklet", "sched", "hrtimer", "rcu",
+];
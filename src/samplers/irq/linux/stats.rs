@@ -0,0 +1,126 @@
+use metriken::*;
+
+use crate::common::*;
+use crate::samplers::irq::linux::NR_SOFTIRQS;
+
+#[metric(
+    name = "hardirq/time",
+    description = "The amount of CPU time spent in hardirq handlers",
+    formatter = formatter,
+    metadata = { unit = "nanoseconds" }
+)]
+pub static HARDIRQ_TIME: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for high priority tasklets",
+    formatter = formatter,
+    metadata = { kind = "hi", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_HI: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for timer wheel callbacks",
+    formatter = formatter,
+    metadata = { kind = "timer", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_TIMER: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for network transmit processing",
+    formatter = formatter,
+    metadata = { kind = "net_tx", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_NET_TX: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for network receive processing",
+    formatter = formatter,
+    metadata = { kind = "net_rx", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_NET_RX: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for block device completions",
+    formatter = formatter,
+    metadata = { kind = "block", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_BLOCK: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for IRQ polling",
+    formatter = formatter,
+    metadata = { kind = "irq_poll", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_IRQ_POLL: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for tasklets",
+    formatter = formatter,
+    metadata = { kind = "tasklet", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_TASKLET: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for scheduler load balancing",
+    formatter = formatter,
+    metadata = { kind = "sched", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_SCHED: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for high resolution timer callbacks",
+    formatter = formatter,
+    metadata = { kind = "hrtimer", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_HRTIMER: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "softirq/time",
+    description = "The amount of CPU time spent in softirqs for RCU callbacks",
+    formatter = formatter,
+    metadata = { kind = "rcu", unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_TIME_RCU: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "hardirq/duration",
+    description = "Distribution of the time hardirq handlers run for",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static HARDIRQ_DURATION: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "softirq/duration",
+    description = "Distribution of the time softirqs run for, for each kind of softirq",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_DURATION: HistogramGroup =
+    HistogramGroup::new(NR_SOFTIRQS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "softirq/latency",
+    description = "Distribution of the time from a softirq being raised until it runs, for each kind of softirq",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static SOFTIRQ_LATENCY: HistogramGroup =
+    HistogramGroup::new(NR_SOFTIRQS, HISTOGRAM_GROUPING_POWER, 64);
+
+pub fn formatter(metric: &MetricEntry, format: Format) -> String {
+    match format {
+        Format::Simple => match metric.metadata().get("kind") {
+            Some(kind) => format!("{}/{kind}/cpu", metric.name()),
+            None => format!("{}/cpu", metric.name()),
+        },
+        _ => metric.name().to_string(),
+    }
+}
@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2024 The Rezolus Authors
+
+// This BPF program tracks how long tasks wait for contended locks, both for
+// kernel locks with the `lock:contention_begin` and `lock:contention_end`
+// tracepoints and for userspace locks with the futex syscall. The wait time is
+// recorded in latency histograms and added to counters in total and for the
+// cgroup of the task.
+
+#include <vmlinux.h>
+#include "../../../common/bpf/health.h"
+#include "../../../common/bpf/helpers.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "../../../common/bpf/cgroup.h"
+
+#define COUNTER_GROUP_WIDTH 8
+#define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
+#define HISTOGRAM_BANK HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS)
+#define MAX_CPUS 1024
+#define MAX_WAITS 2
+
+#define WAIT_KERNEL 0
+#define WAIT_FUTEX 1
+
+#define FUTEX_WAKEUPS 2
+
+// contention flags, see `include/trace/events/lock.h`
+#define LCB_F_SPIN (1U << 0)
+#define LCB_F_READ (1U << 1)
+#define LCB_F_WRITE (1U << 2)
+#define LCB_F_RT (1U << 3)
+#define LCB_F_PERCPU (1U << 4)
+#define LCB_F_MUTEX (1U << 5)
+
+// kernel lock kinds, must match `LOCK_KINDS` in userspace
+#define LOCK_SPINLOCK 0
+#define LOCK_RWLOCK 1
+#define LOCK_MUTEX 2
+#define LOCK_RWSEM 3
+#define LOCK_PERCPU_RWSEM 4
+#define LOCK_RT_MUTEX 5
+#define LOCK_OTHER 6
+#define MAX_LOCK_KINDS 7
+
+// futex operations, see `include/uapi/linux/futex.h`
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_LOCK_PI 6
+#define FUTEX_WAIT_BITSET 9
+#define FUTEX_WAKE_BITSET 10
+#define FUTEX_WAIT_REQUEUE_PI 11
+#define FUTEX_LOCK_PI2 13
+#define FUTEX_CMD_MASK 0x7f
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// the in-progress waits for a task. a task only waits for one kernel lock at a
+// time, but an interrupt may contend on a lock while the task it interrupted
+// is waiting, so the lock is kept to match the end of the wait to its start.
+// the futex call is kept separately, as the futex code takes kernel locks
+// itself and those waits overlap the futex call
+struct lock_start {
+	u64 lock;
+	u64 kernel_ts;
+	u64 futex_ts;
+	u32 kind;
+	u32 futex_op;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, struct lock_start);
+} task_start SEC(".maps");
+
+// counters
+// 0 - time waiting for kernel locks
+// 1 - time waiting in futex
+// 2 - tasks woken by futex
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
+} counters SEC(".maps");
+
+// the wait time for each cgroup, with one row of `MAX_CGROUPS` for kernel
+// locks followed by one for futex
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_WAITS * MAX_CGROUPS);
+} cgroup_wait SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_WAITS * MAX_CGROUPS));
+} cgroup_wait_dirty SEC(".maps");
+
+// the distribution of kernel lock wait time, with one bank for each kind
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_LOCK_KINDS * HISTOGRAM_BANK);
+} kernel_latency SEC(".maps");
+
+// the distribution of futex wait time
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} futex_latency SEC(".maps");
+
+static __always_inline struct lock_start *lookup_start(u64 flags)
+{
+	struct task_struct *task = bpf_get_current_task_btf();
+
+	return bpf_task_storage_get(&task_start, task, 0, flags);
+}
+
+// returns the kind of kernel lock from the contention flags. a mutex is first
+// reported as spinning and then again if it has to sleep, so the mutex flag is
+// checked before the spin flag
+static __always_inline u32 lock_kind(u32 flags)
+{
+	if (flags & LCB_F_PERCPU) {
+		return LOCK_PERCPU_RWSEM;
+	} else if (flags & LCB_F_RT) {
+		return LOCK_RT_MUTEX;
+	} else if (flags & LCB_F_MUTEX) {
+		return LOCK_MUTEX;
+	} else if (flags & LCB_F_SPIN) {
+		return (flags & (LCB_F_READ | LCB_F_WRITE)) ? LOCK_RWLOCK : LOCK_SPINLOCK;
+	} else if (flags & (LCB_F_READ | LCB_F_WRITE)) {
+		return LOCK_RWSEM;
+	}
+
+	return LOCK_OTHER;
+}
+
+static __always_inline void account_wait(u32 kind, u64 delta)
+{
+	array_add(&counters, COUNTER_GROUP_WIDTH * bpf_get_smp_processor_id() + kind, delta);
+
+	bool is_new;
+	int cgroup_id = task_cgroup_id(bpf_get_current_task_btf(), &is_new);
+
+	if (cgroup_id) {
+		if (is_new) {
+			// zero the counters, they will not be exported until they are
+			// non-zero
+			u64 zero = 0;
+
+			for (u32 i = 0; i < MAX_WAITS; i++) {
+				u32 offset = i * MAX_CGROUPS + cgroup_id;
+				bpf_map_update_elem(&cgroup_wait, &offset, &zero, BPF_ANY);
+			}
+		}
+
+		array_add_dirty(&cgroup_wait, &cgroup_wait_dirty, kind * MAX_CGROUPS + cgroup_id, delta);
+	}
+}
+
+SEC("tp_btf/contention_begin")
+int BPF_PROG(contention_begin, void *lock, unsigned int flags)
+{
+	struct lock_start *start_ts = lookup_start(BPF_LOCAL_STORAGE_GET_F_CREATE);
+
+	if (!start_ts) {
+		health_incr(HEALTH_MAP_FULL);
+		return 0;
+	}
+
+	// a mutex which has to sleep after spinning is reported twice, the first
+	// report is the start of the wait
+	if (start_ts->kernel_ts) {
+		return 0;
+	}
+
+	start_ts->lock = (u64)lock;
+	start_ts->kind = lock_kind(flags);
+	start_ts->kernel_ts = bpf_ktime_get_ns();
+
+	return 0;
+}
+
+SEC("tp_btf/contention_end")
+int BPF_PROG(contention_end, void *lock, int ret)
+{
+	struct lock_start *start_ts = lookup_start(0);
+	u64 delta;
+	u32 idx, kind;
+
+	// the end of a wait which is nested in another is not matched, as only
+	// the outer wait has a start
+	if (!start_ts || !start_ts->kernel_ts || start_ts->lock != (u64)lock) {
+		return 0;
+	}
+
+	delta = bpf_ktime_get_ns() - start_ts->kernel_ts;
+	kind = start_ts->kind;
+
+	start_ts->kernel_ts = 0;
+
+	if (kind < MAX_LOCK_KINDS) {
+		idx = value_to_index(delta, histogram_power);
+		array_incr(&kernel_latency, histogram_bank_width(histogram_power) * kind + idx);
+	}
+
+	account_wait(WAIT_KERNEL, delta);
+
+	return 0;
+}
+
+SEC("tracepoint/syscalls/sys_enter_futex")
+int sys_enter_futex(struct trace_event_raw_sys_enter *ctx)
+{
+	struct lock_start *start_ts;
+	u32 op = ctx->args[1] & FUTEX_CMD_MASK;
+
+	switch (op) {
+	case FUTEX_WAIT:
+	case FUTEX_WAIT_BITSET:
+	case FUTEX_WAIT_REQUEUE_PI:
+	case FUTEX_LOCK_PI:
+	case FUTEX_LOCK_PI2:
+	case FUTEX_WAKE:
+	case FUTEX_WAKE_BITSET:
+		break;
+	default:
+		return 0;
+	}
+
+	start_ts = lookup_start(BPF_LOCAL_STORAGE_GET_F_CREATE);
+
+	if (!start_ts) {
+		health_incr(HEALTH_MAP_FULL);
+		return 0;
+	}
+
+	start_ts->futex_op = op;
+	start_ts->futex_ts = bpf_ktime_get_ns();
+
+	return 0;
+}
+
+SEC("tracepoint/syscalls/sys_exit_futex")
+int sys_exit_futex(struct trace_event_raw_sys_exit *ctx)
+{
+	struct lock_start *start_ts = lookup_start(0);
+	u64 delta;
+
+	// most tasks never use futex, and those which were in a futex call when
+	// we attached have no start, so neither are counted as dropped
+	if (!start_ts || !start_ts->futex_ts) {
+		return 0;
+	}
+
+	delta = bpf_ktime_get_ns() - start_ts->futex_ts;
+
+	start_ts->futex_ts = 0;
+
+	switch (start_ts->futex_op) {
+	case FUTEX_WAKE:
+	case FUTEX_WAKE_BITSET:
+		// the number of waiters which were woken
+		if (ctx->ret > 0) {
+			array_add(&counters, COUNTER_GROUP_WIDTH * bpf_get_smp_processor_id() + FUTEX_WAKEUPS, ctx->ret);
+		}
+		break;
+	default:
+		histogram_incr(&futex_latency, histogram_power, delta);
+		account_wait(WAIT_FUTEX, delta);
+	}
+
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
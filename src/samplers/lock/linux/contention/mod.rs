@@ -0,0 +1,125 @@
+/// Collects lock contention stats using BPF and traces:
+/// * `lock/contention_begin`
+/// * `lock/contention_end`
+/// * `syscalls/sys_enter_futex`
+/// * `syscalls/sys_exit_futex`
+///
+/// And produces these stats:
+/// * `lock/kernel/wait`
+/// * `lock/kernel/latency`
+/// * `cgroup/lock/kernel/wait`
+/// * `lock/futex/wait`
+/// * `lock/futex/latency`
+/// * `cgroup/lock/futex/wait`
+/// * `lock/futex/wakeups`
+///
+/// The kernel lock histograms have one histogram for each kind of lock, which
+/// is labeled as `kind`. The futex wait time covers the futex calls which wait,
+/// which includes condition variables as well as userspace locks. Contended
+/// kernel locks are only traced on kernels which have the `lock` tracepoints,
+/// from Linux 5.19.
+///
+/// The start timestamps are kept in task local storage, so this sampler is not
+/// available on kernels without it.
+
+const NAME: &str = "lock_contention";
+
+mod bpf {
+    include!(concat!(env!("OUT_DIR"), "/lock_contention.bpf.rs"));
+}
+
+use bpf::*;
+
+use crate::common::*;
+use crate::samplers::lock::linux::stats::*;
+use crate::samplers::lock::linux::LOCK_KINDS;
+use crate::*;
+
+use std::sync::Arc;
+
+#[distributed_slice(SAMPLERS)]
+fn init(config: Arc<Config>) -> SamplerResult {
+    if !config.enabled(NAME) {
+        return Ok(None);
+    }
+
+    if !task_storage_supported() {
+        debug!("{NAME} requires task local storage");
+        return Ok(None);
+    }
+
+    // the contention tracepoints are only in the kernel BTF when they exist
+    let kernel_locks = kernel_struct_has_field("trace_event_raw_contention_begin", "flags");
+
+    for (idx, kind) in LOCK_KINDS.iter().enumerate() {
+        LOCK_KERNEL_LATENCY.insert_metadata(idx, "kind".to_string(), kind.to_string());
+    }
+
+    // the order must match the counter indices in the BPF program
+    let counters = vec![&LOCK_KERNEL_WAIT, &LOCK_FUTEX_WAIT, &LOCK_FUTEX_WAKEUPS];
+
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+
+            if !kernel_locks {
+                debug!("{NAME} kernel lock contention tracepoints not available");
+
+                skel.progs.contention_begin.set_autoload(false)?;
+                skel.progs.contention_end.set_autoload(false)?;
+            }
+
+            Ok(())
+        })
+        .histogram_grouping_power(histogram_power)
+        .counters("counters", counters)
+        .histogram_group("kernel_latency", &LOCK_KERNEL_LATENCY)
+        .histogram("futex_latency", &LOCK_FUTEX_LATENCY)
+        .packed_counters_array(
+            "cgroup_wait",
+            vec![&CGROUP_LOCK_KERNEL_WAIT, &CGROUP_LOCK_FUTEX_WAIT],
+        )
+        .dirty_bitmap("cgroup_wait", "cgroup_wait_dirty")
+        .cgroup_metrics(vec![&CGROUP_LOCK_KERNEL_WAIT, &CGROUP_LOCK_FUTEX_WAIT])
+        .health_counters("health")
+        .build()?;
+
+    Ok(Some(Box::new(bpf)))
+}
+
+impl SkelExt for ModSkel<'_> {
+    fn map(&self, name: &str) -> &libbpf_rs::Map {
+        match name {
+            "counters" => &self.maps.counters,
+            "cgroup_wait" => &self.maps.cgroup_wait,
+            "cgroup_wait_dirty" => &self.maps.cgroup_wait_dirty,
+            "kernel_latency" => &self.maps.kernel_latency,
+            "futex_latency" => &self.maps.futex_latency,
+            "health" => &self.maps.health,
+            _ => unimplemented!(),
+        }
+    }
+}
+
+impl OpenSkelExt for ModSkel<'_> {
+    fn log_prog_instructions(&self) {
+        debug!(
+            "{NAME} contention_begin() BPF instruction count: {}",
+            self.progs.contention_begin.insn_cnt()
+        );
+        debug!(
+            "{NAME} contention_end() BPF instruction count: {}",
+            self.progs.contention_end.insn_cnt()
+        );
+        debug!(
+            "{NAME} sys_enter_futex() BPF instruction count: {}",
+            self.progs.sys_enter_futex.insn_cnt()
+        );
+        debug!(
+            "{NAME} sys_exit_futex() BPF instruction count: {}",
+            self.progs.sys_exit_futex.insn_cnt()
+        );
+    }
+}
@@ -0,0 +1,15 @@
+mod stats;
+
+mod contention;
+
+/// The kinds of kernel locks, in the order of the lock kinds in the BPF
+/// program.
+pub const LOCK_KINDS: [&str; 7] = [
+    "spinlock",
+    "rwlock",
+    "mutex",
+    "rwsem",
+    "percpu_rwsem",
+    "rt_mutex",
+    "other",
+];
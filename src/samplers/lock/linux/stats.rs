@@ -0,0 +1,68 @@
+use crate::common::{
+    CounterGroup, HistogramGroup, HISTOGRAM_GROUPING_POWER, MAX_CGROUPS,
+    MAX_HISTOGRAM_GROUPING_POWER,
+};
+use crate::samplers::lock::linux::LOCK_KINDS;
+use metriken::*;
+
+#[metric(
+    name = "lock/kernel/wait",
+    description = "The amount of time tasks spent waiting for contended kernel locks",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static LOCK_KERNEL_WAIT: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "cgroup/lock/kernel/wait",
+    description = "The amount of time tasks spent waiting for contended kernel locks on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "nanoseconds" }
+)]
+pub static CGROUP_LOCK_KERNEL_WAIT: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "lock/kernel/latency",
+    description = "Distribution of the time tasks spent waiting for contended kernel locks, for each kind of lock",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static LOCK_KERNEL_LATENCY: HistogramGroup =
+    HistogramGroup::new(LOCK_KINDS.len(), HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "lock/futex/wait",
+    description = "The amount of time tasks spent waiting in futex calls",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static LOCK_FUTEX_WAIT: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "cgroup/lock/futex/wait",
+    description = "The amount of time tasks spent waiting in futex calls on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "nanoseconds" }
+)]
+pub static CGROUP_LOCK_FUTEX_WAIT: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "lock/futex/latency",
+    description = "Distribution of the time tasks spent waiting in futex calls",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static LOCK_FUTEX_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "lock/futex/wakeups",
+    description = "The number of tasks woken by futex wake calls",
+    metadata = { unit = "tasks" }
+)]
+pub static LOCK_FUTEX_WAKEUPS: LazyCounter = LazyCounter::new(Counter::default);
+
+pub fn cgroup_formatter(metric: &MetricEntry, format: Format) -> String {
+    match format {
+        Format::Simple => {
+            format!("{}/cgroup", metric.name())
+        }
+        _ => metric.name().to_string(),
+    }
+}
@@ -1,4 +1,5 @@
 mod stats;
 
 mod meminfo;
+mod stall;
 mod vmstat;
@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2024 The Rezolus Authors
+
+// This BPF program tracks the time tasks are stalled in direct reclaim, direct
+// compaction and major page faults. Each stall is recorded in a latency
+// histogram and its time is added to counters in total and for the cgroup of
+// the task.
+
+#include <vmlinux.h>
+#include "../../../common/bpf/health.h"
+#include "../../../common/bpf/helpers.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "../../../common/bpf/cgroup.h"
+
+#define COUNTER_GROUP_WIDTH 8
+#define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
+#define MAX_CPUS 1024
+#define MAX_PID 4194304
+#define MAX_STALLS 3
+
+#define STALL_RECLAIM 0
+#define STALL_COMPACTION 1
+#define STALL_MAJOR_FAULT 2
+
+// the task is a kernel thread, see `include/linux/sched.h`
+#define PF_KTHREAD 0x00200000
+
+// set from userspace when the kernel supports task local storage
+const volatile bool use_task_storage = false;
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// the start of each kind of in-progress stall for a task. they are tracked
+// separately as a major fault may enter direct reclaim or compaction to
+// allocate the page
+struct stall_start {
+	u64 ts[MAX_STALLS];
+};
+
+// stall start stored with each task, preferred when supported
+struct {
+	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, struct stall_start);
+} task_start SEC(".maps");
+
+// stall start indexed by thread id, used on older kernels
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_PID);
+	__type(key, u32);
+	__type(value, struct stall_start);
+} start SEC(".maps");
+
+// counters for the total stall time
+// 0 - direct reclaim
+// 1 - direct compaction
+// 2 - major faults
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
+} counters SEC(".maps");
+
+// the stall time for each cgroup, with one row of `MAX_CGROUPS` for each kind
+// of stall in the same order as the counters
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_STALLS * MAX_CGROUPS);
+} cgroup_stall SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_STALLS * MAX_CGROUPS));
+} cgroup_stall_dirty SEC(".maps");
+
+// histograms for the duration of each stall
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} reclaim_latency SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} compaction_latency SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, HISTOGRAM_BUCKETS);
+} major_fault_latency SEC(".maps");
+
+// returns a pointer to the stall start for the current task
+static __always_inline struct stall_start *lookup_start(u64 flags)
+{
+	if (use_task_storage) {
+		struct task_struct *task = bpf_get_current_task_btf();
+
+		return bpf_task_storage_get(&task_start, task, 0, flags);
+	} else {
+		u32 tid = bpf_get_current_pid_tgid();
+
+		return bpf_map_lookup_elem(&start, &tid);
+	}
+}
+
+// kernel threads such as kcompactd do the same work in the background, which
+// does not stall any task
+static __always_inline bool is_kthread(void)
+{
+	struct task_struct *task = bpf_get_current_task_btf();
+
+	return task->flags & PF_KTHREAD;
+}
+
+static __always_inline void stall_begin(u32 kind)
+{
+	struct stall_start *start_ts;
+
+	if (kind >= MAX_STALLS || is_kthread()) {
+		return;
+	}
+
+	start_ts = lookup_start(BPF_LOCAL_STORAGE_GET_F_CREATE);
+
+	if (!start_ts) {
+		health_incr(HEALTH_MAP_FULL);
+		return;
+	}
+
+	start_ts->ts[kind] = bpf_ktime_get_ns();
+}
+
+// ends the stall and returns its duration, or zero if it was not started.
+// `missing` is set when the stall must have started before we attached
+static __always_inline u64 stall_end(u32 kind, bool missing)
+{
+	struct stall_start *start_ts;
+	u64 ts;
+
+	if (kind >= MAX_STALLS || is_kthread()) {
+		return 0;
+	}
+
+	start_ts = lookup_start(0);
+
+	if (!start_ts || start_ts->ts[kind] == 0) {
+		if (missing) {
+			health_incr(HEALTH_MISSING_START);
+		}
+		return 0;
+	}
+
+	ts = start_ts->ts[kind];
+	start_ts->ts[kind] = 0;
+
+	return bpf_ktime_get_ns() - ts;
+}
+
+static __always_inline void account_stall(u32 kind, void *histogram, u64 delta)
+{
+	histogram_incr(histogram, histogram_power, delta);
+
+	array_add(&counters, COUNTER_GROUP_WIDTH * bpf_get_smp_processor_id() + kind, delta);
+
+	bool is_new;
+	int cgroup_id = task_cgroup_id(bpf_get_current_task_btf(), &is_new);
+
+	if (cgroup_id) {
+		u32 idx = kind * MAX_CGROUPS + cgroup_id;
+
+		if (is_new) {
+			// zero the counters, they will not be exported until they are
+			// non-zero
+			u64 zero = 0;
+
+			for (u32 i = 0; i < MAX_STALLS; i++) {
+				u32 offset = i * MAX_CGROUPS + cgroup_id;
+				bpf_map_update_elem(&cgroup_stall, &offset, &zero, BPF_ANY);
+			}
+		}
+
+		array_add_dirty(&cgroup_stall, &cgroup_stall_dirty, idx, delta);
+	}
+}
+
+SEC("tp_btf/mm_vmscan_direct_reclaim_begin")
+int BPF_PROG(mm_vmscan_direct_reclaim_begin, int order, gfp_t gfp_flags)
+{
+	stall_begin(STALL_RECLAIM);
+
+	return 0;
+}
+
+SEC("tp_btf/mm_vmscan_direct_reclaim_end")
+int BPF_PROG(mm_vmscan_direct_reclaim_end, unsigned long nr_reclaimed)
+{
+	u64 delta = stall_end(STALL_RECLAIM, true);
+
+	if (delta) {
+		account_stall(STALL_RECLAIM, &reclaim_latency, delta);
+	}
+
+	return 0;
+}
+
+// the arguments of the compaction tracepoints differ between kernel versions
+// and are not needed. compaction runs once for each zone, so a single
+// allocation may be stalled by more than one compaction
+
+SEC("tp_btf/mm_compaction_begin")
+int BPF_PROG(mm_compaction_begin)
+{
+	stall_begin(STALL_COMPACTION);
+
+	return 0;
+}
+
+SEC("tp_btf/mm_compaction_end")
+int BPF_PROG(mm_compaction_end)
+{
+	u64 delta = stall_end(STALL_COMPACTION, true);
+
+	if (delta) {
+		account_stall(STALL_COMPACTION, &compaction_latency, delta);
+	}
+
+	return 0;
+}
+
+// there is no tracepoint for major faults. rather than timing every fault in
+// `handle_mm_fault`, only the two handlers which do IO for a fault are traced:
+// `filemap_fault` reads file pages which are not in the page cache and
+// `do_swap_page` reads anonymous pages back from swap. most minor faults never
+// reach either of them, and of those which do only the ones the kernel reports
+// as major are recorded
+
+static __always_inline int fault_exit(vm_fault_t ret)
+{
+	// the start is only missing for faults which began before we attached,
+	// which are not counted as dropped
+	u64 delta = stall_end(STALL_MAJOR_FAULT, false);
+
+	if (delta && (ret & VM_FAULT_MAJOR)) {
+		account_stall(STALL_MAJOR_FAULT, &major_fault_latency, delta);
+	}
+
+	return 0;
+}
+
+// the fentry/fexit and kprobe/kretprobe programs trace the same functions, only
+// one pair of them is loaded for each. fentry is preferred as it avoids the
+// kprobe dispatch cost
+
+SEC("fentry/filemap_fault")
+int BPF_PROG(filemap_fault_fentry)
+{
+	stall_begin(STALL_MAJOR_FAULT);
+
+	return 0;
+}
+
+SEC("fexit/filemap_fault")
+int BPF_PROG(filemap_fault_fexit, struct vm_fault *vmf, vm_fault_t ret)
+{
+	return fault_exit(ret);
+}
+
+SEC("kprobe/filemap_fault")
+int BPF_KPROBE(filemap_fault_kprobe)
+{
+	stall_begin(STALL_MAJOR_FAULT);
+
+	return 0;
+}
+
+SEC("kretprobe/filemap_fault")
+int BPF_KRETPROBE(filemap_fault_kretprobe, vm_fault_t ret)
+{
+	return fault_exit(ret);
+}
+
+SEC("fentry/do_swap_page")
+int BPF_PROG(do_swap_page_fentry)
+{
+	stall_begin(STALL_MAJOR_FAULT);
+
+	return 0;
+}
+
+SEC("fexit/do_swap_page")
+int BPF_PROG(do_swap_page_fexit, struct vm_fault *vmf, vm_fault_t ret)
+{
+	return fault_exit(ret);
+}
+
+SEC("kprobe/do_swap_page")
+int BPF_KPROBE(do_swap_page_kprobe)
+{
+	stall_begin(STALL_MAJOR_FAULT);
+
+	return 0;
+}
+
+SEC("kretprobe/do_swap_page")
+int BPF_KRETPROBE(do_swap_page_kretprobe, vm_fault_t ret)
+{
+	return fault_exit(ret);
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,178 @@
+/// Collects memory stall stats using BPF and traces:
+/// * `mm_vmscan_direct_reclaim_begin`
+/// * `mm_vmscan_direct_reclaim_end`
+/// * `mm_compaction_begin`
+/// * `mm_compaction_end`
+/// * `filemap_fault`
+/// * `do_swap_page`
+///
+/// And produces these stats:
+/// * `memory/reclaim/stall`
+/// * `memory/reclaim/latency`
+/// * `cgroup/memory/reclaim/stall`
+/// * `memory/compaction/stall`
+/// * `memory/compaction/latency`
+/// * `cgroup/memory/compaction/stall`
+/// * `memory/major_fault/stall`
+/// * `memory/major_fault/latency`
+/// * `cgroup/memory/major_fault/stall`
+///
+/// Only stalls of user tasks are recorded, so reclaim and compaction done in
+/// the background by `kswapd` and `kcompactd` are not included. There is no
+/// tracepoint for major faults, so every page fault is traced and the time is
+/// only recorded for faults which the kernel reports as major.
+
+const NAME: &str = "memory_stall";
+
+mod bpf {
+    include!(concat!(env!("OUT_DIR"), "/memory_stall.bpf.rs"));
+}
+
+use bpf::*;
+
+use crate::common::*;
+use crate::samplers::memory::linux::stats::*;
+use crate::*;
+
+use std::sync::Arc;
+
+#[distributed_slice(SAMPLERS)]
+fn init(config: Arc<Config>) -> SamplerResult {
+    if !config.enabled(NAME) {
+        return Ok(None);
+    }
+
+    // prefer task local storage for the start timestamps, falling back to an
+    // array indexed by thread id on older kernels
+    let task_storage = task_storage_supported();
+
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    // the order must match the stall kinds in the BPF program
+    let counters = vec![
+        &MEMORY_RECLAIM_STALL,
+        &MEMORY_COMPACTION_STALL,
+        &MEMORY_MAJOR_FAULT_STALL,
+    ];
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+
+            if task_storage {
+                skel.maps.rodata_data.use_task_storage = true;
+                skel.maps.start.set_max_entries(1)
+            } else {
+                // the array only needs to cover the pids on this host
+                skel.maps.start.set_max_entries(pid_max())?;
+                skel.maps.task_start.set_autocreate(false)
+            }
+        })
+        .fentry_with_fallback(
+            "filemap_fault",
+            "filemap_fault_fentry",
+            "filemap_fault_kprobe",
+        )
+        .fentry_with_fallback(
+            "filemap_fault",
+            "filemap_fault_fexit",
+            "filemap_fault_kretprobe",
+        )
+        .fentry_with_fallback("do_swap_page", "do_swap_page_fentry", "do_swap_page_kprobe")
+        .fentry_with_fallback(
+            "do_swap_page",
+            "do_swap_page_fexit",
+            "do_swap_page_kretprobe",
+        )
+        .histogram_grouping_power(histogram_power)
+        .counters("counters", counters)
+        .histogram("reclaim_latency", &MEMORY_RECLAIM_LATENCY)
+        .histogram("compaction_latency", &MEMORY_COMPACTION_LATENCY)
+        .histogram("major_fault_latency", &MEMORY_MAJOR_FAULT_LATENCY)
+        .packed_counters_array(
+            "cgroup_stall",
+            vec![
+                &CGROUP_MEMORY_RECLAIM_STALL,
+                &CGROUP_MEMORY_COMPACTION_STALL,
+                &CGROUP_MEMORY_MAJOR_FAULT_STALL,
+            ],
+        )
+        .dirty_bitmap("cgroup_stall", "cgroup_stall_dirty")
+        .cgroup_metrics(vec![
+            &CGROUP_MEMORY_RECLAIM_STALL,
+            &CGROUP_MEMORY_COMPACTION_STALL,
+            &CGROUP_MEMORY_MAJOR_FAULT_STALL,
+        ])
+        .health_counters("health")
+        .build()?;
+
+    Ok(Some(Box::new(bpf)))
+}
+
+impl SkelExt for ModSkel<'_> {
+    fn map(&self, name: &str) -> &libbpf_rs::Map {
+        match name {
+            "counters" => &self.maps.counters,
+            "cgroup_stall" => &self.maps.cgroup_stall,
+            "cgroup_stall_dirty" => &self.maps.cgroup_stall_dirty,
+            "reclaim_latency" => &self.maps.reclaim_latency,
+            "compaction_latency" => &self.maps.compaction_latency,
+            "major_fault_latency" => &self.maps.major_fault_latency,
+            "health" => &self.maps.health,
+            _ => unimplemented!(),
+        }
+    }
+}
+
+impl OpenSkelExt for ModSkel<'_> {
+    fn log_prog_instructions(&self) {
+        debug!(
+            "{NAME} mm_vmscan_direct_reclaim_begin() BPF instruction count: {}",
+            self.progs.mm_vmscan_direct_reclaim_begin.insn_cnt()
+        );
+        debug!(
+            "{NAME} mm_vmscan_direct_reclaim_end() BPF instruction count: {}",
+            self.progs.mm_vmscan_direct_reclaim_end.insn_cnt()
+        );
+        debug!(
+            "{NAME} mm_compaction_begin() BPF instruction count: {}",
+            self.progs.mm_compaction_begin.insn_cnt()
+        );
+        debug!(
+            "{NAME} mm_compaction_end() BPF instruction count: {}",
+            self.progs.mm_compaction_end.insn_cnt()
+        );
+        debug!(
+            "{NAME} filemap_fault() fentry BPF instruction count: {}",
+            self.progs.filemap_fault_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} filemap_fault() fexit BPF instruction count: {}",
+            self.progs.filemap_fault_fexit.insn_cnt()
+        );
+        debug!(
+            "{NAME} filemap_fault() kprobe BPF instruction count: {}",
+            self.progs.filemap_fault_kprobe.insn_cnt()
+        );
+        debug!(
+            "{NAME} filemap_fault() kretprobe BPF instruction count: {}",
+            self.progs.filemap_fault_kretprobe.insn_cnt()
+        );
+        debug!(
+            "{NAME} do_swap_page() fentry BPF instruction count: {}",
+            self.progs.do_swap_page_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} do_swap_page() fexit BPF instruction count: {}",
+            self.progs.do_swap_page_fexit.insn_cnt()
+        );
+        debug!(
+            "{NAME} do_swap_page() kprobe BPF instruction count: {}",
+            self.progs.do_swap_page_kprobe.insn_cnt()
+        );
+        debug!(
+            "{NAME} do_swap_page() kretprobe BPF instruction count: {}",
+            self.progs.do_swap_page_kretprobe.insn_cnt()
+        );
+    }
+}
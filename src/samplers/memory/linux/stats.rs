@@ -1,3 +1,4 @@
+use crate::common::{CounterGroup, MAX_CGROUPS, MAX_HISTOGRAM_GROUPING_POWER};
 use metriken::*;
 
 #[metric(
@@ -70,3 +71,81 @@ pub static MEMORY_NUMA_LOCAL: LazyCounter = LazyCounter::new(Counter::default);
     description = "The number of allocations that on this node that were allocated by a process on another node"
 )]
 pub static MEMORY_NUMA_OTHER: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "memory/reclaim/stall",
+    description = "The amount of time tasks were stalled in direct reclaim",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static MEMORY_RECLAIM_STALL: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "cgroup/memory/reclaim/stall",
+    description = "The amount of time tasks were stalled in direct reclaim on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "nanoseconds" }
+)]
+pub static CGROUP_MEMORY_RECLAIM_STALL: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "memory/reclaim/latency",
+    description = "Distribution of the time tasks were stalled in direct reclaim",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static MEMORY_RECLAIM_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "memory/compaction/stall",
+    description = "The amount of time tasks were stalled in direct compaction",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static MEMORY_COMPACTION_STALL: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "cgroup/memory/compaction/stall",
+    description = "The amount of time tasks were stalled in direct compaction on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "nanoseconds" }
+)]
+pub static CGROUP_MEMORY_COMPACTION_STALL: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "memory/compaction/latency",
+    description = "Distribution of the time tasks were stalled in direct compaction",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static MEMORY_COMPACTION_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "memory/major_fault/stall",
+    description = "The amount of time tasks were stalled in major page faults",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static MEMORY_MAJOR_FAULT_STALL: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "cgroup/memory/major_fault/stall",
+    description = "The amount of time tasks were stalled in major page faults on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "nanoseconds" }
+)]
+pub static CGROUP_MEMORY_MAJOR_FAULT_STALL: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "memory/major_fault/latency",
+    description = "Distribution of the time tasks were stalled in major page faults",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static MEMORY_MAJOR_FAULT_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+pub fn cgroup_formatter(metric: &MetricEntry, format: Format) -> String {
+    match format {
+        Format::Simple => {
+            format!("{}/cgroup", metric.name())
+        }
+        _ => metric.name().to_string(),
+    }
+}
@@ -3,6 +3,8 @@ use async_trait::async_trait;
 mod blockio;
 mod cpu;
 mod gpu;
+mod irq;
+mod lock;
 mod memory;
 mod network;
 mod rezolus;
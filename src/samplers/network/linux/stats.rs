@@ -1,3 +1,13 @@
+use crate::common::{CounterGroup, HistogramGroup, HISTOGRAM_GROUPING_POWER};
+
+/// The maximum number of interfaces which are tracked individually. This must
+/// match `MAX_INTERFACES` in the BPF program.
+pub const MAX_INTERFACES: usize = 64;
+
+/// The maximum number of queues which are tracked for each interface. This must
+/// match `MAX_QUEUES` in the BPF program.
+pub const MAX_QUEUES: usize = 64;
+
 use metriken::*;
 
 #[metric(
@@ -61,3 +71,47 @@ pub static NETWORK_TX_DROPPED: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "packets" }
 )]
 pub static NETWORK_TX_PACKETS: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "network/receive/bytes/queue",
+    description = "The number of bytes received over the network, for each receive queue of each interface",
+    metadata = { unit = "bytes" }
+)]
+pub static NETWORK_RX_BYTES_QUEUE: CounterGroup = CounterGroup::new(MAX_INTERFACES * MAX_QUEUES);
+
+#[metric(
+    name = "network/receive/packets/queue",
+    description = "The number of packets received over the network, for each receive queue of each interface",
+    metadata = { unit = "packets" }
+)]
+pub static NETWORK_RX_PACKETS_QUEUE: CounterGroup = CounterGroup::new(MAX_INTERFACES * MAX_QUEUES);
+
+#[metric(
+    name = "network/receive/size/interface",
+    description = "Distribution of the size of packets received over the network in bytes, for each interface",
+    metadata = { unit = "bytes" }
+)]
+pub static NETWORK_RX_SIZE_INTERFACE: HistogramGroup =
+    HistogramGroup::new(MAX_INTERFACES, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "network/transmit/bytes/queue",
+    description = "The number of bytes transmitted over the network, for each transmit queue of each interface",
+    metadata = { unit = "bytes" }
+)]
+pub static NETWORK_TX_BYTES_QUEUE: CounterGroup = CounterGroup::new(MAX_INTERFACES * MAX_QUEUES);
+
+#[metric(
+    name = "network/transmit/packets/queue",
+    description = "The number of packets transmitted over the network, for each transmit queue of each interface",
+    metadata = { unit = "packets" }
+)]
+pub static NETWORK_TX_PACKETS_QUEUE: CounterGroup = CounterGroup::new(MAX_INTERFACES * MAX_QUEUES);
+
+#[metric(
+    name = "network/transmit/size/interface",
+    description = "Distribution of the size of packets transmitted over the network in bytes, for each interface",
+    metadata = { unit = "bytes" }
+)]
+pub static NETWORK_TX_SIZE_INTERFACE: HistogramGroup =
+    HistogramGroup::new(MAX_INTERFACES, HISTOGRAM_GROUPING_POWER, 64);
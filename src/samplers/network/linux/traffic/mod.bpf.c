@@ -2,9 +2,14 @@
 // Copyright (c) 2024 The Rezolus Authors
 
 // This BPF program probes network send and receive paths to get the number of
-// packets and bytes transmitted as well as the size distributions.
+// packets and bytes transmitted as well as the size distributions. Along with
+// the totals, packets and bytes are counted for each queue of each interface
+// and the packet sizes are recorded for each interface. Interfaces are assigned
+// a slot in the per-interface metrics when they are first seen, and the slot is
+// released for reuse when the interface is freed.
 
 #include <vmlinux.h>
+#include "../../../common/bpf/health.h"
 #include "../../../common/bpf/helpers.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_core_read.h>
@@ -12,7 +17,14 @@
 #include <bpf/bpf_endian.h>
 
 #define COUNTER_GROUP_WIDTH 8
+#define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
+#define HISTOGRAM_BANK HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS)
 #define MAX_CPUS 1024
+#define MAX_INTERFACES 64
+#define MAX_QUEUES 64
+#define QUEUE_ROW (MAX_INTERFACES * MAX_QUEUES)
+#define IFNAME_LEN 16
+#define RINGBUF_CAPACITY 32768
 
 // counter indices
 #define RX_BYTES 0
@@ -20,6 +32,32 @@
 #define RX_PACKETS 2
 #define TX_PACKETS 3
 
+// passed to userspace when an interface is first seen so that the
+// per-interface metrics can be labeled, and again with `removed` set when the
+// interface is freed so that the labels can be cleared
+struct interface_info {
+	u32 slot;
+	u32 ifindex;
+	u8 name[IFNAME_LEN];
+	u8 removed;
+};
+
+// the rate at which events are sampled for the size histograms, set from
+// userspace. a rate of N means 1-in-N events are recorded on each CPU
+const volatile u32 sample_rate = 1;
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// per-CPU countdown used to sample events, see `sample_event()`
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} sample_state SEC(".maps");
+
 // counters
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
@@ -29,11 +67,222 @@ struct {
 	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
 } counters SEC(".maps");
 
+// dummy instance for skeleton to generate definition
+struct interface_info _interface_info = {};
+
+// ringbuf to pass interface info to userspace when an interface is assigned a
+// slot
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(key_size, 0);
+	__uint(value_size, 0);
+	__uint(max_entries, RINGBUF_CAPACITY);
+} interface_info SEC(".maps");
+
+// maps the network namespace and ifindex of an interface to its slot in the
+// per-interface metrics
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_INTERFACES);
+	__type(key, u64);
+	__type(value, u32);
+} interface_slots SEC(".maps");
+
+// slots which were released by freed interfaces and can be reused
+struct {
+	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(max_entries, MAX_INTERFACES);
+	__type(value, u32);
+} interface_free_slots SEC(".maps");
+
+// the next slot in the per-interface metrics which has never been assigned.
+// free slots are reused before new ones are taken
+u32 next_interface_slot = 0;
+
+// per-queue counters. there is one row for each of the counter indices, and
+// each row has `MAX_QUEUES` entries for each interface slot. with RSS and XPS
+// a queue is usually only used from one CPU at a time, so these are rarely
+// contended
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, 4 * QUEUE_ROW);
+} queue_counters SEC(".maps");
+
+// packet size histograms for each interface slot, laid out as
+// [cpu][slot][bucket]. an interface is used from every CPU which handles one of
+// its queues, so each CPU has its own bank of histograms
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * MAX_INTERFACES * HISTOGRAM_BANK);
+} interface_rx_size SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * MAX_INTERFACES * HISTOGRAM_BANK);
+} interface_tx_size SEC(".maps");
+
+// returns the key for the interface in `interface_slots`. ifindex is only
+// unique within a network namespace
+static __always_inline u64 interface_key(struct net_device *dev)
+{
+	return ((u64)BPF_CORE_READ(dev, nd_net.net, ns.inum) << 32) | BPF_CORE_READ(dev, ifindex);
+}
+
+// returns the slot for the interface, assigning a new slot if this is the
+// first time the interface has been seen. returns MAX_INTERFACES if there is
+// no slot for the interface
+static __always_inline u32 interface_slot(struct net_device *dev)
+{
+	u32 *slot, new_slot;
+	u64 key;
+
+	if (!dev) {
+		return MAX_INTERFACES;
+	}
+
+	key = interface_key(dev);
+
+	slot = bpf_map_lookup_elem(&interface_slots, &key);
+
+	if (slot) {
+		return *slot;
+	}
+
+	if (bpf_map_pop_elem(&interface_free_slots, &new_slot)) {
+		// check before taking a slot so that the counter can not wrap around
+		// while every slot is in use
+		if (next_interface_slot >= MAX_INTERFACES) {
+			health_incr(HEALTH_OUT_OF_RANGE);
+			return MAX_INTERFACES;
+		}
+
+		new_slot = __sync_fetch_and_add(&next_interface_slot, 1);
+
+		if (new_slot >= MAX_INTERFACES) {
+			health_incr(HEALTH_OUT_OF_RANGE);
+			return MAX_INTERFACES;
+		}
+	}
+
+	// another CPU may have assigned a slot for this interface first, in which
+	// case the new slot is returned to the free slots
+	if (bpf_map_update_elem(&interface_slots, &key, &new_slot, BPF_NOEXIST)) {
+		if (bpf_map_push_elem(&interface_free_slots, &new_slot, 0)) {
+			health_incr(HEALTH_MAP_FULL);
+		}
+
+		slot = bpf_map_lookup_elem(&interface_slots, &key);
+
+		return slot ? *slot : MAX_INTERFACES;
+	}
+
+	// let userspace know about the new interface
+	struct interface_info info = {
+		.slot = new_slot,
+		.ifindex = BPF_CORE_READ(dev, ifindex),
+	};
+
+	bpf_core_read_str(&info.name, IFNAME_LEN, &dev->name);
+
+	if (bpf_ringbuf_output(&interface_info, &info, sizeof(info), 0)) {
+		health_incr(HEALTH_RINGBUF_FULL);
+	}
+
+	return new_slot;
+}
+
+// releases the slot of an interface which is being freed. the per-queue
+// counters are zeroed here so that the next interface to use the slot starts
+// from zero. the size histograms have a bank on every CPU, which is too many
+// entries to zero from BPF, so they are zeroed by userspace when it is told the
+// slot was released
+static __always_inline void release_interface(struct net_device *dev)
+{
+	u32 *elem, slot;
+	u64 key, zero = 0;
+
+	if (!dev) {
+		return;
+	}
+
+	key = interface_key(dev);
+
+	elem = bpf_map_lookup_elem(&interface_slots, &key);
+
+	if (!elem) {
+		return;
+	}
+
+	slot = *elem;
+
+	if (slot >= MAX_INTERFACES || bpf_map_delete_elem(&interface_slots, &key)) {
+		return;
+	}
+
+	for (u32 queue = 0; queue < MAX_QUEUES; queue++) {
+		u32 idx = slot * MAX_QUEUES + queue;
+
+		for (u32 row = 0; row < 4; row++) {
+			u32 offset = row * QUEUE_ROW + idx;
+
+			bpf_map_update_elem(&queue_counters, &offset, &zero, BPF_ANY);
+		}
+	}
+
+	// let userspace know the slot no longer belongs to this interface
+	struct interface_info info = {
+		.slot = slot,
+		.removed = 1,
+	};
+
+	if (bpf_ringbuf_output(&interface_info, &info, sizeof(info), 0)) {
+		health_incr(HEALTH_RINGBUF_FULL);
+	}
+
+	if (bpf_map_push_elem(&interface_free_slots, &slot, 0)) {
+		health_incr(HEALTH_MAP_FULL);
+	}
+}
+
+// counts a packet for the queue of the interface and records its size.
+// queues beyond `MAX_QUEUES` are only counted in the totals
+static __always_inline void count_queue(struct net_device *dev, u32 queue, u32 bytes, u32 packets, void *size, u64 len)
+{
+	u32 slot = interface_slot(dev);
+
+	if (slot >= MAX_INTERFACES) {
+		return;
+	}
+
+	if (queue < MAX_QUEUES) {
+		u32 idx = slot * MAX_QUEUES + queue;
+
+		array_add(&queue_counters, bytes * QUEUE_ROW + idx, len);
+		array_incr(&queue_counters, packets * QUEUE_ROW + idx);
+	}
+
+	// only the size distributions are sampled, the counters are exact
+	if (sample_event(&sample_state, sample_rate)) {
+		u32 offset = MAX_INTERFACES * bpf_get_smp_processor_id() + slot;
+
+		percpu_incr(size, histogram_bank_width(histogram_power) * offset + value_to_index(len, histogram_power));
+	}
+}
+
 SEC("raw_tp/netif_receive_skb")
 int BPF_PROG(netif_receive_skb, struct sk_buff *skb)
 {
 	u64 len;
-	u64 *cnt;
 	u32 idx;
 
 	len = BPF_CORE_READ(skb, len);
@@ -46,15 +295,24 @@ int BPF_PROG(netif_receive_skb, struct sk_buff *skb)
 	idx = offset + RX_BYTES;
 	array_add(&counters, idx, len);
 
+	// drivers record the rx queue plus one, see `skb_record_rx_queue()`.
+	// packets without a recorded queue, such as from virtual devices, are
+	// counted in queue zero
+	u32 queue = BPF_CORE_READ(skb, queue_mapping);
+
+	if (queue) {
+		queue -= 1;
+	}
+
+	count_queue(BPF_CORE_READ(skb, dev), queue, RX_BYTES, RX_PACKETS, &interface_rx_size, len);
+
 	return 0;
 }
 
-
 SEC("raw_tp/net_dev_start_xmit")
-int BPF_PROG(tcp_cleanup_rbuf, struct sk_buff *skb, struct net_device *dev, void *txq, bool more)
+int BPF_PROG(net_dev_start_xmit, struct sk_buff *skb, struct net_device *dev)
 {
 	u64 len;
-	u64 *cnt;
 	u32 idx;
 
 	len = BPF_CORE_READ(skb, len);
@@ -67,6 +325,25 @@ int BPF_PROG(tcp_cleanup_rbuf, struct sk_buff *skb, struct net_device *dev, void
 	idx = offset + TX_BYTES;
 	array_add(&counters, idx, len);
 
+	// the tx queue has already been picked when the packet reaches the driver
+	count_queue(dev, BPF_CORE_READ(skb, queue_mapping), TX_BYTES, TX_PACKETS, &interface_tx_size, len);
+
+	return 0;
+}
+
+SEC("fentry/free_netdev")
+int BPF_PROG(free_netdev_fentry, struct net_device *dev)
+{
+	release_interface(dev);
+
+	return 0;
+}
+
+SEC("kprobe/free_netdev")
+int BPF_KPROBE(free_netdev_kprobe, struct net_device *dev)
+{
+	release_interface(dev);
+
 	return 0;
 }
 
@@ -1,12 +1,29 @@
 /// Collects Network Traffic stats using BPF and traces:
 /// * `netif_receive_skb`
-/// * `netdev_start_xmit`
+/// * `net_dev_start_xmit`
+/// * `free_netdev`
 ///
 /// And produces these stats:
 /// * `network/receive/bytes`
-/// * `network/receive/frames`
+/// * `network/receive/bytes/queue`
+/// * `network/receive/packets`
+/// * `network/receive/packets/queue`
+/// * `network/receive/size/interface`
 /// * `network/transmit/bytes`
-/// * `network/transmit/frames`
+/// * `network/transmit/bytes/queue`
+/// * `network/transmit/packets`
+/// * `network/transmit/packets/queue`
+/// * `network/transmit/size/interface`
+///
+/// The per-queue stats are labeled with the interface name and queue, so the
+/// totals for an interface are the sum across its queues. Received packets
+/// without a recorded queue, such as from virtual devices, are counted in
+/// queue zero.
+///
+/// Each interface is assigned one of `MAX_INTERFACES` slots when it is first
+/// seen, and the slot is released for reuse when the interface is freed. The
+/// per-queue counters and size histograms of a released slot are reset, so the
+/// next interface to use the slot starts from zero.
 
 const NAME: &str = "network_traffic";
 
@@ -23,6 +40,73 @@ use crate::*;
 
 use std::sync::Arc;
 
+unsafe impl plain::Plain for bpf::types::interface_info {}
+
+fn handle_interface_info(data: &[u8]) -> i32 {
+    let mut interface_info = bpf::types::interface_info::default();
+
+    if plain::copy_from_bytes(&mut interface_info, data).is_ok() {
+        let name = String::from_utf8_lossy(&interface_info.name)
+            .trim_end_matches(char::from(0))
+            .to_string();
+
+        let slot = interface_info.slot as usize;
+
+        if slot >= MAX_INTERFACES {
+            return 0;
+        }
+
+        if interface_info.removed != 0 {
+            // clearing the histograms also zeroes their BPF banks, see
+            // `PercpuHistogramGroupMap`
+            for group in [&NETWORK_RX_SIZE_INTERFACE, &NETWORK_TX_SIZE_INTERFACE] {
+                group.clear_metadata(slot);
+                group.clear(slot);
+            }
+
+            // the BPF program has zeroed the counters, but counters which are
+            // zero in BPF are not copied to userspace
+            for idx in (slot * MAX_QUEUES)..((slot + 1) * MAX_QUEUES) {
+                for group in [
+                    &NETWORK_RX_BYTES_QUEUE,
+                    &NETWORK_TX_BYTES_QUEUE,
+                    &NETWORK_RX_PACKETS_QUEUE,
+                    &NETWORK_TX_PACKETS_QUEUE,
+                ] {
+                    group.clear_metadata(idx);
+                    let _ = group.set(idx, 0);
+                }
+            }
+
+            return 0;
+        }
+
+        let ifindex = interface_info.ifindex.to_string();
+
+        for group in [&NETWORK_RX_SIZE_INTERFACE, &NETWORK_TX_SIZE_INTERFACE] {
+            group.insert_metadata(slot, "name".to_string(), name.clone());
+            group.insert_metadata(slot, "ifindex".to_string(), ifindex.clone());
+        }
+
+        for queue in 0..MAX_QUEUES {
+            let idx = slot * MAX_QUEUES + queue;
+
+            for group in [
+                &NETWORK_RX_BYTES_QUEUE,
+                &NETWORK_TX_BYTES_QUEUE,
+                &NETWORK_RX_PACKETS_QUEUE,
+                &NETWORK_TX_PACKETS_QUEUE,
+            ] {
+                group.insert_metadata(idx, "name".to_string(), name.clone());
+                group.insert_metadata(idx, "ifindex".to_string(), ifindex.clone());
+                group.insert_metadata(idx, "queue".to_string(), queue.to_string());
+            }
+        }
+    }
+
+    0
+}
+
 #[distributed_slice(SAMPLERS)]
 fn init(config: Arc<Config>) -> SamplerResult {
     if !config.enabled(NAME) {
@@ -36,8 +120,32 @@ fn init(config: Arc<Config>) -> SamplerResult {
         &NETWORK_TX_PACKETS,
     ];
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    // rows must match the counter indices in the BPF program
+    let queue_counters = vec![
+        &NETWORK_RX_BYTES_QUEUE,
+        &NETWORK_TX_BYTES_QUEUE,
+        &NETWORK_RX_PACKETS_QUEUE,
+        &NETWORK_TX_PACKETS_QUEUE,
+    ];
+
+    let sample_rate = config.sample_rate(NAME);
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.sample_rate = sample_rate;
+            skel.maps.rodata_data.histogram_power = histogram_power;
+            Ok(())
+        })
+        .fentry_with_fallback("free_netdev", "free_netdev_fentry", "free_netdev_kprobe")
+        .sample_rate(sample_rate)
+        .histogram_grouping_power(histogram_power)
         .counters("counters", counters)
+        .packed_counters_array("queue_counters", queue_counters)
+        .percpu_histogram_group("interface_rx_size", &NETWORK_RX_SIZE_INTERFACE)
+        .percpu_histogram_group("interface_tx_size", &NETWORK_TX_SIZE_INTERFACE)
+        .ringbuf_handler("interface_info", handle_interface_info)
+        .health_counters("health")
         .build()?;
 
     Ok(Some(Box::new(bpf)))
@@ -47,6 +155,11 @@ impl SkelExt for ModSkel<'_> {
     fn map(&self, name: &str) -> &libbpf_rs::Map {
         match name {
             "counters" => &self.maps.counters,
+            "health" => &self.maps.health,
+            "interface_info" => &self.maps.interface_info,
+            "interface_rx_size" => &self.maps.interface_rx_size,
+            "interface_tx_size" => &self.maps.interface_tx_size,
+            "queue_counters" => &self.maps.queue_counters,
             _ => unimplemented!(),
         }
     }
@@ -59,8 +172,16 @@ impl OpenSkelExt for ModSkel<'_> {
             self.progs.netif_receive_skb.insn_cnt()
         );
         debug!(
-            "{NAME} tcp_cleanup_rbuf() BPF instruction count: {}",
-            self.progs.tcp_cleanup_rbuf.insn_cnt()
+            "{NAME} net_dev_start_xmit() BPF instruction count: {}",
+            self.progs.net_dev_start_xmit.insn_cnt()
+        );
+        debug!(
+            "{NAME} free_netdev() fentry BPF instruction count: {}",
+            self.progs.free_netdev_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} free_netdev() kprobe BPF instruction count: {}",
+            self.progs.free_netdev_kprobe.insn_cnt()
         );
     }
 }
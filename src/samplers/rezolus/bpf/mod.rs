@@ -0,0 +1,129 @@
+/// Exports the kernel's stats for each of the BPF programs loaded by the other
+/// samplers. This lets us see the overhead of each probe in production.
+///
+/// And produces these stats:
+/// * `rezolus/bpf/run_time`
+/// * `rezolus/bpf/run_count`
+/// * `rezolus/bpf/instructions`
+/// * `rezolus/bpf/verified_instructions`
+/// * `rezolus/bpf/sample_rate`
+/// * `rezolus/bpf/refresh_time`
+/// * `rezolus/bpf/load_time`
+/// * `rezolus/bpf/map_memory`
+///
+/// Runtime stats are only collected by the kernel while this sampler is
+/// enabled. The refresh time is the time each BPF sampler spends reading its
+/// BPF maps into metrics, which is always tracked. The load time and map memory
+/// are recorded once as each BPF sampler starts.
+///
+/// The kernel's runtime stats cover every BPF program on the host, not only
+/// ours, so this sampler is only enabled when its own config section enables
+/// it. `benches/probe_overhead.rs` uses these stats to measure the cost of
+/// each program under a synthetic workload.
+const NAME: &str = "rezolus_bpf";
+
+use crate::common::*;
+use crate::samplers::rezolus::stats::*;
+use crate::*;
+
+use std::os::fd::OwnedFd;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+#[distributed_slice(SAMPLERS)]
+fn init(config: Arc<Config>) -> SamplerResult {
+    if !config.opt_in_enabled(NAME) {
+        return Ok(None);
+    }
+
+    // the kernel only collects runtime stats while this fd is open
+    let stats = match bpf_enable_stats() {
+        Ok(fd) => Some(fd),
+        Err(e) => {
+            debug!("{NAME} failed to enable BPF runtime stats: {e}");
+            None
+        }
+    };
+
+    Ok(Some(Box::new(BpfStats {
+        _stats: stats,
+        labeled: AtomicUsize::new(0),
+        labeled_samplers: AtomicUsize::new(0),
+    })))
+}
+
+pub struct BpfStats {
+    _stats: Option<OwnedFd>,
+    labeled: AtomicUsize,
+    labeled_samplers: AtomicUsize,
+}
+
+#[async_trait]
+impl Sampler for BpfStats {
+    async fn refresh(&self) {
+        let programs = bpf_programs();
+
+        let labeled = self.labeled.load(Ordering::Relaxed);
+
+        for (idx, program) in programs.iter().enumerate().take(MAX_BPF_PROGRAMS) {
+            // programs are only ever appended, so we only need to add metadata
+            // for programs we have not seen before
+            if idx >= labeled {
+                let name = format!("{}/{}", program.sampler(), program.name());
+
+                let groups: [&dyn CgroupMetric; 5] = [
+                    &BPF_RUN_TIME,
+                    &BPF_RUN_COUNT,
+                    &BPF_INSTRUCTIONS,
+                    &BPF_VERIFIED_INSTRUCTIONS,
+                    &BPF_SAMPLE_RATE,
+                ];
+
+                for group in groups {
+                    group.insert_metadata(idx, "name".to_string(), name.clone());
+                    group.insert_metadata(
+                        idx,
+                        "sampler".to_string(),
+                        program.sampler().to_string(),
+                    );
+                    group.insert_metadata(idx, "program".to_string(), program.name().to_string());
+                }
+
+                let _ = BPF_SAMPLE_RATE.set(idx, program.sample_rate() as i64);
+            }
+
+            if let Some(stats) = program.stats() {
+                let _ = BPF_RUN_TIME.set(idx, stats.run_time);
+                let _ = BPF_RUN_COUNT.set(idx, stats.run_count);
+                let _ = BPF_INSTRUCTIONS.set(idx, stats.instructions as i64);
+                let _ = BPF_VERIFIED_INSTRUCTIONS.set(idx, stats.verified_instructions as i64);
+            }
+        }
+
+        self.labeled
+            .store(programs.len().min(MAX_BPF_PROGRAMS), Ordering::Relaxed);
+
+        let samplers = bpf_samplers();
+
+        let labeled_samplers = self.labeled_samplers.load(Ordering::Relaxed);
+
+        for (idx, sampler) in samplers.iter().enumerate().take(MAX_BPF_SAMPLERS) {
+            // like programs, samplers are only ever appended
+            if idx >= labeled_samplers {
+                let groups: [&dyn CgroupMetric; 3] =
+                    [&BPF_REFRESH_TIME, &BPF_LOAD_TIME, &BPF_MAP_MEMORY];
+
+                for group in groups {
+                    group.insert_metadata(idx, "sampler".to_string(), sampler.name().to_string());
+                }
+
+                let _ = BPF_LOAD_TIME.set(idx, sampler.load_time() as i64);
+                let _ = BPF_MAP_MEMORY.set(idx, sampler.map_memory() as i64);
+            }
+
+            let _ = BPF_REFRESH_TIME.set(idx, sampler.refresh_time());
+        }
+
+        self.labeled_samplers
+            .store(samplers.len().min(MAX_BPF_SAMPLERS), Ordering::Relaxed);
+    }
+}
@@ -1,3 +1,6 @@
 mod stats;
 
+#[cfg(target_os = "linux")]
+mod bpf;
+
 mod rusage;
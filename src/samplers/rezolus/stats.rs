@@ -1,5 +1,13 @@
 use metriken::*;
 
+use crate::common::*;
+
+/// The maximum number of BPF programs we track stats for.
+pub const MAX_BPF_PROGRAMS: usize = 256;
+
+/// The maximum number of BPF samplers we track stats for.
+pub const MAX_BPF_SAMPLERS: usize = 64;
+
 #[metric(
     name = "rezolus/cpu/usage/user",
     description = "The amount of CPU time Rezolus was executing in user mode",
@@ -58,3 +66,55 @@ pub static RU_NVCSW: LazyCounter = LazyCounter::new(Counter::default);
     description = "The number of involuntary context switches"
 )]
 pub static RU_NIVCSW: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "rezolus/bpf/run_time",
+    description = "The amount of time spent executing each BPF program",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BPF_RUN_TIME: CounterGroup = CounterGroup::new(MAX_BPF_PROGRAMS);
+
+#[metric(
+    name = "rezolus/bpf/run_count",
+    description = "The number of times each BPF program has been executed"
+)]
+pub static BPF_RUN_COUNT: CounterGroup = CounterGroup::new(MAX_BPF_PROGRAMS);
+
+#[metric(
+    name = "rezolus/bpf/instructions",
+    description = "The number of instructions in each BPF program after translation by the kernel"
+)]
+pub static BPF_INSTRUCTIONS: GaugeGroup = GaugeGroup::new(MAX_BPF_PROGRAMS);
+
+#[metric(
+    name = "rezolus/bpf/verified_instructions",
+    description = "The number of instructions processed by the verifier when loading each BPF program"
+)]
+pub static BPF_VERIFIED_INSTRUCTIONS: GaugeGroup = GaugeGroup::new(MAX_BPF_PROGRAMS);
+
+#[metric(
+    name = "rezolus/bpf/sample_rate",
+    description = "The rate at which each BPF program samples events for its distributions. A rate of N means 1-in-N events are recorded"
+)]
+pub static BPF_SAMPLE_RATE: GaugeGroup = GaugeGroup::new(MAX_BPF_PROGRAMS);
+
+#[metric(
+    name = "rezolus/bpf/refresh_time",
+    description = "The amount of time each BPF sampler has spent reading its metrics from BPF maps",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BPF_REFRESH_TIME: CounterGroup = CounterGroup::new(MAX_BPF_SAMPLERS);
+
+#[metric(
+    name = "rezolus/bpf/load_time",
+    description = "The time each BPF sampler took to load and attach its programs and set up its maps",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static BPF_LOAD_TIME: GaugeGroup = GaugeGroup::new(MAX_BPF_SAMPLERS);
+
+#[metric(
+    name = "rezolus/bpf/map_memory",
+    description = "The locked memory used by the BPF maps of each BPF sampler",
+    metadata = { unit = "bytes" }
+)]
+pub static BPF_MAP_MEMORY: GaugeGroup = GaugeGroup::new(MAX_BPF_SAMPLERS);
@@ -1,3 +1,4 @@
 mod stats;
 
-mod runqueue;
+pub mod runqueue;
+mod sched_switch;
@@ -2,70 +2,30 @@
 /// * `sched_wakeup`
 /// * `sched_wakeup_new`
 /// * `sched_switch`
+/// * `sched_migrate_task`
+///
+/// The BPF program is shared with the other samplers which trace context
+/// switches, see `sched_switch`.
 ///
 /// And produces these stats:
 /// * `scheduler/runqueue/latency`
+/// * `scheduler/runqueue/latency/cpu`
+/// * `scheduler/runqueue/latency/same_cpu`
+/// * `scheduler/runqueue/latency/migrated`
+/// * `cgroup/scheduler/runqueue/latency`
 /// * `scheduler/running`
 /// * `scheduler/offcpu`
 /// * `scheduler/context_switch/involuntary`
+/// * `scheduler/migrations`
+/// * `scheduler/migrations/cpu`
+/// * `scheduler/wakeup/cross_llc`
+/// * `scheduler/wakeup/cross_node`
+///
+/// Wakeups are compared against the CPU topology, which is loaded from sysfs
+/// when the sampler starts.
+///
+/// When `offcpu_stack_threshold` is configured, off-cpu intervals at least that
+/// long are totalled in the kernel by process and the kernel stack the task
+/// blocked in. The totals are served as folded stacks from `/stacks/offcpu`.
 
-const NAME: &str = "scheduler_runqueue";
-
-mod bpf {
-    include!(concat!(env!("OUT_DIR"), "/scheduler_runqueue.bpf.rs"));
-}
-
-use bpf::*;
-
-use crate::common::*;
-use crate::samplers::scheduler::linux::stats::*;
-use crate::*;
-
-use std::sync::Arc;
-
-#[distributed_slice(SAMPLERS)]
-fn init(config: Arc<Config>) -> SamplerResult {
-    if !config.enabled(NAME) {
-        return Ok(None);
-    }
-
-    let counters = vec![&SCHEDULER_IVCSW];
-
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
-        .counters("counters", counters)
-        .histogram("runqlat", &SCHEDULER_RUNQUEUE_LATENCY)
-        .histogram("running", &SCHEDULER_RUNNING)
-        .histogram("offcpu", &SCHEDULER_OFFCPU)
-        .build()?;
-
-    Ok(Some(Box::new(bpf)))
-}
-
-impl SkelExt for ModSkel<'_> {
-    fn map(&self, name: &str) -> &libbpf_rs::Map {
-        match name {
-            "counters" => &self.maps.counters,
-            "offcpu" => &self.maps.offcpu,
-            "running" => &self.maps.running,
-            "runqlat" => &self.maps.runqlat,
-            _ => unimplemented!(),
-        }
-    }
-}
-
-impl OpenSkelExt for ModSkel<'_> {
-    fn log_prog_instructions(&self) {
-        debug!(
-            "{NAME} handle__sched_switch() BPF instruction count: {}",
-            self.progs.handle__sched_switch.insn_cnt()
-        );
-        debug!(
-            "{NAME} handle__sched_wakeup() BPF instruction count: {}",
-            self.progs.handle__sched_wakeup.insn_cnt()
-        );
-        debug!(
-            "{NAME} handle__sched_wakeup_new() BPF instruction count: {}",
-            self.progs.handle__sched_wakeup_new.insn_cnt()
-        );
-    }
-}
+pub const NAME: &str = "scheduler_runqueue";
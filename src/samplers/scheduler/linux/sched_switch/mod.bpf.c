@@ -0,0 +1,747 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2019 Facebook
+// Copyright (c) 2023 The Rezolus Authors
+
+// NOTICE: this file is based off `runqslower.bpf.c` from the BCC project
+// <https://github.com/iovisor/bcc/> and has been modified for use within
+// Rezolus.
+
+// This BPF program does all of the work which Rezolus does on each context
+// switch, so that only a single program runs in the context switch path. It
+// has one section for each of the samplers which trace `sched_switch`:
+// * `scheduler_runqueue` probes enqueue and dequeue from the scheduler
+//   runqueue to calculate the runqueue latency, running time, and off-cpu time,
+//   along with task migrations and wakeups across caches or numa nodes, and
+//   optionally the total off-cpu time by the kernel stack tasks blocked in
+// * `cpu_perf` attributes hardware perf counters to the cgroup of each task
+// * `cpu_frequency` attributes the APERF, MPERF and TSC MSRs to the cgroup of
+//   each task
+//
+// Each section is enabled from userspace with read-only data. The cpu and the
+// cgroup of the previous task are found once and shared by all the sections.
+
+#include <vmlinux.h>
+#include "../../../common/bpf/health.h"
+#include "../../../common/bpf/helpers.h"
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include "../../../common/bpf/cgroup.h"
+#include "../../../common/bpf/exemplar.h"
+#include "../../../common/bpf/stacks.h"
+
+#define COUNTER_GROUP_WIDTH 8
+#define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
+#define HISTOGRAM_BANK HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS)
+#define MAX_CPUS 1024
+#define MAX_EVENTS 8
+#define MAX_PID 4194304
+#define MAX_STACKS 16384 // must fit in the `offcpu_stack` of `task_state`
+#define STACK_DEPTH 32
+
+// fixed-point precision used to scale counts for multiplexing
+#define SCALE_SHIFT 10
+
+#define TASK_RUNNING 0
+
+// counter positions
+#define MIGRATIONS 0
+#define IVCSW 1
+#define WAKEUP_CROSS_LLC 2
+#define WAKEUP_CROSS_NODE 3
+
+/**
+ * commit 2f064a59a1 ("sched: Change task_struct::state") changes
+ * the name of task_struct::state to task_struct::__state
+ * see:
+ *     https://github.com/torvalds/linux/commit/2f064a59a1
+ */
+struct task_struct___o {
+	volatile long int state;
+} __attribute__((preserve_access_index));
+
+struct task_struct___x {
+	unsigned int __state;
+} __attribute__((preserve_access_index));
+
+static __always_inline __s64 get_task_state(void *task)
+{
+	struct task_struct___x *t = task;
+
+	if (bpf_core_field_exists(t->__state))
+		return BPF_CORE_READ(t, __state);
+	return BPF_CORE_READ((struct task_struct___o *)task, state);
+}
+
+// set from userspace to enable each section
+const volatile bool runqueue_enabled = false;
+const volatile u32 nr_perf_events = 0;
+const volatile u32 nr_frequency_events = 0;
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+/*
+ * runqueue section
+ */
+
+// counters (see constants defined at top)
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
+} counters SEC(".maps");
+
+/*
+ * tracking structs
+ */
+
+// set from userspace when the kernel supports task local storage
+const volatile bool use_task_storage = false;
+
+// all of the scheduler state tracked for a task, kept together so that each
+// context switch only needs a single lookup per task
+struct task_state {
+	u64 enqueued_at;
+	u64 offcpu_at;
+	u64 running_at;
+	u32 last_cpu;
+	// set once `last_cpu` is valid
+	u16 has_run;
+	// the kernel stack the task blocked in, negative if it was preempted or
+	// the stack was not captured
+	s16 offcpu_stack;
+};
+
+// state stored with each task, preferred when supported
+struct {
+	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, struct task_state);
+} task_storage SEC(".maps");
+
+// state indexed by pid, used on older kernels
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_PID);
+	__type(key, u32);
+	__type(value, struct task_state);
+} task_array SEC(".maps");
+
+// returns a pointer to the state for the task, using either the task local
+// storage or the array indexed by pid
+static __always_inline struct task_state *lookup_task_state(struct task_struct *task)
+{
+	struct task_state *state;
+
+	if (use_task_storage) {
+		state = bpf_task_storage_get(&task_storage, task, 0, BPF_LOCAL_STORAGE_GET_F_CREATE);
+
+		if (!state) {
+			health_incr(HEALTH_MAP_FULL);
+		}
+	} else {
+		u32 pid = task->pid;
+
+		state = bpf_map_lookup_elem(&task_array, &pid);
+
+		if (!state) {
+			health_incr(HEALTH_OUT_OF_RANGE);
+		}
+	}
+
+	return state;
+}
+
+/*
+ * off-cpu stacks
+ */
+
+// the off-cpu time at or above which the time is added to the total for the
+// stack the task blocked in, set from userspace. zero disables stack capture
+const volatile u64 offcpu_stack_threshold = 0;
+
+// the kernel stacks which tasks blocked in. stacks are never removed, so that
+// the ids held by blocked tasks remain valid
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, STACK_DEPTH * sizeof(u64));
+	__uint(max_entries, MAX_STACKS);
+} offcpu_stacks SEC(".maps");
+
+// total off-cpu time for each cgroup, process and stack, drained from
+// userspace
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_STACKS);
+	__type(key, struct stack_key);
+	__type(value, u64);
+} offcpu_stack_totals SEC(".maps");
+
+/*
+ * histograms, each has one bank of buckets per CPU
+ */
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * HISTOGRAM_BANK);
+} runqlat SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * HISTOGRAM_BANK));
+} runqlat_dirty SEC(".maps");
+
+// runqueue latency for each cgroup, one bank of buckets per cgroup. unlike the
+// per-cgroup counters of the other samplers, this is shared by all CPUs, as a
+// copy for each CPU would need `MAX_CGROUPS` histograms per CPU
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CGROUPS * HISTOGRAM_BANK);
+} cgroup_runqlat SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CGROUPS * HISTOGRAM_BANK));
+} cgroup_runqlat_dirty SEC(".maps");
+
+// runqueue latency split by whether the task runs on the same cpu it last ran
+// on or was migrated to a different cpu
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * HISTOGRAM_BANK);
+} runqlat_same_cpu SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * HISTOGRAM_BANK));
+} runqlat_same_cpu_dirty SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * HISTOGRAM_BANK);
+} runqlat_migrated SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * HISTOGRAM_BANK));
+} runqlat_migrated_dirty SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * HISTOGRAM_BANK);
+} running SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * HISTOGRAM_BANK));
+} running_dirty SEC(".maps");
+
+/*
+ * cpu topology, loaded from userspace
+ */
+
+// the last level cache of each cpu, identified by the first cpu sharing it
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS);
+} cpu_llc SEC(".maps");
+
+// the numa node of each cpu
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS);
+} cpu_node SEC(".maps");
+
+/**
+ * commit bcf9033e5449 ("sched: move CPU field back into thread_info if
+ * THREAD_INFO_IN_TASK") moves task_struct::cpu into thread_info
+ * see:
+ *     https://github.com/torvalds/linux/commit/bcf9033e5449
+ */
+struct task_struct___cpu {
+	unsigned int cpu;
+} __attribute__((preserve_access_index));
+
+static __always_inline u32 get_task_cpu(struct task_struct *task)
+{
+	if (bpf_core_field_exists(task->thread_info.cpu))
+		return BPF_CORE_READ(task, thread_info.cpu);
+	return BPF_CORE_READ((struct task_struct___cpu *)task, cpu);
+}
+
+// counts wakeups where the waker and the wakee are on different last level
+// caches or numa nodes
+static __always_inline void count_remote_wakeup(struct task_struct *p)
+{
+	u32 waker_cpu = bpf_get_smp_processor_id();
+	u32 wakee_cpu = get_task_cpu(p);
+
+	if (waker_cpu == wakee_cpu || waker_cpu >= MAX_CPUS) {
+		return;
+	}
+
+	u64 *waker, *wakee;
+
+	waker = bpf_map_lookup_elem(&cpu_llc, &waker_cpu);
+	wakee = bpf_map_lookup_elem(&cpu_llc, &wakee_cpu);
+
+	if (waker && wakee && *waker != *wakee) {
+		array_incr(&counters, COUNTER_GROUP_WIDTH * waker_cpu + WAKEUP_CROSS_LLC);
+	}
+
+	waker = bpf_map_lookup_elem(&cpu_node, &waker_cpu);
+	wakee = bpf_map_lookup_elem(&cpu_node, &wakee_cpu);
+
+	if (waker && wakee && *waker != *wakee) {
+		array_incr(&counters, COUNTER_GROUP_WIDTH * waker_cpu + WAKEUP_CROSS_NODE);
+	}
+}
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * HISTOGRAM_BANK);
+} offcpu SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * HISTOGRAM_BANK));
+} offcpu_dirty SEC(".maps");
+
+/*
+ * perf and frequency sections, each has a perf event array with one row of
+ * `MAX_CPUS` for each event, the previous reading of each event on each cpu,
+ * and per-cgroup counters with one row of `MAX_CGROUPS` for each event
+ */
+
+struct perf_reading {
+	u64 counter;
+	u64 enabled;
+	u64 running;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, MAX_EVENTS * MAX_CPUS);
+} perf_events SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, struct perf_reading);
+	__uint(max_entries, MAX_EVENTS * MAX_CPUS);
+} perf_readings SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_EVENTS * MAX_CGROUPS);
+} cgroup_perf SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_EVENTS * MAX_CGROUPS));
+} cgroup_perf_dirty SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__type(key, u32);
+	__type(value, u32);
+	__uint(max_entries, MAX_EVENTS * MAX_CPUS);
+} frequency_events SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, u32);
+	__type(value, struct perf_reading);
+	__uint(max_entries, MAX_EVENTS * MAX_CPUS);
+} frequency_readings SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_EVENTS * MAX_CGROUPS);
+} cgroup_frequency SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_EVENTS * MAX_CGROUPS));
+} cgroup_frequency_dirty SEC(".maps");
+
+// zero the per-cgroup counters of each section and the runqueue histogram when
+// a cgroup slot is reused, so that the new cgroup does not report the history
+// of the cgroup which had the slot before it
+static __always_inline void reset_cgroup(u32 cgroup_id)
+{
+	u64 zero = 0;
+
+	u32 width = histogram_bank_width(histogram_power);
+	u32 start = width * cgroup_id;
+
+	for (u32 i = 0; i < width; i++) {
+		u32 idx = start + i;
+
+		bpf_map_update_elem(&cgroup_runqlat, &idx, &zero, BPF_ANY);
+
+		// the bank is a whole number of cachelines, so mark each cacheline
+		// once all of its buckets are zeroed
+		if (i % 8 == 7) {
+			mark_dirty(&cgroup_runqlat_dirty, idx);
+		}
+	}
+
+	for (u32 event = 0; event < MAX_EVENTS; event++) {
+		u32 offset = event * MAX_CGROUPS + cgroup_id;
+
+		if (event < nr_perf_events) {
+			bpf_map_update_elem(&cgroup_perf, &offset, &zero, BPF_ANY);
+		}
+
+		if (event < nr_frequency_events) {
+			bpf_map_update_elem(&cgroup_frequency, &offset, &zero, BPF_ANY);
+		}
+	}
+}
+
+// returns the cgroup slot for the task. this must be used instead of calling
+// `task_cgroup_id()` directly, as a new cgroup is only reported once for the
+// whole program and every section needs to reset its state
+static __always_inline u32 switch_cgroup_id(struct task_struct *task)
+{
+	bool is_new;
+	int cgroup_id = task_cgroup_id(task, &is_new);
+
+	if (cgroup_id && is_new) {
+		reset_cgroup(cgroup_id);
+	}
+
+	return cgroup_id;
+}
+
+// reads the first `nr` events of a perf event array on this cpu and adds the
+// change since the last reading to the counters for the cgroup
+static __always_inline void count_events(void *events, void *readings, void *cgroup_counters, void *cgroup_dirty, u32 nr, u32 processor_id, u32 cgroup_id)
+{
+	for (u32 event = 0; event < MAX_EVENTS; event++) {
+		if (event >= nr) {
+			break;
+		}
+
+		u32 idx = event * MAX_CPUS + processor_id;
+
+		struct bpf_perf_event_value value = {};
+
+		if (bpf_perf_event_read_value(events, idx, &value, sizeof(value))) {
+			continue;
+		}
+
+		struct perf_reading *last = bpf_map_lookup_elem(readings, &idx);
+
+		if (!last) {
+			continue;
+		}
+
+		// update the cgroup counter, skipping the first reading on each cpu
+		if (cgroup_id && last->enabled) {
+			u64 delta = value.counter - last->counter;
+			u64 enabled = value.enabled - last->enabled;
+			u64 running = value.running - last->running;
+
+			// the event was multiplexed with others, so scale up the count
+			// by the fraction of time it was actually running
+			if (running && running < enabled) {
+				delta = (delta * ((enabled << SCALE_SHIFT) / running)) >> SCALE_SHIFT;
+			}
+
+			array_add_dirty(cgroup_counters, cgroup_dirty, event * MAX_CGROUPS + cgroup_id, delta);
+		}
+
+		// update the per-core reading
+
+		last->counter = value.counter;
+		last->enabled = value.enabled;
+		last->running = value.running;
+	}
+}
+
+/*
+ * programs
+ */
+
+/* record enqueue timestamp */
+static __always_inline
+int trace_enqueue(struct task_struct *p)
+{
+	struct task_state *state;
+
+	if (!p->pid) {
+		return 0;
+	}
+
+	state = lookup_task_state(p);
+	if (state) {
+		state->enqueued_at = bpf_ktime_get_ns();
+	}
+
+	count_remote_wakeup(p);
+
+	return 0;
+}
+
+SEC("tp_btf/sched_wakeup")
+int handle__sched_wakeup(u64 *ctx)
+{
+	/* TP_PROTO(struct task_struct *p) */
+	struct task_struct *p = (void *)ctx[0];
+
+	return trace_enqueue(p);
+}
+
+SEC("tp_btf/sched_wakeup_new")
+int handle__sched_wakeup_new(u64 *ctx)
+{
+	/* TP_PROTO(struct task_struct *p) */
+	struct task_struct *p = (void *)ctx[0];
+
+	return trace_enqueue(p);
+}
+
+SEC("tp_btf/sched_migrate_task")
+int handle__sched_migrate_task(u64 *ctx)
+{
+	/* TP_PROTO(struct task_struct *p, int dest_cpu) */
+	u32 dest_cpu = (u32)ctx[1];
+
+	// migrations are counted by the cpu the task is moving to
+	if (dest_cpu < MAX_CPUS) {
+		array_incr(&counters, COUNTER_GROUP_WIDTH * dest_cpu + MIGRATIONS);
+	}
+
+	return 0;
+}
+
+// the runqueue section of the sched_switch handler
+static __always_inline void runqueue_switch(u64 *ctx, struct task_struct *prev, struct task_struct *next, u32 processor_id)
+{
+	struct task_state *state;
+	u32 idx;
+	u64 delta_ns, offcpu_ns;
+
+	u64 ts = bpf_ktime_get_ns();
+
+	// prev task is moving from running
+	// - if it is still runnable it was preempted, so count an involuntary
+	//   context switch, mark when it was enqueued, and calculate how long it
+	//   was running
+	// - for all tasks, track when it went off-cpu
+	state = lookup_task_state(prev);
+
+	bool preempted = get_task_state(prev) == TASK_RUNNING;
+
+	if (preempted) {
+		// count involuntary context switch
+		idx = COUNTER_GROUP_WIDTH * processor_id + IVCSW;
+		array_incr(&counters, idx);
+
+		if (state) {
+			// mark when it was enqueued
+			state->enqueued_at = ts;
+
+			// calculate how long it was running and increment stats
+			if (state->running_at) {
+				delta_ns = ts - state->running_at;
+
+				// update histogram
+				histogram_incr_percpu_dirty(&running, &running_dirty, histogram_bank_width(histogram_power), histogram_power, delta_ns);
+
+				state->running_at = 0;
+			}
+		}
+	}
+
+	// mark off-cpu at
+	if (state) {
+		state->offcpu_at = ts;
+
+		// the task is still running here, so its kernel stack shows where it
+		// blocked. preempted tasks are only waiting on the runqueue
+		if (offcpu_stack_threshold) {
+			s32 stack_id = -1;
+
+			if (!preempted) {
+				stack_id = bpf_get_stackid(ctx, &offcpu_stacks, 0);
+
+				if (stack_id < 0) {
+					health_incr(HEALTH_MAP_FULL);
+				}
+			}
+
+			state->offcpu_stack = stack_id;
+		}
+	}
+
+	// next task has moved into running
+	// - mark when it started running
+	// - calculate how long it was enqueued and off-cpu, update hists
+	state = lookup_task_state(next);
+	if (!state) {
+		return;
+	}
+
+	bool migrated = state->has_run && state->last_cpu != processor_id;
+
+	state->running_at = ts;
+	state->last_cpu = processor_id;
+	state->has_run = 1;
+
+	// calculate how long it was enqueued and increment stats
+	if (state->enqueued_at) {
+		delta_ns = ts - state->enqueued_at;
+
+		// update the histogram
+		histogram_incr_percpu_dirty(&runqlat, &runqlat_dirty, histogram_bank_width(histogram_power), histogram_power, delta_ns);
+
+		// update the histogram for where the task runs
+		if (migrated) {
+			histogram_incr_percpu_dirty(&runqlat_migrated, &runqlat_migrated_dirty, histogram_bank_width(histogram_power), histogram_power, delta_ns);
+		} else {
+			histogram_incr_percpu_dirty(&runqlat_same_cpu, &runqlat_same_cpu_dirty, histogram_bank_width(histogram_power), histogram_power, delta_ns);
+		}
+
+		// update the histogram for the cgroup of the task
+		u32 cgroup_id = switch_cgroup_id(next);
+
+		if (cgroup_id) {
+			array_incr_dirty(&cgroup_runqlat, &cgroup_runqlat_dirty, histogram_bank_width(histogram_power) * cgroup_id + value_to_index(delta_ns, histogram_power));
+		}
+
+		// the exemplar is for the task which waited, identified by the cpu it
+		// waited for
+		exemplar_submit(next, processor_id, delta_ns);
+
+		state->enqueued_at = 0;
+
+		// calculate how long it was off-cpu, not including runqueue wait,
+		// and increment stats
+		if (state->offcpu_at) {
+			offcpu_ns = ts - state->offcpu_at;
+
+			if (offcpu_ns > delta_ns) {
+				offcpu_ns = offcpu_ns - delta_ns;
+
+				// update the histogram
+				histogram_incr_percpu_dirty(&offcpu, &offcpu_dirty, histogram_bank_width(histogram_power), histogram_power, offcpu_ns);
+
+				// aggregate long off-cpu intervals by where the task blocked
+				if (offcpu_stack_threshold && offcpu_ns >= offcpu_stack_threshold && state->offcpu_stack >= 0) {
+					struct stack_key key = {
+						.cgroup = cgroup_id,
+						.tgid = BPF_CORE_READ(next, tgid),
+						.user_stack_id = -1,
+						.kernel_stack_id = state->offcpu_stack,
+					};
+
+					stack_total_add(&offcpu_stack_totals, &key, offcpu_ns);
+				}
+			}
+
+			state->offcpu_at = 0;
+		}
+	}
+}
+
+SEC("tp_btf/sched_switch")
+int handle__sched_switch(u64 *ctx)
+{
+	/* TP_PROTO(bool preempt, struct task_struct *prev,
+	 *      struct task_struct *next)
+	 */
+	struct task_struct *prev = (struct task_struct *)ctx[1];
+	struct task_struct *next = (struct task_struct *)ctx[2];
+
+	u32 processor_id = bpf_get_smp_processor_id();
+
+	if (processor_id >= MAX_CPUS) {
+		return 0;
+	}
+
+	// the counters are attributed to the cgroup of the task which was running
+	if (nr_perf_events || nr_frequency_events) {
+		u32 cgroup_id = switch_cgroup_id(prev);
+
+		if (nr_perf_events) {
+			count_events(&perf_events, &perf_readings, &cgroup_perf, &cgroup_perf_dirty, nr_perf_events, processor_id, cgroup_id);
+		}
+
+		if (nr_frequency_events) {
+			count_events(&frequency_events, &frequency_readings, &cgroup_frequency, &cgroup_frequency_dirty, nr_frequency_events, processor_id, cgroup_id);
+		}
+	}
+
+	if (runqueue_enabled) {
+		runqueue_switch(ctx, prev, next, processor_id);
+	}
+
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
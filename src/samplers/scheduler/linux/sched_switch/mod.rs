@@ -0,0 +1,274 @@
+//! Runs all of the BPF work which is done on each context switch in a single
+//! program, so that only one program is called in the context switch path. The
+//! program has one section for each sampler which traces `sched_switch`:
+//! * `scheduler_runqueue`
+//! * `cpu_perf`
+//! * `cpu_frequency`
+//!
+//! Each section is loaded when its sampler is enabled, and the sampler configs
+//! are used as normal. The cpu and the cgroup of the previous task are found
+//! once for every section.
+
+const NAME: &str = "sched_switch";
+
+mod bpf {
+    include!(concat!(env!("OUT_DIR"), "/scheduler_sched_switch.bpf.rs"));
+}
+
+use bpf::*;
+
+use crate::common::*;
+use crate::samplers::cpu::linux::{frequency, perf};
+use crate::samplers::scheduler::linux::runqueue;
+use crate::samplers::scheduler::linux::stats::*;
+use crate::*;
+
+use std::sync::Arc;
+
+#[distributed_slice(SAMPLERS)]
+fn init(config: Arc<Config>) -> SamplerResult {
+    let runqueue = config.enabled(runqueue::NAME);
+
+    let perf_events = if config.enabled(perf::NAME) {
+        perf::events(&config)
+    } else {
+        Vec::new()
+    };
+
+    let frequency_events = if config.enabled(frequency::NAME) {
+        match frequency::events() {
+            Ok(events) => events,
+            Err(e) => {
+                debug!("{} failed to initialize MSR events: {e}", frequency::NAME);
+                Vec::new()
+            }
+        }
+    } else {
+        Vec::new()
+    };
+
+    if !runqueue && perf_events.is_empty() && frequency_events.is_empty() {
+        return Ok(None);
+    }
+
+    let nr_perf_events = perf_events.len() as u32;
+    let nr_frequency_events = frequency_events.len() as u32;
+
+    // prefer task local storage for the per-task state, falling back to an
+    // array indexed by pid on older kernels
+    let task_storage = runqueue && task_storage_supported();
+
+    // only the runqueue section records histograms
+    let histogram_power = config.histogram_grouping_power(runqueue::NAME);
+    let exemplar_threshold = config.exemplar_threshold(runqueue::NAME);
+    let offcpu_stack_threshold = config.offcpu_stack_threshold(runqueue::NAME);
+
+    let mut bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.runqueue_enabled = runqueue;
+            skel.maps.rodata_data.nr_perf_events = nr_perf_events;
+            skel.maps.rodata_data.nr_frequency_events = nr_frequency_events;
+            skel.maps.rodata_data.histogram_power = histogram_power;
+
+            if !runqueue {
+                // only the sched_switch handler is needed by the other sections
+                skel.progs.handle__sched_wakeup.set_autoload(false)?;
+                skel.progs.handle__sched_wakeup_new.set_autoload(false)?;
+                skel.progs.handle__sched_migrate_task.set_autoload(false)?;
+
+                for map in [
+                    &mut skel.maps.runqlat,
+                    &mut skel.maps.runqlat_dirty,
+                    &mut skel.maps.runqlat_same_cpu,
+                    &mut skel.maps.runqlat_same_cpu_dirty,
+                    &mut skel.maps.runqlat_migrated,
+                    &mut skel.maps.runqlat_migrated_dirty,
+                    &mut skel.maps.cgroup_runqlat,
+                    &mut skel.maps.cgroup_runqlat_dirty,
+                    &mut skel.maps.running,
+                    &mut skel.maps.running_dirty,
+                    &mut skel.maps.offcpu,
+                    &mut skel.maps.offcpu_dirty,
+                    &mut skel.maps.offcpu_stacks,
+                    &mut skel.maps.offcpu_stack_totals,
+                    &mut skel.maps.task_array,
+                ] {
+                    map.set_max_entries(1)?;
+                }
+
+                return skel.maps.task_storage.set_autocreate(false);
+            }
+
+            if let Some(threshold) = exemplar_threshold {
+                skel.maps.rodata_data.exemplar_threshold = threshold.as_nanos() as u64;
+            }
+
+            if let Some(threshold) = offcpu_stack_threshold {
+                skel.maps.rodata_data.offcpu_stack_threshold = threshold.as_nanos() as u64;
+            } else {
+                skel.maps.offcpu_stacks.set_max_entries(1)?;
+                skel.maps.offcpu_stack_totals.set_max_entries(1)?;
+            }
+
+            if task_storage {
+                skel.maps.rodata_data.use_task_storage = true;
+                skel.maps.task_array.set_max_entries(1)
+            } else {
+                // the array only needs to cover the pids on this host
+                skel.maps.task_array.set_max_entries(pid_max())?;
+                skel.maps.task_storage.set_autocreate(false)
+            }
+        })
+        .histogram_grouping_power(histogram_power)
+        .health_counters("health");
+
+    let mut cgroup_metrics: Vec<&'static dyn CgroupMetric> = Vec::new();
+
+    if runqueue {
+        bpf = bpf
+            .counters(
+                "counters",
+                vec![
+                    &SCHEDULER_MIGRATIONS,
+                    &SCHEDULER_IVCSW,
+                    &SCHEDULER_WAKEUP_CROSS_LLC,
+                    &SCHEDULER_WAKEUP_CROSS_NODE,
+                ],
+            )
+            .cpu_counters("counters", vec![&SCHEDULER_MIGRATIONS_PERCPU])
+            .percpu_histogram(
+                "runqlat",
+                &SCHEDULER_RUNQUEUE_LATENCY,
+                Some(&SCHEDULER_RUNQUEUE_LATENCY_PERCPU),
+            )
+            .percpu_histogram(
+                "runqlat_same_cpu",
+                &SCHEDULER_RUNQUEUE_LATENCY_SAME_CPU,
+                None,
+            )
+            .percpu_histogram(
+                "runqlat_migrated",
+                &SCHEDULER_RUNQUEUE_LATENCY_MIGRATED,
+                None,
+            )
+            .histogram_group("cgroup_runqlat", &CGROUP_SCHEDULER_RUNQUEUE_LATENCY)
+            .map("cpu_llc", topology(common::linux::cpu_llc))
+            .map("cpu_node", topology(common::linux::cpu_node))
+            .percpu_histogram("running", &SCHEDULER_RUNNING, None)
+            .percpu_histogram("offcpu", &SCHEDULER_OFFCPU, None)
+            .dirty_bitmap("runqlat", "runqlat_dirty")
+            .dirty_bitmap("runqlat_same_cpu", "runqlat_same_cpu_dirty")
+            .dirty_bitmap("runqlat_migrated", "runqlat_migrated_dirty")
+            .dirty_bitmap("cgroup_runqlat", "cgroup_runqlat_dirty")
+            .dirty_bitmap("running", "running_dirty")
+            .dirty_bitmap("offcpu", "offcpu_dirty");
+
+        cgroup_metrics.push(&CGROUP_SCHEDULER_RUNQUEUE_LATENCY);
+
+        if exemplar_threshold.is_some() {
+            bpf = bpf.exemplars("exemplars", "cpu", |cpu| cpu.to_string());
+        }
+
+        if offcpu_stack_threshold.is_some() {
+            bpf = bpf.stack_totals("offcpu", "offcpu_stack_totals", "offcpu_stacks", false);
+        }
+    }
+
+    for (map, cgroup_map, cgroup_dirty, events) in [
+        (
+            "perf_events",
+            "cgroup_perf",
+            "cgroup_perf_dirty",
+            perf_events,
+        ),
+        (
+            "frequency_events",
+            "cgroup_frequency",
+            "cgroup_frequency_dirty",
+            frequency_events,
+        ),
+    ] {
+        if events.is_empty() {
+            continue;
+        }
+
+        let mut percpu = Vec::new();
+        let mut cgroup = Vec::new();
+
+        for (event, percpu_counters, cgroup_counters) in events {
+            percpu.push((event, percpu_counters));
+            cgroup.push(cgroup_counters);
+            cgroup_metrics.push(cgroup_counters);
+        }
+
+        bpf = bpf
+            .perf_event_array(map, percpu)
+            .packed_counters_array(cgroup_map, cgroup)
+            .dirty_bitmap(cgroup_map, cgroup_dirty);
+    }
+
+    Ok(Some(Box::new(bpf.cgroup_metrics(cgroup_metrics).build()?)))
+}
+
+/// Returns a value for each CPU which identifies the part of the topology the
+/// CPU belongs to, such as its last level cache. CPUs where the topology is not
+/// known are treated as all belonging to the same part.
+fn topology(lookup: fn(usize) -> Option<usize>) -> Vec<u64> {
+    (0..MAX_CPUS)
+        .map(|cpu| lookup(cpu).unwrap_or(0) as u64)
+        .collect()
+}
+
+impl SkelExt for ModSkel<'_> {
+    fn map(&self, name: &str) -> &libbpf_rs::Map {
+        match name {
+            "cgroup_frequency" => &self.maps.cgroup_frequency,
+            "cgroup_frequency_dirty" => &self.maps.cgroup_frequency_dirty,
+            "cgroup_perf" => &self.maps.cgroup_perf,
+            "cgroup_perf_dirty" => &self.maps.cgroup_perf_dirty,
+            "cgroup_runqlat" => &self.maps.cgroup_runqlat,
+            "cgroup_runqlat_dirty" => &self.maps.cgroup_runqlat_dirty,
+            "counters" => &self.maps.counters,
+            "cpu_llc" => &self.maps.cpu_llc,
+            "cpu_node" => &self.maps.cpu_node,
+            "exemplars" => &self.maps.exemplars,
+            "frequency_events" => &self.maps.frequency_events,
+            "offcpu" => &self.maps.offcpu,
+            "offcpu_dirty" => &self.maps.offcpu_dirty,
+            "offcpu_stack_totals" => &self.maps.offcpu_stack_totals,
+            "offcpu_stacks" => &self.maps.offcpu_stacks,
+            "perf_events" => &self.maps.perf_events,
+            "running" => &self.maps.running,
+            "running_dirty" => &self.maps.running_dirty,
+            "runqlat" => &self.maps.runqlat,
+            "runqlat_dirty" => &self.maps.runqlat_dirty,
+            "runqlat_migrated" => &self.maps.runqlat_migrated,
+            "runqlat_migrated_dirty" => &self.maps.runqlat_migrated_dirty,
+            "runqlat_same_cpu" => &self.maps.runqlat_same_cpu,
+            "runqlat_same_cpu_dirty" => &self.maps.runqlat_same_cpu_dirty,
+            "health" => &self.maps.health,
+            _ => unimplemented!(),
+        }
+    }
+}
+
+impl OpenSkelExt for ModSkel<'_> {
+    fn log_prog_instructions(&self) {
+        debug!(
+            "{NAME} handle__sched_switch() BPF instruction count: {}",
+            self.progs.handle__sched_switch.insn_cnt()
+        );
+        debug!(
+            "{NAME} handle__sched_wakeup() BPF instruction count: {}",
+            self.progs.handle__sched_wakeup.insn_cnt()
+        );
+        debug!(
+            "{NAME} handle__sched_wakeup_new() BPF instruction count: {}",
+            self.progs.handle__sched_wakeup_new.insn_cnt()
+        );
+        debug!(
+            "{NAME} handle__sched_migrate_task() BPF instruction count: {}",
+            self.progs.handle__sched_migrate_task.insn_cnt()
+        );
+    }
+}
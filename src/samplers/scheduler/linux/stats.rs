@@ -1,4 +1,7 @@
-use crate::common::HISTOGRAM_GROUPING_POWER;
+use crate::common::{
+    CounterGroup, HistogramGroup, HISTOGRAM_GROUPING_POWER, MAX_CGROUPS, MAX_CPUS,
+    MAX_HISTOGRAM_GROUPING_POWER,
+};
 use metriken::*;
 
 #[metric(
@@ -7,24 +10,92 @@ use metriken::*;
     metadata = { unit = "nanoseconds" }
 )]
 pub static SCHEDULER_RUNQUEUE_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "scheduler/runqueue/latency/cpu",
+    description = "Distribution of the amount of time tasks were waiting in the runqueue on a per-CPU basis",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static SCHEDULER_RUNQUEUE_LATENCY_PERCPU: HistogramGroup =
+    HistogramGroup::new(MAX_CPUS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "cgroup/scheduler/runqueue/latency",
+    description = "Distribution of the amount of time tasks were waiting in the runqueue on a per-cgroup basis",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static CGROUP_SCHEDULER_RUNQUEUE_LATENCY: HistogramGroup =
+    HistogramGroup::new(MAX_CGROUPS, HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "scheduler/runqueue/latency/same_cpu",
+    description = "Distribution of the amount of time tasks were waiting in the runqueue before running on the same CPU they last ran on",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static SCHEDULER_RUNQUEUE_LATENCY_SAME_CPU: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
+
+#[metric(
+    name = "scheduler/runqueue/latency/migrated",
+    description = "Distribution of the amount of time tasks were waiting in the runqueue before running on a different CPU than they last ran on",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static SCHEDULER_RUNQUEUE_LATENCY_MIGRATED: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "scheduler/running",
     description = "Distribution of the amount of time tasks were on-CPU",
     metadata = { unit = "nanoseconds" }
 )]
-pub static SCHEDULER_RUNNING: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static SCHEDULER_RUNNING: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "scheduler/offcpu",
     description = "Distribution of the amount of time tasks were off-CPU",
     metadata = { unit = "nanoseconds" }
 )]
-pub static SCHEDULER_OFFCPU: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static SCHEDULER_OFFCPU: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "scheduler/context_switch/involuntary",
     description = "The number of involuntary context switches"
 )]
 pub static SCHEDULER_IVCSW: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "scheduler/migrations",
+    description = "The number of times tasks were migrated between CPUs"
+)]
+pub static SCHEDULER_MIGRATIONS: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "scheduler/migrations",
+    description = "The number of times tasks were migrated to each CPU",
+    formatter = cpu_formatter
+)]
+pub static SCHEDULER_MIGRATIONS_PERCPU: CounterGroup = CounterGroup::new(MAX_CPUS);
+
+#[metric(
+    name = "scheduler/wakeup/cross_llc",
+    description = "The number of wakeups where the waker and the wakee are on CPUs with different last level caches"
+)]
+pub static SCHEDULER_WAKEUP_CROSS_LLC: LazyCounter = LazyCounter::new(Counter::default);
+
+#[metric(
+    name = "scheduler/wakeup/cross_node",
+    description = "The number of wakeups where the waker and the wakee are on CPUs in different NUMA nodes"
+)]
+pub static SCHEDULER_WAKEUP_CROSS_NODE: LazyCounter = LazyCounter::new(Counter::default);
+
+pub fn cpu_formatter(metric: &MetricEntry, format: Format) -> String {
+    match format {
+        Format::Simple => {
+            format!("{}/cpu", metric.name())
+        }
+        _ => metric.name().to_string(),
+    }
+}
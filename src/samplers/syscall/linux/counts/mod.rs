@@ -1,73 +0,0 @@
-/// Collects Syscall stats using BPF and traces:
-/// * `raw_syscalls/sys_enter`
-///
-/// And produces these stats:
-/// * `syscall/total`
-/// * `syscall/read`
-/// * `syscall/write`
-/// * `syscall/poll`
-/// * `syscall/lock`
-/// * `syscall/time`
-/// * `syscall/sleep`
-/// * `syscall/socket`
-/// * `syscall/yield`
-
-const NAME: &str = "syscall_counts";
-
-mod bpf {
-    include!(concat!(env!("OUT_DIR"), "/syscall_counts.bpf.rs"));
-}
-
-use bpf::*;
-
-use crate::common::*;
-use crate::samplers::syscall::linux::stats::*;
-use crate::samplers::syscall::linux::syscall_lut;
-use crate::*;
-
-use std::sync::Arc;
-
-#[distributed_slice(SAMPLERS)]
-fn init(config: Arc<Config>) -> SamplerResult {
-    if !config.enabled(NAME) {
-        return Ok(None);
-    }
-
-    let counters = vec![
-        &SYSCALL_TOTAL,
-        &SYSCALL_READ,
-        &SYSCALL_WRITE,
-        &SYSCALL_POLL,
-        &SYSCALL_LOCK,
-        &SYSCALL_TIME,
-        &SYSCALL_SLEEP,
-        &SYSCALL_SOCKET,
-        &SYSCALL_YIELD,
-    ];
-
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
-        .counters("counters", counters)
-        .map("syscall_lut", syscall_lut())
-        .build()?;
-
-    Ok(Some(Box::new(bpf)))
-}
-
-impl SkelExt for ModSkel<'_> {
-    fn map(&self, name: &str) -> &libbpf_rs::Map {
-        match name {
-            "counters" => &self.maps.counters,
-            "syscall_lut" => &self.maps.syscall_lut,
-            _ => unimplemented!(),
-        }
-    }
-}
-
-impl OpenSkelExt for ModSkel<'_> {
-    fn log_prog_instructions(&self) {
-        debug!(
-            "{NAME} sys_enter() BPF instruction count: {}",
-            self.progs.sys_enter.insn_cnt()
-        );
-    }
-}
@@ -1,14 +1,81 @@
 mod stats;
 
-mod counts;
-mod latency;
+mod syscall;
+
+use crate::*;
+
+use stats::MAX_CUSTOM_FAMILIES;
+
+use std::collections::HashMap;
 
 pub const MAX_SYSCALL_ID: usize = 1024;
 
-pub fn syscall_lut() -> Vec<u64> {
-    (0..MAX_SYSCALL_ID)
+/// The built-in syscall families, in the order of their rows in the BPF counter
+/// and latency maps after the total. Each of these families has its own
+/// metrics.
+pub const SYSCALL_FAMILIES: [&str; 8] = [
+    "read", "write", "poll", "lock", "time", "sleep", "socket", "yield",
+];
+
+/// The row of the first family defined in the config. These families follow
+/// the total and the built-in families, and must match `FIRST_CUSTOM_ROW` in
+/// the BPF program.
+const FIRST_CUSTOM_ROW: usize = SYSCALL_FAMILIES.len() + 1;
+
+/// The lookup table from syscall id to family row, along with the names of the
+/// families defined in the config.
+pub struct SyscallLut {
+    pub rows: Vec<u64>,
+    pub custom_families: Vec<String>,
+}
+
+/// Returns the family row for each syscall id, with zero for syscalls which are
+/// not grouped. `families` maps syscall names to a family name, or to `none`,
+/// and overrides the default grouping. Families which are not one of
+/// `SYSCALL_FAMILIES` are defined by the config, and are given rows after the
+/// built-in families in the order of their names, up to `MAX_CUSTOM_FAMILIES`.
+/// Their metrics are labeled with the family name.
+pub fn syscall_lut(families: Option<&HashMap<String, String>>) -> SyscallLut {
+    let mut custom_families: Vec<String> = families
+        .into_iter()
+        .flatten()
+        .map(|(_, family)| family)
+        .filter(|family| *family != "none" && !SYSCALL_FAMILIES.contains(&family.as_str()))
+        .cloned()
+        .collect();
+
+    custom_families.sort();
+    custom_families.dedup();
+
+    if custom_families.len() > MAX_CUSTOM_FAMILIES {
+        for family in custom_families.drain(MAX_CUSTOM_FAMILIES..) {
+            warn!("too many syscall families, '{family}' is not tracked");
+        }
+    }
+
+    let mut overrides = HashMap::new();
+
+    for (syscall, family) in families.into_iter().flatten() {
+        let row = if family == "none" {
+            0
+        } else if let Some(idx) = SYSCALL_FAMILIES.iter().position(|f| f == family) {
+            idx + 1
+        } else if let Some(idx) = custom_families.iter().position(|f| f == family) {
+            FIRST_CUSTOM_ROW + idx
+        } else {
+            continue;
+        };
+
+        overrides.insert(syscall.as_str(), row as u64);
+    }
+
+    let rows: Vec<u64> = (0..MAX_SYSCALL_ID)
         .map(|id| {
             if let Some(syscall_name) = syscall_numbers::native::sys_call_name(id as i64) {
+                if let Some(row) = overrides.remove(syscall_name) {
+                    return row;
+                }
+
                 match syscall_name {
                     // read related
                     "pread64" | "preadv" | "preadv2" | "read" | "readv" | "recvfrom"
@@ -42,5 +109,94 @@ pub fn syscall_lut() -> Vec<u64> {
                 0
             }
         })
-        .collect()
+        .collect();
+
+    for syscall in overrides.keys() {
+        warn!("unknown syscall '{syscall}' in syscall families");
+    }
+
+    SyscallLut {
+        rows,
+        custom_families,
+    }
+}
+
+/// Formats a syscall id for exemplars, using the name of the syscall when it is
+/// known.
+pub fn syscall_name(id: u32) -> String {
+    syscall_numbers::native::sys_call_name(id as i64)
+        .map(|name| name.to_string())
+        .unwrap_or_else(|| id.to_string())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn id(name: &str) -> usize {
+        (0..MAX_SYSCALL_ID)
+            .find(|id| syscall_numbers::native::sys_call_name(*id as i64) == Some(name))
+            .unwrap()
+    }
+
+    #[test]
+    fn families() {
+        let lut = syscall_lut(None);
+
+        assert_eq!(lut.rows[id("read")], 1);
+        assert_eq!(lut.rows[id("futex")], 4);
+        assert_eq!(lut.rows[id("io_uring_enter")], 0);
+        assert!(lut.custom_families.is_empty());
+
+        let families = HashMap::from([
+            ("io_uring_enter".to_string(), "read".to_string()),
+            ("futex".to_string(), "none".to_string()),
+            ("epoll_ctl".to_string(), "none".to_string()),
+        ]);
+
+        let lut = syscall_lut(Some(&families));
+
+        assert_eq!(lut.rows[id("io_uring_enter")], 1);
+        assert_eq!(lut.rows[id("futex")], 0);
+        assert_eq!(lut.rows[id("epoll_ctl")], 0);
+        assert!(lut.custom_families.is_empty());
+    }
+
+    #[test]
+    fn custom_families() {
+        let families = HashMap::from([
+            ("io_uring_enter".to_string(), "io_uring".to_string()),
+            ("futex".to_string(), "futex".to_string()),
+            ("epoll_wait".to_string(), "epoll".to_string()),
+            ("epoll_pwait".to_string(), "epoll".to_string()),
+        ]);
+
+        let lut = syscall_lut(Some(&families));
+
+        // the families are in the order of their names, after the built-in
+        // families
+        assert_eq!(lut.custom_families, vec!["epoll", "futex", "io_uring"]);
+        assert_eq!(lut.rows[id("epoll_wait")], FIRST_CUSTOM_ROW as u64);
+        assert_eq!(lut.rows[id("epoll_pwait")], FIRST_CUSTOM_ROW as u64);
+        assert_eq!(lut.rows[id("futex")], FIRST_CUSTOM_ROW as u64 + 1);
+        assert_eq!(lut.rows[id("io_uring_enter")], FIRST_CUSTOM_ROW as u64 + 2);
+
+        // syscalls which are not listed keep their default family
+        assert_eq!(lut.rows[id("epoll_ctl")], 3);
+
+        // families beyond the limit are not tracked
+        let families: HashMap<String, String> = (0..MAX_SYSCALL_ID)
+            .filter_map(|id| syscall_numbers::native::sys_call_name(id as i64))
+            .take(MAX_CUSTOM_FAMILIES + 1)
+            .map(|name| (name.to_string(), format!("family_{name}")))
+            .collect();
+
+        let lut = syscall_lut(Some(&families));
+
+        assert_eq!(lut.custom_families.len(), MAX_CUSTOM_FAMILIES);
+        assert!(lut
+            .rows
+            .iter()
+            .all(|row| { (*row as usize) < FIRST_CUSTOM_ROW + MAX_CUSTOM_FAMILIES }));
+    }
 }
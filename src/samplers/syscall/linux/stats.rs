@@ -1,10 +1,18 @@
-use crate::common::HISTOGRAM_GROUPING_POWER;
+use crate::common::{
+    CounterGroup, HistogramGroup, HISTOGRAM_GROUPING_POWER, MAX_CGROUPS,
+    MAX_HISTOGRAM_GROUPING_POWER,
+};
 use metriken::*;
 
 // this is hard-coded still and must match the BPF histograms which are fixed to
 // use 2^64-1 as the max value
 static LATENCY_HISTOGRAM_MAX: u8 = 64;
 
+/// The maximum number of syscall families which can be defined in the config,
+/// in addition to the built-in families. This must match `MAX_CUSTOM_FAMILIES`
+/// in the BPF program.
+pub const MAX_CUSTOM_FAMILIES: usize = 16;
+
 #[metric(
     name = "syscall/total",
     description = "The total number of syscalls",
@@ -12,13 +20,21 @@ static LATENCY_HISTOGRAM_MAX: u8 = 64;
 )]
 pub static SYSCALL_TOTAL: LazyCounter = LazyCounter::new(Counter::default);
 
+#[metric(
+    name = "cgroup/syscall/total",
+    description = "The total number of syscalls on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "syscalls" }
+)]
+pub static CGROUP_SYSCALL_TOTAL: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
 #[metric(
     name = "syscall/total/latency",
     description = "Distribution of the latency for all syscalls",
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_TOTAL_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/read",
@@ -33,7 +49,7 @@ pub static SYSCALL_READ: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_READ_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/write",
@@ -48,7 +64,7 @@ pub static SYSCALL_WRITE: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_WRITE_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/poll",
@@ -63,7 +79,7 @@ pub static SYSCALL_POLL: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_POLL_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/lock",
@@ -78,7 +94,7 @@ pub static SYSCALL_LOCK: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_LOCK_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/time",
@@ -93,7 +109,7 @@ pub static SYSCALL_TIME: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_TIME_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/sleep",
@@ -108,7 +124,7 @@ pub static SYSCALL_SLEEP: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_SLEEP_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/socket",
@@ -123,7 +139,7 @@ pub static SYSCALL_SOCKET: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_SOCKET_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
 
 #[metric(
     name = "syscall/yield",
@@ -138,4 +154,33 @@ pub static SYSCALL_YIELD: LazyCounter = LazyCounter::new(Counter::default);
     metadata = { unit = "nanoseconds" }
 )]
 pub static SYSCALL_YIELD_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, LATENCY_HISTOGRAM_MAX);
+
+#[metric(
+    name = "syscall/family",
+    description = "The number of syscalls in each of the families defined in the config",
+    metadata = { unit = "syscalls" }
+)]
+pub static SYSCALL_FAMILY: CounterGroup = CounterGroup::new(MAX_CUSTOM_FAMILIES);
+
+#[metric(
+    name = "syscall/family/latency",
+    description = "Distribution of the latency for each of the families defined in the config",
+    metadata = { unit = "nanoseconds" }
+)]
+pub static SYSCALL_FAMILY_LATENCY: HistogramGroup = HistogramGroup::new(
+    MAX_CUSTOM_FAMILIES,
+    HISTOGRAM_GROUPING_POWER,
+    LATENCY_HISTOGRAM_MAX,
+);
+
+// formatters
+
+pub fn cgroup_formatter(metric: &MetricEntry, format: Format) -> String {
+    match format {
+        Format::Simple => {
+            format!("{}/cgroup", metric.name())
+        }
+        _ => metric.name().to_string(),
+    }
+}
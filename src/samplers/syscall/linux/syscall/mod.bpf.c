@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2020 Anton Protopopov
+// Copyright (c) 2023 The Rezolus Authors
+//
+// Based on syscount(8) from BCC by Sasha Goldshtein
+
+// NOTICE: this file is based off `syscount.bpf.c` from the BCC project
+// <https://github.com/iovisor/bcc/> and has been modified for use within
+// Rezolus.
+
+// This BPF program tracks syscall enter and exit to provide metrics about
+// syscall counts and latencies. Both are collected by the same pair of
+// programs so that each syscall only pays for a single lookup of its family.
+
+#include <vmlinux.h>
+#include "../../../common/bpf/health.h"
+#include "../../../common/bpf/helpers.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+#include "../../../common/bpf/cgroup.h"
+#include "../../../common/bpf/exemplar.h"
+
+#define COUNTER_GROUP_WIDTH 16
+#define FIRST_CUSTOM_ROW 9
+#define MAX_CUSTOM_FAMILIES 16
+#define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
+#define HISTOGRAM_BANK HISTOGRAM_BANK_WIDTH(HISTOGRAM_BUCKETS)
+#define MAX_CPUS 1024
+#define MAX_PID 4194304
+#define MAX_SYSCALL_ID 1024
+
+// set from userspace to select which metrics are collected
+const volatile bool counts_enabled = true;
+const volatile bool latency_enabled = true;
+
+// set from userspace when the kernel supports task local storage
+const volatile bool use_task_storage = false;
+
+// the number of rows in the latency histogram array, set from userspace. row 0
+// tracks all syscalls and the remaining rows are for the built-in syscall
+// families. rows from `FIRST_CUSTOM_ROW` are for the families defined in the
+// config, which are tracked in the `family_counters` and `family_latency` maps
+const volatile u32 histogram_rows = 1;
+
+// the rate at which events are sampled for the latency histograms, set from
+// userspace. a rate of N means 1-in-N events are recorded on each CPU
+const volatile u32 sample_rate = 1;
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// total syscall counts for each cgroup, with a bank for each CPU as every
+// syscall updates them
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * MAX_CGROUPS);
+} cgroup_syscalls SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * MAX_CGROUPS));
+} cgroup_syscalls_dirty SEC(".maps");
+
+// per-CPU countdown used to sample events, see `sample_event()`
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} sample_state SEC(".maps");
+
+// counters for syscalls
+// 0 - total
+// 1..FIRST_CUSTOM_ROW - the built-in syscall families, see the `syscall_lut`
+//                       map
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
+} counters SEC(".maps");
+
+// counters for the syscall families defined in the config, laid out as
+// [cpu][family] with the family being the row less `FIRST_CUSTOM_ROW`
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * MAX_CUSTOM_FAMILIES);
+} family_counters SEC(".maps");
+
+// the start of an in-progress syscall. the family is recorded on enter so that
+// the exit path does not need to consult the lookup table, and the syscall id
+// is kept for exemplars
+struct syscall_start {
+	u64 ts;
+	u32 row;
+	u32 id;
+};
+
+// syscall start stored with each task, preferred when supported
+struct {
+	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, struct syscall_start);
+} task_start SEC(".maps");
+
+// syscall start indexed by thread id, used on older kernels
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_PID);
+	__type(key, u32);
+	__type(value, struct syscall_start);
+} start SEC(".maps");
+
+// tracks the latency distribution of syscalls, laid out as [cpu][row][bucket]
+// so that each CPU has its own bank of buckets for every row. this map is
+// resized from userspace to match the number of rows
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * HISTOGRAM_BANK);
+} latency SEC(".maps");
+
+// tracks the latency distribution of the syscall families defined in the
+// config, laid out as [cpu][family][bucket]. this map is resized from
+// userspace to match the grouping power, or shrunk when there are no such
+// families
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * MAX_CUSTOM_FAMILIES * HISTOGRAM_BANK);
+} family_latency SEC(".maps");
+
+// provides a lookup table from syscall id to a counter offset and histogram row
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_SYSCALL_ID);
+} syscall_lut SEC(".maps");
+
+// returns a pointer to the syscall start for the current task
+static __always_inline struct syscall_start *lookup_start(u64 flags)
+{
+	if (use_task_storage) {
+		struct task_struct *task = bpf_get_current_task_btf();
+
+		return bpf_task_storage_get(&task_start, task, 0, flags);
+	} else {
+		u32 tid = bpf_get_current_pid_tgid();
+
+		return bpf_map_lookup_elem(&start, &tid);
+	}
+}
+
+SEC("tp_btf/sys_enter")
+int BPF_PROG(sys_enter, struct pt_regs *regs, long id)
+{
+	struct syscall_start *start_ts;
+	u32 offset, row = 0;
+
+	if (id < 0) {
+		return 0;
+	}
+
+	u32 syscall_id = id;
+
+	// for some syscalls, we track counts and latency by "family" of syscall.
+	// check the lookup table once for both
+	if (syscall_id < MAX_SYSCALL_ID) {
+		u32 *lut_row = bpf_map_lookup_elem(&syscall_lut, &syscall_id);
+
+		if (lut_row) {
+			row = *lut_row;
+		}
+	} else {
+		health_incr(HEALTH_OUT_OF_RANGE);
+	}
+
+	if (counts_enabled) {
+		offset = COUNTER_GROUP_WIDTH * bpf_get_smp_processor_id();
+
+		// update the total counter
+		array_incr(&counters, offset);
+
+		// update the counter for the syscall family
+		if (row && row < FIRST_CUSTOM_ROW) {
+			array_incr(&counters, offset + row);
+		} else if (row >= FIRST_CUSTOM_ROW && row < FIRST_CUSTOM_ROW + MAX_CUSTOM_FAMILIES) {
+			percpu_incr(&family_counters, MAX_CUSTOM_FAMILIES * bpf_get_smp_processor_id() + row - FIRST_CUSTOM_ROW);
+		}
+
+		// update the total counter for the cgroup
+		bool is_new;
+		int cgroup_id = task_cgroup_id(bpf_get_current_task_btf(), &is_new);
+
+		if (cgroup_id) {
+			if (is_new) {
+				// zero the counter, it will not be exported until it is non-zero
+				cgroup_percpu_zero(&cgroup_syscalls, cgroup_id);
+			}
+
+			array_incr_dirty(&cgroup_syscalls, &cgroup_syscalls_dirty, cgroup_percpu_idx(cgroup_id));
+		}
+	}
+
+	// only the latency is sampled, the counters are exact
+	if (latency_enabled && sample_event(&sample_state, sample_rate)) {
+		start_ts = lookup_start(BPF_LOCAL_STORAGE_GET_F_CREATE);
+
+		if (start_ts) {
+			start_ts->ts = bpf_ktime_get_ns();
+			start_ts->row = row;
+			start_ts->id = syscall_id;
+		} else {
+			health_incr(HEALTH_MAP_FULL);
+		}
+	}
+
+	return 0;
+}
+
+// this program is only loaded when latency is enabled
+SEC("tp_btf/sys_exit")
+int BPF_PROG(sys_exit, struct pt_regs *regs, long ret)
+{
+	struct syscall_start *start_ts;
+	u64 lat;
+	u32 idx, offset, bucket, row, syscall_id;
+
+	// lookup the start time
+	start_ts = lookup_start(0);
+
+	// possible we missed the start. when sampling, most syscalls have no
+	// start by design so they are not counted as dropped
+	if (!start_ts || start_ts->ts == 0) {
+		if (sample_rate <= 1) {
+			health_incr(HEALTH_MISSING_START);
+		}
+		return 0;
+	}
+
+	// calculate the latency
+	lat = bpf_ktime_get_ns() - start_ts->ts;
+	row = start_ts->row;
+	syscall_id = start_ts->id;
+
+	// clear the start timestamp
+	start_ts->ts = 0;
+
+	// the row offset for this CPU and the bucket for this latency value
+	offset = histogram_rows * bpf_get_smp_processor_id();
+	bucket = value_to_index(lat, histogram_power);
+
+	// update the total latency histogram
+	idx = offset * histogram_bank_width(histogram_power) + bucket;
+	percpu_incr(&latency, idx);
+
+	// update the latency histogram for the syscall family
+	if (row && row < histogram_rows) {
+		idx = (offset + row) * histogram_bank_width(histogram_power) + bucket;
+		percpu_incr(&latency, idx);
+	} else if (row >= FIRST_CUSTOM_ROW && row < FIRST_CUSTOM_ROW + MAX_CUSTOM_FAMILIES) {
+		offset = MAX_CUSTOM_FAMILIES * bpf_get_smp_processor_id() + row - FIRST_CUSTOM_ROW;
+		idx = offset * histogram_bank_width(histogram_power) + bucket;
+		percpu_incr(&family_latency, idx);
+	}
+
+	exemplar_submit(bpf_get_current_task_btf(), syscall_id, lat);
+
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,228 @@
+/// Collects Syscall stats using BPF and traces:
+/// * `raw_syscalls/sys_enter`
+/// * `raw_syscalls/sys_exit`
+///
+/// And produces these stats:
+/// * `syscall/total`
+/// * `cgroup/syscall/total`
+/// * `syscall/total/latency`
+/// * `syscall/read`
+/// * `syscall/read/latency`
+/// * `syscall/write`
+/// * `syscall/write/latency`
+/// * `syscall/poll`
+/// * `syscall/poll/latency`
+/// * `syscall/lock`
+/// * `syscall/lock/latency`
+/// * `syscall/time`
+/// * `syscall/time/latency`
+/// * `syscall/sleep`
+/// * `syscall/sleep/latency`
+/// * `syscall/socket`
+/// * `syscall/socket/latency`
+/// * `syscall/yield`
+/// * `syscall/yield/latency`
+/// * `syscall/family`
+/// * `syscall/family/latency`
+///
+/// The counts and latency are enabled separately in the config with the
+/// `syscall_counts` and `syscall_latency` samplers, but are collected by a
+/// single BPF program so that each syscall is only traced once.
+///
+/// Each syscall is grouped in at most one family. The grouping of individual
+/// syscalls can be changed with the `syscall_families` option of either
+/// sampler, which takes effect without rebuilding. The `syscall_latency`
+/// option is used when both are set. Syscalls in the built-in
+/// `SYSCALL_FAMILIES` have their own metrics, while new families named in the
+/// option are tracked by `syscall/family` and `syscall/family/latency` with a
+/// `family` label.
+
+const NAME: &str = "syscall";
+
+const COUNTS_NAME: &str = "syscall_counts";
+const LATENCY_NAME: &str = "syscall_latency";
+
+mod bpf {
+    include!(concat!(env!("OUT_DIR"), "/syscall_syscall.bpf.rs"));
+}
+
+use bpf::*;
+
+use crate::common::*;
+use crate::samplers::syscall::linux::stats::*;
+use crate::samplers::syscall::linux::{syscall_lut, syscall_name};
+use crate::*;
+
+use std::sync::Arc;
+
+#[distributed_slice(SAMPLERS)]
+fn init(config: Arc<Config>) -> SamplerResult {
+    let counts = config.enabled(COUNTS_NAME);
+    let latency = config.enabled(LATENCY_NAME);
+
+    if !counts && !latency {
+        return Ok(None);
+    }
+
+    // prefer task local storage for the start timestamps, falling back to an
+    // array indexed by thread id on older kernels
+    let task_storage = task_storage_supported();
+
+    // the order must match `SYSCALL_FAMILIES`, after the total
+    let counters = vec![
+        &SYSCALL_TOTAL,
+        &SYSCALL_READ,
+        &SYSCALL_WRITE,
+        &SYSCALL_POLL,
+        &SYSCALL_LOCK,
+        &SYSCALL_TIME,
+        &SYSCALL_SLEEP,
+        &SYSCALL_SOCKET,
+        &SYSCALL_YIELD,
+    ];
+
+    // one histogram per row of the latency map, in the same order as the
+    // counters
+    let histograms = vec![
+        &SYSCALL_TOTAL_LATENCY,
+        &SYSCALL_READ_LATENCY,
+        &SYSCALL_WRITE_LATENCY,
+        &SYSCALL_POLL_LATENCY,
+        &SYSCALL_LOCK_LATENCY,
+        &SYSCALL_TIME_LATENCY,
+        &SYSCALL_SLEEP_LATENCY,
+        &SYSCALL_SOCKET_LATENCY,
+        &SYSCALL_YIELD_LATENCY,
+    ];
+
+    // only the latency distributions are sampled
+    let sample_rate = config.sample_rate(LATENCY_NAME);
+
+    let histogram_power = config.histogram_grouping_power(LATENCY_NAME);
+
+    let families = config
+        .syscall_families(LATENCY_NAME)
+        .or(config.syscall_families(COUNTS_NAME));
+
+    let lut = syscall_lut(families);
+
+    // the families defined in the config are only tracked when there are any
+    let custom_families = !lut.custom_families.is_empty();
+
+    for (idx, family) in lut.custom_families.iter().enumerate() {
+        SYSCALL_FAMILY.insert_metadata(idx, "family".to_string(), family.clone());
+        SYSCALL_FAMILY_LATENCY.insert_metadata(idx, "family".to_string(), family.clone());
+    }
+
+    // exemplars are only captured for syscalls which are timed
+    let exemplar_threshold = config.exemplar_threshold(LATENCY_NAME);
+
+    // the builder sizes the latency map for the rows and the grouping power
+    let rows = histograms.len();
+
+    let mut bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.counts_enabled = counts;
+            skel.maps.rodata_data.latency_enabled = latency;
+
+            if !counts {
+                skel.maps.counters.set_max_entries(1)?;
+                skel.maps.cgroup_syscalls.set_max_entries(1)?;
+                skel.maps.cgroup_syscalls_dirty.set_max_entries(1)?;
+            }
+
+            if !counts || !custom_families {
+                skel.maps.family_counters.set_max_entries(1)?;
+            }
+
+            if !latency || !custom_families {
+                skel.maps.family_latency.set_max_entries(1)?;
+            }
+
+            if !latency {
+                // nothing is tracked on syscall exit
+                skel.progs.sys_exit.set_autoload(false)?;
+
+                skel.maps.latency.set_max_entries(1)?;
+                skel.maps.start.set_max_entries(1)?;
+                return skel.maps.task_start.set_autocreate(false);
+            }
+
+            skel.maps.rodata_data.histogram_rows = rows as u32;
+            skel.maps.rodata_data.histogram_power = histogram_power;
+            skel.maps.rodata_data.sample_rate = sample_rate;
+
+            if let Some(threshold) = exemplar_threshold {
+                skel.maps.rodata_data.exemplar_threshold = threshold.as_nanos() as u64;
+            }
+
+            if task_storage {
+                skel.maps.rodata_data.use_task_storage = true;
+                skel.maps.start.set_max_entries(1)
+            } else {
+                // the array only needs to cover the pids on this host
+                skel.maps.start.set_max_entries(pid_max())?;
+                skel.maps.task_start.set_autocreate(false)
+            }
+        })
+        .sample_rate(sample_rate)
+        .histogram_grouping_power(histogram_power)
+        .map("syscall_lut", lut.rows)
+        .health_counters("health");
+
+    if counts {
+        bpf = bpf
+            .counters("counters", counters)
+            .percpu_packed_counters("cgroup_syscalls", &CGROUP_SYSCALL_TOTAL)
+            .dirty_bitmap("cgroup_syscalls", "cgroup_syscalls_dirty")
+            .cgroup_metrics(vec![&CGROUP_SYSCALL_TOTAL]);
+
+        if custom_families {
+            bpf = bpf.percpu_packed_counters("family_counters", &SYSCALL_FAMILY);
+        }
+    }
+
+    if latency {
+        bpf = bpf.percpu_histogram_array("latency", histograms);
+
+        if custom_families {
+            bpf = bpf.percpu_histogram_group("family_latency", &SYSCALL_FAMILY_LATENCY);
+        }
+
+        if exemplar_threshold.is_some() {
+            bpf = bpf.exemplars("exemplars", "syscall", syscall_name);
+        }
+    }
+
+    Ok(Some(Box::new(bpf.build()?)))
+}
+
+impl SkelExt for ModSkel<'_> {
+    fn map(&self, name: &str) -> &libbpf_rs::Map {
+        match name {
+            "cgroup_syscalls" => &self.maps.cgroup_syscalls,
+            "cgroup_syscalls_dirty" => &self.maps.cgroup_syscalls_dirty,
+            "counters" => &self.maps.counters,
+            "exemplars" => &self.maps.exemplars,
+            "family_counters" => &self.maps.family_counters,
+            "family_latency" => &self.maps.family_latency,
+            "latency" => &self.maps.latency,
+            "syscall_lut" => &self.maps.syscall_lut,
+            "health" => &self.maps.health,
+            _ => unimplemented!(),
+        }
+    }
+}
+
+impl OpenSkelExt for ModSkel<'_> {
+    fn log_prog_instructions(&self) {
+        debug!(
+            "{NAME} sys_enter() BPF instruction count: {}",
+            self.progs.sys_enter.insn_cnt()
+        );
+        debug!(
+            "{NAME} sys_exit() BPF instruction count: {}",
+            self.progs.sys_exit.insn_cnt()
+        );
+    }
+}
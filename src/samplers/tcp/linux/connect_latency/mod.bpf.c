@@ -10,25 +10,40 @@
 // distribution for establishing connections to hosts.
 
 #include <vmlinux.h>
+#include "../../../common/bpf/health.h"
 #include "../../../common/bpf/helpers.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
 
 #define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
-#define HISTOGRAM_POWER 3
 
-#define MAX_ENTRIES	10240
+#define MAX_ENTRIES 10240
 #define AF_INET 2
 #define AF_INET6 10
-#define NO_EXIST 1
 
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// the time each socket started to connect. the storage is freed by the kernel
+// along with the socket. used by the fentry programs
+struct {
+	__uint(type, BPF_MAP_TYPE_SK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, u64);
+} start SEC(".maps");
+
+// the time each socket started to connect, keyed by the socket pointer. used
+// by the kprobe programs, which can not use socket storage, and cleaned up by
+// `tcp_destroy_sock`
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_ENTRIES);
 	__type(key, u64);
 	__type(value, u64);
-} start SEC(".maps");
+} start_hash SEC(".maps");
 
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
@@ -38,35 +53,34 @@ struct {
 	__uint(max_entries, HISTOGRAM_BUCKETS);
 } latency SEC(".maps");
 
-static __always_inline __u64 get_sock_ident(struct sock *sk)
-{
-	return (__u64)sk;
-}
-
 static int trace_connect(struct sock *sk)
 {
-	u64 sock_ident, ts;
+	u64 *tsp;
 
-	sock_ident = get_sock_ident(sk);
-	ts = bpf_ktime_get_ns();
+	tsp = bpf_sk_storage_get(&start, sk, 0, BPF_SK_STORAGE_GET_F_CREATE);
+	if (!tsp) {
+		health_incr(HEALTH_MAP_FULL);
+		return 0;
+	}
 
-	bpf_map_update_elem(&start, &sock_ident, &ts, NO_EXIST);
+	// keep the time of the first connect attempt
+	if (*tsp == 0) {
+		*tsp = bpf_ktime_get_ns();
+	}
 
 	return 0;
 }
 
 static int handle_tcp_rcv_state_process(void *ctx, struct sock *sk)
 {
-	u32 idx;
-	u64 sock_ident, now, delta_ns, *cnt, *tsp;
+	u64 now, delta_ns, *tsp;
 
 	if (BPF_CORE_READ(sk, __sk_common.skc_state) != TCP_SYN_SENT)
 		return 0;
 
-	sock_ident = get_sock_ident(sk);
-
-	tsp = bpf_map_lookup_elem(&start, &sock_ident);
-	if (!tsp) {
+	tsp = bpf_sk_storage_get(&start, sk, 0, 0);
+	if (!tsp || *tsp == 0) {
+		health_incr(HEALTH_MISSING_START);
 		return 0;
 	}
 
@@ -78,38 +92,99 @@ static int handle_tcp_rcv_state_process(void *ctx, struct sock *sk)
 
 	delta_ns = (now - *tsp);
 
-	histogram_incr(&latency, HISTOGRAM_POWER, delta_ns);
+	histogram_incr(&latency, histogram_power, delta_ns);
 
 cleanup:
-	bpf_map_delete_elem(&start, &sock_ident);
+	bpf_sk_storage_delete(&start, sk);
+	return 0;
+}
+
+// the kprobe programs keep the start time in a hash keyed by the socket
+// pointer. sockets which connect while the hash is full are not tracked, and
+// are counted as missing a start when they are established
+
+static int trace_connect_hash(struct sock *sk)
+{
+	u64 sock_ident = (u64)sk;
+	u64 ts = bpf_ktime_get_ns();
+
+	// keep the time of the first connect attempt
+	bpf_map_update_elem(&start_hash, &sock_ident, &ts, BPF_NOEXIST);
+
 	return 0;
 }
 
+static int handle_tcp_rcv_state_process_hash(struct sock *sk)
+{
+	u64 sock_ident, now, *tsp;
+
+	if (BPF_CORE_READ(sk, __sk_common.skc_state) != TCP_SYN_SENT)
+		return 0;
+
+	sock_ident = (u64)sk;
+
+	tsp = bpf_map_lookup_elem(&start_hash, &sock_ident);
+	if (!tsp) {
+		health_incr(HEALTH_MISSING_START);
+		return 0;
+	}
+
+	now = bpf_ktime_get_ns();
+
+	if (*tsp <= now) {
+		histogram_incr(&latency, histogram_power, now - *tsp);
+	}
+
+	bpf_map_delete_elem(&start_hash, &sock_ident);
+	return 0;
+}
+
+// the fentry and kprobe programs are loaded as a set, as each set keeps the
+// start time in its own map. fentry is preferred as socket storage has no
+// limit on the number of sockets
+
+SEC("fentry/tcp_v4_connect")
+int BPF_PROG(tcp_v4_connect_fentry, struct sock *sk)
+{
+	return trace_connect(sk);
+}
+
+SEC("fentry/tcp_v6_connect")
+int BPF_PROG(tcp_v6_connect_fentry, struct sock *sk)
+{
+	return trace_connect(sk);
+}
+
+SEC("fentry/tcp_rcv_state_process")
+int BPF_PROG(tcp_rcv_state_process_fentry, struct sock *sk)
+{
+	return handle_tcp_rcv_state_process(ctx, sk);
+}
+
 SEC("kprobe/tcp_v4_connect")
 int BPF_KPROBE(tcp_v4_connect, struct sock *sk)
 {
-	return trace_connect(sk);
+	return trace_connect_hash(sk);
 }
 
 SEC("kprobe/tcp_v6_connect")
 int BPF_KPROBE(tcp_v6_connect, struct sock *sk)
 {
-	return trace_connect(sk);
+	return trace_connect_hash(sk);
 }
 
 SEC("kprobe/tcp_rcv_state_process")
 int BPF_KPROBE(tcp_rcv_state_process, struct sock *sk)
 {
-	return handle_tcp_rcv_state_process(ctx, sk);
+	return handle_tcp_rcv_state_process_hash(sk);
 }
 
 SEC("tracepoint/tcp/tcp_destroy_sock")
 int tcp_destroy_sock(struct trace_event_raw_tcp_event_sk *ctx)
 {
-	struct sock *sk = ctx->skaddr;
+	u64 sock_ident = (u64)ctx->skaddr;
 
-	u64 sock_ident = get_sock_ident(sk);
-	bpf_map_delete_elem(&start, &sock_ident);
+	bpf_map_delete_elem(&start_hash, &sock_ident);
 
 	return 0;
 }
@@ -2,7 +2,11 @@
 /// * `tcp_v4_connect`
 /// * `tcp_v6_connect`
 /// * `tcp_rcv_state_process`
-/// * `tcp_destroy_sock`
+///
+/// The connect time is kept in socket local storage, so it is freed along with
+/// the socket and there is no limit on the number of sockets tracked. On
+/// kernels without fentry or socket storage for tracing programs, kprobes are
+/// used instead and the connect time is kept in a hash of up to 10240 sockets.
 ///
 /// And produces these stats:
 /// * `tcp/connect_latency`
@@ -27,8 +31,39 @@ fn init(config: Arc<Config>) -> SamplerResult {
         return Ok(None);
     }
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    // the start and end of a connect must use the same map, so either all of
+    // the fentry programs are loaded or all of the kprobe programs. socket
+    // storage was made available to tracing programs in the same release as
+    // task storage
+    let use_fentry = task_storage_supported()
+        && ["tcp_v4_connect", "tcp_v6_connect", "tcp_rcv_state_process"]
+            .iter()
+            .all(|func| fentry_supported(func));
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+
+            if use_fentry {
+                skel.maps.start_hash.set_max_entries(1)?;
+                skel.progs.tcp_v4_connect.set_autoload(false)?;
+                skel.progs.tcp_v6_connect.set_autoload(false)?;
+                skel.progs.tcp_rcv_state_process.set_autoload(false)?;
+                skel.progs.tcp_destroy_sock.set_autoload(false)
+            } else {
+                debug!("{NAME} using kprobes");
+
+                skel.maps.start.set_autocreate(false)?;
+                skel.progs.tcp_v4_connect_fentry.set_autoload(false)?;
+                skel.progs.tcp_v6_connect_fentry.set_autoload(false)?;
+                skel.progs.tcp_rcv_state_process_fentry.set_autoload(false)
+            }
+        })
+        .histogram_grouping_power(histogram_power)
         .histogram("latency", &TCP_CONNECT_LATENCY)
+        .health_counters("health")
         .build()?;
 
     Ok(Some(Box::new(bpf)))
@@ -38,6 +73,7 @@ impl SkelExt for ModSkel<'_> {
     fn map(&self, name: &str) -> &libbpf_rs::Map {
         match name {
             "latency" => &self.maps.latency,
+            "health" => &self.maps.health,
             _ => unimplemented!(),
         }
     }
@@ -46,11 +82,19 @@ impl SkelExt for ModSkel<'_> {
 impl OpenSkelExt for ModSkel<'_> {
     fn log_prog_instructions(&self) {
         debug!(
-            "{NAME} tcp_v4_connect() BPF instruction count: {}",
+            "{NAME} tcp_v4_connect() fentry BPF instruction count: {}",
+            self.progs.tcp_v4_connect_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} tcp_rcv_state_process() fentry BPF instruction count: {}",
+            self.progs.tcp_rcv_state_process_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} tcp_v4_connect() kprobe BPF instruction count: {}",
             self.progs.tcp_v4_connect.insn_cnt()
         );
         debug!(
-            "{NAME} tcp_rcv_state_process() BPF instruction count: {}",
+            "{NAME} tcp_rcv_state_process() kprobe BPF instruction count: {}",
             self.progs.tcp_rcv_state_process.insn_cnt()
         );
     }
@@ -11,24 +11,45 @@
 // application.
 
 #include <vmlinux.h>
+#include "../../../common/bpf/health.h"
 #include "../../../common/bpf/helpers.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
+#include "../../../common/bpf/exemplar.h"
 
 #define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
-#define HISTOGRAM_POWER 3
 
 #define MAX_ENTRIES	10240
 #define AF_INET		2
-#define NO_EXIST    1
 
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// set from userspace when the kernel supports socket storage for tracing
+// programs, which selects the `tp_btf` programs over the `raw_tp` programs
+const volatile bool use_sk_storage = false;
+
+// the time the first unprocessed packet was received on each socket. the
+// storage is freed by the kernel along with the socket. used by the `tp_btf`
+// programs
+struct {
+	__uint(type, BPF_MAP_TYPE_SK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, u64);
+} start SEC(".maps");
+
+// the time the first unprocessed packet was received, keyed by the socket
+// pointer. used by the `raw_tp` programs, which can not use socket storage,
+// and cleaned up by `tcp_destroy_sock`
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_ENTRIES);
 	__type(key, u64);
 	__type(value, u64);
-} start SEC(".maps");
+} start_hash SEC(".maps");
 
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
@@ -38,15 +59,27 @@ struct {
 	__uint(max_entries, HISTOGRAM_BUCKETS);
 } latency SEC(".maps");
 
-static __always_inline __u64 get_sock_ident(struct sock *sk)
+// returns the receive time for the socket, creating a zeroed entry for it if
+// `create` is set. the check of `use_sk_storage` is resolved by the verifier,
+// so each set of programs only references the map it uses
+static __always_inline u64 *lookup_start(struct sock *sk, bool create)
 {
-	return (__u64)sk;
+	u64 key = (u64)sk, zero = 0;
+
+	if (use_sk_storage) {
+		return bpf_sk_storage_get(&start, sk, 0, create ? BPF_SK_STORAGE_GET_F_CREATE : 0);
+	}
+
+	if (create) {
+		bpf_map_update_elem(&start_hash, &key, &zero, BPF_NOEXIST);
+	}
+
+	return bpf_map_lookup_elem(&start_hash, &key);
 }
 
 static int handle_tcp_probe(struct sock *sk, struct sk_buff *skb)
 {
-	const struct inet_sock *inet = (struct inet_sock *)(sk);
-	u64 sock_ident, ts, len, doff;
+	u64 len, doff, *tsp;
 	const struct tcphdr *th;
 
 	th = (const struct tcphdr*)BPF_CORE_READ(skb, data);
@@ -56,25 +89,27 @@ static int handle_tcp_probe(struct sock *sk, struct sk_buff *skb)
 	if (len <= doff * 4) {
 		return 0;
 	}
-	sock_ident = get_sock_ident(sk);
-	ts = bpf_ktime_get_ns();
-	bpf_map_update_elem(&start, &sock_ident, &ts, NO_EXIST);
+
+	tsp = lookup_start(sk, true);
+	if (!tsp) {
+		health_incr(HEALTH_MAP_FULL);
+		return 0;
+	}
+
+	// only the first packet since the last receive space adjustment is timed
+	if (*tsp == 0) {
+		*tsp = bpf_ktime_get_ns();
+	}
+
 	return 0;
 }
 
 static int handle_tcp_rcv_space_adjust(void *ctx, struct sock *sk)
 {
-	const struct inet_sock *inet = (struct inet_sock *)(sk);
-	u64 sock_ident = get_sock_ident(sk);
-	u64 id = bpf_get_current_pid_tgid(), *tsp;
-	u32 idx;
-	u64 now, delta_ns;
-	u32 pid = id >> 32, tid = id;
-	struct event *eventp;
-	u16 family;
-
-	tsp = bpf_map_lookup_elem(&start, &sock_ident);
-	if (!tsp) {
+	u64 now, delta_ns, *tsp;
+
+	tsp = lookup_start(sk, false);
+	if (!tsp || *tsp == 0) {
 		return 0;
 	}
 
@@ -86,36 +121,61 @@ static int handle_tcp_rcv_space_adjust(void *ctx, struct sock *sk)
 
 	delta_ns = (now - *tsp);
 
-	histogram_incr(&latency, HISTOGRAM_POWER, delta_ns);
+	histogram_incr(&latency, histogram_power, delta_ns);
+
+	// the receive space is adjusted as the application reads from the socket,
+	// so the exemplar is for the reading task and the local port
+	if (exemplar_is_outlier(delta_ns)) {
+		exemplar_submit(bpf_get_current_task_btf(), BPF_CORE_READ(sk, __sk_common.skc_num), delta_ns);
+	}
 
 cleanup:
-	bpf_map_delete_elem(&start, &sock_ident);
+	*tsp = 0;
+
+	// the hash is bounded, so only sockets waiting to be read keep an entry
+	if (!use_sk_storage) {
+		u64 key = (u64)sk;
+
+		bpf_map_delete_elem(&start_hash, &key);
+	}
+
 	return 0;
 }
 
-static int handle_tcp_destroy_sock(void *ctx, struct sock *sk)
+static int handle_tcp_destroy_sock(struct sock *sk)
 {
-	u64 sock_ident = get_sock_ident(sk);
+	u64 key = (u64)sk;
 
-	bpf_map_delete_elem(&start, &sock_ident);
+	bpf_map_delete_elem(&start_hash, &key);
 	return 0;
 }
 
-SEC("raw_tp/tcp_probe")
+SEC("tp_btf/tcp_probe")
 int BPF_PROG(tcp_probe, struct sock *sk, struct sk_buff *skb) {
 	return handle_tcp_probe(sk, skb);
 }
 
-SEC("raw_tp/tcp_rcv_space_adjust")
+SEC("tp_btf/tcp_rcv_space_adjust")
 int BPF_PROG(tcp_rcv_space_adjust, struct sock *sk)
 {
 	return handle_tcp_rcv_space_adjust(ctx, sk);
 }
 
+SEC("raw_tp/tcp_probe")
+int BPF_PROG(tcp_probe_raw_tp, struct sock *sk, struct sk_buff *skb) {
+	return handle_tcp_probe(sk, skb);
+}
+
+SEC("raw_tp/tcp_rcv_space_adjust")
+int BPF_PROG(tcp_rcv_space_adjust_raw_tp, struct sock *sk)
+{
+	return handle_tcp_rcv_space_adjust(ctx, sk);
+}
+
 SEC("raw_tp/tcp_destroy_sock")
 int BPF_PROG(tcp_destroy_sock, struct sock *sk)
 {
-	return handle_tcp_destroy_sock(ctx, sk);
+	return handle_tcp_destroy_sock(sk);
 }
 
 char LICENSE[] SEC("license") = "GPL";
@@ -1,7 +1,13 @@
 /// Collects TCP packet latency stats using BPF and traces:
-/// * `tcp_destroy_sock`
 /// * `tcp_probe`
 /// * `tcp_rcv_space_adjust`
+/// * `tcp_destroy_sock`
+///
+/// The receive time is kept in socket local storage, so it is freed along with
+/// the socket and there is no limit on the number of sockets tracked. On
+/// kernels without socket storage for tracing programs, raw tracepoints are
+/// used instead and the receive time is kept in a hash of up to 10240 sockets,
+/// which is cleaned up with `tcp_destroy_sock`.
 ///
 /// And produces these stats:
 /// * `tcp/receive/packet_latency`
@@ -26,17 +32,52 @@ fn init(config: Arc<Config>) -> SamplerResult {
         return Ok(None);
     }
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    let histogram_power = config.histogram_grouping_power(NAME);
+    let exemplar_threshold = config.exemplar_threshold(NAME);
+
+    // socket storage was made available to tracing programs in the same
+    // release as task storage
+    let use_sk_storage = task_storage_supported();
+
+    let mut bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+
+            if let Some(threshold) = exemplar_threshold {
+                skel.maps.rodata_data.exemplar_threshold = threshold.as_nanos() as u64;
+            }
+
+            if use_sk_storage {
+                skel.maps.rodata_data.use_sk_storage = true;
+                skel.maps.start_hash.set_max_entries(1)?;
+                skel.progs.tcp_probe_raw_tp.set_autoload(false)?;
+                skel.progs.tcp_rcv_space_adjust_raw_tp.set_autoload(false)?;
+                skel.progs.tcp_destroy_sock.set_autoload(false)
+            } else {
+                debug!("{NAME} using raw tracepoints");
+
+                skel.maps.start.set_autocreate(false)?;
+                skel.progs.tcp_probe.set_autoload(false)?;
+                skel.progs.tcp_rcv_space_adjust.set_autoload(false)
+            }
+        })
+        .histogram_grouping_power(histogram_power)
         .histogram("latency", &TCP_PACKET_LATENCY)
-        .build()?;
+        .health_counters("health");
+
+    if exemplar_threshold.is_some() {
+        bpf = bpf.exemplars("exemplars", "port", |port| port.to_string());
+    }
 
-    Ok(Some(Box::new(bpf)))
+    Ok(Some(Box::new(bpf.build()?)))
 }
 
 impl SkelExt for ModSkel<'_> {
     fn map(&self, name: &str) -> &libbpf_rs::Map {
         match name {
+            "exemplars" => &self.maps.exemplars,
             "latency" => &self.maps.latency,
+            "health" => &self.maps.health,
             _ => unimplemented!(),
         }
     }
@@ -52,6 +93,14 @@ impl OpenSkelExt for ModSkel<'_> {
             "{NAME} tcp_rcv_space_adjust() BPF instruction count: {}",
             self.progs.tcp_rcv_space_adjust.insn_cnt()
         );
+        debug!(
+            "{NAME} tcp_probe() raw_tp BPF instruction count: {}",
+            self.progs.tcp_probe_raw_tp.insn_cnt()
+        );
+        debug!(
+            "{NAME} tcp_rcv_space_adjust() raw_tp BPF instruction count: {}",
+            self.progs.tcp_rcv_space_adjust_raw_tp.insn_cnt()
+        );
         debug!(
             "{NAME} tcp_destroy_sock() BPF instruction count: {}",
             self.progs.tcp_destroy_sock.insn_cnt()
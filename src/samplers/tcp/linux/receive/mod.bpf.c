@@ -17,7 +17,10 @@
 #include <bpf/bpf_endian.h>
 
 #define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
-#define HISTOGRAM_POWER 3
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
@@ -35,30 +38,52 @@ struct {
 	__uint(max_entries, HISTOGRAM_BUCKETS);
 } srtt SEC(".maps");
 
-SEC("kprobe/tcp_rcv_established")
-int BPF_KPROBE(tcp_rcv_kprobe, struct sock *sk)
+static __always_inline void record_rtt(u32 srtt_us, u32 mdev_us)
 {
-	const struct inet_sock *inet = (struct inet_sock *)(sk);
-	struct tcp_sock *ts;
-	u64 key, slot;
-	u32 idx, mdev_us, srtt_us;
 	u64 mdev_ns, srtt_ns;
 
-	ts = (struct tcp_sock *)(sk);
-	bpf_probe_read_kernel(&srtt_us, sizeof(srtt_us), &ts->srtt_us);
-	bpf_probe_read_kernel(&mdev_us, sizeof(mdev_us), &ts->mdev_us);
-
 	// NOTE: srtt is stored as 8x the value in microseconds but we want to
 	// record nanoseconds.
 	srtt_ns = 1000 * (u64) srtt_us >> 3;
 
-	histogram_incr(&srtt, HISTOGRAM_POWER, srtt_ns);
+	histogram_incr(&srtt, histogram_power, srtt_ns);
 
 	// NOTE: mdev is stored as 4x the value in microseconds but we want to
 	// record nanoseconds.
 	mdev_ns = 1000 * (u64) mdev_us >> 2;
 
-	histogram_incr(&jitter, HISTOGRAM_POWER, mdev_ns);
+	histogram_incr(&jitter, histogram_power, mdev_ns);
+}
+
+// the fentry and kprobe programs trace the same function, only one of them is
+// loaded. fentry is preferred as it avoids the kprobe dispatch cost and the
+// socket fields can be read directly
+
+SEC("fentry/tcp_rcv_established")
+int BPF_PROG(tcp_rcv_fentry, struct sock *sk)
+{
+	struct tcp_sock *ts = bpf_skc_to_tcp_sock(sk);
+
+	if (!ts) {
+		return 0;
+	}
+
+	record_rtt(ts->srtt_us, ts->mdev_us);
+
+	return 0;
+}
+
+SEC("kprobe/tcp_rcv_established")
+int BPF_KPROBE(tcp_rcv_kprobe, struct sock *sk)
+{
+	struct tcp_sock *ts;
+	u32 mdev_us, srtt_us;
+
+	ts = (struct tcp_sock *)(sk);
+	bpf_probe_read_kernel(&srtt_us, sizeof(srtt_us), &ts->srtt_us);
+	bpf_probe_read_kernel(&mdev_us, sizeof(mdev_us), &ts->mdev_us);
+
+	record_rtt(srtt_us, mdev_us);
 
 	return 0;
 }
@@ -25,7 +25,15 @@ fn init(config: Arc<Config>) -> SamplerResult {
         return Ok(None);
     }
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .fentry_with_fallback("tcp_rcv_established", "tcp_rcv_fentry", "tcp_rcv_kprobe")
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.histogram_power = histogram_power;
+            Ok(())
+        })
+        .histogram_grouping_power(histogram_power)
         .histogram("srtt", &TCP_SRTT)
         .histogram("jitter", &TCP_JITTER)
         .build()?;
@@ -46,7 +54,11 @@ impl SkelExt for ModSkel<'_> {
 impl OpenSkelExt for ModSkel<'_> {
     fn log_prog_instructions(&self) {
         debug!(
-            "{NAME} tcp_rcv() BPF instruction count: {}",
+            "{NAME} tcp_rcv() fentry BPF instruction count: {}",
+            self.progs.tcp_rcv_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} tcp_rcv() kprobe BPF instruction count: {}",
             self.progs.tcp_rcv_kprobe.insn_cnt()
         );
     }
@@ -22,8 +22,7 @@ struct {
 	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
 } counters SEC(".maps");
 
-SEC("kprobe/tcp_retransmit_skb")
-int BPF_KPROBE(tcp_retransmit_skb, struct sock *sk, struct sk_buff *skb, int segs)
+static __always_inline int count_retransmit(void)
 {
 	u32 idx = COUNTER_GROUP_WIDTH * bpf_get_smp_processor_id();
 	array_incr(&counters, idx);
@@ -31,4 +30,19 @@ int BPF_KPROBE(tcp_retransmit_skb, struct sock *sk, struct sk_buff *skb, int seg
 	return 0;
 }
 
+// the fentry and kprobe programs trace the same function, only one of them is
+// loaded. fentry is preferred as it avoids the kprobe dispatch cost
+
+SEC("fentry/tcp_retransmit_skb")
+int BPF_PROG(tcp_retransmit_skb_fentry, struct sock *sk, struct sk_buff *skb, int segs)
+{
+	return count_retransmit();
+}
+
+SEC("kprobe/tcp_retransmit_skb")
+int BPF_KPROBE(tcp_retransmit_skb, struct sock *sk, struct sk_buff *skb, int segs)
+{
+	return count_retransmit();
+}
+
 char LICENSE[] SEC("license") = "GPL";
@@ -26,7 +26,12 @@ fn init(config: Arc<Config>) -> SamplerResult {
 
     let counters = vec![&TCP_TX_RETRANSMIT];
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .fentry_with_fallback(
+            "tcp_retransmit_skb",
+            "tcp_retransmit_skb_fentry",
+            "tcp_retransmit_skb",
+        )
         .counters("counters", counters)
         .build()?;
 
@@ -45,7 +50,11 @@ impl SkelExt for ModSkel<'_> {
 impl OpenSkelExt for ModSkel<'_> {
     fn log_prog_instructions(&self) {
         debug!(
-            "{NAME} tcp_retransmit_skb() BPF instruction count: {}",
+            "{NAME} tcp_retransmit_skb() fentry BPF instruction count: {}",
+            self.progs.tcp_retransmit_skb_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} tcp_retransmit_skb() kprobe BPF instruction count: {}",
             self.progs.tcp_retransmit_skb.insn_cnt()
         );
     }
@@ -1,4 +1,4 @@
-use crate::common::HISTOGRAM_GROUPING_POWER;
+use crate::common::{CounterGroup, MAX_CGROUPS, MAX_HISTOGRAM_GROUPING_POWER};
 use metriken::*;
 
 #[metric(
@@ -103,28 +103,29 @@ pub static TCP_CONN_STATE_NEW_SYN_RECV: LazyGauge = LazyGauge::new(Gauge::defaul
     metadata = { unit = "nanoseconds" }
 )]
 pub static TCP_CONNECT_LATENCY: RwLockHistogram =
-    RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "tcp/packet_latency",
     description = "Distribution of latency from a socket becoming readable until a userspace read",
     metadata = { unit = "nanoseconds" }
 )]
-pub static TCP_PACKET_LATENCY: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static TCP_PACKET_LATENCY: RwLockHistogram =
+    RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "tcp/jitter",
     description = "Distribution of TCP latency jitter",
     metadata = { unit = "nanoseconds" }
 )]
-pub static TCP_JITTER: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static TCP_JITTER: RwLockHistogram = RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "tcp/srtt",
     description = "Distribution of TCP smoothed round-trip time",
     metadata = { unit = "nanoseconds" }
 )]
-pub static TCP_SRTT: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static TCP_SRTT: RwLockHistogram = RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "tcp/transmit/retransmit",
@@ -152,7 +153,7 @@ pub static TCP_RX_PACKETS: LazyCounter = LazyCounter::new(Counter::default);
     description = "Distribution of the size of TCP packets received after reassembly",
     metadata = { unit = "bytes" }
 )]
-pub static TCP_RX_SIZE: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static TCP_RX_SIZE: RwLockHistogram = RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 #[metric(
     name = "tcp/transmit/bytes",
@@ -168,12 +169,28 @@ pub static TCP_TX_BYTES: LazyCounter = LazyCounter::new(Counter::default);
 )]
 pub static TCP_TX_PACKETS: LazyCounter = LazyCounter::new(Counter::default);
 
+#[metric(
+    name = "cgroup/tcp/receive/bytes",
+    description = "The number of bytes received over TCP on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "bytes" }
+)]
+pub static CGROUP_TCP_RX_BYTES: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
+#[metric(
+    name = "cgroup/tcp/transmit/bytes",
+    description = "The number of bytes transmitted over TCP on a per-cgroup basis",
+    formatter = cgroup_formatter,
+    metadata = { unit = "bytes" }
+)]
+pub static CGROUP_TCP_TX_BYTES: CounterGroup = CounterGroup::new(MAX_CGROUPS);
+
 #[metric(
     name = "tcp/transmit/size",
     description = "Distribution of the size of TCP packets transmitted before fragmentation",
     metadata = { unit = "bytes" }
 )]
-pub static TCP_TX_SIZE: RwLockHistogram = RwLockHistogram::new(HISTOGRAM_GROUPING_POWER, 64);
+pub static TCP_TX_SIZE: RwLockHistogram = RwLockHistogram::new(MAX_HISTOGRAM_GROUPING_POWER, 64);
 
 /// A function to format the tcp connection state metrics.
 ///
@@ -209,3 +226,12 @@ pub fn conn_state_formatter(metric: &MetricEntry, format: Format) -> String {
         _ => metriken::default_formatter(metric, format),
     }
 }
+
+pub fn cgroup_formatter(metric: &MetricEntry, format: Format) -> String {
+    match format {
+        Format::Simple => {
+            format!("{}/cgroup", metric.name())
+        }
+        _ => metric.name().to_string(),
+    }
+}
@@ -8,17 +8,23 @@
 
 // This BPF program probes TCP send and receive paths to get the number of
 // segments and bytes transmitted as well as the size distributions.
+//
+// The counters and size distributions are double-buffered, see `epoch.h`, so
+// that the bytes, packets and sizes read by userspace always cover the same
+// set of events.
 
 #include <vmlinux.h>
+#include "../../../common/bpf/health.h"
 #include "../../../common/bpf/helpers.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_core_read.h>
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_endian.h>
+#include "../../../common/bpf/cgroup.h"
+#include "../../../common/bpf/epoch.h"
 
 #define COUNTER_GROUP_WIDTH 8
 #define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_POW_3
-#define HISTOGRAM_POWER 3
 #define MAX_CPUS 1024
 
 /* Taken from kernel include/linux/socket.h. */
@@ -30,21 +36,72 @@
 #define TCP_RX_PACKETS 2
 #define TCP_TX_PACKETS 3
 
-// counters
+// counters, with a bank for each buffer on each CPU
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
 	__uint(map_flags, BPF_F_MMAPABLE);
 	__type(key, u32);
 	__type(value, u64);
-	__uint(max_entries, MAX_CPUS * COUNTER_GROUP_WIDTH);
+	__uint(max_entries, 2 * MAX_CPUS * COUNTER_GROUP_WIDTH);
 } counters SEC(".maps");
 
+// bytes received and transmitted for each cgroup, with a bank for each CPU as
+// every send and receive updates them
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
 	__uint(map_flags, BPF_F_MMAPABLE);
 	__type(key, u32);
 	__type(value, u64);
-	__uint(max_entries, HISTOGRAM_BUCKETS);
+	__uint(max_entries, MAX_CPUS * MAX_CGROUPS);
+} cgroup_rx_bytes SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * MAX_CGROUPS));
+} cgroup_rx_bytes_dirty SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, MAX_CPUS * MAX_CGROUPS);
+} cgroup_tx_bytes SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, DIRTY_BITMAP_ENTRIES(MAX_CPUS * MAX_CGROUPS));
+} cgroup_tx_bytes_dirty SEC(".maps");
+
+// the rate at which events are sampled for the size histograms, set from
+// userspace. a rate of N means 1-in-N events are recorded on each CPU
+const volatile u32 sample_rate = 1;
+
+// the grouping power of the histograms, set from userspace. the histogram maps
+// are sized for the default power and resized to match before load
+const volatile u8 histogram_power = 3;
+
+// per-CPU countdown used to sample events, see `sample_event()`
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} sample_state SEC(".maps");
+
+// size distributions, with the buckets for each buffer one after the other
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__type(key, u32);
+	__type(value, u64);
+	__uint(max_entries, 2 * HISTOGRAM_BUCKETS);
 } rx_size SEC(".maps");
 
 struct {
@@ -52,7 +109,7 @@ struct {
 	__uint(map_flags, BPF_F_MMAPABLE);
 	__type(key, u32);
 	__type(value, u64);
-	__uint(max_entries, HISTOGRAM_BUCKETS);
+	__uint(max_entries, 2 * HISTOGRAM_BUCKETS);
 } tx_size SEC(".maps");
 
 static int probe_ip(bool receiving, struct sock *sk, size_t size)
@@ -67,15 +124,45 @@ static int probe_ip(bool receiving, struct sock *sk, size_t size)
 		return 0;
 	}
 
-	u32 offset = COUNTER_GROUP_WIDTH * bpf_get_smp_processor_id();
+	int buffer = epoch_enter();
+
+	if (buffer < 0) {
+		return 0;
+	}
+
+	// each CPU has a bank of counters for each buffer, so the map can be
+	// sized for the CPUs on the host without changing the layout
+	u32 offset = COUNTER_GROUP_WIDTH * (2 * bpf_get_smp_processor_id() + buffer);
+	u32 size_offset = histogram_buckets(histogram_power) * buffer;
 
 	u64 sz = (u64) size;
 
+	// only the size distributions are sampled, the counters are exact
+	bool sampled = sample_event(&sample_state, sample_rate);
+
+	// both probes run in the context of the task sending or receiving. the
+	// untyped current task is used as the kprobes may be loaded on kernels
+	// without `bpf_get_current_task_btf()`
+	bool is_new;
+	int cgroup_id = task_cgroup_id((struct task_struct *)bpf_get_current_task(), &is_new);
+
+	if (cgroup_id && is_new) {
+		// zero the counters, they will not be exported until they are non-zero
+		cgroup_percpu_zero(&cgroup_rx_bytes, cgroup_id);
+		cgroup_percpu_zero(&cgroup_tx_bytes, cgroup_id);
+	}
+
 	if (receiving) {
 		idx = offset + TCP_RX_BYTES;
 		array_add(&counters, idx, sz);
 
-		histogram_incr(&rx_size, HISTOGRAM_POWER, sz);
+		if (cgroup_id) {
+			array_add_dirty(&cgroup_rx_bytes, &cgroup_rx_bytes_dirty, cgroup_percpu_idx(cgroup_id), sz);
+		}
+
+		if (sampled) {
+			array_incr(&rx_size, size_offset + value_to_index(sz, histogram_power));
+		}
 
 		idx = offset + TCP_RX_PACKETS;
 		array_incr(&counters, idx);
@@ -83,15 +170,32 @@ static int probe_ip(bool receiving, struct sock *sk, size_t size)
 		idx = offset + TCP_TX_BYTES;
 		array_add(&counters, idx, sz);
 
-		histogram_incr(&tx_size, HISTOGRAM_POWER, sz);
+		if (cgroup_id) {
+			array_add_dirty(&cgroup_tx_bytes, &cgroup_tx_bytes_dirty, cgroup_percpu_idx(cgroup_id), sz);
+		}
+
+		if (sampled) {
+			array_incr(&tx_size, size_offset + value_to_index(sz, histogram_power));
+		}
 
 		idx = offset + TCP_TX_PACKETS;
 		array_incr(&counters, idx);
 	}
 
+	epoch_exit(buffer);
+
 	return 0;
 }
 
+// the fentry and kprobe programs trace the same functions, only one of each
+// pair is loaded. fentry is preferred as it avoids the kprobe dispatch cost
+
+SEC("fentry/tcp_sendmsg")
+int BPF_PROG(tcp_sendmsg_fentry, struct sock *sk, struct msghdr *msg, size_t size)
+{
+	return probe_ip(false, sk, size);
+}
+
 SEC("kprobe/tcp_sendmsg")
 int BPF_KPROBE(tcp_sendmsg, struct sock *sk, struct msghdr *msg, size_t size)
 {
@@ -104,6 +208,16 @@ int BPF_KPROBE(tcp_sendmsg, struct sock *sk, struct msghdr *msg, size_t size)
  * - misses tcp_read_sock() traffic
  * we'd much prefer tracepoints once they are available.
  */
+SEC("fentry/tcp_cleanup_rbuf")
+int BPF_PROG(tcp_cleanup_rbuf_fentry, struct sock *sk, int copied)
+{
+	if (copied <= 0) {
+		return 0;
+	}
+
+	return probe_ip(true, sk, copied);
+}
+
 SEC("kprobe/tcp_cleanup_rbuf")
 int BPF_KPROBE(tcp_cleanup_rbuf, struct sock *sk, int copied)
 {
@@ -9,6 +9,11 @@
 /// * `tcp/transmit/bytes`
 /// * `tcp/transmit/packets`
 /// * `tcp/transmit/size`
+/// * `cgroup/tcp/receive/bytes`
+/// * `cgroup/tcp/transmit/bytes`
+///
+/// The counters and size distributions are double-buffered, so each refresh
+/// reads the bytes, packets and sizes for exactly the same set of events.
 
 const NAME: &str = "tcp_traffic";
 
@@ -37,10 +42,33 @@ fn init(config: Arc<Config>) -> SamplerResult {
         &TCP_TX_PACKETS,
     ];
 
-    let bpf = BpfBuilder::new(ModSkelBuilder::default)
+    let sample_rate = config.sample_rate(NAME);
+    let histogram_power = config.histogram_grouping_power(NAME);
+
+    let bpf = BpfBuilder::new(NAME, ModSkelBuilder::default)
+        .fentry_with_fallback("tcp_sendmsg", "tcp_sendmsg_fentry", "tcp_sendmsg")
+        .fentry_with_fallback(
+            "tcp_cleanup_rbuf",
+            "tcp_cleanup_rbuf_fentry",
+            "tcp_cleanup_rbuf",
+        )
+        .open_hook(move |skel| {
+            skel.maps.rodata_data.sample_rate = sample_rate;
+            skel.maps.rodata_data.histogram_power = histogram_power;
+            Ok(())
+        })
+        .sample_rate(sample_rate)
+        .histogram_grouping_power(histogram_power)
+        .epoch("epoch")
         .counters("counters", counters)
         .histogram("rx_size", &TCP_RX_SIZE)
         .histogram("tx_size", &TCP_TX_SIZE)
+        .percpu_packed_counters("cgroup_rx_bytes", &CGROUP_TCP_RX_BYTES)
+        .percpu_packed_counters("cgroup_tx_bytes", &CGROUP_TCP_TX_BYTES)
+        .dirty_bitmap("cgroup_rx_bytes", "cgroup_rx_bytes_dirty")
+        .dirty_bitmap("cgroup_tx_bytes", "cgroup_tx_bytes_dirty")
+        .cgroup_metrics(vec![&CGROUP_TCP_RX_BYTES, &CGROUP_TCP_TX_BYTES])
+        .health_counters("health")
         .build()?;
 
     Ok(Some(Box::new(bpf)))
@@ -49,7 +77,13 @@ fn init(config: Arc<Config>) -> SamplerResult {
 impl SkelExt for ModSkel<'_> {
     fn map(&self, name: &str) -> &libbpf_rs::Map {
         match name {
+            "cgroup_rx_bytes" => &self.maps.cgroup_rx_bytes,
+            "cgroup_rx_bytes_dirty" => &self.maps.cgroup_rx_bytes_dirty,
+            "cgroup_tx_bytes" => &self.maps.cgroup_tx_bytes,
+            "cgroup_tx_bytes_dirty" => &self.maps.cgroup_tx_bytes_dirty,
             "counters" => &self.maps.counters,
+            "epoch" => &self.maps.epoch,
+            "health" => &self.maps.health,
             "rx_size" => &self.maps.rx_size,
             "tx_size" => &self.maps.tx_size,
             _ => unimplemented!(),
@@ -60,11 +94,19 @@ impl SkelExt for ModSkel<'_> {
 impl OpenSkelExt for ModSkel<'_> {
     fn log_prog_instructions(&self) {
         debug!(
-            "{NAME} tcp_sendmsg() BPF instruction count: {}",
+            "{NAME} tcp_sendmsg() fentry BPF instruction count: {}",
+            self.progs.tcp_sendmsg_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} tcp_sendmsg() kprobe BPF instruction count: {}",
             self.progs.tcp_sendmsg.insn_cnt()
         );
         debug!(
-            "{NAME} tcp_cleanup_rbuf() BPF instruction count: {}",
+            "{NAME} tcp_cleanup_rbuf() fentry BPF instruction count: {}",
+            self.progs.tcp_cleanup_rbuf_fentry.insn_cnt()
+        );
+        debug!(
+            "{NAME} tcp_cleanup_rbuf() kprobe BPF instruction count: {}",
             self.progs.tcp_cleanup_rbuf.insn_cnt()
         );
     }